@@ -0,0 +1,394 @@
+﻿#include <math.h>
+#include <string.h>
+#include "block_compress.h"
+
+// BC7の2bitと4bitインデックスの補間の重み(/64)
+static const int BC7_WEIGHTS2[4] = { 0, 21, 43, 64 };
+static const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static inline int clampByte(float v){
+	if(v <= 0.0f)
+		return 0;
+	if(v >= 255.0f)
+		return 255;
+	return static_cast<int>(v + 0.5f);
+}
+
+/**
+ * 画素の主軸に沿った両端をendpointsとする
+ * 主軸は共分散行列の冪乗法で求める、channelsは3(RGB)か4(RGBA)
+ */
+static void fitLine(const unsigned char* block, int channels, float* e0, float* e1){
+	float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for(int i = 0; i < 16; i++){
+		for(int c = 0; c < channels; c++)
+			mean[c] += block[i * 4 + c];
+	}
+	for(int c = 0; c < channels; c++)
+		mean[c] /= 16.0f;
+	float cov[4][4];
+	memset(cov, 0, sizeof(cov));
+	for(int i = 0; i < 16; i++){
+		float d[4];
+		for(int c = 0; c < channels; c++)
+			d[c] = block[i * 4 + c] - mean[c];
+		for(int a = 0; a < channels; a++){
+			for(int b = 0; b < channels; b++)
+				cov[a][b] += d[a] * d[b];
+		}
+	}
+	float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	for(int k = 0; k < 8; k++){
+		float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float len = 0.0f;
+		for(int a = 0; a < channels; a++){
+			for(int b = 0; b < channels; b++)
+				next[a] += cov[a][b] * axis[b];
+			len += next[a] * next[a];
+		}
+		if(len < 1.0e-6f)
+			break;
+		len = 1.0f / sqrtf(len);
+		for(int a = 0; a < channels; a++)
+			axis[a] = next[a] * len;
+	}
+	float tmin = 0.0f;
+	float tmax = 0.0f;
+	for(int i = 0; i < 16; i++){
+		float t = 0.0f;
+		for(int c = 0; c < channels; c++)
+			t += (block[i * 4 + c] - mean[c]) * axis[c];
+		if(t < tmin)
+			tmin = t;
+		if(t > tmax)
+			tmax = t;
+	}
+	for(int c = 0; c < channels; c++){
+		e0[c] = mean[c] + axis[c] * tmin;
+		e1[c] = mean[c] + axis[c] * tmax;
+	}
+}
+
+static inline unsigned short to565(const float* color){
+	const int r = (clampByte(color[0]) * 31 + 127) / 255;
+	const int g = (clampByte(color[1]) * 63 + 127) / 255;
+	const int b = (clampByte(color[2]) * 31 + 127) / 255;
+	return static_cast<unsigned short>((r << 11) | (g << 5) | b);
+}
+
+static inline void from565(unsigned short value, int* color){
+	const int r = (value >> 11) & 31;
+	const int g = (value >> 5) & 63;
+	const int b = value & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+static inline int distance3(const unsigned char* p, const int* c){
+	int d = 0;
+	for(int i = 0; i < 3; i++)
+		d += (p[i] - c[i]) * (p[i] - c[i]);
+	return d;
+}
+
+/**
+ * 不透明の4色モード(c0 > c1)で圧縮する
+ * アルファは無視する
+ */
+void compressBC1(const unsigned char* block, unsigned char* output){
+	float e0[4];
+	float e1[4];
+	fitLine(block, 3, e0, e1);
+	unsigned short c0 = to565(e1);
+	unsigned short c1 = to565(e0);
+	if(c0 < c1){
+		const unsigned short t = c0;
+		c0 = c1;
+		c1 = t;
+	}
+	unsigned int indices = 0;
+	if(c0 != c1){
+		int palette[4][3];
+		from565(c0, palette[0]);
+		from565(c1, palette[1]);
+		for(int c = 0; c < 3; c++){
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		for(int i = 0; i < 16; i++){
+			int best = 0;
+			int best_distance = distance3(&block[i * 4], palette[0]);
+			for(int j = 1; j < 4; j++){
+				const int d = distance3(&block[i * 4], palette[j]);
+				if(d < best_distance){
+					best = j;
+					best_distance = d;
+				}
+			}
+			indices |= static_cast<unsigned int>(best) << (i * 2);
+		}
+	}
+	output[0] = static_cast<unsigned char>(c0 & 0xff);
+	output[1] = static_cast<unsigned char>(c0 >> 8);
+	output[2] = static_cast<unsigned char>(c1 & 0xff);
+	output[3] = static_cast<unsigned char>(c1 >> 8);
+	for(int i = 0; i < 4; i++)
+		output[4 + i] = static_cast<unsigned char>(indices >> (i * 8));
+}
+
+/**
+ * 1チャンネルを8段階モード(a0 > a1)で圧縮する
+ */
+void compressBC4(const unsigned char* block, int channel, unsigned char* output){
+	int a0 = 0;
+	int a1 = 255;
+	for(int i = 0; i < 16; i++){
+		const int v = block[i * 4 + channel];
+		if(v > a0)
+			a0 = v;
+		if(v < a1)
+			a1 = v;
+	}
+	output[0] = static_cast<unsigned char>(a0);
+	output[1] = static_cast<unsigned char>(a1);
+	unsigned long long indices = 0;
+	if(a0 > a1){
+		int palette[8];
+		palette[0] = a0;
+		palette[1] = a1;
+		for(int j = 1; j < 7; j++)
+			palette[1 + j] = ((7 - j) * a0 + j * a1) / 7;
+		for(int i = 0; i < 16; i++){
+			const int v = block[i * 4 + channel];
+			int best = 0;
+			int best_distance = 256;
+			for(int j = 0; j < 8; j++){
+				const int d = (v > palette[j])? v - palette[j] : palette[j] - v;
+				if(d < best_distance){
+					best = j;
+					best_distance = d;
+				}
+			}
+			indices |= static_cast<unsigned long long>(best) << (i * 3);
+		}
+	}
+	for(int i = 0; i < 6; i++)
+		output[2 + i] = static_cast<unsigned char>(indices >> (i * 8));
+}
+
+/**
+ * アルファをBC4、色をBC1で圧縮する
+ */
+void compressBC3(const unsigned char* block, unsigned char* output){
+	compressBC4(block, 3, output);
+	compressBC1(block, output + 8);
+}
+
+/**
+ * RとGをそれぞれBC4で圧縮する(法線マップ向け)
+ */
+void compressBC5(const unsigned char* block, unsigned char* output){
+	compressBC4(block, 0, output);
+	compressBC4(block, 1, output + 8);
+}
+
+static inline void putBits(unsigned char* output, int* pos, unsigned int value, int bits){
+	for(int i = 0; i < bits; i++, (*pos)++){
+		if((value >> i) & 1)
+			output[*pos >> 3] |= static_cast<unsigned char>(1 << (*pos & 7));
+	}
+}
+
+/**
+ * 端点を7bitとPビットに量子化する
+ * Pビットは4チャンネルの誤差の合計が小さい方を選ぶ
+ */
+static void quantizeEndpoint(const float* endpoint, int* value, int* pbit){
+	int best_error = -1;
+	for(int p = 0; p < 2; p++){
+		int q[4];
+		int error = 0;
+		for(int c = 0; c < 4; c++){
+			const int v = clampByte(endpoint[c]);
+			int t = (v - p + 1) / 2;
+			if(t > 127)
+				t = 127;
+			q[c] = t;
+			const int d = v - ((t << 1) | p);
+			error += d * d;
+		}
+		if((best_error < 0) || (error < best_error)){
+			best_error = error;
+			for(int c = 0; c < 4; c++)
+				value[c] = q[c];
+			*pbit = p;
+		}
+	}
+}
+
+/**
+ * 各画素に最も近い補間値のインデックスを選ぶ
+ * channelsは先頭からのチャンネル数、誤差の合計を返す
+ */
+static int selectIndices(const unsigned char* block, int first, int channels, const int (*palette)[4], int count, int* indices){
+	int total = 0;
+	for(int i = 0; i < 16; i++){
+		int best = 0;
+		int best_distance = -1;
+		for(int j = 0; j < count; j++){
+			int d = 0;
+			for(int c = first; c < first + channels; c++)
+				d += (block[i * 4 + c] - palette[j][c]) * (block[i * 4 + c] - palette[j][c]);
+			if((best_distance < 0) || (d < best_distance)){
+				best = j;
+				best_distance = d;
+			}
+		}
+		indices[i] = best;
+		total += best_distance;
+	}
+	return total;
+}
+
+/**
+ * モード6: RGBAを1本の直線で近似する
+ * 誤差の合計を返す
+ */
+static int compressBC7Mode6(const unsigned char* block, unsigned char* output){
+	float e0[4];
+	float e1[4];
+	fitLine(block, 4, e0, e1);
+	int q0[4];
+	int q1[4];
+	int p0;
+	int p1;
+	quantizeEndpoint(e0, q0, &p0);
+	quantizeEndpoint(e1, q1, &p1);
+	int palette[16][4];
+	for(int j = 0; j < 16; j++){
+		for(int c = 0; c < 4; c++){
+			const int a = (q0[c] << 1) | p0;
+			const int b = (q1[c] << 1) | p1;
+			palette[j][c] = ((64 - BC7_WEIGHTS4[j]) * a + BC7_WEIGHTS4[j] * b + 32) >> 6;
+		}
+	}
+	int indices[16];
+	const int error = selectIndices(block, 0, 4, palette, 16, indices);
+	// 先頭の画素のインデックスは最上位bitが0になるように端点を入れ替える
+	if(indices[0] >= 8){
+		for(int c = 0; c < 4; c++){
+			const int t = q0[c];
+			q0[c] = q1[c];
+			q1[c] = t;
+		}
+		const int t = p0;
+		p0 = p1;
+		p1 = t;
+		for(int i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+	memset(output, 0, 16);
+	int pos = 0;
+	putBits(output, &pos, 1 << 6, 7);	// モード6
+	for(int c = 0; c < 4; c++){
+		putBits(output, &pos, q0[c], 7);
+		putBits(output, &pos, q1[c], 7);
+	}
+	putBits(output, &pos, p0, 1);
+	putBits(output, &pos, p1, 1);
+	putBits(output, &pos, indices[0], 3);
+	for(int i = 1; i < 16; i++)
+		putBits(output, &pos, indices[i], 4);
+	return error;
+}
+
+/**
+ * 先頭の画素のインデックスの最上位bitが0になるように端点を入れ替える
+ */
+static void fixAnchor(int* e0, int* e1, int channels, int* indices, int count){
+	if(indices[0] < count / 2)
+		return;
+	for(int c = 0; c < channels; c++){
+		const int t = e0[c];
+		e0[c] = e1[c];
+		e1[c] = t;
+	}
+	for(int i = 0; i < 16; i++)
+		indices[i] = count - 1 - indices[i];
+}
+
+/**
+ * モード5: RGB(7bit)とアルファ(8bit)を別々のインデックスで近似する
+ * 色とアルファの変化が揃っていない場合に向く、誤差の合計を返す
+ */
+static int compressBC7Mode5(const unsigned char* block, unsigned char* output){
+	float e0[4];
+	float e1[4];
+	fitLine(block, 3, e0, e1);
+	int color0[3];
+	int color1[3];
+	for(int c = 0; c < 3; c++){
+		color0[c] = (clampByte(e0[c]) * 127 + 127) / 255;
+		color1[c] = (clampByte(e1[c]) * 127 + 127) / 255;
+	}
+	int alpha0 = 255;
+	int alpha1 = 0;
+	for(int i = 0; i < 16; i++){
+		if(block[i * 4 + 3] < alpha0)
+			alpha0 = block[i * 4 + 3];
+		if(block[i * 4 + 3] > alpha1)
+			alpha1 = block[i * 4 + 3];
+	}
+	int palette[4][4];
+	for(int j = 0; j < 4; j++){
+		for(int c = 0; c < 3; c++){
+			const int a = (color0[c] << 1) | (color0[c] >> 6);
+			const int b = (color1[c] << 1) | (color1[c] >> 6);
+			palette[j][c] = ((64 - BC7_WEIGHTS2[j]) * a + BC7_WEIGHTS2[j] * b + 32) >> 6;
+		}
+		palette[j][3] = ((64 - BC7_WEIGHTS2[j]) * alpha0 + BC7_WEIGHTS2[j] * alpha1 + 32) >> 6;
+	}
+	int color_indices[16];
+	int alpha_indices[16];
+	const int error = selectIndices(block, 0, 3, palette, 4, color_indices) + selectIndices(block, 3, 1, palette, 4, alpha_indices);
+	fixAnchor(color0, color1, 3, color_indices, 4);
+	fixAnchor(&alpha0, &alpha1, 1, alpha_indices, 4);
+	memset(output, 0, 16);
+	int pos = 0;
+	putBits(output, &pos, 1 << 5, 6);	// モード5
+	putBits(output, &pos, 0, 2);	// チャンネルの入れ替えなし
+	for(int c = 0; c < 3; c++){
+		putBits(output, &pos, color0[c], 7);
+		putBits(output, &pos, color1[c], 7);
+	}
+	putBits(output, &pos, alpha0, 8);
+	putBits(output, &pos, alpha1, 8);
+	putBits(output, &pos, color_indices[0], 1);
+	for(int i = 1; i < 16; i++)
+		putBits(output, &pos, color_indices[i], 2);
+	putBits(output, &pos, alpha_indices[0], 1);
+	for(int i = 1; i < 16; i++)
+		putBits(output, &pos, alpha_indices[i], 2);
+	return error;
+}
+
+/**
+ * モード6とモード5のうち誤差の小さい方を使う
+ * アルファが一様なブロックはモード6のみ試す
+ */
+void compressBC7(const unsigned char* block, unsigned char* output){
+	const int error = compressBC7Mode6(block, output);
+	if(error == 0)
+		return;
+	bool opaque = true;
+	for(int i = 1; i < 16; i++){
+		if(block[i * 4 + 3] != block[3])
+			opaque = false;
+	}
+	if(opaque)
+		return;
+	unsigned char mode5[16];
+	if(compressBC7Mode5(block, mode5) < error)
+		memcpy(output, mode5, 16);
+}
@@ -0,0 +1,12 @@
+﻿/**
+ * テクスチャのブロック圧縮(BC1/BC3/BC4/BC5/BC7)
+ * 入力は4x4画素のRGBA8(行順に64バイト)、出力はBC1とBC4が8バイト、その他は16バイト
+ * BC7はモード6(RGBAを1本の直線で近似)とモード5(色とアルファを別々に近似)のみ使う
+ */
+#pragma once
+
+void compressBC1(const unsigned char* block, unsigned char* output);
+void compressBC3(const unsigned char* block, unsigned char* output);
+void compressBC4(const unsigned char* block, int channel, unsigned char* output);
+void compressBC5(const unsigned char* block, unsigned char* output);
+void compressBC7(const unsigned char* block, unsigned char* output);
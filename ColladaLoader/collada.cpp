@@ -1,12 +1,29 @@
 ﻿#include "collada.h"
-#include "crc32.h"
+#include "collada_async.h"
+#include "collada_cache.h"
+#include "collada_context.h"
+#include "collada_index.h"
+#include "collada_stream.h"
+#include "collada_zae.h"
+#include "hash64.h"
+#include "mapped_file.h"
+#include "text_number.h"
+#include "timer.h"
 #include "log.h"
 
 namespace collada{
 
 ////////////////////////////////////////////////////////////////////////////////
 
-std::string path; // 作業用パス
+/**
+ * collada-domはスレッド安全とは限らないので、collada-domを使う処理は同時に1つだけ
+ * 遅延展開ではDOMから展開する間だけロックする
+ */
+static Mutex dom_mutex;
+
+Mutex* getDomMutex(){
+	return &dom_mutex;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -35,11 +52,26 @@ static size_t new_size(size_t size){
 	return 0;	// should raise exception
 }
 
+#ifdef VALIDATE_UID
+/**
+ * uidの衝突検査
+ * 同じuidが既に別の名前で登録されていれば衝突
+ */
+static bool validateUid(const Node* node, const std::string& name){
+	if(node->name.empty() || (node->name == name))
+		return true;
+	Log_e("uid collision: %s and %s.\n", node->name.c_str(), name.c_str());
+	return false;
+}
+#endif
+
 Node::Node(){
 	sibling = NULL;
 	child = NULL;
 	next = NULL;
-	uid = INVALID_ID;
+	uid = INVALID_UID;
+	// updateMatrix()を呼ぶまでは原点に置く
+	mathematics::Matrix44Identity(&current);
 }
 
 Node::~Node(){
@@ -57,8 +89,6 @@ void Node::cleanup(){
 bool Node::load(const daeElementRefArray& dae_elem_ref_array){
 	// 列ベクトルかつ出現順序で乗算
 	mathematics::Matrix44Identity(&local_to_world);
-	mathematics::Matrix44 current;
-	mathematics::Vector3 v;
 	float values[16];
 
 	size_t cont_count = dae_elem_ref_array.getCount();
@@ -70,42 +100,67 @@ bool Node::load(const daeElementRefArray& dae_elem_ref_array){
 		switch(type){
 		case TransformationElement_Lookat:
 			load(values, dynamic_cast<domLookat*>(dae_elem));
-			Log_w("unsupported\n");
 			break;
-		case TransformationElement_Matrix:// 入力は行指向
+		case TransformationElement_Matrix:
 			load(values, dynamic_cast<domMatrix*>(dae_elem));
-			current.set(values[0], values[1], values[2], values[3],
-						values[4], values[5], values[6], values[7],
-						values[8], values[9], values[10], values[11],
-						values[12], values[13], values[14], values[15]);
-			mathematics::Matrix44Mul(&local_to_world, &current, &local_to_world);
 			break;
 		case TransformationElement_Rotate:
 			load(values, dynamic_cast<domRotate*>(dae_elem));
-			v.set(values[0], values[1], values[2]);
-			mathematics::Matrix44RotationAxis(&current, &v, values[3]);
-			mathematics::Matrix44Mul(&local_to_world, &current, &local_to_world);
 			break;
 		case TransformationElement_Scale:
 			load(values, dynamic_cast<domScale*>(dae_elem));
-			mathematics::Matrix44Scaling(&current, values[0], values[1], values[2]);
-			mathematics::Matrix44Mul(&local_to_world, &current, &local_to_world);
 			break;
 		case TransformationElement_Skew:
 			load(values, dynamic_cast<domSkew*>(dae_elem));
-			Log_w("unsupported\n");
 			break;
 		case TransformationElement_Translate:
 			load(values, dynamic_cast<domTranslate*>(dae_elem));
-			mathematics::Matrix44Translation(&current, values[0], values[1], values[2]);
-			mathematics::Matrix44Mul(&local_to_world, &current, &local_to_world);
 			break;
 		default:
 			break;
 		}
+		transform(type, values);
 	}
 	return true;
 }
+
+/**
+ * 変換要素をlocal_to_worldに乗算する
+ */
+void Node::transform(TransformationElementType type, const float* values){
+	mathematics::Matrix44 current;
+	mathematics::Vector3 v;
+	switch(type){
+	case TransformationElement_Lookat:
+		Log_w("unsupported\n");
+		break;
+	case TransformationElement_Matrix:// 入力は行指向
+		current.set(values[0], values[1], values[2], values[3],
+					values[4], values[5], values[6], values[7],
+					values[8], values[9], values[10], values[11],
+					values[12], values[13], values[14], values[15]);
+		mathematics::Matrix44Mul(&local_to_world, &current, &local_to_world);
+		break;
+	case TransformationElement_Rotate:
+		v.set(values[0], values[1], values[2]);
+		mathematics::Matrix44RotationAxis(&current, &v, values[3]);
+		mathematics::Matrix44Mul(&local_to_world, &current, &local_to_world);
+		break;
+	case TransformationElement_Scale:
+		mathematics::Matrix44Scaling(&current, values[0], values[1], values[2]);
+		mathematics::Matrix44Mul(&local_to_world, &current, &local_to_world);
+		break;
+	case TransformationElement_Skew:
+		Log_w("unsupported\n");
+		break;
+	case TransformationElement_Translate:
+		mathematics::Matrix44Translation(&current, values[0], values[1], values[2]);
+		mathematics::Matrix44Mul(&local_to_world, &current, &local_to_world);
+		break;
+	default:
+		break;
+	}
+}
 void Node::load(float* values, const domLookat* dom_lookat){
 	size_t count = dom_lookat->getValue().getCount();
 	for(size_t i = 0; i < count; i++)
@@ -173,6 +228,126 @@ bool Node::load(domNode* dom_node){
 	return true;
 }
 
+bool Node::load(const StreamElement* stream_node){
+	if(!loadTransform(stream_node))
+		return false;
+	// <instance_geometry>
+	for(const StreamElement* elem = stream_node->getChild("instance_geometry"); elem; elem = elem->getNext("instance_geometry")){
+		if(!loadGeometry(elem)){
+			cleanup();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Node::loadTransform(const StreamElement* stream_node){
+	// transformation_elements
+	mathematics::Matrix44Identity(&local_to_world);
+	for(const StreamElement* elem = stream_node->getChild(); elem; elem = elem->getSibling()){
+		TransformationElementType type = getTransformationType(elem);
+		if(!isTransformationElement(type))
+			continue;
+		float values[16];
+		size_t count;
+		if(!elem->getFloats(values, 16, &count)){
+			Log_e("could not load transformation_elements.\n");
+			cleanup();
+			return false;
+		}
+		transform(type, values);
+	}
+	return true;
+}
+
+bool Node::loadGeometry(const StreamElement* stream_inst_geom){
+	Geometry* geom;
+	try{
+		geom = new Geometry;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	if(!geom->load(stream_inst_geom)){
+		Log_e("could not load Geometry(%d).\n", static_cast<int>(geometries.size()));
+		delete geom;
+		return false;
+	}
+	try{
+		geometries.push_back(geom);
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		delete geom;
+		return false;
+	}
+	return true;
+}
+
+bool Node::load(CacheReader* reader){
+	float* m = local_to_world;
+	for(size_t i = 0; i < 16; i++){
+		if(!reader->readF32(&m[i]))
+			return false;
+	}
+#if defined(DEBUG) || defined(VALIDATE_UID)
+	if(!reader->readString(&name))
+		return false;
+#endif
+	unsigned int geom_count;
+	if(!reader->readU32(&geom_count))
+		return false;
+	for(unsigned int i = 0; i < geom_count; i++){
+		Geometry* geom;
+		try{
+			geom = new Geometry;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			cleanup();
+			return false;
+		}
+		if(!geom->load(reader)){
+			Log_e("could not load Geometry(%d).\n", i);
+			delete geom;
+			cleanup();
+			return false;
+		}
+		geometries.push_back(geom);
+	}
+	return true;
+}
+
+bool Node::save(CacheWriter* writer) const{
+	const float* m = local_to_world;
+	for(size_t i = 0; i < 16; i++){
+		writer->writeF32(m[i]);
+	}
+#if defined(DEBUG) || defined(VALIDATE_UID)
+	writer->writeString(name);
+#endif
+	if(!writer->writeU32(static_cast<unsigned int>(geometries.size())))
+		return false;
+	for(GeometryPtrArray::const_iterator it = geometries.begin(); it != geometries.end(); it++){
+		if(!(*it)->save(writer))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * 遅延展開する場合に、このノードのメッシュを先に展開しておく
+ */
+bool Node::prefetch() const{
+	bool result = true;
+	for(GeometryPtrArray::const_iterator it = geometries.begin(); it != geometries.end(); it++){
+		if(!(*it)->prefetch())
+			result = false;
+	}
+	return result;
+}
+
 void Node::addSibling(Node* sibling){
 	if(this->sibling){
 		sibling->sibling = this->sibling;
@@ -232,81 +407,115 @@ void Node::updateMatrix(const mathematics::Matrix44* parent, bool flag){
 
 NodeBank::NodeBank(){
 	size = 0;
+	count = 0;
 	nodes = NULL;
 }
 
 NodeBank::~NodeBank(){
-	if(nodes)
-		delete[] nodes;
+	free();
 }
 
+/**
+ * 予め領域を確保する
+ * 足りなくなった場合はcreate()で拡張されるので目安で良い
+ */
 bool NodeBank::alloc(size_t size){
-	if(nodes)
-		return false;
-	const size_t actual_size = new_size(size);
-	try{
-		nodes = new Node[actual_size];
-		for(size_t i = 0; i < actual_size; i++){
-			nodes[i].sibling = NULL;
-			nodes[i].child = NULL;
-			nodes[i].next = NULL;
-			nodes[i].uid = INVALID_ID;
-		}
-	}
-	catch(std::bad_alloc& e){
-		Log_e("could not allocate memory.\n");
-		return false;
-	}
-	this->size = actual_size;
-	return true;
+	const size_t actual_size = new_size(size * 4 / 3);
+	if(actual_size <= this->size)
+		return true;
+	return rehash(actual_size);
 }
 
 void NodeBank::free(){
 	if(nodes){
+		for(size_t i = 0; i < size; i++){
+			if(nodes[i])
+				delete nodes[i];
+		}
 		delete[] nodes;
 		nodes = NULL;
 	}
 	size = 0;
+	count = 0;
 }
 
-Node* NodeBank::create(unsigned int uid){
-	Node* node = find(uid);
-	if(node == NULL){
-		node = addNode(uid);
+Node* NodeBank::create(Uid uid){
+	// 負荷率が3/4を超える前に拡張
+	if((count + 1) * 4 > size * 3){
+		if(!rehash(new_size(size))){
+			return NULL;
+		}
+	}
+	unsigned int index = findSlot(uid);
+	if(nodes[index])
+		return nodes[index];
+	Node* node;
+	try{
+		node = new Node;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return NULL;
 	}
+	node->uid = uid;
+	nodes[index] = node;
+	count++;
 	return node;
 }
 
-unsigned int NodeBank::findFirstKey(unsigned int start_index, unsigned int key){
+/**
+ * uidを保持するスロットか、最初に見つかった空きスロットを返す
+ */
+unsigned int NodeBank::findSlot(Uid uid) const{
 	const size_t size = this->size;
-	unsigned int index = INVALID_ID;
+	unsigned int index = getHash(uid);
 	for(size_t i = 0; i < size; i++){
-		unsigned int actual_index = (start_index + i) % size;
-		if(nodes[actual_index].uid == key){
-			index = actual_index;
-			break;
-		}
-		else
-		if(nodes[actual_index].uid == INVALID_ID){
-			break;
-		}
+		const Node* node = nodes[index];
+		if((node == NULL) || (node->uid == uid))
+			return index;
+		index = static_cast<unsigned int>((index + 1) % size);
 	}
-	return index;
+	return INVALID_ID;
 }
 
-Node* NodeBank::find(unsigned int uid){
-	unsigned int index = findFirstKey(getHash(uid), uid);
-	return (index != INVALID_ID)? &nodes[index] : NULL;
+/**
+ * テーブルを拡張して再配置する
+ * Node自体は移動しないので外部のポインタは有効なまま
+ */
+bool NodeBank::rehash(size_t capacity){
+	if(capacity == 0){
+		Log_e("could not extend NodeBank.\n");
+		return false;
+	}
+	Node** new_nodes;
+	try{
+		new_nodes = new Node*[capacity];
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	for(size_t i = 0; i < capacity; i++){
+		new_nodes[i] = NULL;
+	}
+	Node** old_nodes = nodes;
+	const size_t old_size = size;
+	nodes = new_nodes;
+	size = capacity;
+	for(size_t i = 0; i < old_size; i++){
+		if(old_nodes[i])
+			nodes[findSlot(old_nodes[i]->uid)] = old_nodes[i];
+	}
+	if(old_nodes)
+		delete[] old_nodes;
+	return true;
 }
 
-Node* NodeBank::addNode(unsigned int uid){
-	unsigned int index = findFirstKey(uid, INVALID_ID);
-	if(index != INVALID_ID){
-		Node* node = &nodes[index];
-		node->uid = uid;
-		return node;
-	}
-	return NULL;
+Node* NodeBank::find(Uid uid){
+	if(count == 0)
+		return NULL;
+	unsigned int index = findSlot(uid);
+	return (index != INVALID_ID)? nodes[index] : NULL;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -349,19 +558,205 @@ Images::~Images(){
 void Images::cleanup(){
 	path.clear();
 	images.clear();
+	embedded.clear();
+	embedded_data.clear();
+}
+
+/**
+ * <image>の名前
+ * ファイルならファイル名、<data>に埋め込まれていれば"#"+id
+ */
+bool getImageName(std::string* output, const domImage* dom_image){
+	if(dom_image->getInit_from()){
+		getFileName(output, dom_image->getInit_from()->getValue().getPath());
+		return true;
+	}
+	if(dom_image->getData()){
+		const char* id = dom_image->getID();
+		output->assign("#");
+		output->append(id? id : "");
+		return true;
+	}
+	Log_e("element <init_from> not found.\n");
+	return false;
 }
 
 bool Images::load(const domLibrary_images* dom_lib_images){
 	const domImage_Array& dom_image_array = dom_lib_images->getImage_array();
 	const size_t count = dom_image_array.getCount();
 	for(size_t i = 0; i < count; i++){
+		if(!checkProgress(LoadStage_Image, i, count)){
+			Log_i("canceled.\n");
+			cleanup();
+			return false;
+		}
 		const domImage* dom_image = dom_image_array.get(i);
-		const char* filepath = dom_image->getInit_from()->getValue().getPath();
 		std::string filename;
-		getFileName(&filename, filepath);
+		if(!getImageName(&filename, dom_image)){
+			cleanup();
+			return false;
+		}
 		images.push_back(filename.c_str());
+		embedded.push_back(std::string());
+		embedded_data.push_back(std::vector<unsigned char>());
+		// collada-domが変換済みなのでバイト列のまま持つ
+		if(!dom_image->getInit_from()){
+			const domListOfHexBinary& data = dom_image->getData()->getValue();
+			std::vector<unsigned char>& bytes = embedded_data.back();
+			bytes.resize(data.getCount());
+			for(size_t j = 0; j < data.getCount(); j++)
+				bytes[j] = data[j];
+		}
+	}
+	checkProgress(LoadStage_Image, count, count);
+	this->path.append(LoadContext::getPath());
+	return validate();
+}
+
+/**
+ * <init_from>のURIからファイル名を取り出す
+ */
+void getImageName(std::string* output, const std::string& uri){
+	std::string filepath(uri, 0, uri.find_first_of("#?"));
+	getFileName(output, filepath.c_str());
+}
+
+bool getImageName(std::string* output, const StreamElement* stream_image){
+	const StreamElement* init_from = stream_image->getChild("init_from");
+	if(init_from){
+		std::string uri;
+		init_from->getText(&uri);
+		getImageName(output, uri);
+		return true;
+	}
+	if(stream_image->getChild("data")){
+		const char* id = stream_image->getID();
+		output->assign("#");
+		output->append(id? id : "");
+		return true;
+	}
+	Log_e("element <init_from> not found.\n");
+	return false;
+}
+
+
+bool Images::load(const StreamElement* stream_lib_images){
+	for(const StreamElement* elem = stream_lib_images->getChild("image"); elem; elem = elem->getNext("image")){
+		if(!checkProgress(LoadStage_Image)){
+			Log_i("canceled.\n");
+			cleanup();
+			return false;
+		}
+		std::string filename;
+		if(!getImageName(&filename, elem)){
+			cleanup();
+			return false;
+		}
+		images.push_back(filename);
+		// 16進数字のまま持ち、変換は画像を開く時(展開するスレッド)に行う
+		std::string hex;
+		const StreamElement* data = elem->getChild("init_from")? NULL : elem->getChild("data");
+		if(data)
+			data->getText(&hex);
+		embedded.push_back(hex);
+		embedded_data.push_back(std::vector<unsigned char>());
+	}
+	this->path.append(LoadContext::getPath());
+	return validate();
+}
+
+bool Images::validate(){
+#ifdef VALIDATE_UID
+	// 画像のuid(パス+ファイル名)の衝突検査
+	std::map<Uid, const std::string*> uids;
+	for(StringArray::const_iterator it = images.begin(); it != images.end(); it++){
+		std::string temp;
+		temp.append(this->path);
+		temp.append(*it);
+		Uid uid = calcHash64(reinterpret_cast<const unsigned char*>(temp.c_str()));
+		std::pair<Uid, const std::string*> p(uid, &(*it));
+		std::map<Uid, const std::string*>::_Pairib pib = uids.insert(p);
+		if(!pib.second && (*pib.first->second != *it)){
+			Log_e("uid collision: %s and %s.\n", pib.first->second->c_str(), it->c_str());
+			cleanup();
+			return false;
+		}
+	}
+#endif
+	return true;
+}
+
+bool Images::load(CacheReader* reader){
+	cleanup();
+	unsigned int count;
+	if(!reader->readString(&path) || !reader->readU32(&count))
+		return false;
+	for(unsigned int i = 0; i < count; i++){
+		std::string filename;
+		unsigned int size;
+		if(!reader->readString(&filename) || !reader->readU32(&size) || (size > reader->getRemain())){
+			cleanup();
+			return false;
+		}
+		images.push_back(filename);
+		embedded.push_back(std::string());
+		embedded_data.push_back(std::vector<unsigned char>());
+		if(size > 0){
+			embedded_data.back().resize(size);
+			if(!reader->readBytes(&embedded_data.back()[0], size)){
+				cleanup();
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * 埋め込まれた画像はバイト列で書く(ファイルなら長さ0)
+ */
+bool Images::save(CacheWriter* writer) const{
+	writer->writeString(path);
+	if(!writer->writeU32(static_cast<unsigned int>(images.size())))
+		return false;
+	for(size_t i = 0; i < images.size(); i++){
+		if(!writer->writeString(images[i]))
+			return false;
+		std::vector<unsigned char> buffer;
+		const std::vector<unsigned char>* data = &embedded_data[i];
+		if(!embedded[i].empty()){
+			try{
+				if(!getEmbedded(i, &buffer))
+					return false;
+			}
+			catch(std::bad_alloc& e){
+				Log_e("could not allocate memory.\n");
+				return false;
+			}
+			data = &buffer;
+		}
+		if(!writer->writeU32(static_cast<unsigned int>(data->size())))
+			return false;
+		if(!data->empty() && !writer->writeBytes(&(*data)[0], data->size()))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * index番目の埋め込まれた画像のバイト列
+ * 16進数字のまま持っている場合はここで変換する
+ */
+bool Images::getEmbedded(size_t index, std::vector<unsigned char>* output) const{
+	if(!embedded[index].empty()){
+		const std::string& hex = embedded[index];
+		if(!parseHex(hex.c_str(), hex.c_str() + hex.size(), output)){
+			Log_e("invalid image data: %s.\n", images[index].c_str());
+			return false;
+		}
+		return true;
 	}
-	this->path.append(collada::path.c_str());
+	output->assign(embedded_data[index].begin(), embedded_data[index].end());
 	return true;
 }
 
@@ -379,6 +774,9 @@ void Images::dump(){
 
 Scene::Scene(){
 	root = NULL;
+	task_count = 0;
+	for(int i = 0; i < Task_Count; i++)
+		task_costs[i] = 0;
 }
 
 Scene::~Scene(){
@@ -386,23 +784,34 @@ Scene::~Scene(){
 
 void Scene::cleanup(){
 	node_bank.free();
+	node_cache.clear();
+	tasks.clear();
+	names.clear();
+	task_count = 0;
 	root = NULL;
 }
 
+/**
+ * 階層は一度だけ辿る
+ * NodeBankは必要に応じて拡張されるので事前の数え上げは行わない
+ */
 bool Scene::load(domVisual_scene* dom_visual_scene){
-	if(!node_bank.alloc(countGeometryNode(dom_visual_scene))){
-		cleanup();
-		return false;
-	}
 	daeDatabase* dae_db = dom_visual_scene->getDAE()->getDatabase();
 	size_t node_count = dom_visual_scene->getNode_array().getCount();
 	for(size_t i = 0; i < node_count; i++){
+		if(!checkProgress(LoadStage_Scene, i, node_count)){
+			Log_i("canceled.\n");
+			cleanup();
+			return false;
+		}
 		if(!load(dae_db, dom_visual_scene->getNode_array().get(i), NULL)){
 			Log_e("could not load Node(%d).\n", i);
 			cleanup();
 			return false;
 		}
 	}
+	node_cache.clear();
+	checkProgress(LoadStage_Scene, node_count, node_count);
 #ifdef DEBUG
 	if(root)
 		root->update();
@@ -413,38 +822,46 @@ bool Scene::load(domVisual_scene* dom_visual_scene){
 bool Scene::load(daeDatabase* dae_db, domNode* dom_node, const char* parent){
 	if(!isGeometryNode(dom_node))
 		return true;
-#ifdef DEBUG
+#if defined(DEBUG) || defined(VALIDATE_UID)
 	std::string myname;
 #endif
-	unsigned int id;
-	unsigned int pid;
+	Uid id;
+	Uid pid;
 	if(parent){
 		std::string name;
 		name.append(parent);
 		name.append("-");
 		name.append(dom_node->getID());
 		name.append("\0");
-		id = calcCRC32(reinterpret_cast<const unsigned char*>(name.c_str()));
-		pid = calcCRC32(reinterpret_cast<const unsigned char*>(parent));
-#ifdef DEBUG
+		id = calcHash64(reinterpret_cast<const unsigned char*>(name.c_str()));
+		pid = calcHash64(reinterpret_cast<const unsigned char*>(parent));
+#if defined(DEBUG) || defined(VALIDATE_UID)
 		myname.append(name);
 #endif
 	}else{
-		id = calcCRC32(reinterpret_cast<const unsigned char*>(dom_node->getID()));
+		id = calcHash64(reinterpret_cast<const unsigned char*>(dom_node->getID()));
 		const daeElement* dae_element = dom_node->getParent();
-		pid = calcCRC32(reinterpret_cast<const unsigned char*>(dae_element->getID()));
-#ifdef DEBUG
+		pid = calcHash64(reinterpret_cast<const unsigned char*>(dae_element->getID()));
+#if defined(DEBUG) || defined(VALIDATE_UID)
 		myname.append(dom_node->getID());
 		myname.append("\0");
 #endif
 	}
 	Node* node = node_bank.create(id);
+	if(!node){
+		Log_e("could not create Node.\n");
+		return false;
+	}
+#ifdef VALIDATE_UID
+	if(!validateUid(node, myname))
+		return false;
+#endif
 	if(!node->load(dom_node)){
 		Log_e("could not load Node.\n");
 		return false;
 	}
-#ifdef DEBUG
-	node->name.append(myname);
+#if defined(DEBUG) || defined(VALIDATE_UID)
+	node->name.assign(myname);
 #endif
 	// アクセス用にリンク
 	if(root){
@@ -480,13 +897,28 @@ bool Scene::load(daeDatabase* dae_db, domNode* dom_node, const char* parent){
 	return true;
 }
 
-bool Scene::load(daeDatabase* dae_db, domInstance_node* dom_inst_node, const char* parent){
-	const char* type = dom_inst_node->getUrl().fragment().c_str();
+/**
+ * <instance_node>の参照先を取得
+ * 同じ<node>は何度も参照されるので解決結果を覚えておく
+ */
+domNode* Scene::findNode(daeDatabase* dae_db, domInstance_node* dom_inst_node){
+	const std::string url(dom_inst_node->getUrl().fragment());
+	std::map<std::string, domNode*>::iterator it = node_cache.find(url);
+	if(it != node_cache.end())
+		return it->second;
 	domNode* dom_node;
-	if(const_cast<daeDatabase*>(dae_db)->getElement((daeElement**)&dom_node, 0, type, "node") != DAE_OK){
-		Log_e("element <node> %s not found.\n", type);
-		return false;
+	if(getElement((daeElement**)&dom_node, dae_db, url.c_str(), "node") != DAE_OK){
+		Log_e("element <node> %s not found.\n", url.c_str());
+		return NULL;
 	}
+	node_cache.insert(std::pair<std::string, domNode*>(url, dom_node));
+	return dom_node;
+}
+
+bool Scene::load(daeDatabase* dae_db, domInstance_node* dom_inst_node, const char* parent){
+	domNode* dom_node = findNode(dae_db, dom_inst_node);
+	if(!dom_node)
+		return false;
 	if(!isGeometryNode(dom_node))
 		return true;
 
@@ -495,21 +927,29 @@ bool Scene::load(daeDatabase* dae_db, domInstance_node* dom_inst_node, const cha
 	name.append("-");
 	name.append(dom_node->getID());
 	name.append("\0");
-	unsigned int id = calcCRC32(reinterpret_cast<const unsigned char*>(name.c_str()));
+	Uid id = calcHash64(reinterpret_cast<const unsigned char*>(name.c_str()));
 	Node* node = node_bank.create(id);
+	if(!node){
+		Log_e("could not create Node(%s).\n", name.c_str());
+		return false;
+	}
+#ifdef VALIDATE_UID
+	if(!validateUid(node, name))
+		return false;
+#endif
 	if(!node->load(dom_node)){
 		Log_e("could not load Node(%s).\n", name.c_str());
 		return false;
 	}
-#ifdef DEBUG
-	node->name.append(name);
+#if defined(DEBUG) || defined(VALIDATE_UID)
+	node->name.assign(name);
 #endif
 	// アクセス用にリンク
 	if(root){
 		root->addNext(node);
 	}
 	// 親子関係の構築
-	unsigned int pid = calcCRC32(reinterpret_cast<const unsigned char*>(parent));
+	Uid pid = calcHash64(reinterpret_cast<const unsigned char*>(parent));
 	Node* pnode = node_bank.find(pid);
 	if(pnode){
 		pnode->addChild(node);
@@ -535,27 +975,451 @@ bool Scene::load(daeDatabase* dae_db, domInstance_node* dom_inst_node, const cha
 	return true;
 }
 
-Node* Scene::findNode(const char* name){
-	if(name == NULL){
-		return root;
-	}
-	unsigned int id = calcCRC32(reinterpret_cast<const unsigned char*>(name));
-	return node_bank.find(id);
+/**
+ * collada-domを介さない場合の読み込み
+ * uidや親子関係はDOM版と同じ規則で作る
+ */
+bool Scene::load(const StreamElement* stream_visual_scene){
+	if(!begin(stream_visual_scene))
+		return false;
+	bool done;
+	return step(0, &done);
 }
 
-const Node* Scene::findNode(const char* name) const{
-	return const_cast<Scene*>(this)->findNode(name);
+/**
+ * 段階的な読み込みの開始
+ * 再帰の代わりに未処理のノードをスタックに積み、step()で少しずつ処理する
+ */
+bool Scene::begin(const StreamElement* stream_visual_scene){
+	cleanup();
+	if(!push(Task_Node, stream_visual_scene->getChild("node"), NULL, NULL)){
+		cleanup();
+		return false;
+	}
+	return true;
 }
 
-////////////////////////////////////////////////////////////////////////////////
+// 種類ごとの要素名
+static const char* const task_element_names[] = {
+	"node",
+	"instance_node",
+	"instance_geometry",
+};
+
+/**
+ * 読み込みを進める
+ * deadline(getMicroseconds()の時刻)までに終わりそうな分だけ処理する、0なら最後まで
+ * 1回の呼び出しで少なくとも1つは処理する
+ * 途中でも読み込み済みのノードは描画できる
+ */
+bool Scene::step(unsigned long long deadline, bool* done){
+	*done = false;
+	bool first = true;
+	while(!tasks.empty()){
+		const Task& top = tasks.back();
+		if(deadline && !first){
+			// 直近の処理時間から終わらないと見込まれれば次回に回す
+			if(getMicroseconds() + task_costs[top.type] >= deadline)
+				return true;
+		}
+		first = false;
+		if(!checkProgress(LoadStage_Scene, task_count, task_count + tasks.size())){
+			Log_i("canceled.\n");
+			cleanup();
+			return false;
+		}
+		const Task task = top;
+		tasks.pop_back();
+		// 次の兄弟は自身の子孫の後に処理されるように先に積む
+		if(!push(task.type, task.element->getNext(task_element_names[task.type]), task.parent, task.node)){
+			cleanup();
+			return false;
+		}
+		const unsigned long long start = deadline? getMicroseconds() : 0;
+		if(!run(task)){
+			Log_e("could not load Node(%s).\n", task.element->getID()? task.element->getID() : "");
+			cleanup();
+			return false;
+		}
+		if(deadline){
+			// 指数移動平均
+			const unsigned long long cost = getMicroseconds() - start;
+			task_costs[task.type] = (task_costs[task.type] * 3 + cost) / 4;
+		}
+		task_count++;
+	}
+	names.clear();
+	checkProgress(LoadStage_Scene, task_count, task_count);
+#ifdef DEBUG
+	if(root)
+		root->update();
+#endif
+	*done = true;
+	return true;
+}
+
+/**
+ * 未処理の要素を積む
+ * 兄弟は処理する時点で1つずつ積むので、子の多いノードでも1回の処理は短い
+ */
+bool Scene::push(TaskType type, const StreamElement* element, const char* parent, Node* node){
+	if(!element)
+		return true;
+	Task task;
+	task.type = type;
+	task.element = element;
+	task.parent = parent;
+	task.node = node;
+	try{
+		tasks.push_back(task);
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	return true;
+}
+
+bool Scene::run(const Task& task){
+	switch(task.type){
+	case Task_Node:
+		return load(task.element, task.parent);
+	case Task_InstanceNode:
+		return instantiate(task.element, task.parent);
+	case Task_Geometry:
+		return task.node->loadGeometry(task.element);
+	default:
+		return false;
+	}
+}
+
+/**
+ * ノードを作って階層に加える
+ * <instance_geometry>、子の<node>、<instance_node>の順に処理されるように積む
+ */
+bool Scene::load(const StreamElement* stream_node, const char* parent){
+	if(!isGeometryNode(stream_node))
+		return true;
+	const char* node_id = stream_node->getID()? stream_node->getID() : "";
+#if defined(DEBUG) || defined(VALIDATE_UID)
+	std::string myname;
+#endif
+	Uid id;
+	Uid pid;
+	if(parent){
+		std::string name;
+		name.append(parent);
+		name.append("-");
+		name.append(node_id);
+		id = calcHash64(reinterpret_cast<const unsigned char*>(name.c_str()));
+		pid = calcHash64(reinterpret_cast<const unsigned char*>(parent));
+#if defined(DEBUG) || defined(VALIDATE_UID)
+		myname.append(name);
+#endif
+	}else{
+		id = calcHash64(reinterpret_cast<const unsigned char*>(node_id));
+		const char* parent_id = stream_node->getParent()->getID();
+		pid = calcHash64(reinterpret_cast<const unsigned char*>(parent_id? parent_id : ""));
+#if defined(DEBUG) || defined(VALIDATE_UID)
+		myname.append(node_id);
+#endif
+	}
+	Node* node = node_bank.create(id);
+	if(!node){
+		Log_e("could not create Node.\n");
+		return false;
+	}
+#ifdef VALIDATE_UID
+	if(!validateUid(node, myname))
+		return false;
+#endif
+	if(!node->loadTransform(stream_node)){
+		Log_e("could not load Node.\n");
+		return false;
+	}
+#if defined(DEBUG) || defined(VALIDATE_UID)
+	node->name.assign(myname);
+#endif
+	// アクセス用にリンク
+	if(root){
+		root->addNext(node);
+	}
+	// 親子関係の構築
+	Node* pnode = node_bank.find(pid);
+	if(pnode){
+		pnode->addChild(node);
+	}
+	else
+	if(root){
+		root->addSibling(node);
+	}
+	else{
+		root = node;
+	}
+
+	// 後に積んだものから処理される
+	return push(Task_InstanceNode, stream_node->getChild("instance_node"), node_id, NULL)
+		&& push(Task_Node, stream_node->getChild("node"), NULL, NULL)
+		&& push(Task_Geometry, stream_node->getChild("instance_geometry"), NULL, node);
+}
+
+bool Scene::instantiate(const StreamElement* stream_inst_node, const char* parent){
+	const char* uri = stream_inst_node->getAttribute("url");
+	const char* url = getFragment(uri);
+	const StreamElement* stream_node = stream_inst_node->getDocument()->resolve(uri, "node");
+	if(!stream_node){
+		Log_e("element <node> %s not found.\n", url);
+		return false;
+	}
+	if(!isGeometryNode(stream_node))
+		return true;
+
+	std::string name;
+	name.append(parent);
+	name.append("-");
+	name.append(stream_node->getID());
+	Uid id = calcHash64(reinterpret_cast<const unsigned char*>(name.c_str()));
+	Node* node = node_bank.create(id);
+	if(!node){
+		Log_e("could not create Node(%s).\n", name.c_str());
+		return false;
+	}
+#ifdef VALIDATE_UID
+	if(!validateUid(node, name))
+		return false;
+#endif
+	if(!node->loadTransform(stream_node)){
+		Log_e("could not load Node(%s).\n", name.c_str());
+		return false;
+	}
+#if defined(DEBUG) || defined(VALIDATE_UID)
+	node->name.assign(name);
+#endif
+	// アクセス用にリンク
+	if(root){
+		root->addNext(node);
+	}
+	// 親子関係の構築
+	Uid pid = calcHash64(reinterpret_cast<const unsigned char*>(parent));
+	Node* pnode = node_bank.find(pid);
+	if(pnode){
+		pnode->addChild(node);
+	}
+	else{
+		return false;	// ありえない
+	}
+
+	// 子孫の名前に使うので処理が終わるまで残しておく
+	const char* parent_name;
+	try{
+		names.push_back(name);
+		parent_name = names.back().c_str();
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	return push(Task_InstanceNode, stream_node->getChild("instance_node"), parent_name, NULL)
+		&& push(Task_Node, stream_node->getChild("node"), parent_name, NULL)
+		&& push(Task_Geometry, stream_node->getChild("instance_geometry"), NULL, node);
+}
+
+#define INVALID_INDEX (unsigned int)-1
+
+/**
+ * nextを辿った順に番号を付けて保存する
+ * 兄弟・子・次へのリンクはその番号で表す
+ */
+bool Scene::save(CacheWriter* writer) const{
+	std::vector<const Node*> nodes;
+	std::map<const Node*, unsigned int> indices;
+	for(const Node* node = root; node; node = node->next){
+		indices.insert(std::pair<const Node*, unsigned int>(node, static_cast<unsigned int>(nodes.size())));
+		nodes.push_back(node);
+	}
+	if(!writer->writeU32(static_cast<unsigned int>(nodes.size())))
+		return false;
+	for(size_t i = 0; i < nodes.size(); i++){
+		const Node* node = nodes[i];
+		const Node* links[3] = { node->sibling, node->child, node->next };
+		for(size_t j = 0; j < 3; j++){
+			unsigned int index = INVALID_INDEX;
+			if(links[j]){
+				std::map<const Node*, unsigned int>::const_iterator it = indices.find(links[j]);
+				if(it == indices.end()){
+					Log_e("Node is not linked from root.\n");
+					return false;
+				}
+				index = it->second;
+			}
+			writer->writeU32(index);
+		}
+		writer->writeU64(node->uid);
+		if(!node->save(writer))
+			return false;
+	}
+	return true;
+}
+
+bool Scene::load(CacheReader* reader){
+	cleanup();
+	unsigned int count;
+	if(!reader->readU32(&count))
+		return false;
+	std::vector<Node*> nodes;
+	std::vector<unsigned int> links;
+	for(unsigned int i = 0; i < count; i++){
+		unsigned int link[3];
+		Uid uid;
+		if(!reader->readU32(&link[0]) || !reader->readU32(&link[1]) || !reader->readU32(&link[2]) || !reader->readU64(&uid)){
+			cleanup();
+			return false;
+		}
+		Node* node = node_bank.create(uid);
+		if(!node || (node_bank.getCount() != nodes.size() + 1)){
+			Log_e("could not create Node(%d).\n", i);
+			cleanup();
+			return false;
+		}
+		if(!node->load(reader)){
+			Log_e("could not load Node(%d).\n", i);
+			cleanup();
+			return false;
+		}
+		nodes.push_back(node);
+		links.insert(links.end(), link, link + 3);
+	}
+	// リンクの復元
+	for(size_t i = 0; i < nodes.size(); i++){
+		Node** targets[3] = { &nodes[i]->sibling, &nodes[i]->child, &nodes[i]->next };
+		for(size_t j = 0; j < 3; j++){
+			const unsigned int index = links[i * 3 + j];
+			if(index == INVALID_INDEX){
+				*targets[j] = NULL;
+			}
+			else
+			if(index < nodes.size()){
+				*targets[j] = nodes[index];
+			}
+			else{
+				Log_e("invalid link.\n");
+				cleanup();
+				return false;
+			}
+		}
+	}
+	root = nodes.empty()? NULL : nodes[0];
+	return true;
+}
+
+/**
+ * 遅延展開する場合に、全てのメッシュを先に展開しておく
+ */
+bool Scene::prefetch() const{
+	bool result = true;
+	for(const Node* node = root; node; node = node->getNext()){
+		if(!node->prefetch())
+			result = false;
+	}
+	return result;
+}
+
+/**
+ * 読み直したotherのうち内容の変わったメッシュと<bind_material>だけをこのSceneに移す
+ * ノードの構成(並び、uid、Geometryの数)が違えば何もせずにfalse
+ * Nodeと変わっていないメッシュ、マテリアルのアドレスはそのまま残る
+ */
+bool Scene::patch(Scene* other, ReloadResult* result){
+	if(node_bank.getCount() != other->node_bank.getCount())
+		return false;
+	const Node* src = other->root;
+	for(const Node* node = root; node; node = node->next, src = src->next){
+		if(!src || (node->uid != src->uid) || (node->geometries.size() != src->geometries.size()))
+			return false;
+	}
+	if(src)
+		return false;
+	// 差し替え
+	Node* src_node = other->root;
+	for(Node* node = root; node; node = node->next, src_node = src_node->next){
+		node->local_to_world = src_node->local_to_world;
+		for(size_t i = 0; i < node->geometries.size(); i++){
+			Geometry* geom = node->geometries[i];
+			Geometry* src_geom = src_node->geometries[i];
+			// ハッシュが不明なもの(collada-domやキャッシュから読んだもの)は変わったとみなす
+			if((geom->getMeshHash() == INVALID_UID) || (geom->getMeshHash() != src_geom->getMeshHash())){
+				geom->swapMesh(src_geom);
+				result->meshes.push_back(geom);
+			}
+			if((geom->getMaterialHash() == INVALID_UID) || (geom->getMaterialHash() != src_geom->getMaterialHash())){
+				geom->swapBindMaterial(src_geom);
+				result->materials.push_back(geom);
+			}
+		}
+	}
+	return true;
+}
+
+Node* Scene::findNode(const char* name){
+	if(name == NULL){
+		return root;
+	}
+	Uid id = calcHash64(reinterpret_cast<const unsigned char*>(name));
+	return node_bank.find(id);
+}
+
+const Node* Scene::findNode(const char* name) const{
+	return const_cast<Scene*>(this)->findNode(name);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * 読み込み後も参照する文書
+ * 遅延展開するメッシュはこの文書から展開する
+ */
+class SourceDocument{
+public:
+	SourceDocument(){ dae = NULL; }
+	~SourceDocument(){
+		// collada-domは全体で1つずつしか使えない
+		if(dae){
+			ScopedLock lock(&dom_mutex);
+			dae->cleanup();
+			delete dae;
+		}
+	}
+	Mutex mutex;	// 文書からの展開は1つずつ
+	DAE* dae;	// collada-domで読み込んだ場合
+	FileStream file;
+	std::vector<unsigned char> buffer;	// 呼び出し側のストリームの複製
+	StreamDocument doc;	// file、bufferの内容を直接参照する
+};
 
 Collada::Collada(){
 	scene = NULL;
 	images = NULL;
+	index_stats.elements = 0;
+	index_stats.hits = 0;
+	index_stats.misses = 0;
+	use_cache = true;
+	use_stream = false;
+	use_lazy = false;
+	use_reload = false;
+	resolver = &file_resolver;
+	archive = NULL;
+	progress = NULL;
+	incremental = NULL;
+	source = NULL;
 }
 
 Collada::~Collada(){
+	resetIncremental();
 	cleanup();
+	if(archive){
+		delete archive;
+		archive = NULL;
+	}
 }
 
 void Collada::cleanup(){
@@ -567,9 +1431,320 @@ void Collada::cleanup(){
 		delete images;
 		images = NULL;
 	}
+	// メッシュが参照しているので最後に解放する
+	if(source){
+		delete source;
+		source = NULL;
+	}
+	filename.clear();
+	image_hashes.clear();
+}
+
+/**
+ * 遅延展開や段階的な読み込みのために文書を保持する準備
+ */
+bool Collada::createSource(){
+	if(source){
+		delete source;
+		source = NULL;
+	}
+	try{
+		source = new SourceDocument;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	return true;
 }
 
 bool Collada::load(const char* uri){
+	LoadContext context(progress);
+	resetIncremental();
+	cleanup();
+	resolver = &file_resolver;
+	if(archive){
+		delete archive;
+		archive = NULL;
+	}
+	// .zaeは中央ディレクトリだけを先に読む(キャッシュを使う場合も画像はここから開く)
+	if(isArchive(uri)){
+		try{
+			archive = new ZaeArchive;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			return false;
+		}
+		if(!archive->load(uri)){
+			delete archive;
+			archive = NULL;
+			return false;
+		}
+		resolver = archive;
+	}
+	// 有効なキャッシュがあればそれを使う
+	std::string cache;
+	if(use_cache){
+		cache.append(uri);
+		cache.append(".cache");
+		if(loadCache(uri, cache.c_str())){
+			checkProgress(LoadStage_Parse, 1, 1);
+			recordReload(uri);
+			return true;
+		}
+	}
+	if(archive){
+		if(!loadArchive(uri))
+			return false;
+	}
+	else{
+		if(use_lazy && !createSource())
+			return false;
+		if(use_stream){
+			// 遅延展開する場合は読み込み後も内容を参照するので開いたままにする
+			FileStream file;
+			FileStream* stream = source? &source->file : &file;
+			if(!stream->open(uri)){
+				Log_e("could not open %s.\n", uri);
+				cleanup();
+				return false;
+			}
+			if(!loadStream(stream, uri))
+				return false;
+		}
+		else{
+			if(!loadDae(uri, NULL))
+				return false;
+		}
+	}
+	// 遅延展開する場合は保存のために全て展開することになるので保存しない
+	if(use_cache && !use_lazy){
+		if(!saveCache(uri, cache.c_str()))
+			Log_w("could not save cache(%s).\n", cache.c_str());
+	}
+	recordReload(uri);
+	return true;
+}
+
+/**
+ * reload()のために読み込んだファイルを覚えておく
+ */
+void Collada::recordReload(const char* uri){
+	try{
+		filename.assign(uri);
+	}
+	catch(std::bad_alloc& e){
+		Log_w("could not allocate memory.\n");
+		filename.clear();
+		return;
+	}
+	if(use_reload && !hashImages(&image_hashes))
+		image_hashes.clear();
+}
+
+/**
+ * 画像の内容のハッシュ
+ * 開けない画像はINVALID_UID
+ */
+bool Collada::hashImages(std::vector<Uid>* hashes) const{
+	hashes->clear();
+	if(!images)
+		return true;
+	try{
+		hashes->resize(images->getImages()->size(), INVALID_UID);
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	for(size_t i = 0; i < hashes->size(); i++){
+		Stream* stream = openImage(i);
+		if(!stream)
+			continue;
+		// 直接参照できれば複製しない
+		const unsigned char* data = stream->getData();
+		const size_t size = static_cast<size_t>(stream->getSize());
+		std::vector<unsigned char> buffer;
+		if(!data && (size > 0)){
+			if(!readStream(stream, &buffer)){
+				delete stream;
+				continue;
+			}
+			data = &buffer[0];
+		}
+		(*hashes)[i] = calcHash64(data, size);
+		delete stream;
+	}
+	return true;
+}
+
+/**
+ * 最後にファイルから読み込んだ文書を読み直し、内容の変わったメッシュとマテリアルだけを差し替える
+ * 変更は要素ごとのハッシュで検出し、collada-domやキャッシュから読んだ直後は全て変わったものとみなす
+ * ノードの構成や画像の一覧が変わっていれば全体を入れ替える
+ * 読み直せなければ現在の内容を残してfalse、描画と同時には呼ばない
+ */
+bool Collada::reload(ReloadResult* result){
+	ReloadResult ignored;
+	if(!result)
+		result = &ignored;
+	result->meshes.clear();
+	result->materials.clear();
+	result->images.clear();
+	result->rebuilt = false;
+	if(filename.empty() || !scene || !images){
+		Log_e("nothing to reload.\n");
+		return false;
+	}
+	// 新しい内容は遅延展開で読み、変わったメッシュだけを展開する
+	Collada fresh;
+	fresh.setCacheEnabled(false);
+	fresh.setStreamEnabled(true);
+	fresh.setLazyEnabled(true);
+	fresh.setProgress(progress);
+	if(!fresh.load(filename.c_str())){
+		Log_e("could not reload %s.\n", filename.c_str());
+		return false;
+	}
+	const bool same_images = (*images->getPath() == *fresh.images->getPath()) && (*images->getImages() == *fresh.images->getImages());
+	if(!same_images || !scene->patch(fresh.scene, result)){
+		// 全体を入れ替える
+		if(!use_lazy && !fresh.scene->prefetch())
+			Log_w("could not decode some geometries.\n");
+		std::swap(scene, fresh.scene);
+		std::swap(images, fresh.images);
+		std::swap(source, fresh.source);
+		std::swap(archive, fresh.archive);
+		resolver = archive? static_cast<Resolver*>(archive) : &file_resolver;
+		result->rebuilt = true;
+	}
+	// 画像
+	if(use_reload){
+		std::vector<Uid> hashes;
+		if(hashImages(&hashes)){
+			for(size_t i = 0; i < hashes.size(); i++){
+				if(result->rebuilt || (i >= image_hashes.size()) || (hashes[i] != image_hashes[i]))
+					result->images.push_back(i);
+			}
+			image_hashes.swap(hashes);
+		}
+	}
+	return true;
+}
+
+/**
+ * メモリ上の文書を読み込む
+ * uriは画像や外部の文書の位置の基準、resolverがNULLならファイルとして開く
+ */
+bool Collada::load(const void* data, size_t size, const char* uri, Resolver* resolver){
+	MemoryStream stream(data, size);
+	return load(&stream, uri, resolver);
+}
+
+/**
+ * ストリームから読み込む
+ * collada-domを介さない場合、内容を直接参照できるストリームは複製しない
+ * 元のファイルの更新を検出できないのでキャッシュは使わない
+ */
+bool Collada::load(Stream* stream, const char* uri, Resolver* resolver){
+	LoadContext context(progress);
+	resetIncremental();
+	cleanup();
+	this->resolver = resolver? resolver : &file_resolver;
+	if(use_lazy && !createSource())
+		return false;
+	if(use_stream){
+		if(!source)
+			return loadStream(stream, uri);
+		// 遅延展開する場合は読み込み後も内容を参照するので複製する
+		if(!readStream(stream, &source->buffer)){
+			Log_e("could not read %s.\n", uri);
+			cleanup();
+			return false;
+		}
+		MemoryStream copy(source->buffer.empty()? NULL : &source->buffer[0], source->buffer.size());
+		return loadStream(&copy, uri);
+	}
+	// collada-domは終端された文字列を要求するので複製する
+	std::vector<unsigned char> buffer;
+	if(!readStream(stream, &buffer)){
+		Log_e("could not read %s.\n", uri);
+		return false;
+	}
+	try{
+		buffer.push_back('\0');
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	return loadDae(uri, reinterpret_cast<const char*>(&buffer[0]));
+}
+
+/**
+ * .zaeの最初の文書を展開しながら読み込む
+ */
+bool Collada::loadArchive(const char* uri){
+	std::string root;
+	if(!archive->getRoot(&root)){
+		Log_e("could not find document in %s.\n", uri);
+		return false;
+	}
+	Stream* stream = archive->open(root.c_str());
+	if(!stream)
+		return false;
+	const bool result = load(stream, root.c_str(), archive);
+	delete stream;
+	return result;
+}
+
+/**
+ * index番目の画像を開く
+ * 呼び出し側でdeleteする
+ */
+Stream* Collada::openImage(size_t index) const{
+	if(!images || (index >= images->getImages()->size()))
+		return NULL;
+	// 埋め込まれた画像は複製して渡す(16進数字のままならここで変換する)
+	if(images->isEmbedded(index)){
+		std::vector<unsigned char> buffer;
+		BufferStream* stream = NULL;
+		try{
+			if(!images->getEmbedded(index, &buffer))
+				return NULL;
+			stream = new BufferStream(&buffer);
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			return NULL;
+		}
+		return stream;
+	}
+	std::string filename(*images->getPath());
+	filename.append((*images->getImages())[index]);
+	return resolver->open(filename.c_str());
+}
+
+/**
+ * index番目の画像をファイルとして直接読める場合はそのパスを返す
+ * .zaeの中や呼び出し側のResolverから開く場合はfalse
+ */
+bool Collada::getImageFile(size_t index, std::string* filename) const{
+	if(!images || (index >= images->getImages()->size()) || (resolver != &file_resolver) || images->isEmbedded(index))
+		return false;
+	filename->assign(*images->getPath());
+	filename->append((*images->getImages())[index]);
+	return true;
+}
+
+/**
+ * collada-domで読み込む
+ * bufferがNULLならuriのファイルを読む
+ */
+bool Collada::loadDae(const char* uri, const char* buffer){
+	ScopedLock lock(&dom_mutex);
+	LoadContext* context = LoadContext::get();
 	// DAEの生成と読み込み
 	DAE* dae;
 	try{
@@ -579,25 +1754,47 @@ bool Collada::load(const char* uri){
 		Log_e("could not allocate memory.\n");
 		return false;
 	}
-	if(dae->load(uri) != DAE_OK){
+	checkProgress(LoadStage_Parse, 0, 1);
+	const bool loaded = buffer? (dae->openFromMemory(uri, buffer) != NULL) : (dae->load(uri) == DAE_OK);
+	if(!loaded){
 		Log_e("could not load DAE.\n");
 		dae->cleanup();
 		delete dae;
 		return false;
 	}
+	if(!checkProgress(LoadStage_Parse, 1, 1)){
+		Log_i("canceled.\n");
+		dae->cleanup();
+		delete dae;
+		return false;
+	}
 
-	path.clear();
-	getFilePath(&path, uri);
+	context->path.clear();
+	getFilePath(&context->path, uri);
 
 	// 各種読み込み	
 	daeDatabase* dae_db = dae->getDatabase();
+	// IDの索引
+	IdIndex index;
+	if(!index.build(dae_db)){
+		Log_e("could not build IdIndex.\n");
+		dae->cleanup();
+		delete dae;
+		context->path.clear();
+		return false;
+	}
+	context->id_index = &index;
+	// 遅延展開は文書ごとのロックで1つずつ行い、DOMを読む間だけdom_mutexを取る
+	context->lazy_mutex = source? &source->mutex : NULL;
 	// <library_images>
 	if(!loadLibraryImages(dae_db)){
 		Log_e("could not load LibraryImages.\n");
 		dae->cleanup();
 		delete dae;
 		cleanup();
-		path.clear();
+		context->path.clear();
+		context->id_index = NULL;
+		context->lazy_mutex = NULL;
 		return false;
 	}
 #ifdef DEBUG
@@ -611,10 +1808,72 @@ bool Collada::load(const char* uri){
 		dae->cleanup();
 		delete dae;
 		cleanup();
-		path.clear();
+		context->path.clear();
+		context->id_index = NULL;
+		context->lazy_mutex = NULL;
 		return false;
 	}
-	path.clear();
+	index_stats = index.getStats();
+	// 毎回の数値はgetIndexStats()で取れる、ログはLOG_I_ENABLEで止められる
+	Log_i("IdIndex: %u elements, %u hits, %u misses\n",
+		static_cast<unsigned int>(index_stats.elements),
+		static_cast<unsigned int>(index_stats.hits),
+		static_cast<unsigned int>(index_stats.misses));
+	context->path.clear();
+	context->id_index = NULL;
+	context->lazy_mutex = NULL;
+	// 遅延展開しなければ文書は不要
+	if(source){
+		source->dae = dae;
+	}
+	else{
+		dae->cleanup();
+		delete dae;
+	}
+	return true;
+}
+
+/**
+ * collada-domを介さずに読み込む
+ * 必要な要素だけを持つ軽量な文書を作る
+ */
+bool Collada::loadStream(Stream* stream, const char* uri){
+	LoadContext* context = LoadContext::get();
+	// 遅延展開する場合は読み込み後も保持する
+	StreamDocument local_doc;
+	StreamDocument* doc = source? &source->doc : &local_doc;
+	if(!doc->load(stream, uri, resolver)){
+		Log_e("could not parse %s.\n", uri);
+		cleanup();
+		return false;
+	}
+
+	context->path.clear();
+	getFilePath(&context->path, uri);
+
+	// <library_images>
+	if(!loadLibraryImages(doc)){
+		Log_e("could not load LibraryImages.\n");
+		cleanup();
+		context->path.clear();
+		return false;
+	}
+#ifdef DEBUG
+	if(images){
+		images->dump();
+	}
+#endif
+	// <scene>
+	context->lazy_mutex = source? &source->mutex : NULL;
+	const bool loaded = loadScene(doc);
+	context->lazy_mutex = NULL;
+	if(!loaded){
+		Log_e("could not load Scene.\n");
+		cleanup();
+		context->path.clear();
+		return false;
+	}
+	context->path.clear();
 	return true;
 }
 
@@ -641,6 +1900,28 @@ bool Collada::loadLibraryImages(daeDatabase* dae_db){
 	return true;
 }
 
+bool Collada::loadLibraryImages(StreamDocument* doc){
+	StreamElement* stream_lib_images = doc->findElement("library_images");
+	if(!stream_lib_images){
+		Log_e("element <library_images> not found.\n");
+		return false;
+	}
+	try{
+		images = new Images;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	if(!images->load(stream_lib_images)){
+		Log_e("could not load Images.\n");
+		delete images;
+		images = NULL;
+		return false;
+	}
+	return true;
+}
+
 bool Collada::loadScene(daeDatabase* dae_db){
 	// <scene>
 	domCOLLADA::domScene* dom_scene;
@@ -656,7 +1937,7 @@ bool Collada::loadScene(daeDatabase* dae_db){
 	}
 	const char* url = dom_iwe->getUrl().fragment().c_str();
 	domVisual_scene* dom_vis_scn;
-	if(dae_db->getElement((daeElement**)&dom_vis_scn, 0, url, "visual_scene") != DAE_OK){
+	if(getElement((daeElement**)&dom_vis_scn, dae_db, url, "visual_scene") != DAE_OK){
 		Log_e("elemnt <visual_scene> %s not found.\n", url);
 		return false;
 	}
@@ -677,4 +1958,190 @@ bool Collada::loadScene(daeDatabase* dae_db){
 	return true;
 }
 
+/**
+ * <visual_scene>を探してSceneの読み込みを始める
+ */
+bool Collada::beginScene(StreamDocument* doc){
+	// <scene>
+	StreamElement* stream_scene = doc->findElement("scene");
+	if(!stream_scene){
+		Log_e("element <scene> not found.\n");
+		return false;
+	}
+	StreamElement* stream_iwe = stream_scene->getChild("instance_visual_scene");
+	if(!stream_iwe){
+		Log_e("failed to get.\n");
+		return false;
+	}
+	const char* uri = stream_iwe->getAttribute("url");
+	const char* url = getFragment(uri);
+	StreamElement* stream_vis_scn = doc->resolve(uri, "visual_scene");
+	if(!stream_vis_scn){
+		Log_e("elemnt <visual_scene> %s not found.\n", url);
+		return false;
+	}
+
+	try{
+		scene = new Scene;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	if(!scene->begin(stream_vis_scn)){
+		Log_e("could not load Scene.\n");
+		delete scene;
+		scene = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool Collada::loadScene(StreamDocument* doc){
+	if(!beginScene(doc))
+		return false;
+	bool done;
+	if(!scene->step(0, &done)){
+		Log_e("could not load Scene.\n");
+		delete scene;
+		scene = NULL;
+		return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * 段階的な読み込みの途中状態
+ */
+class IncrementalLoad{
+public:
+	typedef enum{
+		Phase_Parse,
+		Phase_Images,
+		Phase_Scene
+	}Phase;
+public:
+	std::string uri;
+	std::string path;	// 読み込み中の作業用パス
+	Phase phase;
+	bool lazy;	// 読み込み後も文書を保持して遅延展開する
+};
+
+void Collada::resetIncremental(){
+	if(incremental){
+		delete incremental;
+		incremental = NULL;
+	}
+}
+
+/**
+ * 段階的な読み込みの開始
+ * 読み込み用のスレッドを使えない環境向けで、step()を毎フレーム呼んで少しずつ読み込む
+ * collada-domを介さずに読み込み、キャッシュは使わない
+ */
+bool Collada::begin(const char* uri){
+	LoadContext context(progress);
+	resetIncremental();
+	cleanup();
+	resolver = &file_resolver;
+	if(archive){
+		delete archive;
+		archive = NULL;
+	}
+	try{
+		incremental = new IncrementalLoad;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	// 文書は解析の途中状態ごと保持する
+	if(!createSource()){
+		resetIncremental();
+		return false;
+	}
+	if(!source->file.open(uri)){
+		Log_e("could not open %s.\n", uri);
+		cleanup();
+		resetIncremental();
+		return false;
+	}
+	if(!source->doc.begin(&source->file, uri, resolver)){
+		Log_e("could not parse %s.\n", uri);
+		cleanup();
+		resetIncremental();
+		return false;
+	}
+	getFilePath(&incremental->path, uri);
+	incremental->phase = IncrementalLoad::Phase_Parse;
+	incremental->lazy = use_lazy;
+	try{
+		incremental->uri.assign(uri);
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		cleanup();
+		resetIncremental();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * 読み込みをおよそbudget_usマイクロ秒だけ進める
+ * 文書の解析は字句単位、シーンはノードと<instance_geometry>単位で区切る
+ * 読み込み済みの部分はgetScene()から描画できる
+ * 完了すればdoneをtrueにする、失敗すればそれまでに読み込んだ分も解放してfalse
+ */
+bool Collada::step(unsigned int budget_us, bool* done){
+	*done = false;
+	if(!incremental){
+		Log_e("not loading.\n");
+		return false;
+	}
+	LoadContext context(progress);
+	const unsigned long long deadline = getMicroseconds() + budget_us;
+	context.path = incremental->path;
+	context.lazy_mutex = incremental->lazy? &source->mutex : NULL;
+	bool result = true;
+	do{
+		switch(incremental->phase){
+		case IncrementalLoad::Phase_Parse:{
+			bool parsed;
+			result = source->doc.parse(deadline, &parsed);
+			if(result && parsed)
+				incremental->phase = IncrementalLoad::Phase_Images;
+			break;
+		}
+		case IncrementalLoad::Phase_Images:
+			// <library_images>と<scene>の準備は短いので区切らない
+			result = loadLibraryImages(&source->doc) && beginScene(&source->doc);
+			if(result)
+				incremental->phase = IncrementalLoad::Phase_Scene;
+			break;
+		case IncrementalLoad::Phase_Scene:
+			result = scene->step(deadline, done);
+			break;
+		}
+	}while(result && !*done && (getMicroseconds() < deadline));
+	if(!result){
+		Log_e("could not load %s.\n", source->doc.getRoot()? "Scene" : "document");
+		cleanup();
+		resetIncremental();
+		return false;
+	}
+	if(*done){
+		// 遅延展開しなければ文書はもう参照しない
+		if(!incremental->lazy){
+			delete source;
+			source = NULL;
+		}
+		recordReload(incremental->uri.c_str());
+		resetIncremental();
+	}
+	return true;
+}
+
 } // namespace collada
@@ -1,22 +1,42 @@
 ﻿#pragma once
 #include <dae.h>
 #include <dom/domCOLLADA.h>
+#include <deque>
 #include <vector>
+#include <map>
 #include "collada_def.h"
 #include "collada_util.h"
 #include "collada_geometry.h"
+#include "collada_index.h"
+#include "collada_io.h"
 #include "matrix.h"
 #include "vector.h"
 
 namespace collada{
 
+/**
+ * reload()で差し替えたもの
+ * 描画側はここに挙がったものの資源だけを作り直せばよい
+ */
+typedef struct{
+	GeometryPtrArray meshes;	// メッシュを差し替えたGeometry
+	GeometryPtrArray materials;	// <bind_material>を差し替えたGeometry
+	std::vector<size_t> images;	// 内容が変わった画像(Images::getImages()の添字)
+	bool rebuilt;	// 構成が変わったので全体を入れ替えた(以前のポインタは全て無効)
+}ReloadResult;
+
 class Node{
 friend class NodeBank;
+friend class Scene;
 public:
 	Node();
 	~Node();
 	void cleanup();
 	bool load(domNode* dom_node);
+	bool load(const StreamElement* stream_node);
+	bool load(CacheReader* reader);
+	bool save(CacheWriter* writer) const;
+	bool prefetch() const;
 	Node* getNext(){ return next; };
 	const Node* getNext() const { return next; }
 	void addSibling(Node* sibling);
@@ -35,7 +55,10 @@ private:
 	void load(float*, const domScale*);
 	void load(float*, const domSkew*);
 	void load(float*, const domTranslate*);
-#ifdef DEBUG
+	void transform(TransformationElementType type, const float* values);
+	bool loadTransform(const StreamElement* stream_node);
+	bool loadGeometry(const StreamElement* stream_inst_geom);
+#if defined(DEBUG) || defined(VALIDATE_UID)
 public:
 	std::string name;	// for debug
 #endif
@@ -43,29 +66,35 @@ private:
 	Node* sibling;
 	Node* child;
 	Node* next;
-	unsigned int uid;
+	Uid uid;
 	GeometryPtrArray geometries;
 	mathematics::Matrix44 local_to_world;
 	mathematics::Matrix44 current;
 };
 
+/**
+ * Nodeの格納庫
+ * 登録数に応じて拡張するのでNodeのアドレスは変わらない
+ */
 class NodeBank{
 public:
 	NodeBank();
 	~NodeBank();
 	bool alloc(size_t size);
 	void free();
-	Node* create(unsigned int uid);
-	Node* find(unsigned int uid);
+	Node* create(Uid uid);
+	Node* find(Uid uid);
+	size_t getCount() const { return count; }
 private:
-	unsigned int getHash(unsigned int uid){
-		return uid % size;
+	unsigned int getHash(Uid uid) const {
+		return static_cast<unsigned int>(uid % size);
 	}
-	unsigned int findFirstKey(unsigned int startIndex, unsigned int key);
-	Node* addNode(unsigned int uid);
+	unsigned int findSlot(Uid uid) const;
+	bool rehash(size_t capacity);
 private:
 	size_t size;
-	Node* nodes;
+	size_t count;
+	Node** nodes;
 };
 
 class Scene{
@@ -74,13 +103,42 @@ public:
 	~Scene();
 	void cleanup();
 	bool load(domVisual_scene* dom_visual_scene);
+	bool load(const StreamElement* stream_visual_scene);
+	bool load(CacheReader* reader);
+	bool save(CacheWriter* writer) const;
+	bool begin(const StreamElement* stream_visual_scene);
+	bool step(unsigned long long deadline, bool* done);
+	bool prefetch() const;
+	bool patch(Scene* other, ReloadResult* result);
 	Node* findNode(const char* name = NULL);
 	const Node* findNode(const char* name = NULL) const;
 private:
+	typedef enum{
+		Task_Node,
+		Task_InstanceNode,
+		Task_Geometry,
+		Task_Count
+	}TaskType;
+	typedef struct{
+		TaskType type;
+		const StreamElement* element;
+		const char* parent;	// 名前に付ける親の名前(NULLなら付けない)
+		Node* node;	// <instance_geometry>の格納先
+	}Task;
+	bool push(TaskType type, const StreamElement* element, const char* parent, Node* node);
+	bool run(const Task& task);
 	bool load(daeDatabase* dae_db, domNode* dom_node, const char* parent);
 	bool load(daeDatabase* dae_db, domInstance_node* dom_inst_node, const char* parent);
+	domNode* findNode(daeDatabase* dae_db, domInstance_node* dom_inst_node);
+	bool load(const StreamElement* stream_node, const char* parent);
+	bool instantiate(const StreamElement* stream_inst_node, const char* parent);
 	NodeBank node_bank;
 	Node* root;
+	std::map<std::string, domNode*> node_cache;	// <instance_node>のURL解決結果(読み込み中のみ)
+	std::vector<Task> tasks;	// 未処理のノード(読み込み中のみ)
+	std::deque<std::string> names;	// Task::parentの実体(読み込み中のみ)
+	size_t task_count;	// 処理済みの数
+	unsigned long long task_costs[Task_Count];	// 種類ごとの直近の処理時間(マイクロ秒)
 };
 
 class Images{
@@ -88,15 +146,24 @@ public:
 	Images();
 	~Images();
 	bool load(const domLibrary_images*);
+	bool load(const StreamElement* stream_lib_images);
+	bool load(CacheReader* reader);
+	bool save(CacheWriter* writer) const;
 	void cleanup();
 #ifdef DEBUG
 	void dump();
 #endif
 	const std::string* getPath() const { return &path; }
 	const StringArray* getImages() const { return &images; }
+	bool isEmbedded(size_t index) const { return !embedded[index].empty() || !embedded_data[index].empty(); }
+	bool getEmbedded(size_t index, std::vector<unsigned char>* output) const;
+private:
+	bool validate();
 private:
 	std::string path;
 	StringArray images;
+	StringArray embedded;	// <data>の16進数字のまま(collada-domを介さずに読んだ場合)、それ以外は空
+	std::vector<std::vector<unsigned char> > embedded_data;	// 変換済みの<data>(collada-domかキャッシュから読んだ場合)、それ以外は空
 };
 
 class Collada{
@@ -104,15 +171,53 @@ public:
 	Collada();
 	~Collada();
 	bool load(const char* uri);
+	bool reload(ReloadResult* result = NULL);
+	bool load(const void* data, size_t size, const char* uri, Resolver* resolver = NULL);
+	bool load(Stream* stream, const char* uri, Resolver* resolver = NULL);
+	bool begin(const char* uri);
+	bool step(unsigned int budget_us, bool* done);
+	Stream* openImage(size_t index) const;
+	bool getImageFile(size_t index, std::string* filename) const;
+	void setCacheEnabled(bool enable){ use_cache = enable; }
+	void setStreamEnabled(bool enable){ use_stream = enable; }
+	void setLazyEnabled(bool enable){ use_lazy = enable; }
+	void setReloadEnabled(bool enable){ use_reload = enable; }
+	void setProgress(LoadProgress* progress){ this->progress = progress; }
 	const Scene* getScene() const { return scene; }
 	const Images* getImages() const { return images; }
+	const IdIndex::Stats& getIndexStats() const { return index_stats; }
 private:
+	bool loadArchive(const char* uri);
+	bool loadDae(const char* uri, const char* buffer);
+	bool loadStream(Stream* stream, const char* uri);
 	bool loadLibraryImages(daeDatabase*);
+	bool loadLibraryImages(StreamDocument*);
 	bool loadScene(daeDatabase*);
+	bool loadScene(StreamDocument*);
+	bool beginScene(StreamDocument*);
+	void resetIncremental();
+	bool createSource();
+	void recordReload(const char* uri);
+	bool hashImages(std::vector<Uid>* hashes) const;
+	bool loadCache(const char* uri, const char* filename);
+	bool saveCache(const char* uri, const char* filename) const;
 private:
 	void cleanup();
 	Scene* scene;
 	Images* images;
+	bool use_cache;	// 読み込み結果を"<uri>.cache"に保存して次回から利用する
+	bool use_stream;	// collada-domを介さずに直接読み込む
+	bool use_lazy;	// メッシュは初めて参照された時に展開する
+	bool use_reload;	// reload()で画像の内容の変化も検出する(読み込み時に画像を読んでハッシュを記録する)
+	IdIndex::Stats index_stats;	// 直近の読み込みでの索引の利用状況
+	Resolver* resolver;	// 画像と外部の文書を開く(呼び出し側の所有)
+	FileResolver file_resolver;
+	ZaeArchive* archive;	// .zaeを読み込んだ場合、画像もここから開く
+	LoadProgress* progress;	// 進捗の通知と中断(呼び出し側の所有)
+	IncrementalLoad* incremental;	// 段階的な読み込みの途中状態
+	SourceDocument* source;	// 読み込み後も参照する文書(遅延展開と段階的な読み込み)
+	std::string filename;	// reload()で読み直すファイル
+	std::vector<Uid> image_hashes;	// 画像の内容のハッシュ(use_reloadの場合)
 };
 
 } // namespace collada
\ No newline at end of file
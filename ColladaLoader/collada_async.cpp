@@ -0,0 +1,308 @@
+﻿#include <new>
+#include "collada.h"
+#include "collada_async.h"
+#include "collada_context.h"
+#include "log.h"
+
+namespace collada{
+
+////////////////////////////////////////////////////////////////////////////////
+
+LoadProgress::LoadProgress(LoadListener* listener){
+	this->listener = listener;
+	canceled = false;
+	for(int i = 0; i < LoadStage_Count; i++)
+		counts[i] = 0;
+}
+
+void LoadProgress::cancel(){
+	ScopedLock lock(&mutex);
+	canceled = true;
+}
+
+bool LoadProgress::isCanceled() const{
+	ScopedLock lock(&mutex);
+	return canceled;
+}
+
+void LoadProgress::report(LoadStage stage, unsigned long long done, unsigned long long total){
+	if(listener)
+		listener->onProgress(stage, done, total);
+}
+
+/**
+ * 総数の分からない段階を1つ進める
+ */
+void LoadProgress::step(LoadStage stage){
+	unsigned long long done;
+	{
+		ScopedLock lock(&mutex);
+		done = ++counts[stage];
+	}
+	report(stage, done, 0);
+}
+
+bool checkProgress(LoadStage stage, unsigned long long done, unsigned long long total){
+	const LoadContext* context = LoadContext::get();
+	if(!context || !context->progress)
+		return true;
+	context->progress->report(stage, done, total);
+	return !context->progress->isCanceled();
+}
+
+bool checkProgress(LoadStage stage){
+	const LoadContext* context = LoadContext::get();
+	if(!context || !context->progress)
+		return true;
+	context->progress->step(stage);
+	return !context->progress->isCanceled();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+AsyncLoader::AsyncLoader(){
+	state = State_Idle;
+	progress = NULL;
+	result = NULL;
+	use_cache = true;
+	use_stream = false;
+}
+
+/**
+ * 読み込み中なら中断して終了を待つ
+ */
+AsyncLoader::~AsyncLoader(){
+	cancel();
+	thread.join();
+	cleanup();
+}
+
+void AsyncLoader::cleanup(){
+	if(result){
+		delete result;
+		result = NULL;
+	}
+	if(progress){
+		delete progress;
+		progress = NULL;
+	}
+	uri.clear();
+	state = State_Idle;
+}
+
+/**
+ * 読み込みを開始する
+ * listenerは読み込みが終わるまで有効である必要がある
+ */
+bool AsyncLoader::start(const char* uri, LoadListener* listener){
+	if(getState() == State_Loading){
+		Log_e("already loading.\n");
+		return false;
+	}
+	thread.join();
+	ScopedLock lock(&mutex);
+	cleanup();
+	try{
+		progress = new LoadProgress(listener);
+		this->uri.assign(uri);
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		cleanup();
+		return false;
+	}
+	state = State_Loading;
+	if(!thread.start(run, this)){
+		cleanup();
+		state = State_Failed;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * 中断を要求する
+ * 読み込み中の各段階の区切りで検査され、途中まで読んだ分は解放される
+ */
+void AsyncLoader::cancel(){
+	ScopedLock lock(&mutex);
+	if(progress)
+		progress->cancel();
+}
+
+/**
+ * 完了まで待つ
+ * 読み込めた場合はtrue
+ */
+bool AsyncLoader::wait(){
+	thread.join();
+	return getState() == State_Done;
+}
+
+AsyncLoader::State AsyncLoader::getState() const{
+	ScopedLock lock(&mutex);
+	return state;
+}
+
+/**
+ * 読み込んだColladaを受け取る
+ * 完了していなければNULL、受け取った側でdeleteする
+ */
+Collada* AsyncLoader::detach(){
+	ScopedLock lock(&mutex);
+	if(state != State_Done)
+		return NULL;
+	Collada* collada = result;
+	result = NULL;
+	return collada;
+}
+
+void AsyncLoader::run(void* arg){
+	AsyncLoader* loader = static_cast<AsyncLoader*>(arg);
+	Collada* collada;
+	try{
+		collada = new Collada;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		ScopedLock lock(&loader->mutex);
+		loader->state = State_Failed;
+		return;
+	}
+	collada->setCacheEnabled(loader->use_cache);
+	collada->setStreamEnabled(loader->use_stream);
+	collada->setProgress(loader->progress);
+	bool loaded = collada->load(loader->uri.c_str());
+	collada->setProgress(NULL);
+	const bool canceled = loader->progress->isCanceled();
+	if(!loaded || canceled){
+		delete collada;
+		collada = NULL;
+		loaded = false;
+	}
+	// 完了した時点でまとめて公開する
+	ScopedLock lock(&loader->mutex);
+	loader->result = collada;
+	loader->state = loaded? State_Done : (canceled? State_Canceled : State_Failed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BatchLoader::BatchLoader() : progress(NULL){
+	next_index = 0;
+	use_cache = true;
+	use_stream = true;
+	use_lazy = false;
+}
+
+BatchLoader::~BatchLoader(){
+	cleanup();
+}
+
+void BatchLoader::cleanup(){
+	for(std::vector<Collada*>::iterator it = results.begin(); it != results.end(); it++)
+		delete *it;
+	results.clear();
+	uris.clear();
+	next_index = 0;
+}
+
+/**
+ * uris[0]～uris[count-1]を読み込み、全て終わるまで待つ
+ * thread_countが0ならプロセッサの数だけスレッドを使う
+ * 全て読み込めた場合はtrue、個々の結果はdetach()で受け取る
+ */
+bool BatchLoader::load(const char* const* uris, size_t count, unsigned int thread_count){
+	cleanup();
+	if(thread_count == 0)
+		thread_count = getProcessorCount();
+	if(thread_count > count)
+		thread_count = static_cast<unsigned int>(count);
+	Thread* threads = NULL;
+	try{
+		this->uris.assign(uris, uris + count);
+		results.assign(count, NULL);
+		if(thread_count > 1)
+			threads = new Thread[thread_count - 1];
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		cleanup();
+		return false;
+	}
+	// 1つは呼び出したスレッドで読み込む
+	for(unsigned int i = 0; i + 1 < thread_count; i++){
+		if(!threads[i].start(run, this))
+			break;
+	}
+	run(this);
+	delete[] threads;
+	bool result = true;
+	for(size_t i = 0; i < count; i++){
+		if(!results[i]){
+			Log_e("could not load %s.\n", uris[i]);
+			result = false;
+		}
+	}
+	return result;
+}
+
+/**
+ * 中断を要求する
+ * 読み込み中の文書は各段階の区切りで中断され、未着手の文書は読み込まない
+ */
+void BatchLoader::cancel(){
+	progress.cancel();
+}
+
+/**
+ * 読み込んだColladaを受け取る
+ * 読み込めなかった場合はNULL、受け取った側でdeleteする
+ */
+Collada* BatchLoader::detach(size_t index){
+	if(index >= results.size())
+		return NULL;
+	Collada* collada = results[index];
+	results[index] = NULL;
+	return collada;
+}
+
+/**
+ * 次に読み込む文書を取り出す
+ */
+bool BatchLoader::next(size_t* index){
+	ScopedLock lock(&mutex);
+	if(next_index >= uris.size() || progress.isCanceled())
+		return false;
+	*index = next_index++;
+	return true;
+}
+
+void BatchLoader::run(void* arg){
+	BatchLoader* loader = static_cast<BatchLoader*>(arg);
+	size_t index;
+	while(loader->next(&index)){
+		Collada* collada;
+		try{
+			collada = new Collada;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			continue;
+		}
+		collada->setCacheEnabled(loader->use_cache);
+		collada->setStreamEnabled(loader->use_stream);
+		collada->setLazyEnabled(loader->use_lazy);
+		collada->setProgress(&loader->progress);
+		const bool loaded = collada->load(loader->uris[index].c_str());
+		collada->setProgress(NULL);
+		if(!loaded || loader->progress.isCanceled()){
+			delete collada;
+			continue;
+		}
+		// 要素ごとに別のスレッドが書き込むだけなのでロックは要らない
+		loader->results[index] = collada;
+	}
+}
+
+} // namespace collada
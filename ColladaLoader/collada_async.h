@@ -0,0 +1,121 @@
+﻿/**
+ * 非同期の読み込み
+ * 別スレッドでColladaを読み込み、完了した時点でまとめて受け渡す
+ * 進捗は段階ごとに通知し、中断は各段階の区切りで検査する
+ * BatchLoaderは複数の文書を複数のスレッドで並行して読み込む
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include "thread.h"
+
+namespace collada{
+
+class Collada;
+
+typedef enum{
+	LoadStage_Parse,	// 文書の解析(キャッシュの読み込みを含む)
+	LoadStage_Scene,	// <visual_scene>直下のノード
+	LoadStage_Geometry,	// <instance_geometry>
+	LoadStage_Material,	// <instance_material>
+	LoadStage_Image,	// <image>
+	LoadStage_Count
+}LoadStage;
+
+/**
+ * 進捗の通知先
+ * 読み込みを行うスレッドから呼ばれる
+ */
+class LoadListener{
+public:
+	virtual ~LoadListener(){}
+	// totalが0なら総数は不明
+	virtual void onProgress(LoadStage stage, unsigned long long done, unsigned long long total) = 0;
+};
+
+/**
+ * 読み込み1回分の進捗と中断要求
+ */
+class LoadProgress{
+public:
+	explicit LoadProgress(LoadListener* listener);
+	void cancel();
+	bool isCanceled() const;
+	void report(LoadStage stage, unsigned long long done, unsigned long long total);
+	void step(LoadStage stage);
+private:
+	mutable Mutex mutex;
+	LoadListener* listener;
+	bool canceled;
+	unsigned long long counts[LoadStage_Count];	// step()で進めた数
+};
+
+// 読み込み中の進捗を通知し、中断が要求されていればfalse
+bool checkProgress(LoadStage stage, unsigned long long done, unsigned long long total);
+bool checkProgress(LoadStage stage);
+
+class AsyncLoader{
+public:
+	typedef enum{
+		State_Idle,
+		State_Loading,
+		State_Done,
+		State_Failed,
+		State_Canceled
+	}State;
+public:
+	AsyncLoader();
+	~AsyncLoader();
+	bool start(const char* uri, LoadListener* listener = NULL);
+	void cancel();
+	bool wait();
+	State getState() const;
+	Collada* detach();
+	void setCacheEnabled(bool enable){ use_cache = enable; }
+	void setStreamEnabled(bool enable){ use_stream = enable; }
+private:
+	static void run(void* arg);
+	void cleanup();
+private:
+	Thread thread;
+	mutable Mutex mutex;
+	State state;
+	std::string uri;
+	LoadProgress* progress;
+	Collada* result;	// 完了するまではNULL
+	bool use_cache;
+	bool use_stream;
+};
+
+/**
+ * 複数の文書の並行読み込み
+ * 各スレッドが未着手の文書を順に取り出して読み込む
+ * collada-domを使う読み込みは1つずつしか進まないので、既定ではcollada-domを介さずに読む
+ */
+class BatchLoader{
+public:
+	BatchLoader();
+	~BatchLoader();
+	void cleanup();
+	bool load(const char* const* uris, size_t count, unsigned int thread_count = 0);
+	void cancel();
+	size_t getCount() const { return results.size(); }
+	Collada* detach(size_t index);
+	void setCacheEnabled(bool enable){ use_cache = enable; }
+	void setStreamEnabled(bool enable){ use_stream = enable; }
+	void setLazyEnabled(bool enable){ use_lazy = enable; }
+private:
+	static void run(void* arg);
+	bool next(size_t* index);
+private:
+	Mutex mutex;
+	LoadProgress progress;	// 全ての文書で共有する(中断要求のみに使う)
+	std::vector<std::string> uris;
+	std::vector<Collada*> results;	// 読み込めなかった文書はNULL
+	size_t next_index;	// 次に読み込む文書
+	bool use_cache;
+	bool use_stream;	// falseにするとcollada-domの読み込みが直列になる
+	bool use_lazy;
+};
+
+} // namespace collada
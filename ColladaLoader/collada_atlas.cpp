@@ -0,0 +1,218 @@
+﻿#include <string.h>
+#include <algorithm>
+#include <new>
+#include <set>
+#include "collada.h"
+#include "collada_atlas.h"
+#include "log.h"
+
+namespace collada{
+
+TextureAtlas::TextureAtlas(){
+}
+
+TextureAtlas::~TextureAtlas(){
+	cleanup();
+}
+
+void TextureAtlas::cleanup(){
+	pages.clear();
+	regions.clear();
+}
+
+/**
+ * loaderで展開したテクスチャからアトラスを作る
+ * キャッシュに移したものと圧縮したものは含めない
+ */
+bool TextureAtlas::build(const TextureLoader* loader, unsigned int threshold, unsigned int page_size, unsigned int padding){
+	std::vector<const Texture*> textures;
+	try{
+		for(size_t i = 0; i < loader->getCount(); i++)
+			textures.push_back(loader->getTexture(i));
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		cleanup();
+		return false;
+	}
+	if(textures.empty()){
+		cleanup();
+		return true;
+	}
+	return build(&textures[0], textures.size(), threshold, page_size, padding);
+}
+
+/**
+ * 幅と高さがthreshold以下のRGBA8のテクスチャをpage_size四方のページに詰める
+ * 周りにpadding画素の隙間を設けて端の画素で埋める
+ * paddingは2の累乗に切り上げ、ページのレベルはpaddingが1画素以上残るところまで作る(隣と混ざらない)
+ */
+bool TextureAtlas::build(const Texture* const* textures, size_t count, unsigned int threshold, unsigned int page_size, unsigned int padding){
+	cleanup();
+	unsigned int align = 1;
+	unsigned int levels = 1;
+	while(align < padding){
+		align <<= 1;
+		levels++;
+	}
+	padding = align;
+	page_size = (page_size + align - 1) / align * align;
+	if(threshold + padding * 2 > page_size){
+		Log_e("atlas page is too small.\n");
+		return false;
+	}
+	std::vector<Slot> slots;
+	std::set<Uid> uids;
+	try{
+		for(size_t i = 0; i < count; i++){
+			const Texture* texture = textures[i];
+			if(!texture || texture->levels.empty() || (texture->format != TextureFormat_RGBA8))
+				continue;
+			const TextureLevel& base = texture->levels[0];
+			if((base.width > threshold) || (base.height > threshold))
+				continue;
+			// 同じ画像が複数回挙がっていれば1つだけ詰める
+			if(!uids.insert(texture->uid).second)
+				continue;
+			Slot slot;
+			slot.texture = texture;
+			slot.width = (base.width + padding * 2 + align - 1) / align * align;
+			slot.height = (base.height + padding * 2 + align - 1) / align * align;
+			slot.x = 0;
+			slot.y = 0;
+			slot.page = 0;
+			slots.push_back(slot);
+			if(texture->levels.size() < levels)
+				levels = static_cast<unsigned int>(texture->levels.size());
+		}
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	if(slots.empty())
+		return true;
+	std::stable_sort(slots.begin(), slots.end(), isHigher);
+	if(!pack(&slots, page_size) || !fill(slots, page_size, padding, levels)){
+		cleanup();
+		return false;
+	}
+	const float inv = 1.0f / page_size;
+	try{
+		for(std::vector<Slot>::const_iterator it = slots.begin(); it != slots.end(); it++){
+			const TextureLevel& base = it->texture->levels[0];
+			AtlasRegion region;
+			region.page = it->page;
+			region.scale[0] = base.width * inv;
+			region.scale[1] = base.height * inv;
+			region.offset[0] = (it->x + padding) * inv;
+			region.offset[1] = (it->y + padding) * inv;
+			std::pair<Uid, AtlasRegion> p(it->texture->uid, region);
+			regions.insert(p);
+		}
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		cleanup();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * 画像のページ上の位置
+ * アトラスに含まれていなければNULL
+ */
+const AtlasRegion* TextureAtlas::findRegion(Uid image_uid) const{
+	std::map<Uid, AtlasRegion>::const_iterator it = regions.find(image_uid);
+	if(it == regions.end())
+		return NULL;
+	return &it->second;
+}
+
+/**
+ * 高さの順に並べた領域を下から棚状に並べる
+ * 溢れたら次のページに移る
+ */
+bool TextureAtlas::pack(std::vector<Slot>* slots, unsigned int page_size){
+	size_t page = 0;
+	unsigned int x = 0;
+	unsigned int y = 0;
+	unsigned int shelf = 0;	// 現在の棚の高さ
+	for(std::vector<Slot>::iterator it = slots->begin(); it != slots->end(); it++){
+		if(x + it->width > page_size){
+			x = 0;
+			y += shelf;
+			shelf = 0;
+		}
+		if(y + it->height > page_size){
+			page++;
+			x = 0;
+			y = 0;
+			shelf = 0;
+		}
+		it->x = x;
+		it->y = y;
+		it->page = page;
+		x += it->width;
+		if(it->height > shelf)
+			shelf = it->height;
+	}
+	try{
+		pages.resize(page + 1);
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * 各レベルに元のテクスチャの同じレベルを写し、隙間を端の画素で埋める
+ * 領域は2^(levels-1)の倍数に揃えてあるので、縮小しても隣とは重ならない
+ */
+bool TextureAtlas::fill(const std::vector<Slot>& slots, unsigned int page_size, unsigned int padding, unsigned int levels){
+	try{
+		for(std::vector<Texture>::iterator page = pages.begin(); page != pages.end(); page++){
+			page->uid = INVALID_UID;
+			page->hash = INVALID_UID;
+			page->format = TextureFormat_RGBA8;
+			page->levels.resize(levels);
+			for(unsigned int l = 0; l < levels; l++){
+				TextureLevel* level = &page->levels[l];
+				level->width = page_size >> l;
+				level->height = page_size >> l;
+				level->pixels.assign(static_cast<size_t>(level->width) * level->height * 4, 0);
+			}
+		}
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	for(std::vector<Slot>::const_iterator it = slots.begin(); it != slots.end(); it++){
+		for(unsigned int l = 0; l < levels; l++){
+			const TextureLevel& src = it->texture->levels[l];
+			TextureLevel* dst = &pages[it->page].levels[l];
+			const int pad = static_cast<int>(padding >> l);
+			const int w = static_cast<int>(src.width);
+			const int h = static_cast<int>(src.height);
+			const unsigned int x0 = it->x >> l;
+			const unsigned int y0 = it->y >> l;
+			for(int y = -pad; y < h + pad; y++){
+				const int sy = (y < 0)? 0 : ((y >= h)? h - 1 : y);
+				unsigned char* row = &dst->pixels[(static_cast<size_t>(y0 + pad + y) * dst->width + x0) * 4];
+				const unsigned char* src_row = &src.pixels[static_cast<size_t>(sy) * w * 4];
+				for(int x = -pad; x < 0; x++)
+					memcpy(row + (pad + x) * 4, src_row, 4);
+				memcpy(row + pad * 4, src_row, w * 4);
+				for(int x = w; x < w + pad; x++)
+					memcpy(row + (pad + x) * 4, src_row + (w - 1) * 4, 4);
+			}
+		}
+	}
+	return true;
+}
+
+} // namespace collada
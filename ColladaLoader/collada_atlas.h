@@ -0,0 +1,52 @@
+﻿/**
+ * 小さいテクスチャをまとめたアトラス
+ * 閾値以下のテクスチャを共有のページに詰め、描画時のテクスチャの切り替えを減らす
+ * テクスチャ座標は書き換えず、Material::Samplerごとの拡大率と位置を返す
+ * ページのミップマップは隣と混ざらないレベルまでしか作らないので、転送時にGL_TEXTURE_MAX_LEVELで制限する
+ */
+#pragma once
+#include <map>
+#include <vector>
+#include "collada_texture.h"
+
+namespace collada{
+
+/**
+ * ページ上の位置
+ * uv' = offset + uv * scale(繰り返す場合はシェーダでuvの小数部を使う)
+ */
+typedef struct{
+	size_t page;
+	float scale[2];
+	float offset[2];
+}AtlasRegion;
+
+class TextureAtlas{
+public:
+	TextureAtlas();
+	~TextureAtlas();
+	void cleanup();
+	bool build(const TextureLoader* loader, unsigned int threshold = 64, unsigned int page_size = 1024, unsigned int padding = 4);
+	bool build(const Texture* const* textures, size_t count, unsigned int threshold = 64, unsigned int page_size = 1024, unsigned int padding = 4);
+	size_t getPageCount() const { return pages.size(); }
+	const Texture* getPage(size_t index) const { return &pages[index]; }
+	const AtlasRegion* findRegion(Uid image_uid) const;
+	const AtlasRegion* findRegion(const Material::Sampler* sampler) const { return findRegion(sampler->image_uid); }
+private:
+	typedef struct{
+		const Texture* texture;
+		unsigned int x;	// 隙間を含む領域の左下
+		unsigned int y;
+		unsigned int width;	// 隙間を含む
+		unsigned int height;
+		size_t page;
+	}Slot;
+	static bool isHigher(const Slot& a, const Slot& b){ return a.height > b.height; }
+	bool pack(std::vector<Slot>* slots, unsigned int page_size);
+	bool fill(const std::vector<Slot>& slots, unsigned int page_size, unsigned int padding, unsigned int levels);
+private:
+	std::vector<Texture> pages;
+	std::map<Uid, AtlasRegion> regions;	// 画像のuid→ページ上の位置
+};
+
+} // namespace collada
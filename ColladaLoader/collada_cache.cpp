@@ -0,0 +1,310 @@
+﻿#include <string.h>
+#include "collada.h"
+#include "collada_cache.h"
+#include "crc32.h"
+#include "mapped_file.h"
+#include "log.h"
+
+namespace collada{
+
+extern void getFilePath(std::string* output, const char* uri);
+
+////////////////////////////////////////////////////////////////////////////////
+
+CacheWriter::CacheWriter(){
+	fp = NULL;
+	good = false;
+	crc = CRC32_INIT;
+}
+
+CacheWriter::~CacheWriter(){
+	if(fp)
+		fclose(fp);
+}
+
+bool CacheWriter::open(const char* filename){
+	fp = fopen(filename, "wb");
+	if(fp == NULL){
+		perror(filename);
+		return false;
+	}
+	good = true;
+	crc = CRC32_INIT;
+	return true;
+}
+
+bool CacheWriter::close(){
+	if(fp == NULL)
+		return false;
+	if(fclose(fp) != 0)
+		good = false;
+	fp = NULL;
+	return good;
+}
+
+bool CacheWriter::writeBytes(const void* buf, size_t size){
+	if(!good)
+		return false;
+	if((size > 0) && (fwrite(buf, 1, size, fp) != size))
+		good = false;
+	crc = updateCRC32(crc, buf, size);
+	return good;
+}
+
+bool CacheWriter::writeU8(unsigned char value){
+	return writeBytes(&value, sizeof(value));
+}
+
+bool CacheWriter::writeU32(unsigned int value){
+	return writeBytes(&value, sizeof(value));
+}
+
+bool CacheWriter::writeU64(unsigned long long value){
+	return writeBytes(&value, sizeof(value));
+}
+
+bool CacheWriter::writeF32(float value){
+	return writeBytes(&value, sizeof(value));
+}
+
+bool CacheWriter::writeString(const std::string& value){
+	if(!writeU32(static_cast<unsigned int>(value.size())))
+		return false;
+	return writeBytes(value.data(), value.size());
+}
+
+bool CacheWriter::writeFloats(const FloatArray& value){
+	if(!writeU32(static_cast<unsigned int>(value.size())))
+		return false;
+	if(value.empty())
+		return true;
+	return writeBytes(&value[0], sizeof(float) * value.size());
+}
+
+bool CacheWriter::writeUints(const UintArray& value){
+	if(!writeU32(static_cast<unsigned int>(value.size())))
+		return false;
+	if(value.empty())
+		return true;
+	return writeBytes(&value[0], sizeof(unsigned int) * value.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+CacheReader::CacheReader(const unsigned char* data, size_t size){
+	ptr = data;
+	end = data + size;
+}
+
+bool CacheReader::readBytes(void* buf, size_t size){
+	if(size > getRemain()){
+		Log_e("unexpected end of cache.\n");
+		return false;
+	}
+	memcpy(buf, ptr, size);
+	ptr += size;
+	return true;
+}
+
+bool CacheReader::readU8(unsigned char* value){
+	return readBytes(value, sizeof(*value));
+}
+
+bool CacheReader::readU32(unsigned int* value){
+	return readBytes(value, sizeof(*value));
+}
+
+bool CacheReader::readU64(unsigned long long* value){
+	return readBytes(value, sizeof(*value));
+}
+
+bool CacheReader::readF32(float* value){
+	return readBytes(value, sizeof(*value));
+}
+
+bool CacheReader::readString(std::string* value){
+	unsigned int size;
+	if(!readU32(&size))
+		return false;
+	if(size > getRemain()){
+		Log_e("unexpected end of cache.\n");
+		return false;
+	}
+	value->assign(reinterpret_cast<const char*>(ptr), size);
+	ptr += size;
+	return true;
+}
+
+bool CacheReader::readFloats(FloatArray* value){
+	unsigned int count;
+	if(!readU32(&count))
+		return false;
+	if(count > getRemain() / sizeof(float)){
+		Log_e("unexpected end of cache.\n");
+		return false;
+	}
+	value->resize(count);
+	if(count == 0)
+		return true;
+	return readBytes(&(*value)[0], sizeof(float) * count);
+}
+
+bool CacheReader::readUints(UintArray* value){
+	unsigned int count;
+	if(!readU32(&count))
+		return false;
+	if(count > getRemain() / sizeof(unsigned int)){
+		Log_e("unexpected end of cache.\n");
+		return false;
+	}
+	value->resize(count);
+	if(count == 0)
+		return true;
+	return readBytes(&(*value)[0], sizeof(unsigned int) * count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * キャッシュの元になった.daeの情報
+ */
+typedef struct{
+	unsigned long long size;
+	unsigned long long mtime;
+	unsigned int crc;
+	std::string path;	// 画像のuidはパスを含むので一致している必要がある
+}SourceSignature;
+
+static unsigned int getCacheFlags(){
+	unsigned int flags = 0;
+#if defined(DEBUG) || defined(VALIDATE_UID)
+	flags |= CACHE_FLAG_NAMES;
+#endif
+	return flags;
+}
+
+static bool getSourceStatus(const char* uri, SourceSignature* sig){
+	if(!getFileStatus(uri, &sig->size, &sig->mtime))
+		return false;
+	sig->path.clear();
+	getFilePath(&sig->path, uri);
+	return true;
+}
+
+static bool getSourceCRC(const char* uri, SourceSignature* sig){
+	MappedFile file;
+	if(!file.open(uri))
+		return false;
+	sig->crc = updateCRC32(CRC32_INIT, file.getData(), file.getSize());
+	return true;
+}
+
+static bool writeHeader(CacheWriter* writer, const SourceSignature& sig){
+	writer->writeU32(CACHE_MAGIC);
+	writer->writeU32(CACHE_VERSION);
+	writer->writeU32(getCacheFlags());
+	writer->writeU64(sig.size);
+	writer->writeU64(sig.mtime);
+	writer->writeU32(sig.crc);
+	return writer->writeString(sig.path);
+}
+
+/**
+ * ヘッダの検証
+ * 内容のCRCは最後に確認する(サイズや時刻が違えば読む必要が無い)
+ */
+static bool readHeader(CacheReader* reader, const char* uri){
+	unsigned int magic, version, flags;
+	if(!reader->readU32(&magic) || (magic != CACHE_MAGIC))
+		return false;
+	if(!reader->readU32(&version) || (version != CACHE_VERSION))
+		return false;
+	if(!reader->readU32(&flags) || (flags != getCacheFlags()))
+		return false;
+	SourceSignature sig;
+	if(!getSourceStatus(uri, &sig))
+		return false;
+	SourceSignature cached;
+	if(!reader->readU64(&cached.size) || (cached.size != sig.size))
+		return false;
+	if(!reader->readU64(&cached.mtime) || (cached.mtime != sig.mtime))
+		return false;
+	if(!reader->readU32(&cached.crc))
+		return false;
+	if(!reader->readString(&cached.path) || (cached.path != sig.path))
+		return false;
+	if(!getSourceCRC(uri, &sig) || (cached.crc != sig.crc))
+		return false;
+	return true;
+}
+
+/**
+ * キャッシュから読み込む
+ * 元の.daeと一致しない場合は何もせずにfalseを返す
+ */
+bool Collada::loadCache(const char* uri, const char* filename){
+	MappedFile file;
+	if(!file.open(filename))
+		return false;
+	if(file.getSize() < sizeof(unsigned int))
+		return false;
+	const size_t size = file.getSize() - sizeof(unsigned int);
+	CacheReader reader(file.getData(), size);
+	if(!readHeader(&reader, uri))
+		return false;
+	// 書き込みの途中で止まったものや壊れたものは読まない
+	unsigned int crc;
+	memcpy(&crc, file.getData() + size, sizeof(crc));
+	if(updateCRC32(CRC32_INIT, file.getData(), size) != crc){
+		Log_w("cache is broken(%s).\n", filename);
+		return false;
+	}
+	try{
+		images = new Images;
+		scene = new Scene;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		cleanup();
+		return false;
+	}
+	if(!images->load(&reader) || !scene->load(&reader) || (reader.getRemain() != 0)){
+		Log_e("could not load cache(%s).\n", filename);
+		cleanup();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * キャッシュに書き出す
+ * 途中で失敗しても不完全なファイルが残らないように一時ファイル経由で置き換える
+ */
+bool Collada::saveCache(const char* uri, const char* filename) const{
+	if(!images || !scene)
+		return false;
+	SourceSignature sig;
+	if(!getSourceStatus(uri, &sig) || !getSourceCRC(uri, &sig))
+		return false;
+	std::string temp(filename);
+	temp.append(".tmp");
+	CacheWriter writer;
+	if(!writer.open(temp.c_str()))
+		return false;
+	bool result = writeHeader(&writer, sig)
+				&& images->save(&writer)
+				&& scene->save(&writer)
+				&& writer.writeU32(writer.getCRC());
+	if(!writer.close() || !result){
+		remove(temp.c_str());
+		return false;
+	}
+	remove(filename);
+	if(rename(temp.c_str(), filename) != 0){
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+} // namespace collada
@@ -0,0 +1,57 @@
+﻿/**
+ * 読み込み済みのColladaを保存するバイナリキャッシュ
+ * 数値はすべてネイティブのバイト順で格納する
+ * 末尾にそれより前の全体のCRCを置き、壊れたファイルを読まない
+ */
+#pragma once
+#include <stdio.h>
+#include <string>
+#include "collada_def.h"
+
+namespace collada{
+
+#define CACHE_MAGIC		0x43444c43	// "CLDC"
+#define CACHE_VERSION	7
+
+// キャッシュ内の名前(デバッグ用)の有無
+#define CACHE_FLAG_NAMES	(1 << 0)
+
+class CacheWriter{
+public:
+	CacheWriter();
+	~CacheWriter();
+	bool open(const char* filename);
+	bool close();
+	bool writeBytes(const void* buf, size_t size);
+	bool writeU8(unsigned char value);
+	bool writeU32(unsigned int value);
+	bool writeU64(unsigned long long value);
+	bool writeF32(float value);
+	bool writeString(const std::string& value);
+	bool writeFloats(const FloatArray& value);
+	bool writeUints(const UintArray& value);
+	unsigned int getCRC() const { return crc; }
+private:
+	FILE* fp;
+	bool good;
+	unsigned int crc;	// 書き込んだ全体のCRC
+};
+
+class CacheReader{
+public:
+	CacheReader(const unsigned char* data, size_t size);
+	bool readBytes(void* buf, size_t size);
+	bool readU8(unsigned char* value);
+	bool readU32(unsigned int* value);
+	bool readU64(unsigned long long* value);
+	bool readF32(float* value);
+	bool readString(std::string* value);
+	bool readFloats(FloatArray* value);
+	bool readUints(UintArray* value);
+	size_t getRemain() const { return static_cast<size_t>(end - ptr); }
+private:
+	const unsigned char* ptr;
+	const unsigned char* end;
+};
+
+} // namespace collada
@@ -0,0 +1,37 @@
+﻿#include "collada_context.h"
+
+namespace collada{
+
+// このスレッドで読み込み中の文脈
+static THREAD_LOCAL LoadContext* current = NULL;
+
+LoadContext::LoadContext(LoadProgress* progress){
+	id_index = NULL;
+	this->progress = progress;
+	lazy_mutex = NULL;
+	prev = current;
+	current = this;
+}
+
+LoadContext::~LoadContext(){
+	current = prev;
+}
+
+/**
+ * このスレッドの現在の文脈
+ * 読み込み中でなければNULL
+ */
+LoadContext* LoadContext::get(){
+	return current;
+}
+
+/**
+ * 現在の文書の位置
+ * 読み込み中でなければ空
+ */
+const std::string& LoadContext::getPath(){
+	static const std::string empty;
+	return current? current->path : empty;
+}
+
+} // namespace collada
@@ -0,0 +1,37 @@
+﻿/**
+ * 読み込み1回分の作業用の状態
+ * 読み込む間だけスタック上に置き、そのスレッドの現在の文脈として登録する
+ * 状態をスレッドごとに持つので、別々のスレッドでは同時に読み込める
+ * 入れ子の読み込み(.zae)では内側の文脈が一時的に優先される
+ */
+#pragma once
+#include <string>
+#include "thread.h"
+
+namespace collada{
+
+class IdIndex;
+class LoadProgress;
+
+class LoadContext{
+public:
+	explicit LoadContext(LoadProgress* progress);
+	~LoadContext();
+	static LoadContext* get();
+	static const std::string& getPath();
+public:
+	std::string path;	// 文書の位置(画像のパスの基準)
+	IdIndex* id_index;	// collada-domのIDの索引
+	LoadProgress* progress;	// 進捗の通知と中断(NULLなら通知しない)
+	Mutex* lazy_mutex;	// 遅延展開する場合の排他(NULLなら読み込み時に展開する)
+private:
+	LoadContext(const LoadContext&);
+	LoadContext& operator=(const LoadContext&);
+private:
+	LoadContext* prev;	// 入れ子の外側の文脈
+};
+
+// collada-domの排他(collada-domは同時に1つの処理からしか使えない)
+Mutex* getDomMutex();
+
+} // namespace collada
@@ -1,7 +1,26 @@
-#pragma once
+﻿#pragma once
 
 namespace collada{
 
+// ID文字列から生成する識別子(calcHash64)
+typedef unsigned long long Uid;
+#define INVALID_UID ((collada::Uid)-1)
+#define INVALID_INDEX ((unsigned int)-1)
+
+class CacheWriter;
+class CacheReader;
+
+class StreamElement;
+class StreamDocument;
+
+class Stream;
+class Resolver;
+class ZaeArchive;
+
+class LoadProgress;
+class IncrementalLoad;
+class SourceDocument;
+
 class Geometry;
 typedef std::vector<Geometry*> GeometryPtrArray;
 
@@ -1,10 +1,17 @@
+#include <math.h>
+#include <algorithm>
 #include "collada.h"
-#include "crc32.h"
+#include "collada_async.h"
+#include "collada_cache.h"
+#include "collada_context.h"
+#include "collada_stream.h"
+#include "hash64.h"
 #include "log.h"
 //#include <bitset>
 
 namespace collada{
 
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static domUint getMaxOffset(const domInputLocalOffset_Array& dom_ilo_array){
@@ -38,7 +45,7 @@ static bool load(Input* input, domUint offset, const domP* dom_p, domUint max_of
 	// <float_array>擾
 	const char*	source = dom_accessor->getSource().fragment().c_str();
 	domFloat_array* dom_float_array;
-	if(dae_db->getElement((daeElement**)&dom_float_array, 0, source, "float_array") != DAE_OK){
+	if(getElement((daeElement**)&dom_float_array, dae_db, source, "float_array") != DAE_OK){
 		Log_e("element <float_array> %s not found.\n", source);
 		return false;
 	}
@@ -65,12 +72,63 @@ static bool load(Input* input, domUint offset, const domP* dom_p, domUint max_of
 	return true;
 }
 
+static bool load(Input* input, size_t offset, const UintArray& p, size_t max_offset, const StreamElement* stream_accessor){
+	StreamDocument* doc = stream_accessor->getDocument();
+	// <float_array>擾
+	const char* source = getFragment(stream_accessor->getAttribute("source"));
+	const StreamElement* stream_float_array = doc->getElement(source, "float_array");
+	if(!stream_float_array){
+		Log_e("element <float_array> %s not found.\n", source);
+		return false;
+	}
+	const FloatArray* values = doc->getFloats(stream_float_array);
+	if(!values)
+		return false;
+
+	// 擪̖<param>̐(DOMłgetOffset()Ɠ)
+	size_t param_offset = 0;
+	size_t param_total = 0;
+	bool named = false;
+	for(const StreamElement* elem = stream_accessor->getChild("param"); elem; elem = elem->getNext("param")){
+		if(!named){
+			if(elem->getAttribute("name"))
+				named = true;
+			else
+				param_offset++;
+		}
+		param_total++;
+	}
+	const size_t param_count = param_total - param_offset;
+	const size_t param_stride = stream_accessor->getAttribute("stride", 1);
+	// <p>Kvȗvf𔲂o
+	const size_t p_count = p.size();
+	const size_t skip = max_offset + 1;
+	input->f_array.reserve(input->f_array.size() + (p_count / skip) * param_count);
+	for(size_t i = 0; i < p_count; i += skip){
+		if(i + offset >= p_count){
+			Log_e("<p> is too short.\n");
+			return false;
+		}
+		const size_t base = p[i + offset] * param_stride + param_offset;
+		if(base + param_count > values->size()){
+			Log_e("index out of range in <float_array> %s.\n", source);
+			return false;
+		}
+		for(size_t j = 0; j < param_count; j++){
+			input->f_array.push_back((*values)[base + j]);
+		}
+	}
+	input->stride = param_stride;
+	return true;
+}
+
 Triangles::Triangles(){
 	position = NULL;
 	normal = NULL;
 	texcoords = NULL;
 	indices = NULL;
-	mtrl_uid = (unsigned int)-1;
+	mtrl_uid = INVALID_UID;
+	mtrl_index = INVALID_INDEX;
 }
 
 Triangles::~Triangles(){
@@ -100,7 +158,7 @@ void Triangles::cleanup(){
 		delete indices;
 		indices = NULL;
 	}
-	mtrl_uid = (unsigned int)-1;
+	mtrl_uid = INVALID_UID;
 }
 
 bool Triangles::load(const domInputLocalOffset* dom_ilo, const domP* dom_p, domUint max_offset){
@@ -108,7 +166,7 @@ bool Triangles::load(const domInputLocalOffset* dom_ilo, const domP* dom_p, domU
 	// QƂĂ<source>擾
 	const char* source = dom_ilo->getSource().fragment().c_str();
 	domSource* dom_source;
-	if(dae_db->getElement((daeElement**)&dom_source, 0, source, "source") != DAE_OK){
+	if(getElement((daeElement**)&dom_source, dae_db, source, "source") != DAE_OK){
 		Log_e("element <source> %s not found.\n", source);
 		return false;
 	}
@@ -140,17 +198,16 @@ bool Triangles::load(const domInputLocalOffset* dom_ilo, const domP* dom_p, domU
 		return false;
 	}
 
-	if(strcmp(dom_ilo->getSemantic(), "POSITION") == 0){
+	switch(getInputSemanticType(dom_ilo->getSemantic())){
+	case InputSemantic_Position:
 		assert(position == NULL);
 		position = input;
-	}
-	else
-	if(strcmp(dom_ilo->getSemantic(), "NORMAL") == 0){
+		break;
+	case InputSemantic_Normal:
 		assert(normal == NULL);
 		normal = input;
-	}
-	else
-	if(strcmp(dom_ilo->getSemantic(), "TEXCOORD") == 0){
+		break;
+	case InputSemantic_Texcoord:
 		if(!texcoords){
 			try{
 				texcoords = new InputPtrArray;
@@ -162,9 +219,10 @@ bool Triangles::load(const domInputLocalOffset* dom_ilo, const domP* dom_p, domU
 			}
 		}
 		texcoords->push_back(input);
-	}
-	else{
+		break;
+	default:
 		delete input;
+		break;
 	}
 	return true;
 }
@@ -174,7 +232,7 @@ bool Triangles::load(const domInputLocal* dom_il, const domP* dom_p, domUint max
 	// QƂĂ<source>擾
 	const char* source = dom_il->getSource().fragment().c_str();
 	domSource* dom_source;
-	if(dae_db->getElement((daeElement**)&dom_source, 0, source, "source") != DAE_OK)
+	if(getElement((daeElement**)&dom_source, dae_db, source, "source") != DAE_OK)
 		return false;
 	// <technique_common>擾
 	domSource::domTechnique_common* dom_tech_common = dom_source->getTechnique_common();
@@ -204,17 +262,16 @@ bool Triangles::load(const domInputLocal* dom_il, const domP* dom_p, domUint max
 		return false;
 	}
 
-	if(strcmp(dom_il->getSemantic(), "POSITION") == 0){
+	switch(getInputSemanticType(dom_il->getSemantic())){
+	case InputSemantic_Position:
 		assert(position == NULL);
 		position = input;
-	}
-	else
-	if(strcmp(dom_il->getSemantic(), "NORMAL") == 0){
+		break;
+	case InputSemantic_Normal:
 		assert(normal == NULL);
 		normal = input;
-	}
-	else
-	if(strcmp(dom_il->getSemantic(), "TEXCOORD") == 0){
+		break;
+	case InputSemantic_Texcoord:
 		if(!texcoords){
 			try{
 				texcoords = new InputPtrArray;
@@ -226,9 +283,10 @@ bool Triangles::load(const domInputLocal* dom_il, const domP* dom_p, domUint max
 			}
 		}
 		texcoords->push_back(input);
-	}
-	else{
+		break;
+	default:
 		delete input;
+		break;
 	}
 	return true;
 }
@@ -241,7 +299,7 @@ bool Triangles::load(domTriangles* dom_tri){
 		this->material.clear();
 		this->material.append(material);
 #endif
-		mtrl_uid = calcCRC32(reinterpret_cast<const unsigned char*>(material));
+		mtrl_uid = calcHash64(reinterpret_cast<const unsigned char*>(material));
 	}
 	// <input>ōł傫ItZbg擾
 	const size_t max_offset = getMaxOffset(dom_tri->getInput_array());
@@ -251,10 +309,10 @@ bool Triangles::load(domTriangles* dom_tri){
 	const size_t input_coutn = dom_tri->getInput_array().getCount();
 	for(size_t i = 0; i < input_coutn; i++){
 		domInputLocalOffset* dom_ilo = dom_tri->getInput_array().get(i);
-		if(strcmp(dom_ilo->getSemantic(), "VERTEX") == 0){
+		if(getInputSemanticType(dom_ilo->getSemantic()) == InputSemantic_Vertex){
 			const char* source = dom_ilo->getSource().fragment().c_str();
 			domVertices* dom_verts;
-			if(dom_tri->getDAE()->getDatabase()->getElement((daeElement**)&dom_verts, 0, source, "vertices") != DAE_OK){
+			if(getElement((daeElement**)&dom_verts, dom_tri->getDAE()->getDatabase(), source, "vertices") != DAE_OK){
 				Log_e("element <vertices> %s not found.\n", source);
 				cleanup();
 				return false;
@@ -262,7 +320,7 @@ bool Triangles::load(domTriangles* dom_tri){
 			// <vertices>WJ
 			const size_t input_count = dom_verts->getInput_array().getCount();
 			for(size_t j = 0; j < input_count; j++){
-				domInputLocal* dom_il = dom_verts->getInput_array().get(i);
+				domInputLocal* dom_il = dom_verts->getInput_array().get(j);
 				if(!load(dom_il, dom_p, max_offset, dom_ilo->getOffset(), dom_ilo->getSet())){
 					Log_e("could not load.\n");
 					cleanup();
@@ -287,6 +345,129 @@ bool Triangles::load(domTriangles* dom_tri){
 	return true;
 }
 
+bool Triangles::load(const StreamElement* stream_input, const UintArray& p, size_t max_offset, size_t offset){
+	// QƂĂ<source>擾
+	const char* source = getFragment(stream_input->getAttribute("source"));
+	const StreamElement* stream_source = stream_input->getDocument()->getElement(source, "source");
+	if(!stream_source){
+		Log_e("element <source> %s not found.\n", source);
+		return false;
+	}
+	// <technique_common>擾
+	const StreamElement* stream_tech_common = stream_source->getChild("technique_common");
+	if(!stream_tech_common){
+		Log_e("failed to get.\n");
+		return false;
+	}
+	// <accessor>擾
+	const StreamElement* stream_accessor = stream_tech_common->getChild("accessor");
+	if(!stream_accessor){
+		Log_e("failed to get.\n");
+		return false;
+	}
+
+	Input* input;
+	try{
+		input = new Input;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+
+	if(!collada::load(input, offset, p, max_offset, stream_accessor)){
+		Log_e("could not load.\n");
+		delete input;
+		return false;
+	}
+
+	switch(getInputSemanticType(stream_input->getAttribute("semantic"))){
+	case InputSemantic_Position:
+		assert(position == NULL);
+		position = input;
+		break;
+	case InputSemantic_Normal:
+		assert(normal == NULL);
+		normal = input;
+		break;
+	case InputSemantic_Texcoord:
+		if(!texcoords){
+			try{
+				texcoords = new InputPtrArray;
+			}
+			catch(std::bad_alloc& e){
+				Log_e("could not allocate memory.\n");
+				delete input;
+				return false;
+			}
+		}
+		texcoords->push_back(input);
+		break;
+	default:
+		delete input;
+		break;
+	}
+	return true;
+}
+
+/**
+ * <triangles>܂͎Op`ɓWJ<polylist>̓ǂݍ
+ * p<p>̒l
+ */
+bool Triangles::load(const StreamElement* stream_prim, const UintArray& p){
+	// }eA̎擾
+	const char* material = stream_prim->getAttribute("material");
+	if(material){
+#ifdef DEBUG
+		this->material.clear();
+		this->material.append(material);
+#endif
+		mtrl_uid = calcHash64(reinterpret_cast<const unsigned char*>(material));
+	}
+	// <input>ōł傫ItZbg擾
+	size_t max_offset = 0;
+	for(const StreamElement* elem = stream_prim->getChild("input"); elem; elem = elem->getNext("input")){
+		const size_t offset = elem->getAttribute("offset", 0);
+		if(offset > max_offset)
+			max_offset = offset;
+	}
+	// <input>WJĂ
+	for(const StreamElement* stream_ilo = stream_prim->getChild("input"); stream_ilo; stream_ilo = stream_ilo->getNext("input")){
+		const size_t offset = stream_ilo->getAttribute("offset", 0);
+		if(getInputSemanticType(stream_ilo->getAttribute("semantic")) == InputSemantic_Vertex){
+			const char* source = getFragment(stream_ilo->getAttribute("source"));
+			const StreamElement* stream_verts = stream_prim->getDocument()->getElement(source, "vertices");
+			if(!stream_verts){
+				Log_e("element <vertices> %s not found.\n", source);
+				cleanup();
+				return false;
+			}
+			// <vertices>WJ
+			for(const StreamElement* stream_il = stream_verts->getChild("input"); stream_il; stream_il = stream_il->getNext("input")){
+				if(!load(stream_il, p, max_offset, offset)){
+					Log_e("could not load.\n");
+					cleanup();
+					return false;
+				}
+			}
+		}
+		else{
+			if(!load(stream_ilo, p, max_offset, offset)){
+				Log_e("could not load.\n");
+				cleanup();
+				return false;
+			}
+		}
+	}
+	// WJzkCfNX
+	if(!optimize()){
+		Log_e("could not optimize.\n");
+		cleanup();
+		return false;
+	}
+	return true;
+}
+
 /**
  * ΏۂƂȂCfNX܂łŏdĂ邩ׂ
  * @param target_index ΏۂƂȂCfNX
@@ -380,7 +561,7 @@ bool Triangles::optimize(){
 		size_t overlapped_index;
 		if(isOverlapped(i, &overlapped_index)){
 			(*indices)[i] = (*indices)[overlapped_index];
-			size_t mask = ~(1 << (i%bits));
+			size_t mask = ~(static_cast<size_t>(1) << (i%bits));
 			flags[i/bits] = (flags[i/bits] & mask) | ~mask;
 		}
 		else{
@@ -392,7 +573,7 @@ bool Triangles::optimize(){
 	// _z̈k
 	size_t offset = 0;
 	for(size_t i = 0; i < num_elements; i++){
-		if(flags[i/bits] & (1 << (i % bits))){
+		if(flags[i/bits] & (static_cast<size_t>(1) << (i % bits))){
 			if(position){
 				FloatArray::iterator it_beg = position->f_array.begin() + (i - offset) * position->stride;
 				FloatArray::iterator it_end = it_beg + position->stride;
@@ -433,6 +614,159 @@ bool Triangles::optimize(){
 	return true;
 }
 
+static bool save(CacheWriter* writer, const Input* input){
+	if(!writer->writeU8(input? 1 : 0))
+		return false;
+	if(!input)
+		return true;
+	writer->writeU32(static_cast<unsigned int>(input->stride));
+	return writer->writeFloats(input->f_array);
+}
+
+static bool load(CacheReader* reader, Input** input){
+	unsigned char exists;
+	if(!reader->readU8(&exists))
+		return false;
+	if(!exists)
+		return true;
+	try{
+		*input = new Input;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	unsigned int stride;
+	if(!reader->readU32(&stride) || !reader->readFloats(&(*input)->f_array)){
+		delete *input;
+		*input = NULL;
+		return false;
+	}
+	// _zƂēnvf
+	if((stride == 0) || (stride > 4) || ((*input)->f_array.size() % stride != 0)){
+		Log_e("invalid stride %u in cache.\n", stride);
+		delete *input;
+		*input = NULL;
+		return false;
+	}
+	(*input)->stride = stride;
+	return true;
+}
+
+bool Triangles::load(CacheReader* reader){
+	cleanup();
+	if(!reader->readU64(&mtrl_uid)){
+		cleanup();
+		return false;
+	}
+	if(!collada::load(reader, &position) || !collada::load(reader, &normal)){
+		cleanup();
+		return false;
+	}
+	// eNX`W
+	unsigned char exists;
+	if(!reader->readU8(&exists)){
+		cleanup();
+		return false;
+	}
+	if(exists){
+		unsigned int count;
+		try{
+			texcoords = new InputPtrArray;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			cleanup();
+			return false;
+		}
+		if(!reader->readU32(&count)){
+			cleanup();
+			return false;
+		}
+		for(unsigned int i = 0; i < count; i++){
+			Input* input = NULL;
+			if(!collada::load(reader, &input) || !input){
+				cleanup();
+				return false;
+			}
+			texcoords->push_back(input);
+		}
+	}
+	// CfNX
+	if(!reader->readU8(&exists)){
+		cleanup();
+		return false;
+	}
+	if(exists){
+		try{
+			indices = new UintArray;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			cleanup();
+			return false;
+		}
+		if(!reader->readUints(indices)){
+			cleanup();
+			return false;
+		}
+	}
+	if(!validate()){
+		Log_e("invalid triangles in cache.\n");
+		cleanup();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * `Ŕ͈͊Oǂ܂Ȃm߂
+ * ͑Sē_ŁACfNX͈͓͂̔
+ * vf̐glVertexPointer()Ȃǂɓn4ȉ
+ */
+bool Triangles::validate() const{
+	if(!position)
+		return !indices || indices->empty();
+	if((position->stride < 2) || (position->stride > 4))
+		return false;
+	const size_t count = position->f_array.size() / position->stride;
+	if(normal && ((normal->stride != 3) || (normal->f_array.size() / normal->stride != count)))
+		return false;
+	if(texcoords){
+		for(InputPtrArray::const_iterator it = texcoords->begin(); it != texcoords->end(); it++){
+			if(((*it)->stride == 0) || ((*it)->stride > 4) || ((*it)->f_array.size() / (*it)->stride != count))
+				return false;
+		}
+	}
+	if(indices){
+		for(UintArray::const_iterator it = indices->begin(); it != indices->end(); it++){
+			if(*it >= count)
+				return false;
+		}
+	}
+	return true;
+}
+
+bool Triangles::save(CacheWriter* writer) const{
+	writer->writeU64(mtrl_uid);
+	if(!collada::save(writer, position) || !collada::save(writer, normal))
+		return false;
+	writer->writeU8(texcoords? 1 : 0);
+	if(texcoords){
+		writer->writeU32(static_cast<unsigned int>(texcoords->size()));
+		InputPtrArray::const_iterator it = texcoords->begin();
+		while(it != texcoords->end()){
+			if(!collada::save(writer, *it))
+				return false;
+			it++;
+		}
+	}
+	writer->writeU8(indices? 1 : 0);
+	if(indices)
+		return writer->writeUints(*indices);
+	return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static void triangulation(const domPolylist* from, domTriangles* to){
@@ -477,6 +811,48 @@ static void triangulation(const domPolylist* from, domTriangles* to){
 	to->setCount(t_count);
 }
 
+/**
+ * <polylist>Op`<p>ɓWJ(DOMłtriangulation()Ɠ)
+ */
+static bool triangulation(const StreamElement* from, UintArray* to){
+	const StreamElement* stream_vcount = from->getChild("vcount");
+	const StreamElement* stream_p = from->getChild("p");
+	if(!stream_vcount || !stream_p){
+		Log_e("failed to get.\n");
+		return false;
+	}
+	UintArray vcount;
+	UintArray p;
+	if(!stream_vcount->getUints(&vcount) || !stream_p->getUints(&p)){
+		Log_e("invalid <vcount> or <p>.\n");
+		return false;
+	}
+	size_t i_count = 0;
+	for(const StreamElement* elem = from->getChild("input"); elem; elem = elem->getNext("input")){
+		i_count++;
+	}
+	size_t offset = 0;
+	for(size_t i = 0; i < vcount.size(); i++){
+		const size_t ntri = (vcount[i] > 2)? vcount[i] - 2 : 0;	// Op`̐
+		if(offset + vcount[i] * i_count > p.size()){
+			Log_e("<p> is too short.\n");
+			return false;
+		}
+		size_t index = i_count;
+		for(size_t j = 0; j < ntri; j++){
+			// for first vertex
+			to->insert(to->end(), p.begin() + offset, p.begin() + offset + i_count);
+			// for second vertex
+			to->insert(to->end(), p.begin() + offset + index, p.begin() + offset + index + i_count);
+			// for third vertex
+			index += i_count;
+			to->insert(to->end(), p.begin() + offset + index, p.begin() + offset + index + i_count);
+		}
+		offset += vcount[i] * i_count;
+	}
+	return true;
+}
+
 Mesh::Mesh(){
 	triangles = NULL;
 }
@@ -547,34 +923,164 @@ bool Mesh::load(domMesh* dom_mesh){
 	return true;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-Geometry::Geometry(){
-	mesh = NULL;
-}
-
-Geometry::~Geometry(){
-	cleanup();
-}
-
-void Geometry::cleanup(){
-	if(mesh){
-		delete mesh;
-		mesh = NULL;	
-	}
-	url.clear();
-	std::map<unsigned int, Material*>::iterator it = bind_material.begin();
-	while(it != bind_material.end()){
-		if(it->second){
-			delete it->second;
-			it->second = NULL;
+/**
+ * <triangles>̌<polylist>WĴ(DOMłƓ)
+ */
+bool Mesh::load(const StreamElement* stream_mesh){
+	if(stream_mesh->getChild("triangles") || stream_mesh->getChild("polylist")){
+		try{
+			triangles = new TrianglesPtrArray;
 		}
-		it++;
-	}
-	bind_material.clear();
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			cleanup();
+			return false;
+		}
+	}
+	// <triangles>
+	for(const StreamElement* elem = stream_mesh->getChild("triangles"); elem; elem = elem->getNext("triangles")){
+		UintArray p;
+		const StreamElement* stream_p = elem->getChild("p");
+		if(stream_p && !stream_p->getUints(&p)){
+			Log_e("invalid <p>.\n");
+			cleanup();
+			return false;
+		}
+		if(!load(elem, p)){
+			cleanup();
+			return false;
+		}
+	}
+	// <polylist>
+	for(const StreamElement* elem = stream_mesh->getChild("polylist"); elem; elem = elem->getNext("polylist")){
+		UintArray p;
+		if(!triangulation(elem, &p) || !load(elem, p)){
+			cleanup();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Mesh::load(const StreamElement* stream_prim, const UintArray& p){
+	Triangles* tri;
+	try{
+		tri = new Triangles;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	if(!tri->load(stream_prim, p)){
+		Log_e("could not load Triangles(%d).\n", triangles->size());
+		delete tri;
+		return false;
+	}
+	triangles->push_back(tri);
+	return true;
+}
+
+bool Mesh::load(CacheReader* reader){
+	cleanup();
+	unsigned char exists;
+	if(!reader->readU8(&exists))
+		return false;
+	if(!exists)
+		return true;
+	unsigned int count;
+	if(!reader->readU32(&count))
+		return false;
+	try{
+		triangles = new TrianglesPtrArray;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	for(unsigned int i = 0; i < count; i++){
+		Triangles* tri;
+		try{
+			tri = new Triangles;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			cleanup();
+			return false;
+		}
+		if(!tri->load(reader)){
+			Log_e("could not load Triangles(%d).\n", i);
+			delete tri;
+			cleanup();
+			return false;
+		}
+		triangles->push_back(tri);
+	}
+	return true;
+}
+
+bool Mesh::save(CacheWriter* writer) const{
+	writer->writeU8(triangles? 1 : 0);
+	if(!triangles)
+		return true;
+	if(!writer->writeU32(static_cast<unsigned int>(triangles->size())))
+		return false;
+	TrianglesPtrArray::const_iterator it = triangles->begin();
+	while(it != triangles->end()){
+		if(!(*it)->save(writer))
+			return false;
+		it++;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Geometry::Geometry(){
+	mesh = NULL;
+	decode_mutex = NULL;
+	dom_geom = NULL;
+	stream_geom = NULL;
+	decoded = false;
+	has_bounds = false;
+	mesh_hash = INVALID_UID;
+	material_hash = INVALID_UID;
+}
+
+Geometry::~Geometry(){
+	cleanup();
+}
+
+void Geometry::cleanup(){
+	if(mesh){
+		delete mesh;
+		mesh = NULL;	
+	}
+	decode_mutex = NULL;
+	dom_geom = NULL;
+	stream_geom = NULL;
+	decoded = false;
+	ready.reset();
+	has_bounds = false;
+	mesh_hash = INVALID_UID;
+	material_hash = INVALID_UID;
+	url.clear();
+	std::map<Uid, Material*>::iterator it = bind_material.begin();
+	while(it != bind_material.end()){
+		if(it->second){
+			delete it->second;
+			it->second = NULL;
+		}
+		it++;
+	}
+	bind_material.clear();
 }
 
 bool Geometry::load(domInstance_geometry* dom_inst_geom){
+	if(!checkProgress(LoadStage_Geometry)){
+		Log_i("canceled.\n");
+		cleanup();
+		return false;
+	}
 	const char* url = dom_inst_geom->getUrl().fragment().c_str();
 #ifdef DEBUG
 	this->url.clear();
@@ -583,11 +1089,20 @@ bool Geometry::load(domInstance_geometry* dom_inst_geom){
 #if 1
 	// <geometry>
 	domGeometry* dom_geom;
-	if(dom_inst_geom->getDAE()->getDatabase()->getElement((daeElement**)&dom_geom, 0, url, "geometry") != DAE_OK){
+	if(getElement((daeElement**)&dom_geom, dom_inst_geom->getDAE()->getDatabase(), url, "geometry") != DAE_OK){
 		Log_e("element <geometry> %s not found.\n", url);
 		cleanup();
 		return false;
 	}
+	const LoadContext* context = LoadContext::get();
+	Mutex* lazy_mutex = context? context->lazy_mutex : NULL;
+	if(lazy_mutex){
+		// ߂ĎQƂꂽɓWJ
+		decode_mutex = lazy_mutex;
+		this->dom_geom = dom_geom;
+		scanBounds(dom_geom);
+	}
+	else
 	if(!load(dom_geom)){
 		Log_e("could not load.\n");
 		cleanup();
@@ -623,10 +1138,12 @@ bool Geometry::load(domGeometry* dom_geom){
 		}
 		if(!mesh->load(dom_mesh)){
 			Log_e("could not load Mesh.\n");
-			cleanup();
+			delete mesh;
+			mesh = NULL;
 			return false;
 		}
 	}
+	calcBounds();
 	return true;
 }
 
@@ -646,7 +1163,7 @@ bool Geometry::load(domBind_material* dom_bind_mtrl){
 			cleanup();
 			return false;
 		}
-#ifdef DEBUG
+#if defined(DEBUG) || defined(VALIDATE_UID)
 		mtrl->symbol.clear();
 		mtrl->symbol.append(dom_inst_mtrl->getSymbol());
 #endif
@@ -657,10 +1174,14 @@ bool Geometry::load(domBind_material* dom_bind_mtrl){
 			return false;
 		}
 		// o^	
-		unsigned int id = calcCRC32(reinterpret_cast<const unsigned char*>(dom_inst_mtrl->getSymbol()));
-		std::pair<unsigned int, Material*> p(id, mtrl);
-		std::map<unsigned int, Material*>::_Pairib pib = bind_material.insert(p);
+		Uid id = calcHash64(reinterpret_cast<const unsigned char*>(dom_inst_mtrl->getSymbol()));
+		std::pair<Uid, Material*> p(id, mtrl);
+		std::map<Uid, Material*>::_Pairib pib = bind_material.insert(p);
 		if(!pib.second){	// L[dĂ
+#ifdef VALIDATE_UID
+			if(pib.first->second->symbol != mtrl->symbol)
+				Log_e("uid collision: %s and %s.\n", pib.first->second->symbol.c_str(), mtrl->symbol.c_str());
+#endif
 			delete mtrl;
 			cleanup();
 			return false;
@@ -669,4 +1190,468 @@ bool Geometry::load(domBind_material* dom_bind_mtrl){
 	return true;
 }
 
+bool Geometry::load(const StreamElement* stream_inst_geom){
+	if(!checkProgress(LoadStage_Geometry)){
+		Log_i("canceled.\n");
+		cleanup();
+		return false;
+	}
+	const char* uri = stream_inst_geom->getAttribute("url");
+	const char* url = getFragment(uri);
+#ifdef DEBUG
+	this->url.clear();
+	this->url.append(url);
+#endif
+	// <geometry>
+	const StreamElement* stream_geom = stream_inst_geom->getDocument()->resolve(uri, "geometry");
+	if(!stream_geom){
+		Log_e("element <geometry> %s not found.\n", url);
+		cleanup();
+		return false;
+	}
+	// ēǂݍ݂ŕύXo邽
+	mesh_hash = stream_geom->getHash();
+	material_hash = 0;
+	const LoadContext* context = LoadContext::get();
+	Mutex* lazy_mutex = context? context->lazy_mutex : NULL;
+	if(lazy_mutex){
+		// ߂ĎQƂꂽɓWJ
+		decode_mutex = lazy_mutex;
+		this->stream_geom = stream_geom;
+		scanBounds(stream_geom);
+	}
+	else
+	if(!loadGeometry(stream_geom)){
+		Log_e("could not load.\n");
+		cleanup();
+		return false;
+	}
+	// <bind_material>
+	const StreamElement* stream_bind_mtrl = stream_inst_geom->getChild("bind_material");
+	if(stream_bind_mtrl){
+		if(!loadBindMaterial(stream_bind_mtrl)){
+			cleanup();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Geometry::loadGeometry(const StreamElement* stream_geom){
+#ifdef DEBUG
+	id.clear();
+	id.append(stream_geom->getID()? stream_geom->getID() : "");
+#endif
+	// geometric_element(bVȊO͖)
+	const StreamElement* stream_mesh = stream_geom->getChild("mesh");
+	if(stream_mesh){
+		try{
+			mesh = new Mesh;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			cleanup();
+			return false;
+		}
+		if(!mesh->load(stream_mesh)){
+			Log_e("could not load Mesh.\n");
+			delete mesh;
+			mesh = NULL;
+			return false;
+		}
+	}
+	calcBounds();
+	return true;
+}
+
+/**
+ * bV擾
+ * xWJꍇ͏߂ĎQƂꂽɓWJAsĂNULL
+ * WJ͕Ƃ1ŝŁAʂ̃XbhĂłdɂ͓WJȂ
+ */
+Mesh* Geometry::getMesh(){
+	// WJIĂ΃bNȂ
+	if(!decode_mutex || ready.isSet())
+		return mesh;
+	ScopedLock lock(decode_mutex);
+	decode();
+	return mesh;
+}
+
+/**
+ * `OɓWJĂ
+ * xWJȂꍇ͉Ȃ
+ */
+bool Geometry::prefetch(){
+	if(!decode_mutex)
+		return true;
+	if(ready.isSet())
+		return decoded;
+	ScopedLock lock(decode_mutex);
+	return decode();
+}
+
+/**
+ * WJȂWJ
+ * decode_mutexbNČĂ
+ * collada-dom͋LȂ̂ŁADOMWJԂdom_mutex
+ */
+bool Geometry::decode(){
+	if(dom_geom){
+		domGeometry* target = dom_geom;
+		dom_geom = NULL;
+		ScopedLock lock(getDomMutex());
+		decoded = load(target);
+	}
+	else
+	if(stream_geom){
+		const StreamElement* target = stream_geom;
+		stream_geom = NULL;
+		decoded = loadGeometry(target);
+	}
+	else{
+		return decoded;
+	}
+	if(!decoded)
+		Log_e("could not decode Geometry.\n");
+	// ȍ~̓bNȂŃbVƋEǂ߂
+	ready.set();
+	return decoded;
+}
+
+/**
+ * bVother̂̂Ɠւ(ēǂݍݗp)
+ * other͓WJĂւAȍ~Geometry͌̕QƂȂ
+ * WJɎsꍇ̓bVȂɂȂ
+ * getMesh()Ɠɂ͌Ă΂Ȃ
+ */
+void Geometry::swapMesh(Geometry* other){
+	other->prefetch();
+	std::swap(mesh, other->mesh);
+	std::swap(has_bounds, other->has_bounds);
+	for(int i = 0; i < 3; i++)
+		std::swap(bounds_center[i], other->bounds_center[i]);
+	std::swap(bounds_radius, other->bounds_radius);
+	std::swap(mesh_hash, other->mesh_hash);
+	decode_mutex = NULL;
+	dom_geom = NULL;
+	stream_geom = NULL;
+	decoded = true;
+}
+
+/**
+ * <bind_material>other̂̂Ɠւ(ēǂݍݗp)
+ */
+void Geometry::swapBindMaterial(Geometry* other){
+	bind_material.swap(other->bind_material);
+	std::swap(material_hash, other->material_hash);
+}
+
+/**
+ * WJς݂
+ * xWJȂꍇ͏true
+ */
+bool Geometry::isDecoded() const{
+	if(!decode_mutex || ready.isSet())
+		return true;
+	ScopedLock lock(decode_mutex);
+	return !dom_geom && !stream_geom;
+}
+
+/**
+ * bV̋E([JW)擾
+ * WJȂǂݍݎɈʒu̔z񂩂狁߂́AbVȂ߂Ȃfalse
+ */
+bool Geometry::getBounds(float* center, float* radius) const{
+	if(!decode_mutex || ready.isSet())
+		return copyBounds(center, radius);
+	ScopedLock lock(decode_mutex);
+	return copyBounds(center, radius);
+}
+
+bool Geometry::copyBounds(float* center, float* radius) const{
+	if(!has_bounds)
+		return false;
+	for(int i = 0; i < 3; i++)
+		center[i] = bounds_center[i];
+	*radius = bounds_radius;
+	return true;
+}
+
+/**
+ * ʒu͈̔͂狫E߂
+ * S͎sE̒SŁAȍŏł͂Ȃ
+ */
+void Geometry::calcBounds(){
+	has_bounds = false;
+	if(!mesh)
+		return;
+	float min[3];
+	float max[3];
+	const TrianglesPtrArray* triangles = mesh->getTriangles();
+	for(TrianglesPtrArray::const_iterator it = triangles->begin(); it != triangles->end(); it++){
+		const Input* position = (*it)->getPosition();
+		if(!position || (position->stride == 0))
+			continue;
+		addBounds(&position->f_array[0], position->f_array.size(), position->stride, min, max);
+	}
+	setBounds(min, max);
+}
+
+/**
+ * values̈ʒu(stride)͈͂ɉ
+ */
+void Geometry::addBounds(const float* values, size_t size, size_t stride, float* min, float* max){
+	const size_t count = size / stride;
+	for(size_t i = 0; i < count; i++){
+		const float* p = &values[i * stride];
+		for(size_t j = 0; j < 3; j++){
+			const float v = (j < stride)? p[j] : 0.0f;
+			if(!has_bounds || (v < min[j]))
+				min[j] = v;
+			if(!has_bounds || (v > max[j]))
+				max[j] = v;
+		}
+		has_bounds = true;
+	}
+}
+
+/**
+ * ͈͂狫E߂(͈͂Ȃ牽Ȃ)
+ */
+void Geometry::setBounds(const float* min, const float* max){
+	if(!has_bounds)
+		return;
+	float r2 = 0.0f;
+	for(int i = 0; i < 3; i++){
+		bounds_center[i] = (min[i] + max[i]) * 0.5f;
+		const float d = max[i] - bounds_center[i];
+		r2 += d * d;
+	}
+	bounds_radius = sqrtf(r2);
+}
+
+/**
+ * WJɋE߂(xWJGeometry̓ǂݍ݂̗DxɎg)
+ * <vertices>POSITIONQƂ<float_array>̒lSĂ͈̔͂Ȃ̂ŁAWJ̋E傫Ƃ
+ * ߂Ȃ΋EȂ̂܂
+ */
+void Geometry::scanBounds(domGeometry* dom_geom){
+	has_bounds = false;
+	const domMesh* dom_mesh = dom_geom->getMesh();
+	const domVertices* dom_verts = dom_mesh? dom_mesh->getVertices() : NULL;
+	if(!dom_verts)
+		return;
+	daeDatabase* dae_db = dom_geom->getDAE()->getDatabase();
+	const domInputLocal_Array& dom_il_array = dom_verts->getInput_array();
+	for(size_t i = 0; i < dom_il_array.getCount(); i++){
+		const domInputLocal* dom_il = dom_il_array.get(i);
+		if(getInputSemanticType(dom_il->getSemantic()) != InputSemantic_Position)
+			continue;
+		domSource* dom_source;
+		if(getElement((daeElement**)&dom_source, dae_db, dom_il->getSource().fragment().c_str(), "source") != DAE_OK)
+			return;
+		const domSource::domTechnique_common* dom_tech_common = dom_source->getTechnique_common();
+		const domAccessor* dom_accessor = dom_tech_common? dom_tech_common->getAccessor() : NULL;
+		if(!dom_accessor || (dom_accessor->getStride() == 0))
+			return;
+		domFloat_array* dom_float_array;
+		if(getElement((daeElement**)&dom_float_array, dae_db, dom_accessor->getSource().fragment().c_str(), "float_array") != DAE_OK)
+			return;
+		const domListOfFloats& values = dom_float_array->getValue();
+		const size_t stride = static_cast<size_t>(dom_accessor->getStride());
+		float min[3];
+		float max[3];
+		float p[3];
+		for(size_t j = 0; j + stride <= values.getCount(); j += stride){
+			for(size_t k = 0; k < 3; k++)
+				p[k] = (k < stride)? static_cast<float>(values[j + k]) : 0.0f;
+			addBounds(p, 3, 3, min, max);
+		}
+		setBounds(min, max);
+		return;
+	}
+}
+
+void Geometry::scanBounds(const StreamElement* stream_geom){
+	has_bounds = false;
+	const StreamElement* stream_mesh = stream_geom->getChild("mesh");
+	const StreamElement* stream_verts = stream_mesh? stream_mesh->getChild("vertices") : NULL;
+	if(!stream_verts)
+		return;
+	StreamDocument* doc = stream_geom->getDocument();
+	for(const StreamElement* stream_il = stream_verts->getChild("input"); stream_il; stream_il = stream_il->getNext("input")){
+		if(getInputSemanticType(stream_il->getAttribute("semantic")) != InputSemantic_Position)
+			continue;
+		const StreamElement* stream_source = doc->getElement(getFragment(stream_il->getAttribute("source")), "source");
+		const StreamElement* stream_tech_common = stream_source? stream_source->getChild("technique_common") : NULL;
+		const StreamElement* stream_accessor = stream_tech_common? stream_tech_common->getChild("accessor") : NULL;
+		if(!stream_accessor)
+			return;
+		const size_t stride = stream_accessor->getAttribute("stride", 1);
+		const StreamElement* stream_float_array = doc->getElement(getFragment(stream_accessor->getAttribute("source")), "float_array");
+		// ϊl͕ɎĉŁAWJ鎞ɕϊȂ
+		const FloatArray* values = stream_float_array? doc->getFloats(stream_float_array) : NULL;
+		if(!values || values->empty() || (stride == 0))
+			return;
+		float min[3];
+		float max[3];
+		addBounds(&(*values)[0], values->size(), stride, min, max);
+		setBounds(min, max);
+		return;
+	}
+}
+
+/**
+ * <instance_material>Ƃ̎QƐ̃nbV
+ * QƐ悪Ȃseed̂܂(ǂݍݑŎs)
+ */
+static Uid hashMaterial(const StreamElement* stream_inst_mtrl, Uid seed){
+	Uid hash = stream_inst_mtrl->getHash(seed);
+	const StreamElement* stream_mtrl = stream_inst_mtrl->getDocument()->resolve(stream_inst_mtrl->getAttribute("target"), "material");
+	if(!stream_mtrl)
+		return hash;
+	hash = stream_mtrl->getHash(hash);
+	const StreamElement* stream_inst_effect = stream_mtrl->getChild("instance_effect");
+	if(!stream_inst_effect)
+		return hash;
+	const StreamElement* stream_effect = stream_mtrl->getDocument()->resolve(stream_inst_effect->getAttribute("url"), "effect");
+	if(!stream_effect)
+		return hash;
+	return stream_effect->getHash(hash);
+}
+
+bool Geometry::loadBindMaterial(const StreamElement* stream_bind_mtrl){
+	// <technique_common>
+	const StreamElement* stream_tech_common = stream_bind_mtrl->getChild("technique_common");
+	if(!stream_tech_common){
+		Log_e("failed to get.\n");
+		cleanup();
+		return false;
+	}
+	// <instance_material>
+	size_t i = 0;
+	for(const StreamElement* stream_inst_mtrl = stream_tech_common->getChild("instance_material"); stream_inst_mtrl; stream_inst_mtrl = stream_inst_mtrl->getNext("instance_material"), i++){
+		material_hash = hashMaterial(stream_inst_mtrl, material_hash);
+		const char* symbol = stream_inst_mtrl->getAttribute("symbol")? stream_inst_mtrl->getAttribute("symbol") : "";
+		Material* mtrl;
+		try{
+			mtrl = new Material;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			cleanup();
+			return false;
+		}
+#if defined(DEBUG) || defined(VALIDATE_UID)
+		mtrl->symbol.clear();
+		mtrl->symbol.append(symbol);
+#endif
+		if(!mtrl->load(stream_inst_mtrl)){
+			Log_e("could not load Material(%d).\n", i);
+			delete mtrl;
+			cleanup();
+			return false;
+		}
+		// o^
+		Uid id = calcHash64(reinterpret_cast<const unsigned char*>(symbol));
+		std::pair<Uid, Material*> p(id, mtrl);
+		std::map<Uid, Material*>::_Pairib pib = bind_material.insert(p);
+		if(!pib.second){	// L[dĂ
+#ifdef VALIDATE_UID
+			if(pib.first->second->symbol != mtrl->symbol)
+				Log_e("uid collision: %s and %s.\n", pib.first->second->symbol.c_str(), mtrl->symbol.c_str());
+#endif
+			delete mtrl;
+			cleanup();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Geometry::load(CacheReader* reader){
+	cleanup();
+	unsigned char exists;
+	if(!reader->readU8(&exists))
+		return false;
+	if(exists){
+		try{
+			mesh = new Mesh;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			cleanup();
+			return false;
+		}
+		if(!mesh->load(reader)){
+			Log_e("could not load Mesh.\n");
+			cleanup();
+			return false;
+		}
+	}
+	if(!reader->readU64(&mesh_hash) || !reader->readU64(&material_hash)){
+		cleanup();
+		return false;
+	}
+	// <bind_material>
+	unsigned int mtrl_count;
+	if(!reader->readU32(&mtrl_count)){
+		cleanup();
+		return false;
+	}
+	calcBounds();
+	for(unsigned int i = 0; i < mtrl_count; i++){
+		Uid id;
+		if(!reader->readU64(&id)){
+			cleanup();
+			return false;
+		}
+		Material* mtrl;
+		try{
+			mtrl = new Material;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			cleanup();
+			return false;
+		}
+		if(!mtrl->load(reader)){
+			Log_e("could not load Material(%d).\n", i);
+			delete mtrl;
+			cleanup();
+			return false;
+		}
+		std::pair<Uid, Material*> p(id, mtrl);
+		std::map<Uid, Material*>::_Pairib pib = bind_material.insert(p);
+		if(!pib.second){	// L[dĂ
+			delete mtrl;
+			cleanup();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Geometry::save(CacheWriter* writer) const{
+	const Mesh* mesh = getMesh();
+	writer->writeU8(mesh? 1 : 0);
+	if(mesh){
+		if(!mesh->save(writer))
+			return false;
+	}
+	writer->writeU64(mesh_hash);
+	writer->writeU64(material_hash);
+	if(!writer->writeU32(static_cast<unsigned int>(bind_material.size())))
+		return false;
+	std::map<Uid, Material*>::const_iterator it = bind_material.begin();
+	while(it != bind_material.end()){
+		writer->writeU64(it->first);
+		if(!it->second->save(writer))
+			return false;
+		it++;
+	}
+	return true;
+}
+
 } // namespace collada
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "collada_def.h"
 #include "collada_util.h"
 #include "collada_material.h"
+#include "thread.h"
 
 namespace collada{
 
@@ -21,6 +22,10 @@ public:
 	~Triangles();
 	void cleanup();
 	bool load(domTriangles*);
+	bool load(const StreamElement*, const UintArray&);
+	bool load(CacheReader*);
+	bool save(CacheWriter*) const;
+	bool validate() const;
 
 	Input* getPosition(){ return position; }
 	const Input* getPosition() const { return position; }
@@ -30,10 +35,13 @@ public:
 	const InputPtrArray* getTexCoords() const { return texcoords; }
 	UintArray* getIndices(){ return indices; }
 	const UintArray* getIndices() const { return indices; }
-	unsigned int getMaterialUid() const { return mtrl_uid; }
+	Uid getMaterialUid() const { return mtrl_uid; }
+	unsigned int getMaterialIndex() const { return mtrl_index; }
+	void setMaterialIndex(unsigned int index){ mtrl_index = index; }
 private:
 	bool load(const domInputLocalOffset*, const domP*, domUint);
 	bool load(const domInputLocal*, const domP*, domUint, domUint, domUint);
+	bool load(const StreamElement*, const UintArray&, size_t, size_t);
 	bool optimize();
 	bool isOverlapped(size_t target_index, size_t* overlapped_index);
 private:
@@ -41,7 +49,8 @@ private:
 	Input* normal;
 	InputPtrArray* texcoords;
 	UintArray* indices;
-	unsigned int mtrl_uid;
+	Uid mtrl_uid;
+	unsigned int mtrl_index;	// MaterialTable̓Y(o^ȂINVALID_INDEX)
 #ifdef DEBUG
 	std::string material;
 #endif
@@ -53,9 +62,14 @@ public:
 	~Mesh();
 	void cleanup();
 	bool load(domMesh*);
+	bool load(const StreamElement*);
+	bool load(CacheReader*);
+	bool save(CacheWriter*) const;
 
 	TrianglesPtrArray* getTriangles(){ return triangles; }
 	const TrianglesPtrArray* getTriangles() const { return triangles; }
+private:
+	bool load(const StreamElement*, const UintArray&);
 private:
 	TrianglesPtrArray* triangles;
 };
@@ -66,17 +80,46 @@ public:
 	~Geometry();
 	void cleanup();
 	bool load(domInstance_geometry*);
+	bool load(const StreamElement*);
+	bool load(CacheReader*);
+	bool save(CacheWriter*) const;
+	bool prefetch();
+	bool isDecoded() const;
+	bool getBounds(float* center, float* radius) const;
+	Uid getMeshHash() const { return mesh_hash; }
+	Uid getMaterialHash() const { return material_hash; }
+	void swapMesh(Geometry* other);
+	void swapBindMaterial(Geometry* other);
 
-	Mesh* getMesh(){ return mesh; }
-	const Mesh* getMesh() const { return mesh; }
-	std::map<unsigned int, Material*>& getBindMaterial(){ return bind_material; }
-	const std::map<unsigned int, Material*>& getBindMaterial() const { return bind_material; }
+	Mesh* getMesh();
+	const Mesh* getMesh() const { return const_cast<Geometry*>(this)->getMesh(); }
+	std::map<Uid, Material*>& getBindMaterial(){ return bind_material; }
+	const std::map<Uid, Material*>& getBindMaterial() const { return bind_material; }
 private:
 	bool load(domGeometry*);
 	bool load(domBind_material*);
+	bool loadGeometry(const StreamElement*);
+	bool loadBindMaterial(const StreamElement*);
+	bool decode();
+	void calcBounds();
+	void addBounds(const float* values, size_t size, size_t stride, float* min, float* max);
+	void setBounds(const float* min, const float* max);
+	void scanBounds(domGeometry* dom_geom);
+	void scanBounds(const StreamElement* stream_geom);
+	bool copyBounds(float* center, float* radius) const;
 private:
-	std::map<unsigned int, Material*> bind_material;
+	std::map<Uid, Material*> bind_material;
 	Mesh* mesh;	// bV̂ݑΉ
+	Mutex* decode_mutex;	// xWJꍇ̔r(NULLȂǂݍݎɓWJς)
+	domGeometry* dom_geom;	// WJ<geometry>
+	const StreamElement* stream_geom;
+	bool decoded;	// WJł
+	ReadyFlag ready;	// WJI(decode_mutex炸ɓǂ߂)
+	bool has_bounds;
+	float bounds_center[3];	// bV̋E([JW)
+	float bounds_radius;
+	Uid mesh_hash;	// <geometry>̓ẽnbV(sȂINVALID_UID)
+	Uid material_hash;	// <instance_material>ƎQƐ<material>A<effect>̃nbV
 #ifdef DEBUG
 	std::string url;
 	std::string id;
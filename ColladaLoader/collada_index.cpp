@@ -0,0 +1,108 @@
+﻿#include <string.h>
+#include <vector>
+#include "collada_context.h"
+#include "collada_index.h"
+#include "hash64.h"
+#include "log.h"
+
+namespace collada{
+
+IdIndex::IdIndex(){
+	dae_db = NULL;
+	stats.elements = 0;
+	stats.hits = 0;
+	stats.misses = 0;
+}
+
+IdIndex::~IdIndex(){
+	cleanup();
+}
+
+void IdIndex::cleanup(){
+	elements.clear();
+	dae_db = NULL;
+	stats.elements = 0;
+	stats.hits = 0;
+	stats.misses = 0;
+}
+
+/**
+ * 型名をシードにしてIDをハッシュ化
+ */
+Uid IdIndex::getKey(const char* id, const char* type){
+	const unsigned long long seed = calcHash64(reinterpret_cast<const unsigned char*>(type));
+	return calcHash64(reinterpret_cast<const unsigned char*>(id), strlen(id), seed);
+}
+
+void IdIndex::add(daeElement* dae_elem){
+	const char* id = dae_elem->getID();
+	if((id == NULL) || (id[0] == '\0'))
+		return;
+	std::pair<Uid, daeElement*> p(getKey(id, dae_elem->getTypeName()), dae_elem);
+	// 重複した場合は文書順で先のものを優先(daeDatabaseと同じ)
+	// キーの衝突はgetElement()で検出してdaeDatabaseに任せる
+	if(elements.insert(p).second)
+		stats.elements++;
+}
+
+/**
+ * 文書全体を走査して索引を作成
+ * 階層が深くてもスタックを消費しないように明示的なスタックで辿る
+ */
+bool IdIndex::build(daeDatabase* dae_db){
+	cleanup();
+	this->dae_db = dae_db;
+	daeElement* dae_root;
+	if(dae_db->getElement(&dae_root, 0, NULL, "COLLADA") != DAE_OK){
+		Log_e("element <COLLADA> not found.\n");
+		return false;
+	}
+	std::vector<daeElement*> stack;
+	stack.push_back(dae_root);
+	while(!stack.empty()){
+		daeElement* dae_elem = stack.back();
+		stack.pop_back();
+		add(dae_elem);
+		daeElementRefArray children;
+		dae_elem->getChildren(children);
+		// 文書順に処理するため逆順に積む
+		for(size_t i = children.getCount(); i > 0; i--){
+			stack.push_back(children.get(i - 1));
+		}
+	}
+	return true;
+}
+
+/**
+ * daeDatabase::getElement()の代わり
+ * 索引に無ければdaeDatabaseに問い合わせる
+ */
+daeInt IdIndex::getElement(daeElement** element, const char* id, const char* type){
+	if((id != NULL) && (type != NULL)){
+		std::map<Uid, daeElement*>::iterator it = elements.find(getKey(id, type));
+		if(it != elements.end()){
+			daeElement* dae_elem = it->second;
+			if((strcmp(dae_elem->getID(), id) == 0) && (strcmp(dae_elem->getTypeName(), type) == 0)){
+				*element = dae_elem;
+				stats.hits++;
+				return DAE_OK;
+			}
+		}
+	}
+	stats.misses++;
+	if(!dae_db)
+		return DAE_ERR_QUERY_NO_MATCH;
+	return dae_db->getElement(element, 0, id, type);
+}
+
+/**
+ * 読み込み中は索引を使い、それ以外はdaeDatabaseに問い合わせる
+ */
+daeInt getElement(daeElement** element, daeDatabase* dae_db, const char* id, const char* type){
+	const LoadContext* context = LoadContext::get();
+	if(context && context->id_index)
+		return context->id_index->getElement(element, id, type);
+	return dae_db->getElement(element, 0, id, type);
+}
+
+} // namespace collada
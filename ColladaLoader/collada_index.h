@@ -0,0 +1,39 @@
+﻿#pragma once
+#include <dae.h>
+#include <dom/domCOLLADA.h>
+#include <map>
+#include "collada_def.h"
+
+namespace collada{
+
+/**
+ * IDからエレメントを引くための索引
+ * 読み込みの最初に文書を一度だけ走査して作成する
+ * キーはIDと型名から作るので同じIDでも型が異なれば別扱い
+ */
+class IdIndex{
+public:
+	typedef struct{
+		size_t elements;	// 登録数
+		size_t hits;		// 索引で解決した数
+		size_t misses;		// daeDatabaseに問い合わせた数
+	}Stats;
+public:
+	IdIndex();
+	~IdIndex();
+	bool build(daeDatabase* dae_db);
+	void cleanup();
+	daeInt getElement(daeElement** element, const char* id, const char* type);
+	const Stats& getStats() const { return stats; }
+private:
+	static Uid getKey(const char* id, const char* type);
+	void add(daeElement* dae_elem);
+private:
+	daeDatabase* dae_db;
+	std::map<Uid, daeElement*> elements;
+	Stats stats;
+};
+
+daeInt getElement(daeElement** element, daeDatabase* dae_db, const char* id, const char* type);
+
+} // namespace collada
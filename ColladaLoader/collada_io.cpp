@@ -0,0 +1,140 @@
+﻿#include <string.h>
+#include <new>
+#include "collada_io.h"
+#include "log.h"
+
+namespace collada{
+
+////////////////////////////////////////////////////////////////////////////////
+
+MemoryStream::MemoryStream(const void* data, size_t size){
+	this->data = static_cast<const unsigned char*>(data);
+	this->size = size;
+	pos = 0;
+}
+
+size_t MemoryStream::read(void* buffer, size_t size){
+	const size_t rest = this->size - pos;
+	if(size > rest)
+		size = rest;
+	memcpy(buffer, data + pos, size);
+	pos += size;
+	return size;
+}
+
+bool MemoryStream::seek(unsigned long long offset){
+	if(offset > size)
+		return false;
+	pos = static_cast<size_t>(offset);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BufferStream::BufferStream(std::vector<unsigned char>* buffer){
+	data.swap(*buffer);
+	pos = 0;
+}
+
+size_t BufferStream::read(void* buffer, size_t size){
+	const size_t rest = data.size() - pos;
+	if(size > rest)
+		size = rest;
+	if(size > 0)
+		memcpy(buffer, &data[pos], size);
+	pos += size;
+	return size;
+}
+
+bool BufferStream::seek(unsigned long long offset){
+	if(offset > data.size())
+		return false;
+	pos = static_cast<size_t>(offset);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+FileStream::FileStream(){
+	pos = 0;
+}
+
+bool FileStream::open(const char* filename){
+	pos = 0;
+	return file.open(filename);
+}
+
+size_t FileStream::read(void* buffer, size_t size){
+	const size_t rest = file.getSize() - pos;
+	if(size > rest)
+		size = rest;
+	memcpy(buffer, file.getData() + pos, size);
+	pos += size;
+	return size;
+}
+
+bool FileStream::seek(unsigned long long offset){
+	if(offset > file.getSize())
+		return false;
+	pos = static_cast<size_t>(offset);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Stream* FileResolver::open(const char* uri){
+	FileStream* stream;
+	try{
+		stream = new FileStream;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return NULL;
+	}
+	if(!stream->open(uri)){
+		delete stream;
+		return NULL;
+	}
+	return stream;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * ストリームの内容全体をoutputへ読み込む
+ */
+bool readStream(Stream* stream, std::vector<unsigned char>* output){
+	const unsigned long long size = stream->getSize();
+	if(size > static_cast<size_t>(-1))
+		return false;
+	try{
+		output->resize(static_cast<size_t>(size));
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	if(size == 0)
+		return true;
+	const unsigned char* data = stream->getData();
+	if(data){
+		memcpy(&(*output)[0], data, static_cast<size_t>(size));
+		return true;
+	}
+	if(!stream->seek(0))
+		return false;
+	size_t total = 0;
+	while(total < output->size()){
+		const size_t n = stream->read(&(*output)[total], output->size() - total);
+		if(n == 0)
+			break;
+		total += n;
+	}
+	if(total != output->size()){
+		Log_e("unexpected end of stream.\n");
+		return false;
+	}
+	return true;
+}
+
+} // namespace collada
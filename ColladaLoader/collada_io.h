@@ -0,0 +1,90 @@
+﻿/**
+ * 読み込み元の抽象化
+ * ファイル以外(メモリ上のバッファや独自のキャッシュ)からも文書や画像を読めるようにする
+ */
+#pragma once
+#include <stddef.h>
+#include <vector>
+#include "mapped_file.h"
+
+namespace collada{
+
+/**
+ * 読み込み元のストリーム
+ * 内容全体がメモリ上にあればgetData()で直接参照できる(複製しない)
+ */
+class Stream{
+public:
+	virtual ~Stream(){}
+	virtual size_t read(void* buffer, size_t size) = 0;	// 読めたバイト数を返す
+	virtual bool seek(unsigned long long offset) = 0;	// 先頭からの位置
+	virtual unsigned long long getSize() = 0;
+	virtual const unsigned char* getData(){ return NULL; }
+};
+
+/**
+ * メモリ上のバッファ
+ * dataは使い終わるまで呼び出し側で保持する
+ */
+class MemoryStream : public Stream{
+public:
+	MemoryStream(const void* data, size_t size);
+	size_t read(void* buffer, size_t size);
+	bool seek(unsigned long long offset);
+	unsigned long long getSize(){ return size; }
+	const unsigned char* getData(){ return data; }
+private:
+	const unsigned char* data;
+	size_t size;
+	size_t pos;
+};
+
+/**
+ * 中身を所有するメモリ上のバッファ
+ * bufferの中身を受け取る(bufferは空になる)
+ */
+class BufferStream : public Stream{
+public:
+	BufferStream(std::vector<unsigned char>* buffer);
+	size_t read(void* buffer, size_t size);
+	bool seek(unsigned long long offset);
+	unsigned long long getSize(){ return data.size(); }
+	const unsigned char* getData(){ return data.empty()? NULL : &data[0]; }
+private:
+	std::vector<unsigned char> data;
+	size_t pos;
+};
+
+/**
+ * メモリにマップしたファイル
+ */
+class FileStream : public Stream{
+public:
+	FileStream();
+	bool open(const char* filename);
+	size_t read(void* buffer, size_t size);
+	bool seek(unsigned long long offset);
+	unsigned long long getSize(){ return file.getSize(); }
+	const unsigned char* getData(){ return file.getData(); }
+private:
+	MappedFile file;
+	size_t pos;
+};
+
+/**
+ * 文書から参照されるファイル(画像、外部の文書)を開く
+ */
+class Resolver{
+public:
+	virtual ~Resolver(){}
+	virtual Stream* open(const char* uri) = 0;	// 開けなければNULL、呼び出し側でdeleteする
+};
+
+class FileResolver : public Resolver{
+public:
+	Stream* open(const char* uri);
+};
+
+bool readStream(Stream* stream, std::vector<unsigned char>* output);
+
+} // namespace collada
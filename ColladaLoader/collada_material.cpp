@@ -1,12 +1,19 @@
-#include "crc32.h"
+#include "hash64.h"
 #include "collada_material.h"
+#include "collada_async.h"
+#include "collada_cache.h"
+#include "collada_context.h"
+#include "collada_stream.h"
+#include "collada_index.h"
 #include "log.h"
 
 namespace collada{
 
-extern std::string path;
 extern void getFilePath(std::string* output, const char* uri);
 extern void getFileName(std::string* output, const char* filepath);
+extern void getImageName(std::string* output, const std::string& uri);
+extern bool getImageName(std::string* output, const domImage* dom_image);
+extern bool getImageName(std::string* output, const StreamElement* stream_image);
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -17,9 +24,31 @@ bool VertexInput::load(domInstance_material::domBind_vertex_input* dom_bind_vert
 	return true;
 }
 
+bool VertexInput::load(const StreamElement* stream_bind_vert_input){
+	const char* semantic = stream_bind_vert_input->getAttribute("semantic");
+	const char* input_semantic = stream_bind_vert_input->getAttribute("input_semantic");
+	this->semantic.append(semantic? semantic : "");
+	this->input_semantic.append(input_semantic? input_semantic : "");
+	set = stream_bind_vert_input->getAttribute("input_set", 0);
+	return true;
+}
+
+bool VertexInput::load(CacheReader* reader){
+	return reader->readString(&semantic)
+		&& reader->readString(&input_semantic)
+		&& reader->readU32(&set);
+}
+
+bool VertexInput::save(CacheWriter* writer) const{
+	writer->writeString(semantic);
+	writer->writeString(input_semantic);
+	return writer->writeU32(set);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 Material::Sampler::Sampler(){
+	image_uid = INVALID_UID;
 	wrap_s = Wrap_Clamp;
 	wrap_t = Wrap_Clamp;
 	wrap_p = Wrap_Clamp;
@@ -47,6 +76,7 @@ Material::Param::~Param(){
 ////////////////////////////////////////////////////////////////////////////////
 
 Material::Material(){
+	shading = Shading_Phong;
 	shininess = 0.0f;
 	reflectivity = 0.0f;
 	transparency = 0.0f;
@@ -97,12 +127,17 @@ void Material::cleanup(){
 }
 
 bool Material::load(domInstance_material* dom_inst_mtrl){
+	if(!checkProgress(LoadStage_Material)){
+		Log_i("canceled.\n");
+		cleanup();
+		return false;
+	}
 	const char* target = dom_inst_mtrl->getTarget().fragment().c_str();
 #if 1
 	daeDatabase* dae_db = dom_inst_mtrl->getDAE()->getDatabase();
 	// <library_materials>
 	domMaterial* dom_mtrl;
-	if(dae_db->getElement((daeElement**)&dom_mtrl, 0, target, "material") != DAE_OK){
+	if(getElement((daeElement**)&dom_mtrl, dae_db, target, "material") != DAE_OK){
 		Log_e("element <material> %s not found.\n", target);
 		cleanup();
 		return false;
@@ -116,7 +151,7 @@ bool Material::load(domInstance_material* dom_inst_mtrl){
 	// <library_effects>
 	const char* url = dom_inst_effect->getUrl().fragment().c_str();
 	domEffect* dom_effect;
-	if(dae_db->getElement((daeElement**)&dom_effect, 0, url, "effect") != DAE_OK){
+	if(getElement((daeElement**)&dom_effect, dae_db, url, "effect") != DAE_OK){
 		Log_e("element <effect> %s not found.\n", url);
 		cleanup();
 		return false;
@@ -127,7 +162,7 @@ bool Material::load(domInstance_material* dom_inst_mtrl){
 	size_t prof_count = dom_effect->getFx_profile_abstract_array().getCount();
 	for(size_t i = 0; i < prof_count; i++){
 		domFx_profile_abstract* dom_fx_abst = dom_effect->getFx_profile_abstract_array().get(i);
-		if(strcmp(dom_fx_abst->getTypeName(), "profile_COMMON") == 0){
+		if(dom_fx_abst->typeID() == domProfile_COMMON::ID()){
 			domProfile_COMMON* dom_prof_common = dynamic_cast<domProfile_COMMON*>(dom_fx_abst);
 			if(!load(dom_prof_common)){
 				Log_e("could not load <profile_COMMON>.\n");
@@ -170,17 +205,25 @@ bool Material::load(domInstance_material* dom_inst_mtrl){
 
 bool Material::load(const domProfile_COMMON* dom_prof_common){
 	// for constant shading
-	if(dom_prof_common->getTechnique()->getConstant())
+	if(dom_prof_common->getTechnique()->getConstant()){
+		shading = Shading_Constant;
 		return load(dom_prof_common->getTechnique()->getConstant());
+	}
 	// for lambert shading
-	if(dom_prof_common->getTechnique()->getLambert())
+	if(dom_prof_common->getTechnique()->getLambert()){
+		shading = Shading_Lambert;
 		return load(dom_prof_common->getTechnique()->getLambert());
+	}
 	// for phong shading
-	if(dom_prof_common->getTechnique()->getPhong())
+	if(dom_prof_common->getTechnique()->getPhong()){
+		shading = Shading_Phong;
 		return load(dom_prof_common->getTechnique()->getPhong());
+	}
 	// for blinn shading
-	if(dom_prof_common->getTechnique()->getBlinn())
+	if(dom_prof_common->getTechnique()->getBlinn()){
+		shading = Shading_Blinn;
 		return load(dom_prof_common->getTechnique()->getBlinn());
+	}
 	// error
 	return false;
 }
@@ -198,7 +241,7 @@ bool Material::load(const domProfile_COMMON::domTechnique::domConstant* dom_cons
 		if(!load(&transparent, dom_constant->getTransparent()))
 			return false;
 	if(dom_constant->getTransparency())
-		reflectivity = static_cast<float>(dom_constant->getTransparency()->getFloat()->getValue());
+		transparency = static_cast<float>(dom_constant->getTransparency()->getFloat()->getValue());
 	if(dom_constant->getIndex_of_refraction())
 		index_of_refraction = static_cast<float>(dom_constant->getIndex_of_refraction()->getFloat()->getValue());
 	return true;
@@ -223,7 +266,7 @@ bool Material::load(const domProfile_COMMON::domTechnique::domLambert* dom_lambe
 		if(!load(&transparent, dom_lambert->getTransparent()))
 			return false;
 	if(dom_lambert->getTransparency())
-		reflectivity = static_cast<float>(dom_lambert->getTransparency()->getFloat()->getValue());
+		transparency = static_cast<float>(dom_lambert->getTransparency()->getFloat()->getValue());
 	if(dom_lambert->getIndex_of_refraction())
 		index_of_refraction = static_cast<float>(dom_lambert->getIndex_of_refraction()->getFloat()->getValue());
 	return true;
@@ -253,7 +296,7 @@ bool Material::load(const domProfile_COMMON::domTechnique::domPhong* dom_phong){
 		if(!load(&transparent, dom_phong->getTransparent()))
 			return false;
 	if(dom_phong->getTransparency())
-		reflectivity = static_cast<float>(dom_phong->getTransparency()->getFloat()->getValue());
+		transparency = static_cast<float>(dom_phong->getTransparency()->getFloat()->getValue());
 	if(dom_phong->getIndex_of_refraction())
 		index_of_refraction = static_cast<float>(dom_phong->getIndex_of_refraction()->getFloat()->getValue());
 	return true;
@@ -283,7 +326,7 @@ bool Material::load(const domProfile_COMMON::domTechnique::domBlinn* dom_blinn){
 		if(!load(&transparent, dom_blinn->getTransparent()))
 			return false;
 	if(dom_blinn->getTransparency())
-		reflectivity = static_cast<float>(dom_blinn->getTransparency()->getFloat()->getValue());
+		transparency = static_cast<float>(dom_blinn->getTransparency()->getFloat()->getValue());
 	if(dom_blinn->getIndex_of_refraction())
 		index_of_refraction = static_cast<float>(dom_blinn->getIndex_of_refraction()->getFloat()->getValue());
 	return true;
@@ -359,17 +402,17 @@ bool Material::load(Param* param, const domCommon_color_or_texture_type* dom_com
 #if 1
 		daeDatabase* dae_db = const_cast<domCommon_color_or_texture_type*>(dom_common_c_or_t_type)->getDAE()->getDatabase();
 		domImage* dom_image;
-		if(dae_db->getElement((daeElement**)&dom_image, 0, image, "image") != DAE_OK){
+		if(getElement((daeElement**)&dom_image, dae_db, image, "image") != DAE_OK){
 			Log_e("element <image> %s not found.\n", image);
 			return false;
 		}
-		const char* filepath = dom_image->getInit_from()->getValue().getPath();
 		std::string image_name;
-		getFileName(&image_name, filepath);
+		if(!getImageName(&image_name, dom_image))
+			return false;
 		std::string temp;
-		temp.append(path);
+		temp.append(LoadContext::getPath());
 		temp.append(image_name);
-		param->sampler->image_uid = calcCRC32(reinterpret_cast<const unsigned char*>(temp.c_str()));
+		param->sampler->image_uid = calcHash64(reinterpret_cast<const unsigned char*>(temp.c_str()));
 #endif
 	}
 	return true;
@@ -391,4 +434,374 @@ bool Material::load(Param* param, const domCommon_transparent_type* dom_common_t
 	return true;
 }
 
+bool Material::load(const StreamElement* stream_inst_mtrl){
+	if(!checkProgress(LoadStage_Material)){
+		Log_i("canceled.\n");
+		cleanup();
+		return false;
+	}
+	StreamDocument* doc = stream_inst_mtrl->getDocument();
+	const char* target_uri = stream_inst_mtrl->getAttribute("target");
+	const char* target = getFragment(target_uri);
+	// <library_materials>
+	const StreamElement* stream_mtrl = doc->resolve(target_uri, "material");
+	if(!stream_mtrl){
+		Log_e("element <material> %s not found.\n", target);
+		cleanup();
+		return false;
+	}
+	const StreamElement* stream_inst_effect = stream_mtrl->getChild("instance_effect");
+	if(!stream_inst_effect){
+		Log_e("failed to get.\n", target);
+		cleanup();
+		return false;
+	}
+	// <library_effects>
+	const char* uri = stream_inst_effect->getAttribute("url");
+	const char* url = getFragment(uri);
+	// <material>O̕ɂ΂̕T
+	const StreamElement* stream_effect = stream_mtrl->getDocument()->resolve(uri, "effect");
+	if(!stream_effect){
+		Log_e("element <effect> %s not found.\n", url);
+		cleanup();
+		return false;
+	}
+	// }eAWJ
+	// ŏɌ<profile_COMMON>̂ݓKp
+	const StreamElement* stream_prof_common = stream_effect->getChild("profile_COMMON");
+	if(!stream_prof_common){
+		Log_e("material not found.\n");
+		cleanup();
+		return false;
+	}
+	const StreamElement* stream_technique = stream_prof_common->getChild("technique");
+	if(!stream_technique || !loadTechnique(stream_technique)){
+		Log_e("could not load <profile_COMMON>.\n");
+		cleanup();
+		return false;
+	}
+	// <bind_vertex_input>
+	size_t i = 0;
+	for(const StreamElement* elem = stream_inst_mtrl->getChild("bind_vertex_input"); elem; elem = elem->getNext("bind_vertex_input"), i++){
+		VertexInput* vi;
+		try{
+			vi = new VertexInput;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			cleanup();
+			return false;
+		}
+		if(!vi->load(elem)){
+			Log_e("could not load VertexInput(%d).\n", i);
+			delete vi;
+			cleanup();
+			return false;
+		}
+		vis.push_back(vi);
+	}
+	return true;
+}
+
+/**
+ * <constant>, <lambert>, <phong>, <blinn>̓ǂݍ
+ * evf̃XL[}͎̍qvf̗LȂ̂œň
+ */
+bool Material::loadTechnique(const StreamElement* stream_technique){
+	static const char* const shadings[] = { "constant", "lambert", "phong", "blinn" };
+	const StreamElement* stream_shading = NULL;
+	for(size_t i = 0; (i < sizeof(shadings)/sizeof(shadings[0])) && !stream_shading; i++){
+		stream_shading = stream_technique->getChild(shadings[i]);
+		shading = static_cast<Shading>(Shading_Constant + i);	// shadingsƓ
+	}
+	if(!stream_shading)
+		return false;
+	for(const StreamElement* elem = stream_shading->getChild(); elem; elem = elem->getSibling()){
+		Param* param = NULL;
+		float* value = NULL;
+		if(elem->isName("emission"))
+			param = &emission;
+		else
+		if(elem->isName("ambient"))
+			param = &ambient;
+		else
+		if(elem->isName("diffuse"))
+			param = &diffuse;
+		else
+		if(elem->isName("specular"))
+			param = &specular;
+		else
+		if(elem->isName("reflective"))
+			param = &reflective;
+		else
+		if(elem->isName("transparent"))
+			param = &transparent;
+		else
+		if(elem->isName("shininess"))
+			value = &shininess;
+		else
+		if(elem->isName("reflectivity"))
+			value = &reflectivity;
+		else
+		if(elem->isName("transparency"))
+			value = &transparency;
+		else
+		if(elem->isName("index_of_refraction"))
+			value = &index_of_refraction;
+
+		if(param == &transparent){
+			if(elem->getChild("texture")){
+				param->type = Param::Param_Texture;
+				// ToDo:
+			}
+			else
+			if(!load(param, elem)){
+				return false;
+			}
+		}
+		else
+		if(param){
+			if(!load(param, elem))
+				return false;
+		}
+		else
+		if(value){
+			const StreamElement* stream_float = elem->getChild("float");
+			size_t count;
+			if(stream_float && !stream_float->getFloats(value, 1, &count))
+				return false;
+		}
+	}
+	return true;
+}
+
+static const StreamElement* find(const StreamElement* stream_prof_common, const char* sid){
+	for(const StreamElement* elem = stream_prof_common->getChild("newparam"); elem; elem = elem->getNext("newparam")){
+		const char* attr = elem->getAttribute("sid");
+		if(attr && (strcmp(sid, attr) == 0))
+			return elem;
+	}
+	return NULL;
+}
+
+bool Material::load(Param* param, const StreamElement* stream_c_or_t){
+	const StreamElement* stream_color = stream_c_or_t->getChild("color");
+	const StreamElement* stream_texture = stream_c_or_t->getChild("texture");
+	if(stream_color){
+		param->type = Param::Param_Color;
+		size_t count;
+		if(!stream_color->getFloats(param->color, 4, &count))
+			return false;
+	}
+	else
+	if(stream_texture){
+		param->type = Param::Param_Texture;
+
+		try{
+			param->sampler = new Sampler;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			return false;
+		}
+
+		const char* sampler = stream_texture->getAttribute("texture");
+		const char* texcoord = stream_texture->getAttribute("texcoord");
+		if(!sampler)
+			return false;
+#ifdef DEBUG
+		param->sampler->texture.clear();
+		param->sampler->texture.append(sampler);
+		param->sampler->texcoord.clear();
+		param->sampler->texcoord.append(texcoord? texcoord : "");
+#endif
+		// <constant> or <lambert> or <phong> or <blinn>
+		const StreamElement* elem = stream_c_or_t->getParent();
+		// <technique>
+		elem = elem->getParent();
+		// <profile_COMMON>
+		const StreamElement* stream_prof_common = elem->getParent();
+		// <newparam> for <sampler*>
+		const StreamElement* stream_newparam = find(stream_prof_common, sampler);
+		if(!stream_newparam)
+			return false;
+		const StreamElement* stream_sampler2d = stream_newparam->getChild("sampler2D");
+		if(!stream_sampler2d)	// Ƃ肠Sampler2D̂
+			return false;
+		const StreamElement* stream_source = stream_sampler2d->getChild("source");
+		if(!stream_source)
+			return false;
+		std::string surface;
+		stream_source->getText(&surface);
+		// <newparam> for <surface*>
+		stream_newparam = find(stream_prof_common, surface.c_str());
+		if(!stream_newparam)
+			return false;
+		const StreamElement* stream_surface = stream_newparam->getChild("surface");
+		if(!stream_surface)
+			return false;
+		// eNX`1ɂĂ̂ōŏ̗vfo
+		const StreamElement* stream_init_from = stream_surface->getChild("init_from");
+		if(!stream_init_from)
+			return false;
+		std::string image;
+		stream_init_from->getText(&image);
+#ifdef DEBUG
+		param->sampler->image.clear();
+		param->sampler->image.append(image);
+#endif
+		const StreamElement* stream_image = stream_c_or_t->getDocument()->getElement(image.c_str(), "image");
+		if(!stream_image){
+			Log_e("element <image> %s not found.\n", image.c_str());
+			return false;
+		}
+		std::string image_name;
+		if(!getImageName(&image_name, stream_image))
+			return false;
+		std::string temp;
+		temp.append(LoadContext::getPath());
+		temp.append(image_name);
+		param->sampler->image_uid = calcHash64(reinterpret_cast<const unsigned char*>(temp.c_str()));
+	}
+	return true;
+}
+
+static bool save(CacheWriter* writer, const Material::Param* param){
+	writer->writeU32(static_cast<unsigned int>(param->type));
+	for(size_t i = 0; i < 4; i++){
+		writer->writeF32(param->color[i]);
+	}
+	const Material::Sampler* sampler = param->sampler;
+	writer->writeU8(sampler? 1 : 0);
+	if(sampler){
+		writer->writeU64(sampler->image_uid);
+		writer->writeU32(static_cast<unsigned int>(sampler->wrap_s));
+		writer->writeU32(static_cast<unsigned int>(sampler->wrap_t));
+		writer->writeU32(static_cast<unsigned int>(sampler->wrap_p));
+		writer->writeU32(static_cast<unsigned int>(sampler->minfilter));
+		writer->writeU32(static_cast<unsigned int>(sampler->magfilter));
+		writer->writeU32(static_cast<unsigned int>(sampler->mipfilter));
+	}
+	return writer->writeU8(0);	// I[
+}
+
+static bool load(CacheReader* reader, Material::Param* param){
+	unsigned int type;
+	if(!reader->readU32(&type) || (type >= Material::Param::Param_Size))
+		return false;
+	param->type = static_cast<Material::Param::ParamType>(type);
+	for(size_t i = 0; i < 4; i++){
+		if(!reader->readF32(&param->color[i]))
+			return false;
+	}
+	unsigned char exists;
+	if(!reader->readU8(&exists))
+		return false;
+	if(exists){
+		try{
+			param->sampler = new Material::Sampler;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			return false;
+		}
+		unsigned int modes[6];
+		if(!reader->readU64(&param->sampler->image_uid))
+			return false;
+		for(size_t i = 0; i < 6; i++){
+			if(!reader->readU32(&modes[i]))
+				return false;
+		}
+		param->sampler->wrap_s = static_cast<Material::Sampler::WrapMode>(modes[0]);
+		param->sampler->wrap_t = static_cast<Material::Sampler::WrapMode>(modes[1]);
+		param->sampler->wrap_p = static_cast<Material::Sampler::WrapMode>(modes[2]);
+		param->sampler->minfilter = static_cast<Material::Sampler::FilterMode>(modes[3]);
+		param->sampler->magfilter = static_cast<Material::Sampler::FilterMode>(modes[4]);
+		param->sampler->mipfilter = static_cast<Material::Sampler::FilterMode>(modes[5]);
+	}
+	unsigned char terminator;
+	return reader->readU8(&terminator) && (terminator == 0);
+}
+
+bool Material::load(CacheReader* reader){
+	cleanup();
+#if defined(DEBUG) || defined(VALIDATE_UID)
+	if(!reader->readString(&symbol)){
+		cleanup();
+		return false;
+	}
+#endif
+	// <bind_vertex_input>
+	unsigned int vi_count;
+	if(!reader->readU32(&vi_count)){
+		cleanup();
+		return false;
+	}
+	for(unsigned int i = 0; i < vi_count; i++){
+		VertexInput* vi;
+		try{
+			vi = new VertexInput;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			cleanup();
+			return false;
+		}
+		if(!vi->load(reader)){
+			Log_e("could not load VertexInput(%d).\n", i);
+			delete vi;
+			cleanup();
+			return false;
+		}
+		vis.push_back(vi);
+	}
+	if(!collada::load(reader, &emission)
+	|| !collada::load(reader, &ambient)
+	|| !collada::load(reader, &diffuse)
+	|| !collada::load(reader, &specular)
+	|| !collada::load(reader, &reflective)
+	|| !collada::load(reader, &transparent)
+	|| !reader->readF32(&shininess)
+	|| !reader->readF32(&reflectivity)
+	|| !reader->readF32(&transparency)
+	|| !reader->readF32(&index_of_refraction)){
+		cleanup();
+		return false;
+	}
+	unsigned char value;
+	if(!reader->readU8(&value) || (value > Shading_Blinn)){
+		cleanup();
+		return false;
+	}
+	shading = static_cast<Shading>(value);
+	return true;
+}
+
+bool Material::save(CacheWriter* writer) const{
+#if defined(DEBUG) || defined(VALIDATE_UID)
+	writer->writeString(symbol);
+#endif
+	// <bind_vertex_input>
+	if(!writer->writeU32(static_cast<unsigned int>(vis.size())))
+		return false;
+	VertexInputPtrArray::const_iterator it = vis.begin();
+	while(it != vis.end()){
+		if(!(*it)->save(writer))
+			return false;
+		it++;
+	}
+	if(!collada::save(writer, &emission)
+	|| !collada::save(writer, &ambient)
+	|| !collada::save(writer, &diffuse)
+	|| !collada::save(writer, &specular)
+	|| !collada::save(writer, &reflective)
+	|| !collada::save(writer, &transparent))
+		return false;
+	writer->writeF32(shininess);
+	writer->writeF32(reflectivity);
+	writer->writeF32(transparency);
+	writer->writeF32(index_of_refraction);
+	return writer->writeU8(static_cast<unsigned char>(shading));
+}
+
 } // namespace collada
\ No newline at end of file
@@ -11,6 +11,9 @@ namespace collada{
 class VertexInput{
 public:
 	bool load(domInstance_material::domBind_vertex_input*);
+	bool load(const StreamElement*);
+	bool load(CacheReader*);
+	bool save(CacheWriter*) const;
 private:
 	std::string semantic;			// ӂ͏IɃnbVl
 	std::string input_semantic;		// ӂ͏IɃnbVl
@@ -43,7 +46,7 @@ public:
 		std::string texcoord;	// ӂ͏IɃnbVl
 		std::string image;		// ӂ͏IɃnbVl
 	#endif
-		unsigned int image_uid;
+		Uid image_uid;
 		WrapMode wrap_s;
 		WrapMode wrap_t;
 		WrapMode wrap_p;
@@ -71,11 +74,22 @@ public:
 		Sampler* sampler;
 	};
 
+	// <profile_COMMON>̉Ae̎
+	typedef enum{
+		Shading_Constant,
+		Shading_Lambert,
+		Shading_Phong,
+		Shading_Blinn
+	}Shading;
+
 public:
 	Material();
 	~Material();
 	void cleanup();
 	bool load(domInstance_material*);
+	bool load(const StreamElement*);
+	bool load(CacheReader*);
+	bool save(CacheWriter*) const;
 
 	Param* getEmission(){ return &emission; }
 	const Param* getEmission() const { return &emission; }
@@ -93,6 +107,7 @@ public:
 	const Param* getTransparent() const { return &transparent; }
 	float getTransparency() const { return transparency; }
 	float getIndexOfRefraction() const { return index_of_refraction; }
+	Shading getShading() const { return shading; }
 private:
 	bool load(const domProfile_COMMON*);
 	bool load(const domProfile_COMMON::domTechnique::domConstant*);
@@ -101,12 +116,15 @@ private:
 	bool load(const domProfile_COMMON::domTechnique::domBlinn*);
 	bool load(Param*, const domCommon_color_or_texture_type*);
 	bool load(Param*, const domCommon_transparent_type*);
-#ifdef DEBUG
+	bool loadTechnique(const StreamElement*);
+	bool load(Param*, const StreamElement*);
+#if defined(DEBUG) || defined(VALIDATE_UID)
 public:
 	std::string symbol;	 // for debug
 #endif
 private:
 	VertexInputPtrArray vis;	// std::map ɂ邩HL[semantic
+	Shading shading;
 	// ToDO: т͌Ō
 	Param emission;
 	Param ambient;
@@ -0,0 +1,183 @@
+﻿#include <string.h>
+#include <new>
+#include "collada.h"
+#include "collada_material_table.h"
+#include "hash64.h"
+#include "log.h"
+
+namespace collada{
+
+MaterialTable::MaterialTable(){
+}
+
+MaterialTable::~MaterialTable(){
+	cleanup();
+}
+
+void MaterialTable::cleanup(){
+	materials.clear();
+	indices.clear();
+	images.clear();
+	image_indices.clear();
+}
+
+/**
+ * シーンで使われる材質を表にまとめ、展開済みのメッシュのTrianglesに添字を振る
+ * 添字はシーンを辿って最初に現れた順なので、同じ文書なら毎回同じになる
+ * 遅延展開するメッシュは展開後にassign()を呼ぶ
+ */
+bool MaterialTable::build(const Collada* collada){
+	cleanup();
+	const Scene* scene = collada->getScene();
+	if(!scene)
+		return true;
+	for(const Node* node = scene->findNode(); node; node = node->getNext()){
+		const GeometryPtrArray& geometries = node->getGeometries();
+		for(GeometryPtrArray::const_iterator it = geometries.begin(); it != geometries.end(); it++){
+			const std::map<Uid, Material*>& bind_material = (*it)->getBindMaterial();
+			for(std::map<Uid, Material*>::const_iterator mt = bind_material.begin(); mt != bind_material.end(); mt++){
+				if(mt->second && (add(mt->second) == INVALID_INDEX)){
+					cleanup();
+					return false;
+				}
+			}
+			if((*it)->isDecoded())
+				assign(*it);
+		}
+	}
+	return true;
+}
+
+/**
+ * Collada::reload()の結果に合わせて表を作り直す
+ * 差し替えたメッシュのTrianglesには添字が振られていないので、メッシュだけが変わった場合も振り直す
+ * 内容でまとめるので、1つの材質が変わるだけで後ろの材質の添字もずれることがある
+ * 展開済みの全てのTrianglesに振り直すので、呼び出し側は添字や表の内容を持ち越さずに読み直すこと
+ */
+bool MaterialTable::update(const Collada* collada, const ReloadResult& result){
+	if(!result.rebuilt && result.meshes.empty() && result.materials.empty())
+		return true;
+	return build(collada);
+}
+
+/**
+ * geometryのTrianglesに材質の添字を振る
+ * 表に無い材質はINVALID_INDEXになる
+ */
+bool MaterialTable::assign(Geometry* geometry) const{
+	Mesh* mesh = geometry->getMesh();
+	if(!mesh || !mesh->getTriangles())
+		return false;
+	const std::map<Uid, Material*>& bind_material = geometry->getBindMaterial();
+	bool result = true;
+	TrianglesPtrArray* triangles = mesh->getTriangles();
+	for(TrianglesPtrArray::iterator it = triangles->begin(); it != triangles->end(); it++){
+		std::map<Uid, Material*>::const_iterator mt = bind_material.find((*it)->getMaterialUid());
+		const unsigned int index = (mt != bind_material.end())? findIndex(mt->second) : INVALID_INDEX;
+		(*it)->setMaterialIndex(index);
+		if(index == INVALID_INDEX)
+			result = false;
+	}
+	return result;
+}
+
+/**
+ * 内容が同じ材質の添字(表に無ければINVALID_INDEX)
+ */
+unsigned int MaterialTable::findIndex(const Material* material) const{
+	MaterialData data;
+	makeData(material, &data);
+	return findIndex(data);
+}
+
+unsigned int MaterialTable::findIndex(const MaterialData& data) const{
+	const Uid hash = calcHash64(reinterpret_cast<const unsigned char*>(&data), sizeof(data));
+	std::pair<std::multimap<Uid, unsigned int>::const_iterator, std::multimap<Uid, unsigned int>::const_iterator> range = indices.equal_range(hash);
+	for(std::multimap<Uid, unsigned int>::const_iterator it = range.first; it != range.second; it++){
+		if(memcmp(&materials[it->second], &data, sizeof(data)) == 0)
+			return it->second;
+	}
+	return INVALID_INDEX;
+}
+
+/**
+ * 表の1行を作る
+ * 隙間も0で埋めるので、内容が同じなら同じバイト列になる
+ */
+void MaterialTable::makeData(const Material* material, MaterialData* data) const{
+	memset(data, 0, sizeof(*data));
+	const Material::Param* params[] = {
+		material->getEmission(), material->getAmbient(), material->getDiffuse(),
+		material->getSpecular(), material->getReflective(), material->getTransparent()
+	};
+	float* colors[] = {
+		data->emission, data->ambient, data->diffuse, data->specular, data->reflective, data->transparent
+	};
+	int* textures[] = {
+		&data->emission_texture, &data->ambient_texture, &data->diffuse_texture,
+		&data->specular_texture, &data->reflective_texture, &data->transparent_texture
+	};
+	for(size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++){
+		memcpy(colors[i], params[i]->color, sizeof(params[i]->color));
+		*textures[i] = findImage(params[i]);
+	}
+	data->shininess = material->getShininess();
+	data->reflectivity = material->getReflectivity();
+	data->transparency = material->getTransparency();
+	data->index_of_refraction = material->getIndexOfRefraction();
+	data->shading = material->getShading();
+}
+
+/**
+ * 表に加えて添字を返す(内容が同じものが既にあればその添字)
+ */
+unsigned int MaterialTable::add(const Material* material){
+	const Material::Param* params[] = {
+		material->getEmission(), material->getAmbient(), material->getDiffuse(),
+		material->getSpecular(), material->getReflective(), material->getTransparent()
+	};
+	try{
+		// 画像の添字が決まってから内容を比べる
+		for(size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++)
+			addImage(params[i]);
+		MaterialData data;
+		makeData(material, &data);
+		const unsigned int found = findIndex(data);
+		if(found != INVALID_INDEX)
+			return found;
+		const unsigned int index = static_cast<unsigned int>(materials.size());
+		materials.push_back(data);
+		std::pair<Uid, unsigned int> p(calcHash64(reinterpret_cast<const unsigned char*>(&data), sizeof(data)), index);
+		indices.insert(p);
+		return index;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return INVALID_INDEX;
+	}
+}
+
+/**
+ * テクスチャの画像を加えて添字を返す(テクスチャでなければ-1)
+ */
+int MaterialTable::addImage(const Material::Param* param){
+	if((param->type != Material::Param::Param_Texture) || !param->sampler)
+		return -1;
+	const Uid uid = param->sampler->image_uid;
+	std::pair<Uid, int> p(uid, static_cast<int>(images.size()));
+	std::map<Uid, int>::_Pairib pib = image_indices.insert(p);
+	if(pib.second)
+		images.push_back(uid);
+	return pib.first->second;
+}
+
+int MaterialTable::findImage(const Material::Param* param) const{
+	if((param->type != Material::Param::Param_Texture) || !param->sampler)
+		return -1;
+	std::map<Uid, int>::const_iterator it = image_indices.find(param->sampler->image_uid);
+	if(it == image_indices.end())
+		return -1;
+	return it->second;
+}
+
+} // namespace collada
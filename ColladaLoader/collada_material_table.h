@@ -0,0 +1,71 @@
+﻿/**
+ * GPUへそのまま転送できる材質の表
+ * 文書で使われる材質を固定長の構造体の配列にまとめ、Trianglesに表の添字を振る
+ * 描画時は添字で参照するだけで済み、表全体はuniform/storageバッファへ1回で転送できる
+ * 同じ内容の材質は別の<material>でも1つにまとめる
+ */
+#pragma once
+#include <map>
+#include <vector>
+#include "collada.h"
+#include "collada_def.h"
+#include "collada_material.h"
+
+namespace collada{
+
+
+/**
+ * 1つの材質
+ * std140/std430のどちらでも同じ並びになるよう、vec4を先に置いて16バイトの倍数にしてある
+ * テクスチャはMaterialTable::getImage()の添字(無ければ-1)
+ */
+typedef struct{
+	float emission[4];	// 0
+	float ambient[4];	// 16
+	float diffuse[4];	// 32
+	float specular[4];	// 48
+	float reflective[4];	// 64
+	float transparent[4];	// 80
+	float shininess;	// 96
+	float reflectivity;
+	float transparency;
+	float index_of_refraction;
+	int emission_texture;	// 112
+	int ambient_texture;
+	int diffuse_texture;
+	int specular_texture;
+	int reflective_texture;	// 128
+	int transparent_texture;
+	int shading;	// Material::Shading
+	int reserved;
+}MaterialData;	// 144バイト
+
+class MaterialTable{
+public:
+	MaterialTable();
+	~MaterialTable();
+	void cleanup();
+	bool build(const Collada* collada);
+	bool update(const Collada* collada, const ReloadResult& result);
+	bool assign(Geometry* geometry) const;
+	size_t getCount() const { return materials.size(); }
+	const MaterialData* getMaterial(unsigned int index) const { return &materials[index]; }
+	const void* getData() const { return materials.empty()? NULL : &materials[0]; }
+	size_t getDataSize() const { return materials.size() * sizeof(MaterialData); }
+	unsigned int findIndex(const Material* material) const;
+	size_t getImageCount() const { return images.size(); }
+	Uid getImage(size_t index) const { return images[index]; }
+private:
+	unsigned int add(const Material* material);
+	unsigned int findIndex(const MaterialData& data) const;
+	void makeData(const Material* material, MaterialData* data) const;
+	int addImage(const Material::Param* param);
+	int findImage(const Material::Param* param) const;
+private:
+	std::vector<MaterialData> materials;
+	std::multimap<Uid, unsigned int> indices;	// 内容のハッシュ→materialsの添字(アドレスはreload()で使い回されるので使わない)
+	std::vector<Uid> images;	// 材質から参照される画像のuid
+	std::map<Uid, int> image_indices;	// 画像のuid→imagesの添字
+};
+
+} // namespace collada
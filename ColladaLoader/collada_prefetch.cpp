@@ -0,0 +1,541 @@
+﻿#include <string.h>
+#include <new>
+#include <string>
+#include "collada.h"
+#include "collada_prefetch.h"
+#include "log.h"
+
+#if defined(__linux__) && !defined(NO_IO_URING)
+#define USE_IO_URING
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+namespace collada{
+
+#ifdef USE_IO_URING
+
+// 同時に発行する読み込みの数
+static const unsigned int URING_DEPTH = 64;
+// 1回の読み込みの上限(結果はintで返る)
+static const size_t URING_MAX_READ = 1 << 30;
+// 取り消しの完了に付けるuser_data(読み込みは画像の添字を付ける)
+static const unsigned long long URING_CANCEL = ~0ULL;
+// 取り消した読み込みの完了を待つ際に失敗を許す回数
+static const unsigned int URING_DRAIN_RETRY = 16;
+
+/**
+ * io_uringの最小限のラッパ
+ * 発行と回収は同じ1つのスレッドから行う
+ */
+class Uring{
+public:
+	Uring();
+	~Uring();
+	bool init(unsigned int entries);
+	bool read(int fd, struct iovec* iov, unsigned long long offset, unsigned long long user_data);
+	bool cancel(unsigned long long user_data);
+	bool submit();
+	bool wait(unsigned long long* user_data, int* result);
+private:
+	Uring(const Uring&);
+	Uring& operator=(const Uring&);
+private:
+	int fd;
+	void* sq_ring;
+	size_t sq_ring_size;
+	void* cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+	unsigned int* sq_head;
+	unsigned int* sq_tail;
+	unsigned int* sq_mask;
+	unsigned int* sq_entries;
+	unsigned int* sq_array;
+	unsigned int* cq_head;
+	unsigned int* cq_tail;
+	unsigned int* cq_mask;
+	struct io_uring_cqe* cqes;
+	unsigned int queued;	// 発行待ち
+};
+
+Uring::Uring(){
+	fd = -1;
+	sq_ring = MAP_FAILED;
+	cq_ring = MAP_FAILED;
+	sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+	sq_ring_size = 0;
+	cq_ring_size = 0;
+	sqes_size = 0;
+	queued = 0;
+}
+
+Uring::~Uring(){
+	if(sqes != MAP_FAILED)
+		munmap(sqes, sqes_size);
+	if((cq_ring != MAP_FAILED) && (cq_ring != sq_ring))
+		munmap(cq_ring, cq_ring_size);
+	if(sq_ring != MAP_FAILED)
+		munmap(sq_ring, sq_ring_size);
+	if(fd >= 0)
+		close(fd);
+}
+
+/**
+ * カーネルが対応していない(あるいは禁止されている)場合はfalse
+ */
+bool Uring::init(unsigned int entries){
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+	if(fd < 0)
+		return false;
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if(single){
+		if(cq_ring_size > sq_ring_size)
+			sq_ring_size = cq_ring_size;
+		cq_ring_size = sq_ring_size;
+	}
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(sq_ring == MAP_FAILED)
+		return false;
+	cq_ring = single? sq_ring : mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if(cq_ring == MAP_FAILED)
+		return false;
+	sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = static_cast<struct io_uring_sqe*>(mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+	if(sqes == MAP_FAILED)
+		return false;
+	unsigned char* sq = static_cast<unsigned char*>(sq_ring);
+	sq_head = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+	sq_tail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+	sq_mask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+	sq_entries = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_entries);
+	sq_array = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+	unsigned char* cq = static_cast<unsigned char*>(cq_ring);
+	cq_head = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+	cq_tail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+	cq_mask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+	return true;
+}
+
+/**
+ * 読み込みを積む(submit()で発行する)
+ */
+bool Uring::read(int file, struct iovec* iov, unsigned long long offset, unsigned long long user_data){
+	const unsigned int tail = *sq_tail;
+	if(tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= *sq_entries)
+		return false;
+	const unsigned int index = tail & *sq_mask;
+	struct io_uring_sqe* sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = file;
+	sqe->addr = reinterpret_cast<unsigned long long>(iov);
+	sqe->len = 1;
+	sqe->off = offset;
+	sqe->user_data = user_data;
+	sq_array[index] = index;
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	queued++;
+	return true;
+}
+
+/**
+ * user_dataの読み込みの取り消しを積む
+ * 取り消し自体の完了はURING_CANCELで返る
+ */
+bool Uring::cancel(unsigned long long user_data){
+	const unsigned int tail = *sq_tail;
+	if(tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= *sq_entries)
+		return false;
+	const unsigned int index = tail & *sq_mask;
+	struct io_uring_sqe* sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = user_data;
+	sqe->user_data = URING_CANCEL;
+	sq_array[index] = index;
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	queued++;
+	return true;
+}
+
+bool Uring::submit(){
+	while(queued > 0){
+		const int result = static_cast<int>(syscall(__NR_io_uring_enter, fd, queued, 0, 0, NULL, 0));
+		if(result < 0){
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		queued -= result;
+	}
+	return true;
+}
+
+/**
+ * 完了を1つ待って回収する
+ */
+bool Uring::wait(unsigned long long* user_data, int* result){
+	for(;;){
+		const unsigned int head = *cq_head;
+		if(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)){
+			const struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+			*user_data = cqe->user_data;
+			*result = cqe->res;
+			__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+			return true;
+		}
+		if((syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) && (errno != EINTR))
+			return false;
+	}
+}
+
+#else
+
+class Uring{
+};
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
+Prefetcher::Prefetcher(){
+	collada = NULL;
+	next_index = 0;
+	consumed = 0;
+	completed_head = 0;
+	stop = false;
+	threads = NULL;
+	thread_count = 0;
+	uring = NULL;
+	use_uring = true;
+}
+
+/**
+ * 読み込み中のものは終わるまで待つ
+ */
+Prefetcher::~Prefetcher(){
+	cleanup();
+}
+
+void Prefetcher::cleanup(){
+	{
+		ScopedLock lock(&mutex);
+		stop = true;
+	}
+	if(threads){
+		delete[] threads;
+		threads = NULL;
+	}
+	thread_count = 0;
+	if(uring){
+		delete uring;
+		uring = NULL;
+	}
+	entries.clear();
+	completed.clear();
+	completed_head = 0;
+	collada = NULL;
+	next_index = 0;
+	consumed = 0;
+	stop = false;
+}
+
+/**
+ * colladaの全ての画像を読み始める
+ * thread_countはio_uringが使えない場合に読み込むスレッドの数
+ * colladaは全てnext()で受け取るまで有効である必要がある
+ */
+bool Prefetcher::start(const Collada* collada, unsigned int thread_count){
+	cleanup();
+	const Images* images = collada->getImages();
+	const size_t count = images? images->getImages()->size() : 0;
+	if(count == 0)
+		return true;
+	try{
+		entries.resize(count);
+		completed.reserve(count);
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		cleanup();
+		return false;
+	}
+	this->collada = collada;
+#ifdef USE_IO_URING
+	// 全ての画像がファイルの場合のみ使う
+	if(use_uring){
+		bool files = true;
+		std::string filename;
+		for(size_t i = 0; (i < count) && files; i++)
+			files = collada->getImageFile(i, &filename);
+		if(files){
+			uring = new(std::nothrow) Uring;
+			if(uring && !uring->init(URING_DEPTH)){
+				Log_i("io_uring is not available.\n");
+				delete uring;
+				uring = NULL;
+			}
+		}
+	}
+#endif
+	if(uring)
+		thread_count = 1;
+	if(thread_count == 0)
+		thread_count = 1;
+	if(thread_count > count)
+		thread_count = static_cast<unsigned int>(count);
+	threads = new(std::nothrow) Thread[thread_count];
+	if(threads){
+		for(unsigned int i = 0; i < thread_count; i++){
+			if(threads[i].start(uring? runUring : run, this))
+				this->thread_count++;
+		}
+	}
+	// スレッドを作れなければここで全て読む
+	if(this->thread_count == 0)
+		uring? runUring(this) : run(this);
+	return true;
+}
+
+/**
+ * 読み終えた画像を1つ受け取る
+ * 読み終えたものが無ければ待つ、全て渡し終えていればfalse
+ * 読めなかった画像はbufferが空になる
+ */
+bool Prefetcher::next(size_t* index, std::vector<unsigned char>* buffer){
+	ScopedLock lock(&mutex);
+	while(completed_head >= completed.size()){
+		if(consumed >= entries.size())
+			return false;
+		completed_cond.wait(&mutex);
+	}
+	*index = completed[completed_head++];
+	consumed++;
+	// 待っている他のスレッドを終わらせる
+	if(consumed >= entries.size())
+		completed_cond.broadcast();
+	Entry* entry = &entries[*index];
+	buffer->swap(entry->buffer);
+	if(!entry->read)
+		buffer->clear();
+	std::vector<unsigned char>().swap(entry->buffer);
+	return true;
+}
+
+/**
+ * 次に読み始める画像を取り出す(スレッドで読む場合)
+ */
+bool Prefetcher::fetch(size_t* index){
+	ScopedLock lock(&mutex);
+	if(stop || (next_index >= entries.size()))
+		return false;
+	*index = next_index++;
+	return true;
+}
+
+void Prefetcher::complete(size_t index, bool read){
+	ScopedLock lock(&mutex);
+	entries[index].read = read;
+	// start()で全ての画像の分を確保してあるので失敗しない
+	completed.push_back(index);
+	completed_cond.signal();
+}
+
+void Prefetcher::run(void* arg){
+	Prefetcher* prefetcher = static_cast<Prefetcher*>(arg);
+	size_t index;
+	while(prefetcher->fetch(&index)){
+		// バッファは読み終えるまでこのスレッドだけが触る
+		std::vector<unsigned char>* buffer = &prefetcher->entries[index].buffer;
+		bool read = false;
+		Stream* stream = prefetcher->collada->openImage(index);
+		if(stream){
+			read = readStream(stream, buffer) && !buffer->empty();
+			delete stream;
+		}
+		prefetcher->complete(index, read);
+	}
+}
+
+void Prefetcher::runUring(void* arg){
+	Prefetcher* prefetcher = static_cast<Prefetcher*>(arg);
+	if(!prefetcher->readUring()){
+		// 途中で使えなくなった場合は残りを普通に読む
+		// io_uringで発行したものは渡し終えているので、next_indexより後だけを読む
+		Log_w("io_uring failed.\n");
+		run(arg);
+	}
+}
+
+#ifdef USE_IO_URING
+
+typedef struct UringRequest{
+	int fd;
+	size_t done;	// 読めたバイト数
+	struct iovec iov;	// 発行中の読み込み
+	std::vector<unsigned char> buffer;	// 読み込み先(完了するまでカーネルが書き込むので、読み終えてからEntryに移す)
+}UringRequest;
+
+/**
+ * 画像をURING_DEPTH個ずつまとめて読む
+ * ファイルを開いて大きさを調べ、全体を1回(大きければ数回)で読む
+ * 途中で失敗した場合はfalse(発行済みのものは回収して渡し終え、残りはnext_indexから読める)
+ */
+bool Prefetcher::readUring(){
+	std::vector<UringRequest>* requests;
+	try{
+		UringRequest request;
+		request.fd = -1;
+		request.done = 0;
+		requests = new std::vector<UringRequest>(entries.size(), request);
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	unsigned int inflight = 0;
+	for(;;){
+		// 空いている分だけ開いて積む
+		size_t index;
+		while((inflight < URING_DEPTH) && fetch(&index)){
+			UringRequest* request = &(*requests)[index];
+			std::string filename;
+			collada->getImageFile(index, &filename);
+			request->fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+			struct stat st;
+			if((request->fd < 0) || (fstat(request->fd, &st) != 0) || (st.st_size <= 0)){
+				finishUring(request, index, false);
+				continue;
+			}
+			try{
+				request->buffer.resize(static_cast<size_t>(st.st_size));
+			}
+			catch(std::bad_alloc& e){
+				Log_e("could not allocate memory.\n");
+				finishUring(request, index, false);
+				continue;
+			}
+			request->done = 0;
+			request->iov.iov_base = &request->buffer[0];
+			request->iov.iov_len = (request->buffer.size() > URING_MAX_READ)? URING_MAX_READ : request->buffer.size();
+			if(!uring->read(request->fd, &request->iov, 0, index)){
+				finishUring(request, index, false);
+				continue;
+			}
+			inflight++;
+		}
+		if(inflight == 0){
+			delete requests;
+			return true;
+		}
+		unsigned long long user_data;
+		int result;
+		if(!uring->submit() || !uring->wait(&user_data, &result)){
+			if(!drainUring(requests, inflight)){
+				// カーネルがまだ書き込むかもしれないので、読み込み先とio_uringは解放せずに手放す
+				Log_e("could not cancel io_uring reads.\n");
+				for(size_t i = 0; i < requests->size(); i++){
+					if((*requests)[i].fd >= 0)
+						complete(i, false);
+				}
+				ScopedLock lock(&mutex);
+				uring = NULL;
+				return false;
+			}
+			delete requests;
+			return false;
+		}
+		index = static_cast<size_t>(user_data);
+		UringRequest* request = &(*requests)[index];
+		if((result == -EINTR) || (result == -EAGAIN))
+			result = 0;
+		else
+		if(result <= 0){
+			inflight--;
+			finishUring(request, index, false);
+			continue;
+		}
+		request->done += result;
+		if(request->done >= request->buffer.size()){
+			inflight--;
+			finishUring(request, index, true);
+			continue;
+		}
+		// 残りを読む
+		const size_t remain = request->buffer.size() - request->done;
+		request->iov.iov_base = &request->buffer[request->done];
+		request->iov.iov_len = (remain > URING_MAX_READ)? URING_MAX_READ : remain;
+		if(!uring->read(request->fd, &request->iov, request->done, index)){
+			inflight--;
+			finishUring(request, index, false);
+		}
+	}
+}
+
+/**
+ * 発行済みの読み込みを取り消し、全ての完了を回収して失敗として渡す
+ * 回収できなければfalse(読み込み先はまだ使われているかもしれない)
+ */
+bool Prefetcher::drainUring(std::vector<UringRequest>* requests, unsigned int inflight){
+	for(size_t i = 0; i < requests->size(); i++){
+		// 取り消しを積めなくても、読み込みはいずれ完了する
+		if((*requests)[i].fd >= 0)
+			uring->cancel(i);
+	}
+	unsigned int failures = 0;
+	while(inflight > 0){
+		unsigned long long user_data;
+		int result;
+		if(!uring->submit() || !uring->wait(&user_data, &result)){
+			if(++failures >= URING_DRAIN_RETRY)
+				return false;
+			continue;
+		}
+		if((user_data == URING_CANCEL) || (user_data >= requests->size()))
+			continue;
+		UringRequest* request = &(*requests)[static_cast<size_t>(user_data)];
+		if(request->fd < 0)
+			continue;
+		inflight--;
+		finishUring(request, static_cast<size_t>(user_data), false);
+	}
+	return true;
+}
+
+/**
+ * 読み込みを終えてnext()に渡す
+ */
+void Prefetcher::finishUring(UringRequest* request, size_t index, bool read){
+	if(request->fd >= 0)
+		close(request->fd);
+	request->fd = -1;
+	// 渡すまではこのスレッドだけがEntryのバッファを触る
+	if(read)
+		entries[index].buffer.swap(request->buffer);
+	std::vector<unsigned char>().swap(request->buffer);
+	complete(index, read);
+}
+
+#else
+
+bool Prefetcher::readUring(){
+	return false;
+}
+
+#endif
+
+} // namespace collada
@@ -0,0 +1,54 @@
+﻿/**
+ * 画像ファイルの先読み
+ * 文書の解析の直後に全ての画像の読み込みを一度に発行し、読み終えたものから順に展開側へ渡す
+ * 読み込みと展開が交互にならず重なるので、遅いストレージでも待ち時間が隠れる
+ * Linuxではio_uringでまとめて読み、使えない場合や画像がファイルでない場合はスレッドで読む
+ */
+#pragma once
+#include <vector>
+#include "thread.h"
+
+namespace collada{
+
+class Collada;
+class Uring;
+struct UringRequest;
+
+class Prefetcher{
+public:
+	Prefetcher();
+	~Prefetcher();
+	void cleanup();
+	bool start(const Collada* collada, unsigned int thread_count = 4);
+	bool next(size_t* index, std::vector<unsigned char>* buffer);
+	void setUringEnabled(bool enable){ use_uring = enable; }
+	bool isUringUsed() const { return uring != NULL; }
+private:
+	typedef struct{
+		std::vector<unsigned char> buffer;
+		bool read;	// 読めた
+	}Entry;
+	static void run(void* arg);
+	static void runUring(void* arg);
+	bool fetch(size_t* index);
+	void complete(size_t index, bool read);
+	bool readUring();
+	bool drainUring(std::vector<UringRequest>* requests, unsigned int inflight);
+	void finishUring(UringRequest* request, size_t index, bool read);
+private:
+	Mutex mutex;
+	Condition completed_cond;
+	const Collada* collada;	// 読み込み中のみ
+	std::vector<Entry> entries;	// 文書の画像と同じ並び
+	std::vector<size_t> completed;	// 読み終えた順(start()で全ての画像の分を確保する)
+	size_t completed_head;	// completedのうち次にnext()で渡すもの
+	size_t next_index;	// 次に読み始める画像(スレッドで読む場合)
+	size_t consumed;	// next()で渡した数
+	bool stop;	// 新たに読み始めない
+	Thread* threads;
+	unsigned int thread_count;
+	Uring* uring;	// io_uringで読む場合のみ
+	bool use_uring;
+};
+
+} // namespace collada
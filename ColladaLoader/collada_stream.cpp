@@ -0,0 +1,505 @@
+﻿#include <stdlib.h>
+#include <string.h>
+#include "collada_async.h"
+#include "collada_io.h"
+#include "collada_stream.h"
+#include "hash64.h"
+#include "text_number.h"
+#include "timer.h"
+#include "log.h"
+
+namespace collada{
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool isEqual(const char* name, size_t name_len, const char* string){
+	return (strlen(string) == name_len) && (memcmp(name, string, name_len) == 0);
+}
+
+StreamElement::StreamElement(){
+	document = NULL;
+	name = NULL;
+	name_len = 0;
+	text = NULL;
+	text_len = 0;
+	parent = NULL;
+	child = NULL;
+	last = NULL;
+	sibling = NULL;
+}
+
+bool StreamElement::isName(const char* name) const{
+	return isEqual(this->name, name_len, name);
+}
+
+const char* StreamElement::getAttribute(const char* name) const{
+	for(std::vector<Attribute>::const_iterator it = attributes.begin(); it != attributes.end(); it++){
+		if(isEqual(it->name, it->name_len, name))
+			return it->value.c_str();
+	}
+	return NULL;
+}
+
+/**
+ * 数値属性の取得
+ * 無ければvalueをそのまま返す
+ */
+unsigned int StreamElement::getAttribute(const char* name, unsigned int value) const{
+	const char* attr = getAttribute(name);
+	if(attr == NULL)
+		return value;
+	return static_cast<unsigned int>(strtoul(attr, NULL, 10));
+}
+
+/**
+ * nameという名前の最初の子要素
+ */
+StreamElement* StreamElement::getChild(const char* name) const{
+	for(StreamElement* elem = child; elem; elem = elem->sibling){
+		if(elem->isName(name))
+			return elem;
+	}
+	return NULL;
+}
+
+/**
+ * nameという名前の次の兄弟要素
+ */
+StreamElement* StreamElement::getNext(const char* name) const{
+	for(StreamElement* elem = sibling; elem; elem = elem->sibling){
+		if(elem->isName(name))
+			return elem;
+	}
+	return NULL;
+}
+
+void StreamElement::getText(std::string* output) const{
+	XmlReader::Span span = { text, text + text_len };
+	XmlReader::decode(span, output);
+	// 前後の空白を除く
+	const size_t begin = output->find_first_not_of(" \t\r\n");
+	if(begin == std::string::npos){
+		output->clear();
+		return;
+	}
+	const size_t end = output->find_last_not_of(" \t\r\n");
+	output->assign(*output, begin, end - begin + 1);
+}
+
+/**
+ * 長さも含めて連結する(区切り位置の違う内容を区別するため)
+ */
+static Uid hashBytes(const void* data, size_t len, Uid seed){
+	const unsigned long long length = len;
+	const Uid hash = calcHash64(reinterpret_cast<const unsigned char*>(&length), sizeof(length), seed);
+	return calcHash64(reinterpret_cast<const unsigned char*>(data), len, hash);
+}
+
+/**
+ * 子孫を含めた内容のハッシュ
+ * 名前、属性、内容を文書順に連結したもの(読み込み時に捨てた要素は含まない)
+ */
+Uid StreamElement::getHash(Uid seed) const{
+	Uid hash = hashBytes(name, name_len, seed);
+	for(std::vector<Attribute>::const_iterator it = attributes.begin(); it != attributes.end(); it++){
+		hash = hashBytes(it->name, it->name_len, hash);
+		hash = hashBytes(it->value.data(), it->value.size(), hash);
+	}
+	hash = hashBytes(text, text_len, hash);
+	for(const StreamElement* elem = child; elem; elem = elem->sibling)
+		hash = elem->getHash(hash);
+	return hash;
+}
+
+bool StreamElement::getFloats(float* values, size_t max_count, size_t* count) const{
+	return parseFloats(text, text + text_len, values, max_count, count);
+}
+
+bool StreamElement::getUints(UintArray* values) const{
+	return parseUints(text, text + text_len, values);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+StreamDocument::StreamDocument() : reader(NULL, 0){
+	root = NULL;
+	current = NULL;
+	size = 0;
+	next_report = 0;
+	resolver = NULL;
+	owner = this;
+}
+
+StreamDocument::~StreamDocument(){
+	cleanup();
+}
+
+void StreamDocument::cleanup(){
+	for(std::map<const StreamElement*, FloatArray*>::iterator it = floats.begin(); it != floats.end(); it++){
+		delete it->second;
+		it->second = NULL;
+	}
+	floats.clear();
+	for(std::map<std::string, StreamDocument*>::iterator it = externals.begin(); it != externals.end(); it++){
+		delete it->second;
+		it->second = NULL;
+	}
+	externals.clear();
+	for(std::vector<Stream*>::iterator it = streams.begin(); it != streams.end(); it++){
+		delete *it;
+		*it = NULL;
+	}
+	streams.clear();
+	ids.clear();
+	elements.clear();
+	root = NULL;
+	buffer.clear();
+	uri.clear();
+	resolver = NULL;
+	start(NULL, 0);
+}
+
+/**
+ * 型名をシードにしてIDをハッシュ化(IdIndexと同じ)
+ */
+Uid StreamDocument::getKey(const char* id, size_t id_len, const char* type, size_t type_len){
+	const unsigned long long seed = calcHash64(reinterpret_cast<const unsigned char*>(type), type_len);
+	return calcHash64(reinterpret_cast<const unsigned char*>(id), id_len, seed);
+}
+
+/**
+ * ローダが使わない要素は子孫ごと読み飛ばす
+ */
+bool StreamDocument::isSkipped(const char* name, size_t name_len, const StreamElement* parent) const{
+	if(parent == NULL)
+		return false;
+	if(isEqual(name, name_len, "asset") || isEqual(name, name_len, "extra"))
+		return true;
+	if(parent == root){
+		static const char* const libraries[] = {
+			"library_images",
+			"library_materials",
+			"library_effects",
+			"library_geometries",
+			"library_visual_scenes",
+			"library_nodes",
+			"scene",
+		};
+		for(size_t i = 0; i < sizeof(libraries)/sizeof(libraries[0]); i++){
+			if(isEqual(name, name_len, libraries[i]))
+				return false;
+		}
+		return true;
+	}
+	// 最初の<profile_COMMON>のみ使う
+	if(parent->isName("effect"))
+		return !isEqual(name, name_len, "profile_COMMON");
+	// 三角形に展開できるプリミティブのみ使う
+	if(parent->isName("mesh")){
+		return !isEqual(name, name_len, "source")
+			&& !isEqual(name, name_len, "vertices")
+			&& !isEqual(name, name_len, "triangles")
+			&& !isEqual(name, name_len, "polylist");
+	}
+	return false;
+}
+
+void StreamDocument::add(StreamElement* elem){
+	const char* id = elem->getID();
+	if((id == NULL) || (id[0] == '\0'))
+		return;
+	std::pair<Uid, StreamElement*> p(getKey(id, strlen(id), elem->name, elem->name_len), elem);
+	// 重複した場合は文書順で先のものを優先
+	ids.insert(p);
+}
+
+/**
+ * 文書を読み込む
+ * dataは読み込んだ文書を使い終わるまで有効である必要がある
+ */
+bool StreamDocument::load(const char* data, size_t size){
+	cleanup();
+	start(data, size);
+	bool done;
+	return parse(0, &done);
+}
+
+/**
+ * ストリームから文書を読み込む
+ * 内容を直接参照できるストリームは複製せず、文書を使い終わるまで有効である必要がある
+ * uriは外部の文書を指すURIの基準、resolverがNULLなら外部参照は解決しない
+ */
+bool StreamDocument::load(Stream* stream, const char* uri, Resolver* resolver){
+	if(!begin(stream, uri, resolver))
+		return false;
+	bool done;
+	return parse(0, &done);
+}
+
+/**
+ * 段階的な読み込みの開始
+ * parse()を繰り返し呼んで解析を進める
+ */
+bool StreamDocument::begin(Stream* stream, const char* uri, Resolver* resolver){
+	cleanup();
+	this->uri.assign(uri? uri : "");
+	this->resolver = resolver;
+	const unsigned char* data = stream->getData();
+	size_t size = static_cast<size_t>(stream->getSize());
+	if(!data && (size > 0)){
+		if(!readStream(stream, &buffer)){
+			cleanup();
+			return false;
+		}
+		data = &buffer[0];
+	}
+	start(reinterpret_cast<const char*>(data), size);
+	return true;
+}
+
+void StreamDocument::start(const char* data, size_t size){
+	reader = XmlReader(data, size);
+	current = NULL;
+	this->size = size;
+	next_report = 0;
+}
+
+/**
+ * 解析を進める
+ * deadline(getMicroseconds()の時刻)を過ぎたら途中で戻る、0なら最後まで解析する
+ * 最後まで解析できればdoneをtrueにする
+ */
+bool StreamDocument::parse(unsigned long long deadline, bool* done){
+	*done = false;
+	unsigned int count = 0;
+	for(;;){
+		// 時刻の取得は256字句ごと
+		if(deadline && ((++count & 0xFF) == 0) && (getMicroseconds() >= deadline))
+			return true;
+		switch(reader.next()){
+		case XmlReader::Token_StartElement:{
+			// 進捗の通知と中断の検査は1MBごと
+			if(reader.getOffset() >= next_report){
+				if(!checkProgress(LoadStage_Parse, reader.getOffset(), size)){
+					Log_i("canceled.\n");
+					cleanup();
+					return false;
+				}
+				next_report = reader.getOffset() + (1 << 20);
+			}
+			const XmlReader::Span& name = reader.getName();
+			const size_t name_len = static_cast<size_t>(name.end - name.begin);
+			if(current == NULL && root != NULL){
+				Log_e("multiple root elements at %u.\n", static_cast<unsigned int>(reader.getOffset()));
+				cleanup();
+				return false;
+			}
+			if(isSkipped(name.begin, name_len, current)){
+				if(!reader.skip()){
+					Log_e("syntax error at %u.\n", static_cast<unsigned int>(reader.getOffset()));
+					cleanup();
+					return false;
+				}
+				break;
+			}
+			elements.push_back(StreamElement());
+			StreamElement* elem = &elements.back();
+			elem->document = this;
+			elem->name = name.begin;
+			elem->name_len = name_len;
+			elem->attributes.resize(reader.getAttributeCount());
+			for(size_t i = 0; i < reader.getAttributeCount(); i++){
+				const XmlReader::Attribute& attr = reader.getAttribute(i);
+				elem->attributes[i].name = attr.name.begin;
+				elem->attributes[i].name_len = static_cast<size_t>(attr.name.end - attr.name.begin);
+				XmlReader::decode(attr.value, &elem->attributes[i].value);
+			}
+			if(current){
+				elem->parent = current;
+				if(current->last)
+					current->last->sibling = elem;
+				else
+					current->child = elem;
+				current->last = elem;
+			}
+			else{
+				if(!elem->isName("COLLADA")){
+					Log_e("element <COLLADA> not found.\n");
+					cleanup();
+					return false;
+				}
+				root = elem;
+			}
+			add(elem);
+			current = elem;
+			break;
+		}
+		case XmlReader::Token_EndElement:{
+			const XmlReader::Span& name = reader.getName();
+			const size_t name_len = static_cast<size_t>(name.end - name.begin);
+			if((current == NULL) || (current->name_len != name_len) || (memcmp(current->name, name.begin, name_len) != 0)){
+				Log_e("mismatched end tag at %u.\n", static_cast<unsigned int>(reader.getOffset()));
+				cleanup();
+				return false;
+			}
+			current = current->parent;
+			break;
+		}
+		case XmlReader::Token_Text:
+			// 子要素を持たない要素の内容のみ覚えておく
+			if(current && (current->child == NULL) && (current->text == NULL)){
+				current->text = reader.getText().begin;
+				current->text_len = static_cast<size_t>(reader.getText().end - reader.getText().begin);
+			}
+			break;
+		case XmlReader::Token_End:
+			if(current || !root){
+				Log_e("unexpected end of document.\n");
+				cleanup();
+				return false;
+			}
+			checkProgress(LoadStage_Parse, size, size);
+			*done = true;
+			return true;
+		default:
+			Log_e("syntax error at %u.\n", static_cast<unsigned int>(reader.getOffset()));
+			cleanup();
+			return false;
+		}
+	}
+}
+
+/**
+ * typeという名前の<COLLADA>直下の最初の要素
+ */
+StreamElement* StreamDocument::findElement(const char* type){
+	return root? root->getChild(type) : NULL;
+}
+
+/**
+ * IDと型名から要素を引く
+ * ハッシュが衝突していれば文書順に探す
+ */
+StreamElement* StreamDocument::getElement(const char* id, const char* type){
+	if((id == NULL) || (type == NULL))
+		return NULL;
+	std::map<Uid, StreamElement*>::iterator it = ids.find(getKey(id, strlen(id), type, strlen(type)));
+	if(it == ids.end())
+		return NULL;
+	StreamElement* elem = it->second;
+	if(elem->isName(type) && (strcmp(elem->getID(), id) == 0))
+		return elem;
+	for(std::deque<StreamElement>::iterator e = elements.begin(); e != elements.end(); e++){
+		if(e->isName(type) && e->getID() && (strcmp(e->getID(), id) == 0))
+			return &(*e);
+	}
+	return NULL;
+}
+
+/**
+ * URIが指す要素
+ * "#id"はこの文書、"file.dae#id"はuriの位置からの相対パスで外部の文書を探す
+ */
+StreamElement* StreamDocument::resolve(const char* uri, const char* type){
+	if(uri == NULL)
+		return NULL;
+	const char* fragment = strchr(uri, '#');
+	if(fragment == NULL)
+		return NULL;
+	if(fragment == uri)
+		return getElement(fragment + 1, type);
+	std::string filename;
+	const char* file = uri;
+	if(strncmp(file, "file://", 7) == 0)
+		file += 7;
+	// 絶対パス以外は参照元の文書の位置から
+	if((file[0] != '/') && (memchr(file, ':', fragment - file) == NULL)){
+		const char* pos = strrchr(this->uri.c_str(), '/');
+		if(pos)
+			filename.assign(this->uri.c_str(), pos + 1);
+	}
+	filename.append(file, fragment);
+	StreamDocument* doc = owner->getExternal(filename);
+	return doc? doc->getElement(fragment + 1, type) : NULL;
+}
+
+/**
+ * 外部の文書
+ * 一度開いた文書は最初の文書がまとめて保持し、開けなかった場合も覚えておく
+ */
+StreamDocument* StreamDocument::getExternal(const std::string& filename){
+	if(filename == uri)
+		return this;
+	std::map<std::string, StreamDocument*>::iterator it = externals.find(filename);
+	if(it != externals.end())
+		return it->second;
+	externals.insert(std::pair<std::string, StreamDocument*>(filename, static_cast<StreamDocument*>(NULL)));
+	if(resolver == NULL){
+		Log_e("could not resolve %s.\n", filename.c_str());
+		return NULL;
+	}
+	Stream* stream = resolver->open(filename.c_str());
+	if(stream == NULL){
+		Log_e("could not open %s.\n", filename.c_str());
+		return NULL;
+	}
+	StreamDocument* doc;
+	try{
+		streams.push_back(stream);
+		doc = new StreamDocument;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		delete stream;
+		if(!streams.empty() && (streams.back() == stream))
+			streams.pop_back();
+		return NULL;
+	}
+	if(!doc->load(stream, filename.c_str(), resolver)){
+		Log_e("could not parse %s.\n", filename.c_str());
+		delete doc;
+		return NULL;
+	}
+	doc->owner = this;
+	externals[filename] = doc;
+	return doc;
+}
+
+/**
+ * <float_array>の値
+ * 同じ配列は複数の<triangles>から参照されるので一度だけ変換する
+ */
+const FloatArray* StreamDocument::getFloats(const StreamElement* float_array){
+	std::map<const StreamElement*, FloatArray*>::iterator it = floats.find(float_array);
+	if(it != floats.end())
+		return it->second;
+	FloatArray* values;
+	try{
+		values = new FloatArray;
+		values->reserve(float_array->getAttribute("count", 0));
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return NULL;
+	}
+	if(!parseFloats(float_array->text, float_array->text + float_array->text_len, values)){
+		Log_e("invalid <float_array> %s.\n", float_array->getID()? float_array->getID() : "");
+		delete values;
+		return NULL;
+	}
+	floats.insert(std::pair<const StreamElement*, FloatArray*>(float_array, values));
+	return values;
+}
+
+/**
+ * URIの断片識別子('#'以降)
+ * 無ければ空文字列
+ */
+const char* getFragment(const char* uri){
+	if(uri == NULL)
+		return "";
+	const char* pos = strchr(uri, '#');
+	return pos? pos + 1 : "";
+}
+
+} // namespace collada
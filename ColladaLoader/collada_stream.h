@@ -0,0 +1,96 @@
+﻿/**
+ * collada-domを介さない読み込み用の軽量な文書
+ * XmlReaderで文書を一度だけ読み、ローダが使う要素だけを残す
+ * 数値配列はテキストの範囲だけを覚えておき、必要になった時点で直接変換する
+ * 外部の文書を指すURIはResolverで開き、最初の文書がまとめて保持する
+ */
+#pragma once
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "collada_def.h"
+#include "xml_reader.h"
+
+namespace collada{
+
+class StreamDocument;
+
+class StreamElement{
+friend class StreamDocument;
+public:
+	StreamElement();
+	bool isName(const char* name) const;
+	const char* getAttribute(const char* name) const;
+	unsigned int getAttribute(const char* name, unsigned int value) const;
+	const char* getID() const { return getAttribute("id"); }
+	StreamElement* getParent() const { return parent; }
+	StreamElement* getChild() const { return child; }
+	StreamElement* getChild(const char* name) const;
+	StreamElement* getSibling() const { return sibling; }
+	StreamElement* getNext(const char* name) const;
+	StreamDocument* getDocument() const { return document; }
+	void getText(std::string* output) const;
+	bool getFloats(float* values, size_t max_count, size_t* count) const;
+	bool getUints(UintArray* values) const;
+	Uid getHash(Uid seed = 0) const;
+private:
+	typedef struct{
+		const char* name;
+		size_t name_len;
+		std::string value;
+	}Attribute;
+private:
+	StreamDocument* document;
+	const char* name;
+	size_t name_len;
+	std::vector<Attribute> attributes;
+	const char* text;	// 子要素を持たない場合の内容(実体参照は未展開)
+	size_t text_len;
+	StreamElement* parent;
+	StreamElement* child;
+	StreamElement* last;
+	StreamElement* sibling;
+};
+
+class StreamDocument{
+public:
+	StreamDocument();
+	~StreamDocument();
+	bool load(const char* data, size_t size);
+	bool load(Stream* stream, const char* uri, Resolver* resolver);
+	bool begin(Stream* stream, const char* uri, Resolver* resolver);
+	bool parse(unsigned long long deadline, bool* done);
+	void cleanup();
+	StreamElement* getRoot(){ return root; }
+	StreamElement* findElement(const char* type);
+	StreamElement* getElement(const char* id, const char* type);
+	StreamElement* resolve(const char* uri, const char* type);
+	const FloatArray* getFloats(const StreamElement* float_array);
+private:
+	void start(const char* data, size_t size);
+	StreamDocument* getExternal(const std::string& filename);
+	static Uid getKey(const char* id, size_t id_len, const char* type, size_t type_len);
+	bool isSkipped(const char* name, size_t name_len, const StreamElement* parent) const;
+	void add(StreamElement* elem);
+private:
+	std::deque<StreamElement> elements;	// 追加してもアドレスは変わらない
+	StreamElement* root;
+	std::map<Uid, StreamElement*> ids;
+	std::map<const StreamElement*, FloatArray*> floats;	// 変換済みの<float_array>
+	std::string uri;	// 外部参照の基準
+	Resolver* resolver;
+	StreamDocument* owner;	// 外部の文書を保持する最初の文書
+	std::vector<unsigned char> buffer;	// 直接参照できないストリームの内容
+	std::map<std::string, StreamDocument*> externals;
+	std::vector<Stream*> streams;	// 外部の文書の読み込み元
+	// 解析中の状態
+	XmlReader reader;
+	StreamElement* current;
+	size_t size;
+	size_t next_report;
+};
+
+const char* getFragment(const char* uri);
+
+} // namespace collada
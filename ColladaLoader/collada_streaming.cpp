@@ -0,0 +1,158 @@
+﻿#include <math.h>
+#include <algorithm>
+#include "collada.h"
+#include "collada_streaming.h"
+#include "timer.h"
+#include "log.h"
+
+namespace collada{
+
+// カメラが境界球の内側にある場合の距離
+static const float MIN_DISTANCE = 1.0e-3f;
+
+GeometryStreamer::GeometryStreamer(){
+	for(int i = 0; i < 3; i++)
+		eye[i] = 0.0f;
+	scale = 1.0f;
+	placeholder_radius = 1.0f;
+	dirty = true;
+}
+
+GeometryStreamer::~GeometryStreamer(){
+	cleanup();
+}
+
+void GeometryStreamer::cleanup(){
+	pending.clear();
+	dirty = true;
+}
+
+/**
+ * sceneの未展開のメッシュを登録する
+ * sceneは展開が終わるまで有効である必要がある
+ */
+bool GeometryStreamer::begin(const Scene* scene){
+	cleanup();
+	try{
+		for(const Node* node = scene->findNode(); node; node = node->getNext()){
+			const GeometryPtrArray& geometries = node->getGeometries();
+			for(GeometryPtrArray::const_iterator it = geometries.begin(); it != geometries.end(); it++){
+				if((*it)->isDecoded())
+					continue;
+				Entry entry;
+				entry.node = node;
+				entry.geometry = *it;
+				entry.priority = 0.0f;
+				pending.push_back(entry);
+			}
+		}
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		cleanup();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * 優先度の高いものからおよそbudget_usマイクロ秒だけ展開する
+ * 少なくとも1つは展開する
+ * 全て展開し終えればdoneをtrueにする、展開に失敗したメッシュがあればfalse(残りは続けて展開できる)
+ */
+bool GeometryStreamer::step(unsigned int budget_us, bool* done){
+	const unsigned long long deadline = getMicroseconds() + budget_us;
+	if(dirty)
+		prioritize();
+	bool result = true;
+	while(!pending.empty()){
+		std::pop_heap(pending.begin(), pending.end(), isLower);
+		Geometry* geometry = pending.back().geometry;
+		pending.pop_back();
+		// 描画側で既に展開されていれば何もしない
+		if(!geometry->prefetch())
+			result = false;
+		if(getMicroseconds() >= deadline)
+			break;
+	}
+	*done = pending.empty();
+	return result;
+}
+
+/**
+ * カメラの位置を設定する
+ * scaleは画面の高さ/(2*tan(視野角/2))とすれば優先度が画面上の半径(ピクセル)になる
+ * ノードの行列(updateMatrix())もこの時点のものを使うので、毎フレーム呼ぶ
+ */
+void GeometryStreamer::setCamera(float x, float y, float z, float scale){
+	eye[0] = x;
+	eye[1] = y;
+	eye[2] = z;
+	this->scale = scale;
+	dirty = true;
+}
+
+void GeometryStreamer::setPlaceholderRadius(float radius){
+	placeholder_radius = radius;
+	dirty = true;
+}
+
+/**
+ * メッシュの境界球(ワールド座標)を取得する
+ * 未展開の間は読み込み時に求めた境界球を使い、それもなければノードの原点に置いた仮の境界球を返す
+ * メッシュを持たなければfalse
+ */
+bool GeometryStreamer::getBounds(const Node* node, const Geometry* geometry, float* center, float* radius) const{
+	float local[3] = { 0.0f, 0.0f, 0.0f };
+	float local_radius = placeholder_radius;
+	if(!geometry->getBounds(local, &local_radius)){
+		if(geometry->isDecoded())
+			return false;
+		local[0] = local[1] = local[2] = 0.0f;
+		local_radius = placeholder_radius;
+	}
+	// 列ベクトルの行列(OpenGLと同じ並び)
+	const float* m = *node->getCurrentMatrix();
+	float max_scale = 0.0f;
+	for(int i = 0; i < 3; i++){
+		center[i] = m[i] * local[0] + m[4 + i] * local[1] + m[8 + i] * local[2] + m[12 + i];
+		const float* axis = &m[i * 4];
+		const float s = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+		if(s > max_scale)
+			max_scale = s;
+	}
+	*radius = local_radius * sqrtf(max_scale);
+	return true;
+}
+
+/**
+ * 全ての優先度を計算し直してヒープを組み直す
+ */
+void GeometryStreamer::prioritize(){
+	for(std::vector<Entry>::iterator it = pending.begin(); it != pending.end(); it++)
+		it->priority = getPriority(*it);
+	std::make_heap(pending.begin(), pending.end(), isLower);
+	dirty = false;
+}
+
+/**
+ * 画面上の大きさの目安(半径/距離)
+ * 近いものと大きいものほど高い
+ */
+float GeometryStreamer::getPriority(const Entry& entry) const{
+	float center[3];
+	float radius;
+	if(!getBounds(entry.node, entry.geometry, center, &radius))
+		return 0.0f;
+	float d2 = 0.0f;
+	for(int i = 0; i < 3; i++){
+		const float d = center[i] - eye[i];
+		d2 += d * d;
+	}
+	float distance = sqrtf(d2) - radius;
+	if(distance < MIN_DISTANCE)
+		distance = MIN_DISTANCE;
+	return scale * radius / distance;
+}
+
+} // namespace collada
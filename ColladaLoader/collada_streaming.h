@@ -0,0 +1,42 @@
+﻿/**
+ * カメラからの距離に応じたメッシュの段階的な展開
+ * 遅延展開で読み込んだシーンのメッシュを、画面上で大きく見えるものから展開する
+ */
+#pragma once
+#include <vector>
+#include "collada_def.h"
+
+namespace collada{
+
+class Node;
+class Scene;
+
+class GeometryStreamer{
+public:
+	GeometryStreamer();
+	~GeometryStreamer();
+	void cleanup();
+	bool begin(const Scene* scene);
+	bool step(unsigned int budget_us, bool* done);
+	void setCamera(float x, float y, float z, float scale = 1.0f);
+	void setPlaceholderRadius(float radius);
+	bool getBounds(const Node* node, const Geometry* geometry, float* center, float* radius) const;
+	size_t getPendingCount() const { return pending.size(); }
+private:
+	typedef struct{
+		const Node* node;
+		Geometry* geometry;
+		float priority;	// 画面上の大きさの目安
+	}Entry;
+	static bool isLower(const Entry& a, const Entry& b){ return a.priority < b.priority; }
+	void prioritize();
+	float getPriority(const Entry& entry) const;
+private:
+	std::vector<Entry> pending;	// 未展開のメッシュ(優先度のヒープ)
+	float eye[3];	// カメラの位置(ワールド座標)
+	float scale;	// 境界球の半径/距離を画面上の大きさに換算する係数
+	float placeholder_radius;	// 未展開のメッシュの仮の境界球の半径
+	bool dirty;	// 優先度の再計算が必要
+};
+
+} // namespace collada
@@ -0,0 +1,886 @@
+﻿#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include "collada.h"
+#include "collada_texture.h"
+#include "collada_cache.h"
+#include "block_compress.h"
+#include "hash64.h"
+#include "mapped_file.h"
+#include "log.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace collada{
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * 1画素(RGBA)を1つのベクトルとして扱う
+ */
+#ifdef USE_SSE2
+typedef __m128 Pixel;
+static inline Pixel loadPixel(const float* p){ return _mm_loadu_ps(p); }
+static inline void storePixel(float* p, Pixel v){ _mm_storeu_ps(p, v); }
+static inline Pixel zeroPixel(){ return _mm_setzero_ps(); }
+static inline Pixel addPixel(Pixel a, Pixel b){ return _mm_add_ps(a, b); }
+static inline Pixel mulPixel(Pixel a, float s){ return _mm_mul_ps(a, _mm_set1_ps(s)); }
+#else
+typedef struct{
+	float v[4];
+}Pixel;
+static inline Pixel loadPixel(const float* p){ Pixel r; for(int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+static inline void storePixel(float* p, Pixel v){ for(int i = 0; i < 4; i++) p[i] = v.v[i]; }
+static inline Pixel zeroPixel(){ Pixel r; for(int i = 0; i < 4; i++) r.v[i] = 0.0f; return r; }
+static inline Pixel addPixel(Pixel a, Pixel b){ for(int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+static inline Pixel mulPixel(Pixel a, float s){ for(int i = 0; i < 4; i++) a.v[i] *= s; return a; }
+#endif
+
+#define TEXTURE_CACHE_MAGIC		0x58455443	// "CTEX"
+#define TEXTURE_CACHE_VERSION	2
+// キャッシュのレベルの数の上限(32bitの寸法の1x1まで)
+#define TEXTURE_CACHE_MAX_LEVELS	32
+
+// 線形→sRGBの表の分解能
+static const int LINEAR_STEPS = 4096;
+
+// カイザー窓のタップ数(縮小後の1画素あたり)と形状
+static const int KAISER_TAPS = 6;
+static const float KAISER_ALPHA = 4.0f;
+
+static float besselI0(float x){
+	float sum = 1.0f;
+	float term = 1.0f;
+	for(int k = 1; k < 16; k++){
+		term *= (x * 0.5f / k) * (x * 0.5f / k);
+		sum += term;
+	}
+	return sum;
+}
+
+/**
+ * 変換表とフィルタの係数
+ * 静的な初期化で作るのでスレッドから書き換えることはない
+ */
+static struct FilterTables{
+	float srgb_to_linear[256];
+	unsigned char linear_to_srgb[LINEAR_STEPS];
+	float kaiser[KAISER_TAPS];	// 縮小後の画素の中心から-2.5～+2.5画素の重み
+	FilterTables(){
+		for(int i = 0; i < 256; i++){
+			const float c = i / 255.0f;
+			srgb_to_linear[i] = (c <= 0.04045f)? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for(int i = 0; i < LINEAR_STEPS; i++){
+			const float l = static_cast<float>(i) / (LINEAR_STEPS - 1);
+			const float c = (l <= 0.0031308f)? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+			linear_to_srgb[i] = static_cast<unsigned char>(c * 255.0f + 0.5f);
+		}
+		const float pi = 3.14159265f;
+		const float width = KAISER_TAPS * 0.5f;
+		float sum = 0.0f;
+		for(int i = 0; i < KAISER_TAPS; i++){
+			const float d = i - (KAISER_TAPS - 1) * 0.5f;
+			const float x = pi * d * 0.5f;
+			const float sinc = sinf(x) / x;
+			const float r = d / width;
+			kaiser[i] = sinc * besselI0(KAISER_ALPHA * sqrtf(1.0f - r * r)) / besselI0(KAISER_ALPHA);
+			sum += kaiser[i];
+		}
+		for(int i = 0; i < KAISER_TAPS; i++)
+			kaiser[i] /= sum;
+	}
+}tables;
+
+/**
+ * RGBA8(上の行から)を線形の浮動小数点(下の行から)に変換する
+ */
+static void toLinear(const unsigned char* src, unsigned int width, unsigned int height, bool gamma, float* dst){
+	for(unsigned int y = 0; y < height; y++){
+		const unsigned char* s = src + static_cast<size_t>(height - 1 - y) * width * 4;
+		float* d = dst + static_cast<size_t>(y) * width * 4;
+		for(unsigned int x = 0; x < width * 4; x += 4){
+			for(int c = 0; c < 3; c++)
+				d[x + c] = gamma? tables.srgb_to_linear[s[x + c]] : s[x + c] / 255.0f;
+			d[x + 3] = s[x + 3] / 255.0f;	// アルファは線形のまま
+		}
+	}
+}
+
+static inline unsigned char toUnorm(float v){
+	if(v <= 0.0f)
+		return 0;
+	if(v >= 1.0f)
+		return 255;
+	return static_cast<unsigned char>(v * 255.0f + 0.5f);
+}
+
+static inline unsigned char toSrgb(float v){
+	if(v <= 0.0f)
+		return 0;
+	if(v >= 1.0f)
+		return 255;
+	return tables.linear_to_srgb[static_cast<int>(v * (LINEAR_STEPS - 1) + 0.5f)];
+}
+
+static void toLevel(const float* src, bool gamma, TextureLevel* level){
+	const size_t count = static_cast<size_t>(level->width) * level->height * 4;
+	unsigned char* d = &level->pixels[0];
+	for(size_t i = 0; i < count; i += 4){
+		for(int c = 0; c < 3; c++)
+			d[i + c] = gamma? toSrgb(src[i + c]) : toUnorm(src[i + c]);
+		d[i + 3] = toUnorm(src[i + 3]);
+	}
+}
+
+/**
+ * 2x2の平均で縮小する
+ * 奇数の辺は最後の画素が残りの3画素(長さ1の辺は1画素)を平均し、端の列と行を捨てない
+ */
+static void reduceBox(const float* src, unsigned int sw, unsigned int sh, float* dst, unsigned int dw, unsigned int dh){
+	for(unsigned int y = 0; y < dh; y++){
+		const unsigned int y0 = 2 * y;
+		const unsigned int y1 = (y + 1 < dh)? y0 + 2 : sh;
+		float* d = dst + static_cast<size_t>(y) * dw * 4;
+		for(unsigned int x = 0; x < dw; x++){
+			const unsigned int x0 = 2 * x;
+			const unsigned int x1 = (x + 1 < dw)? x0 + 2 : sw;
+			Pixel p = zeroPixel();
+			for(unsigned int sy = y0; sy < y1; sy++){
+				const float* row = src + static_cast<size_t>(sy) * sw * 4;
+				for(unsigned int sx = x0; sx < x1; sx++)
+					p = addPixel(p, loadPixel(row + sx * 4));
+			}
+			storePixel(d + x * 4, mulPixel(p, 1.0f / static_cast<float>((y1 - y0) * (x1 - x0))));
+		}
+	}
+}
+
+static inline unsigned int clampIndex(int i, unsigned int size){
+	if(i < 0)
+		return 0;
+	if(static_cast<unsigned int>(i) >= size)
+		return size - 1;
+	return static_cast<unsigned int>(i);
+}
+
+/**
+ * カイザー窓のsincで縮小する
+ * 横と縦に分けて掛ける、長さ1の辺はそのまま
+ */
+static void reduceKaiser(const float* src, unsigned int sw, unsigned int sh, float* temp, float* dst, unsigned int dw, unsigned int dh){
+	const int offset = KAISER_TAPS / 2 - 1;
+	// 横
+	for(unsigned int y = 0; y < sh; y++){
+		const float* s = src + static_cast<size_t>(y) * sw * 4;
+		float* t = temp + static_cast<size_t>(y) * dw * 4;
+		for(unsigned int x = 0; x < dw; x++){
+			if(sw == 1){
+				storePixel(t + x * 4, loadPixel(s));
+				continue;
+			}
+			Pixel p = zeroPixel();
+			for(int k = 0; k < KAISER_TAPS; k++)
+				p = addPixel(p, mulPixel(loadPixel(s + clampIndex(2 * x + k - offset, sw) * 4), tables.kaiser[k]));
+			storePixel(t + x * 4, p);
+		}
+	}
+	// 縦
+	for(unsigned int y = 0; y < dh; y++){
+		float* d = dst + static_cast<size_t>(y) * dw * 4;
+		if(sh == 1){
+			memcpy(d, temp, dw * 4 * sizeof(float));
+			continue;
+		}
+		for(unsigned int x = 0; x < dw; x++){
+			Pixel p = zeroPixel();
+			for(int k = 0; k < KAISER_TAPS; k++){
+				const float* t = temp + static_cast<size_t>(clampIndex(2 * y + k - offset, sh)) * dw * 4;
+				p = addPixel(p, mulPixel(loadPixel(t + x * 4), tables.kaiser[k]));
+			}
+			storePixel(d + x * 4, p);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TextureCache::TextureCache(){
+	budget = 0;
+	stats.hits = 0;
+	stats.misses = 0;
+	stats.evictions = 0;
+	stats.bytes = 0;
+	stats.count = 0;
+}
+
+TextureCache::~TextureCache(){
+	cleanup();
+}
+
+void TextureCache::cleanup(){
+	ScopedLock lock(&mutex);
+	entries.clear();
+	images.clear();
+	lru.clear();
+	stats.bytes = 0;
+	stats.count = 0;
+}
+
+/**
+ * 保持するレベルの合計の上限
+ * 参照されているものは上限を超えても捨てない
+ */
+void TextureCache::setBudget(size_t bytes){
+	ScopedLock lock(&mutex);
+	budget = bytes;
+	evict();
+}
+
+/**
+ * samplerの画像のテクスチャを参照する
+ * release()するまで捨てられない、キャッシュになければNULL
+ */
+const Texture* TextureCache::acquire(const Material::Sampler* sampler){
+	ScopedLock lock(&mutex);
+	Entry* entry = findEntry(sampler->image_uid);
+	if(!entry)
+		return NULL;
+	entry->refs++;
+	touch(entry);
+	return &entry->texture;
+}
+
+void TextureCache::release(const Material::Sampler* sampler){
+	ScopedLock lock(&mutex);
+	Entry* entry = findEntry(sampler->image_uid);
+	if(!entry || (entry->refs == 0))
+		return;
+	entry->refs--;
+	if(entry->refs == 0)
+		evict();
+}
+
+/**
+ * 画像のuidからテクスチャを引く
+ * 参照は増やさないので、予算を超えれば捨てられることがある
+ */
+const Texture* TextureCache::find(Uid image_uid) const{
+	ScopedLock lock(&mutex);
+	const Entry* entry = findEntry(image_uid);
+	return entry? &entry->texture : NULL;
+}
+
+TextureCache::Stats TextureCache::getStats() const{
+	ScopedLock lock(&mutex);
+	return stats;
+}
+
+/**
+ * 内容が同じテクスチャがあれば画像のuidをそれに結び付ける
+ * 見つかればtrue(展開を省ける)
+ */
+bool TextureCache::bind(Uid image_uid, Uid hash){
+	ScopedLock lock(&mutex);
+	std::map<Uid, Entry>::iterator it = entries.find(hash);
+	if(it == entries.end()){
+		stats.misses++;
+		return false;
+	}
+	try{
+		images[image_uid] = hash;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	stats.hits++;
+	touch(&it->second);
+	return true;
+}
+
+/**
+ * 展開したテクスチャを登録する
+ * レベルはキャッシュに移る、別のスレッドが先に同じ内容を登録していればそちらを使う
+ */
+void TextureCache::insert(Texture* texture){
+	ScopedLock lock(&mutex);
+	try{
+		std::pair<Uid, Entry> p;
+		p.first = texture->hash;
+		std::map<Uid, Entry>::_Pairib pib = entries.insert(p);
+		Entry* entry = &pib.first->second;
+		if(pib.second){
+			entry->texture.uid = texture->uid;
+			entry->texture.hash = texture->hash;
+			entry->texture.format = texture->format;
+			entry->texture.levels.swap(texture->levels);
+			entry->bytes = 0;
+			for(std::vector<TextureLevel>::const_iterator it = entry->texture.levels.begin(); it != entry->texture.levels.end(); it++)
+				entry->bytes += it->pixels.size();
+			entry->refs = 0;
+			entry->lru = lru.insert(lru.end(), texture->hash);
+			stats.bytes += entry->bytes;
+			stats.count++;
+		}
+		else{
+			texture->levels.clear();
+			touch(entry);
+		}
+		images[texture->uid] = texture->hash;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		texture->levels.clear();
+		return;
+	}
+	evict();
+}
+
+TextureCache::Entry* TextureCache::findEntry(Uid image_uid) const{
+	std::map<Uid, Uid>::const_iterator image = images.find(image_uid);
+	if(image == images.end())
+		return NULL;
+	std::map<Uid, Entry>::const_iterator it = entries.find(image->second);
+	if(it == entries.end())
+		return NULL;
+	return const_cast<Entry*>(&it->second);
+}
+
+/**
+ * 最も新しく使ったものにする
+ */
+void TextureCache::touch(Entry* entry){
+	lru.splice(lru.end(), lru, entry->lru);
+}
+
+/**
+ * 予算に収まるまで参照されていないものを古い順に捨てる
+ */
+void TextureCache::evict(){
+	if(budget == 0)
+		return;
+	std::list<Uid>::iterator it = lru.begin();
+	while((stats.bytes > budget) && (it != lru.end())){
+		std::map<Uid, Entry>::iterator entry = entries.find(*it);
+		if(entry->second.refs > 0){
+			it++;
+			continue;
+		}
+		stats.bytes -= entry->second.bytes;
+		stats.count--;
+		stats.evictions++;
+		// 捨てたテクスチャを指す画像のuidも消す
+		std::map<Uid, Uid>::iterator image = images.begin();
+		while(image != images.end()){
+			if(image->second == *it)
+				images.erase(image++);
+			else
+				image++;
+		}
+		entries.erase(entry);
+		it = lru.erase(it);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TextureLoader::TextureLoader(){
+	collada = NULL;
+	decoder = NULL;
+	cache = NULL;
+	next_index = 0;
+	filter = Filter_Box;
+	compression = Compression_None;
+	use_gamma = true;
+	use_mipmap = true;
+	use_prefetch = true;
+}
+
+TextureLoader::~TextureLoader(){
+	cleanup();
+}
+
+void TextureLoader::cleanup(){
+	textures.clear();
+	uids.clear();
+	material_usages.clear();
+	next_index = 0;
+}
+
+/**
+ * 画像の使われ方を指定する
+ * 材質から分からないもの(法線マップなど)に使う
+ */
+void TextureLoader::setUsage(Uid image_uid, TextureUsage usage){
+	try{
+		usages[image_uid] = usage;
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+	}
+}
+
+/**
+ * 展開と圧縮の結果をdirectoryにキャッシュする
+ * directoryはファイル名の前にそのまま付ける(末尾の区切りを含む)、NULLならキャッシュしない
+ */
+void TextureLoader::setDiskCache(const char* directory){
+	if(directory)
+		disk_cache.assign(directory);
+	else
+		disk_cache.clear();
+}
+
+/**
+ * colladaの全ての画像を展開する
+ * thread_countが0ならプロセッサの数だけスレッドを使う
+ * 全て読み込めた場合はtrue、読めなかった画像はhashがINVALID_UIDになる
+ * キャッシュを使う場合、展開したレベルはキャッシュに移るのでTextureCache::acquire()で受け取る
+ */
+bool TextureLoader::load(const Collada* collada, ImageDecoder* decoder, unsigned int thread_count){
+	cleanup();
+	const Images* images = collada->getImages();
+	if(!images)
+		return true;
+	const StringArray* names = images->getImages();
+	const size_t count = names->size();
+	if(thread_count == 0)
+		thread_count = getProcessorCount();
+	if(thread_count > count)
+		thread_count = static_cast<unsigned int>(count);
+	Thread* threads = NULL;
+	try{
+		textures.resize(count);
+		for(size_t i = 0; i < count; i++){
+			std::string temp(*images->getPath());
+			temp.append((*names)[i]);
+			textures[i].uid = calcHash64(reinterpret_cast<const unsigned char*>(temp.c_str()));
+			textures[i].hash = INVALID_UID;
+			textures[i].format = TextureFormat_RGBA8;
+			std::pair<Uid, size_t> p(textures[i].uid, i);
+			uids.insert(p);	// 同じファイルなら最初のものを使う
+		}
+		if(thread_count > 1)
+			threads = new Thread[thread_count - 1];
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		cleanup();
+		return false;
+	}
+	this->collada = collada;
+	this->decoder = decoder;
+	if(compression != Compression_None)
+		collectUsages();
+	if(use_prefetch && !prefetcher.start(collada))
+		use_prefetch = false;
+	// 1つは呼び出したスレッドで読み込む
+	for(unsigned int i = 0; i + 1 < thread_count; i++){
+		if(!threads[i].start(run, this))
+			break;
+	}
+	run(this);
+	delete[] threads;
+	prefetcher.cleanup();
+	this->collada = NULL;
+	this->decoder = NULL;
+	bool result = true;
+	for(size_t i = 0; i < count; i++){
+		if(textures[i].hash == INVALID_UID)
+			result = false;
+	}
+	return result;
+}
+
+const Texture* TextureLoader::findTexture(Uid uid) const{
+	std::map<Uid, size_t>::const_iterator it = uids.find(uid);
+	if(it == uids.end())
+		return NULL;
+	return &textures[it->second];
+}
+
+/**
+ * 次に読み込む画像を取り出す
+ */
+bool TextureLoader::next(size_t* index){
+	ScopedLock lock(&mutex);
+	if(next_index >= textures.size())
+		return false;
+	*index = next_index++;
+	return true;
+}
+
+void TextureLoader::run(void* arg){
+	TextureLoader* loader = static_cast<TextureLoader*>(arg);
+	size_t index;
+	// 要素ごとに別のスレッドが書き込むだけなのでロックは要らない
+	if(loader->use_prefetch){
+		// 読み終えた順に受け取る
+		std::vector<unsigned char> buffer;
+		while(loader->prefetcher.next(&index, &buffer))
+			loader->loadTexture(index, &buffer);
+		return;
+	}
+	while(loader->next(&index))
+		loader->loadTexture(index);
+}
+
+bool TextureLoader::loadTexture(size_t index){
+	const std::string& name = (*collada->getImages()->getImages())[index];
+	Stream* stream = collada->openImage(index);
+	if(!stream){
+		Log_e("could not open %s.\n", name.c_str());
+		return false;
+	}
+	std::vector<unsigned char> buffer;
+	const bool read = readStream(stream, &buffer);
+	delete stream;
+	if(!read)
+		buffer.clear();
+	return loadTexture(index, &buffer);
+}
+
+/**
+ * 読み込んだファイルの中身から展開する
+ * bufferは空で返る
+ */
+bool TextureLoader::loadTexture(size_t index, std::vector<unsigned char>* data){
+	const std::string& name = (*collada->getImages()->getImages())[index];
+	std::vector<unsigned char> buffer;
+	buffer.swap(*data);
+	if(buffer.empty()){
+		Log_e("could not read %s.\n", name.c_str());
+		return false;
+	}
+	Texture* texture = &textures[index];
+	const Uid hash = calcHash64(&buffer[0], buffer.size());
+	if(cache && cache->bind(texture->uid, hash)){
+		texture->hash = hash;
+		return true;
+	}
+	const TextureUsage usage = getUsage(texture->uid);
+	const Uid key = getDiskCacheKey(hash, usage);
+	if(!disk_cache.empty() && loadDiskCache(texture, key, hash)){
+		texture->hash = hash;
+		if(cache)
+			cache->insert(texture);
+		return true;
+	}
+	unsigned int width = 0;
+	unsigned int height = 0;
+	std::vector<unsigned char> pixels;
+	if(!decoder->decode(&buffer[0], buffer.size(), &width, &height, &pixels)
+	|| (width == 0) || (height == 0) || (pixels.size() != static_cast<size_t>(width) * height * 4)){
+		Log_e("could not decode %s.\n", name.c_str());
+		return false;
+	}
+	std::vector<unsigned char>().swap(buffer);
+	if(!buildLevels(texture, width, height, pixels) || !compress(texture, usage))
+		return false;
+	texture->hash = hash;
+	if(!disk_cache.empty() && !saveDiskCache(texture, key, index))
+		Log_w("could not save texture cache(%s).\n", name.c_str());
+	if(cache)
+		cache->insert(texture);
+	return true;
+}
+
+/**
+ * 文書の材質から画像の使われ方を調べる
+ * 透過に使われていればTextureUsage_Alpha、それ以外はTextureUsage_Color
+ */
+void TextureLoader::collectUsages(){
+	const Scene* scene = collada->getScene();
+	if(!scene)
+		return;
+	try{
+		for(const Node* node = scene->findNode(); node; node = node->getNext()){
+			const GeometryPtrArray& geometries = node->getGeometries();
+			for(GeometryPtrArray::const_iterator it = geometries.begin(); it != geometries.end(); it++){
+				const std::map<Uid, Material*>& bind_material = (*it)->getBindMaterial();
+				for(std::map<Uid, Material*>::const_iterator mt = bind_material.begin(); mt != bind_material.end(); mt++){
+					const Material* material = mt->second;
+					const Material::Param* params[] = {
+						material->getEmission(), material->getAmbient(), material->getDiffuse(),
+						material->getSpecular(), material->getReflective(), material->getTransparent()
+					};
+					const size_t count = sizeof(params) / sizeof(params[0]);
+					for(size_t i = 0; i < count; i++){
+						if(!params[i]->sampler)
+							continue;
+						const TextureUsage usage = (params[i] == material->getTransparent())? TextureUsage_Alpha : TextureUsage_Color;
+						std::pair<Uid, TextureUsage> p(params[i]->sampler->image_uid, usage);
+						std::map<Uid, TextureUsage>::_Pairib pib = material_usages.insert(p);
+						if(!pib.second && (usage == TextureUsage_Alpha))
+							pib.first->second = usage;
+					}
+				}
+			}
+		}
+	}
+	catch(std::bad_alloc& e){
+		Log_w("could not allocate memory.\n");
+	}
+}
+
+TextureUsage TextureLoader::getUsage(Uid image_uid) const{
+	std::map<Uid, TextureUsage>::const_iterator it = usages.find(image_uid);
+	if(it != usages.end())
+		return it->second;
+	it = material_usages.find(image_uid);
+	if(it != material_usages.end())
+		return it->second;
+	return TextureUsage_Color;
+}
+
+static bool hasAlpha(const TextureLevel& level){
+	const size_t size = level.pixels.size();
+	for(size_t i = 3; i < size; i += 4){
+		if(level.pixels[i] != 255)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * 使われ方と設定から形式を選んで全てのレベルを圧縮する
+ * 端のブロックは端の画素を繰り返して埋める
+ */
+bool TextureLoader::compress(Texture* texture, TextureUsage usage) const{
+	if(compression == Compression_None)
+		return true;
+	TextureFormat format;
+	if(usage == TextureUsage_Normal)
+		format = TextureFormat_BC5;
+	else
+	if(compression == Compression_BC7)
+		format = TextureFormat_BC7;
+	else
+	if((usage == TextureUsage_Alpha) || hasAlpha(texture->levels[0]))
+		format = TextureFormat_BC3;
+	else
+		format = TextureFormat_BC1;
+	const size_t block_size = (format == TextureFormat_BC1)? 8 : 16;
+	try{
+		for(std::vector<TextureLevel>::iterator level = texture->levels.begin(); level != texture->levels.end(); level++){
+			const unsigned int bw = (level->width + 3) / 4;
+			const unsigned int bh = (level->height + 3) / 4;
+			std::vector<unsigned char> blocks(static_cast<size_t>(bw) * bh * block_size);
+			unsigned char block[64];
+			for(unsigned int by = 0; by < bh; by++){
+				for(unsigned int bx = 0; bx < bw; bx++){
+					for(unsigned int y = 0; y < 4; y++){
+						const unsigned int sy = (by * 4 + y < level->height)? by * 4 + y : level->height - 1;
+						for(unsigned int x = 0; x < 4; x++){
+							const unsigned int sx = (bx * 4 + x < level->width)? bx * 4 + x : level->width - 1;
+							memcpy(&block[(y * 4 + x) * 4], &level->pixels[(static_cast<size_t>(sy) * level->width + sx) * 4], 4);
+						}
+					}
+					unsigned char* output = &blocks[(static_cast<size_t>(by) * bw + bx) * block_size];
+					switch(format){
+					case TextureFormat_BC1:
+						compressBC1(block, output);
+						break;
+					case TextureFormat_BC3:
+						compressBC3(block, output);
+						break;
+					case TextureFormat_BC5:
+						compressBC5(block, output);
+						break;
+					default:
+						compressBC7(block, output);
+						break;
+					}
+				}
+			}
+			level->pixels.swap(blocks);
+		}
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		texture->levels.clear();
+		return false;
+	}
+	texture->format = format;
+	return true;
+}
+
+/**
+ * キャッシュファイルの名前にするハッシュ
+ * 画像の内容と結果に影響する設定から作る
+ */
+Uid TextureLoader::getDiskCacheKey(Uid hash, TextureUsage usage) const{
+	const unsigned long long values[] = {
+		TEXTURE_CACHE_VERSION, hash, usage, compression, filter, use_gamma, use_mipmap
+	};
+	return calcHash64(reinterpret_cast<const unsigned char*>(values), sizeof(values));
+}
+
+static void getDiskCacheName(std::string* output, const std::string& directory, Uid key){
+	char name[32];
+	sprintf(name, "%016llx.tex", key);
+	output->assign(directory);
+	output->append(name);
+}
+
+/**
+ * 形式と寸法から決まるレベルのバイト数
+ */
+static size_t getLevelSize(TextureFormat format, unsigned int width, unsigned int height){
+	if(format == TextureFormat_RGBA8)
+		return static_cast<size_t>(width) * height * 4;
+	const size_t block_size = (format == TextureFormat_BC1)? 8 : 16;
+	return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * block_size;
+}
+
+bool TextureLoader::loadDiskCache(Texture* texture, Uid key, Uid hash) const{
+	std::string filename;
+	getDiskCacheName(&filename, disk_cache, key);
+	MappedFile file;
+	if(!file.open(filename.c_str()))
+		return false;
+	CacheReader reader(file.getData(), file.getSize());
+	unsigned int magic, version, format, count;
+	Uid cached;
+	if(!reader.readU32(&magic) || (magic != TEXTURE_CACHE_MAGIC)
+	|| !reader.readU32(&version) || (version != TEXTURE_CACHE_VERSION)
+	|| !reader.readU64(&cached) || (cached != hash) || !reader.readU32(&format) || !reader.readU32(&count))
+		return false;
+	// 壊れたファイルで転送時に範囲外を読まないように、レベルの数と大きさを形式と寸法から確かめる
+	if((format > TextureFormat_BC7) || (count == 0) || (count > TEXTURE_CACHE_MAX_LEVELS))
+		return false;
+	try{
+		texture->levels.resize(count);
+		for(unsigned int i = 0; i < count; i++){
+			TextureLevel* level = &texture->levels[i];
+			unsigned int size;
+			if(!reader.readU32(&level->width) || !reader.readU32(&level->height) || !reader.readU32(&size)){
+				texture->levels.clear();
+				return false;
+			}
+			bool valid;
+			if(i == 0){
+				// レベルの数は1x1までの数を超えない
+				unsigned int levels = 1;
+				for(unsigned int n = (level->width > level->height)? level->width : level->height; n > 1; n >>= 1)
+					levels++;
+				valid = (level->width > 0) && (level->height > 0) && (count <= levels);
+			}
+			else{
+				const TextureLevel& upper = texture->levels[i - 1];
+				valid = (level->width == ((upper.width > 1)? upper.width / 2 : 1))
+					&& (level->height == ((upper.height > 1)? upper.height / 2 : 1));
+			}
+			if(!valid || (size != getLevelSize(static_cast<TextureFormat>(format), level->width, level->height)) || (size > reader.getRemain())){
+				Log_w("texture cache is broken(%s).\n", filename.c_str());
+				texture->levels.clear();
+				return false;
+			}
+			level->pixels.resize(size);
+			if(!reader.readBytes(&level->pixels[0], size)){
+				texture->levels.clear();
+				return false;
+			}
+		}
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		texture->levels.clear();
+		return false;
+	}
+	texture->format = static_cast<TextureFormat>(format);
+	return true;
+}
+
+/**
+ * 別のスレッドが同じファイルを書いても壊れないように、一時ファイルに書いてから名前を変える
+ */
+bool TextureLoader::saveDiskCache(const Texture* texture, Uid key, size_t index) const{
+	std::string filename;
+	getDiskCacheName(&filename, disk_cache, key);
+	char suffix[32];
+	sprintf(suffix, ".%u.tmp", static_cast<unsigned int>(index));
+	std::string temp(filename);
+	temp.append(suffix);
+	CacheWriter writer;
+	if(!writer.open(temp.c_str()))
+		return false;
+	writer.writeU32(TEXTURE_CACHE_MAGIC);
+	writer.writeU32(TEXTURE_CACHE_VERSION);
+	writer.writeU64(texture->hash);
+	writer.writeU32(texture->format);
+	writer.writeU32(static_cast<unsigned int>(texture->levels.size()));
+	for(std::vector<TextureLevel>::const_iterator it = texture->levels.begin(); it != texture->levels.end(); it++){
+		writer.writeU32(it->width);
+		writer.writeU32(it->height);
+		writer.writeU32(static_cast<unsigned int>(it->pixels.size()));
+		writer.writeBytes(&it->pixels[0], it->pixels.size());
+	}
+	if(!writer.close()){
+		remove(temp.c_str());
+		return false;
+	}
+	remove(filename.c_str());
+	if(rename(temp.c_str(), filename.c_str()) != 0){
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+/**
+ * 原寸から1x1までのレベルを作る
+ * 原寸は上下を反転するだけ、縮小は線形の浮動小数点で行い各レベルを8bitに戻す
+ */
+bool TextureLoader::buildLevels(Texture* texture, unsigned int width, unsigned int height, const std::vector<unsigned char>& pixels) const{
+	try{
+		texture->levels.push_back(TextureLevel());
+		TextureLevel* base = &texture->levels.back();
+		base->width = width;
+		base->height = height;
+		base->pixels.resize(pixels.size());
+		const size_t pitch = static_cast<size_t>(width) * 4;
+		for(unsigned int y = 0; y < height; y++)
+			memcpy(&base->pixels[y * pitch], &pixels[(height - 1 - y) * pitch], pitch);
+		if(!use_mipmap)
+			return true;
+		std::vector<float> current(static_cast<size_t>(width) * height * 4);
+		std::vector<float> reduced;
+		std::vector<float> temp;
+		toLinear(&pixels[0], width, height, use_gamma, &current[0]);
+		while((width > 1) || (height > 1)){
+			const unsigned int w = (width > 1)? width / 2 : 1;
+			const unsigned int h = (height > 1)? height / 2 : 1;
+			reduced.resize(static_cast<size_t>(w) * h * 4);
+			if(filter == Filter_Kaiser){
+				temp.resize(static_cast<size_t>(w) * height * 4);
+				reduceKaiser(&current[0], width, height, &temp[0], &reduced[0], w, h);
+			}
+			else{
+				reduceBox(&current[0], width, height, &reduced[0], w, h);
+			}
+			current.swap(reduced);
+			width = w;
+			height = h;
+			texture->levels.push_back(TextureLevel());
+			TextureLevel* level = &texture->levels.back();
+			level->width = width;
+			level->height = height;
+			level->pixels.resize(static_cast<size_t>(width) * height * 4);
+			toLevel(&current[0], use_gamma, level);
+		}
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		texture->levels.clear();
+		return false;
+	}
+	return true;
+}
+
+} // namespace collada
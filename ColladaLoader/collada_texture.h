@@ -0,0 +1,163 @@
+﻿/**
+ * テクスチャの読み込み
+ * 文書の画像を複数のスレッドで展開し、ミップマップまで生成してそのまま転送できる形にする
+ * 画像形式の展開はImageDecoderとして利用側で与える
+ * TextureCacheは画像の内容で重複を除き、複数の文書で展開結果を共有する
+ * 展開後にブロック圧縮し、結果をファイルにキャッシュすることもできる
+ */
+#pragma once
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include "collada_def.h"
+#include "collada_material.h"
+#include "collada_prefetch.h"
+#include "thread.h"
+
+namespace collada{
+
+class Collada;
+
+/**
+ * 画像形式の展開
+ * 複数のスレッドから同時に呼ばれる
+ */
+class ImageDecoder{
+public:
+	virtual ~ImageDecoder(){}
+	// RGBA8で上の行から出力する、展開できなければfalse
+	virtual bool decode(const unsigned char* data, size_t size, unsigned int* width, unsigned int* height, std::vector<unsigned char>* pixels) = 0;
+};
+
+typedef enum{
+	TextureFormat_RGBA8,
+	TextureFormat_BC1,	// RGB(不透明)
+	TextureFormat_BC3,	// RGBA
+	TextureFormat_BC5,	// RG(法線)
+	TextureFormat_BC7	// RGBA(高品質)
+}TextureFormat;
+
+// 材質での使われ方(圧縮形式の選択に使う)
+typedef enum{
+	TextureUsage_Color,
+	TextureUsage_Alpha,	// 透過に使う
+	TextureUsage_Normal
+}TextureUsage;
+
+typedef struct{
+	unsigned int width;
+	unsigned int height;
+	std::vector<unsigned char> pixels;	// RGBA8か圧縮したブロック、下の行から(OpenGLと同じ)
+}TextureLevel;
+
+typedef struct{
+	Uid uid;	// Material::Sampler::image_uidと同じ(パス+ファイル名のハッシュ)
+	Uid hash;	// 画像ファイルの内容のハッシュ、読めなかった画像はINVALID_UID
+	TextureFormat format;
+	std::vector<TextureLevel> levels;	// [0]が原寸、読めなかった画像とキャッシュに移したものは空
+}Texture;
+
+/**
+ * 展開済みのテクスチャのキャッシュ
+ * 画像ファイルの内容のハッシュで引くので、名前が違っても同じ内容なら1つだけ持つ
+ * Material::Samplerから参照している間は捨てず、予算を超えた分は参照されていないものを古い順に捨てる
+ */
+class TextureCache{
+public:
+	typedef struct{
+		unsigned long long hits;	// 展開を省けた数
+		unsigned long long misses;	// 展開した数
+		unsigned long long evictions;	// 予算を超えて捨てた数
+		size_t bytes;	// 保持しているレベルの合計
+		size_t count;	// 保持しているテクスチャの数
+	}Stats;
+public:
+	TextureCache();
+	~TextureCache();
+	void cleanup();
+	void setBudget(size_t bytes);
+	const Texture* acquire(const Material::Sampler* sampler);
+	void release(const Material::Sampler* sampler);
+	const Texture* find(Uid image_uid) const;
+	Stats getStats() const;
+	bool bind(Uid image_uid, Uid hash);
+	void insert(Texture* texture);
+private:
+	typedef struct{
+		Texture texture;	// uidは最初に登録した画像のもの
+		size_t bytes;
+		unsigned int refs;	// acquire()された数
+		std::list<Uid>::iterator lru;
+	}Entry;
+	Entry* findEntry(Uid image_uid) const;
+	void touch(Entry* entry);
+	void evict();
+private:
+	mutable Mutex mutex;
+	std::map<Uid, Entry> entries;	// 内容のハッシュ→テクスチャ
+	std::map<Uid, Uid> images;	// 画像のuid→内容のハッシュ
+	std::list<Uid> lru;	// 内容のハッシュ、使われた順(古いものが先頭)
+	size_t budget;	// 0なら無制限
+	Stats stats;
+};
+
+class TextureLoader{
+public:
+	typedef enum{
+		Filter_Box,	// 2x2の平均
+		Filter_Kaiser	// カイザー窓のsinc(ぼけにくい)
+	}Filter;
+	typedef enum{
+		Compression_None,
+		Compression_BC,	// BC1/BC3/BC5
+		Compression_BC7	// 色はBC7、法線はBC5
+	}Compression;
+public:
+	TextureLoader();
+	~TextureLoader();
+	void cleanup();
+	bool load(const Collada* collada, ImageDecoder* decoder, unsigned int thread_count = 0);
+	void setFilter(Filter filter){ this->filter = filter; }
+	void setGammaCorrect(bool enable){ use_gamma = enable; }
+	void setMipmapEnabled(bool enable){ use_mipmap = enable; }
+	void setCache(TextureCache* cache){ this->cache = cache; }
+	void setCompression(Compression compression){ this->compression = compression; }
+	void setUsage(Uid image_uid, TextureUsage usage);
+	void setDiskCache(const char* directory);
+	void setPrefetchEnabled(bool enable){ use_prefetch = enable; }
+	size_t getCount() const { return textures.size(); }
+	const Texture* getTexture(size_t index) const { return &textures[index]; }
+	const Texture* findTexture(Uid uid) const;
+private:
+	static void run(void* arg);
+	bool next(size_t* index);
+	bool loadTexture(size_t index);
+	bool loadTexture(size_t index, std::vector<unsigned char>* buffer);
+	bool buildLevels(Texture* texture, unsigned int width, unsigned int height, const std::vector<unsigned char>& pixels) const;
+	bool compress(Texture* texture, TextureUsage usage) const;
+	void collectUsages();
+	TextureUsage getUsage(Uid image_uid) const;
+	Uid getDiskCacheKey(Uid hash, TextureUsage usage) const;
+	bool loadDiskCache(Texture* texture, Uid key, Uid hash) const;
+	bool saveDiskCache(const Texture* texture, Uid key, size_t index) const;
+private:
+	Mutex mutex;
+	const Collada* collada;	// 読み込み中のみ
+	ImageDecoder* decoder;	// 読み込み中のみ
+	TextureCache* cache;	// NULLならキャッシュしない
+	std::vector<Texture> textures;	// 文書の画像と同じ並び
+	std::map<Uid, size_t> uids;	// uid→texturesの添字
+	std::map<Uid, TextureUsage> usages;	// setUsage()で指定したもの
+	std::map<Uid, TextureUsage> material_usages;	// 文書の材質から調べたもの
+	size_t next_index;	// 次に読み込む画像
+	Prefetcher prefetcher;
+	Filter filter;
+	Compression compression;
+	std::string disk_cache;	// キャッシュファイルの置き場所、空ならファイルにはキャッシュしない
+	bool use_gamma;	// sRGBとして線形空間で縮小する
+	bool use_mipmap;
+	bool use_prefetch;	// 全ての画像を先に読み始め、読み終えた順に展開する
+};
+
+} // namespace collada
@@ -1,4 +1,5 @@
 ﻿#include "collada_util.h"
+#include "collada_stream.h"
 
 namespace collada{
 
@@ -15,6 +16,16 @@ bool isGeometryNode(const domNode* dom_node){
 	return true;
 }
 
+bool isGeometryNode(const StreamElement* stream_node){
+	if(stream_node->getChild("instance_camera"))
+		return false;
+	if(stream_node->getChild("instance_controller"))
+		return false;
+	if(stream_node->getChild("instance_light"))
+		return false;
+	return true;
+}
+
 /**
  * ノード数を取得
  * <instance_node>は展開する
@@ -99,20 +110,7 @@ size_t countGeometryNode(const domVisual_scene* dom_visual_scene){
  * エレメントが変換要素か
  */
 bool isTransformationElement(domElement* dom_elem){
-	const char* type = dom_elem->getTypeName();
-	if(strcmp(type, "Lookat") == 0)
-		return true;
-	if(strcmp(type, "matrix") == 0)
-		return true;
-	if(strcmp(type, "rotate") == 0)
-		return true;
-	if(strcmp(type, "scale") == 0)
-		return true;
-	if(strcmp(type, "skew") == 0)
-		return true;
-	if(strcmp(type, "translate") == 0)
-		return true;
-	return false;
+	return isTransformationElement(getTransformationType(dom_elem));
 }
 
 bool isTransformationElement(TransformationElementType type){
@@ -124,24 +122,71 @@ bool isTransformationElement(TransformationElementType type){
 
 /**
  * エレメントをTransformationElementType列挙で返す
+ * 型名の文字列ではなくcollada-domの型IDで判定する
  */
 TransformationElementType getTransformationType(domElement* dom_elem){
-	const char* type = dom_elem->getTypeName();
-	if(strcmp(type, "Lookat") == 0)
-		return TransformationElement_Lookat;
-	if(strcmp(type, "matrix") == 0)
+	const daeInt id = dom_elem->typeID();
+	if(id == domMatrix::ID())
 		return TransformationElement_Matrix;
-	if(strcmp(type, "rotate") == 0)
+	if(id == domTranslate::ID())
+		return TransformationElement_Translate;
+	if(id == domRotate::ID())
 		return TransformationElement_Rotate;
-	if(strcmp(type, "scale") == 0)
+	if(id == domScale::ID())
 		return TransformationElement_Scale;
-	if(strcmp(type, "skew") == 0)
+	if(id == domLookat::ID())
+		return TransformationElement_Lookat;
+	if(id == domSkew::ID())
 		return TransformationElement_Skew;
-	if(strcmp(type, "translate") == 0)
+	return TransformationElement_Unknown;
+}
+
+TransformationElementType getTransformationType(const StreamElement* stream_elem){
+	if(stream_elem->isName("matrix"))
+		return TransformationElement_Matrix;
+	if(stream_elem->isName("translate"))
 		return TransformationElement_Translate;
+	if(stream_elem->isName("rotate"))
+		return TransformationElement_Rotate;
+	if(stream_elem->isName("scale"))
+		return TransformationElement_Scale;
+	if(stream_elem->isName("lookat"))
+		return TransformationElement_Lookat;
+	if(stream_elem->isName("skew"))
+		return TransformationElement_Skew;
 	return TransformationElement_Unknown;
 }
 
+/**
+ * <input>のsemantic属性をInputSemanticType列挙で返す
+ * 先頭文字で振り分けるので比較は高々1回
+ */
+InputSemanticType getInputSemanticType(const char* semantic){
+	if(semantic == NULL)
+		return InputSemantic_Unknown;
+	switch(semantic[0]){
+	case 'P':
+		if(strcmp(semantic + 1, "OSITION") == 0)
+			return InputSemantic_Position;
+		break;
+	case 'N':
+		if(strcmp(semantic + 1, "ORMAL") == 0)
+			return InputSemantic_Normal;
+		break;
+	case 'T':
+		if(strcmp(semantic + 1, "EXCOORD") == 0)
+			return InputSemantic_Texcoord;
+		break;
+	case 'V':
+		if(strcmp(semantic + 1, "ERTEX") == 0)
+			return InputSemantic_Vertex;
+		break;
+	default:
+		break;
+	}
+	return InputSemantic_Unknown;
+}
+
 
 /*
 	domEffect* dom_effect;
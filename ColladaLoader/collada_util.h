@@ -1,11 +1,19 @@
 ﻿#pragma once
 #include <dae.h>
 #include <dom/domCOLLADA.h>
+#include "collada_def.h"
 
 namespace collada{
 
 #define DEBUG
 
+// uidの衝突を元の名前と照合して検出する
+// 照合のため名前を保持するのでDEBUG時は常に有効
+#ifdef DEBUG
+#define VALIDATE_UID
+#endif
+
+
 typedef enum{
 	TransformationElement_Lookat,
 	TransformationElement_Matrix,
@@ -17,7 +25,17 @@ typedef enum{
 	TransformationElement_Size
 }TransformationElementType;
 
+typedef enum{
+	InputSemantic_Position,
+	InputSemantic_Normal,
+	InputSemantic_Texcoord,
+	InputSemantic_Vertex,
+	InputSemantic_Unknown,
+	InputSemantic_Size
+}InputSemanticType;
+
 bool isGeometryNode(const domNode* dom_node);
+bool isGeometryNode(const StreamElement* stream_node);
 size_t countNode(const daeDatabase* dae_db, const domNode* dom_node);
 size_t countGeometryNode(const daeDatabase* dae_db, const domNode* dom_node);
 size_t countNode(const domVisual_scene* dom_visual_scene);
@@ -25,5 +43,7 @@ size_t countGeometryNode(const domVisual_scene* dom_visual_scene);
 bool isTransformationElement(domElement* dom_elem);
 bool isTransformationElement(TransformationElementType type);
 TransformationElementType getTransformationType(domElement* dom_elem);
+TransformationElementType getTransformationType(const StreamElement* stream_elem);
+InputSemanticType getInputSemanticType(const char* semantic);
 
 } // namespace collada
\ No newline at end of file
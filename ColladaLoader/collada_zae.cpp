@@ -0,0 +1,467 @@
+﻿#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "collada_zae.h"
+#include "xml_reader.h"
+#include "log.h"
+
+namespace collada{
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define ZIP_LOCAL_HEADER		0x04034b50
+#define ZIP_CENTRAL_HEADER		0x02014b50
+#define ZIP_END_OF_DIR			0x06054b50
+#define ZIP64_END_OF_DIR		0x06064b50
+#define ZIP64_END_OF_DIR_LOCATOR	0x07064b50
+
+#define ZIP_METHOD_STORED		0
+#define ZIP_METHOD_DEFLATED		8
+
+static inline unsigned int readU16(const unsigned char* p){
+	return p[0] | (p[1] << 8);
+}
+
+static inline unsigned int readU32(const unsigned char* p){
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned int>(p[3]) << 24);
+}
+
+static inline unsigned long long readU64(const unsigned char* p){
+	return readU32(p) | (static_cast<unsigned long long>(readU32(p + 4)) << 32);
+}
+
+/**
+ * 拡張子の比較(大文字小文字を区別しない)
+ */
+static bool hasExtension(const char* name, const char* ext){
+	const size_t len = strlen(name);
+	const size_t ext_len = strlen(ext);
+	if(len <= ext_len)
+		return false;
+	for(size_t i = 0; i < ext_len; i++){
+		if(tolower(static_cast<unsigned char>(name[len - ext_len + i])) != ext[i])
+			return false;
+	}
+	return true;
+}
+
+static void trim(std::string* string){
+	const size_t begin = string->find_first_not_of(" \t\r\n");
+	if(begin == std::string::npos){
+		string->clear();
+		return;
+	}
+	const size_t end = string->find_last_not_of(" \t\r\n");
+	string->assign(*string, begin, end - begin + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ZipEntryStream::ZipEntryStream(const unsigned char* data, size_t compressed_size, size_t size, unsigned int method, unsigned int crc){
+	this->data = data;
+	this->compressed_size = compressed_size;
+	this->size = size;
+	this->method = method;
+	this->crc = crc;
+	pos = 0;
+	crc_calc = 0;
+	memset(&zs, 0, sizeof(zs));
+	inflating = false;
+}
+
+ZipEntryStream::~ZipEntryStream(){
+	end();
+}
+
+void ZipEntryStream::end(){
+	if(inflating)
+		inflateEnd(&zs);
+	inflating = false;
+}
+
+/**
+ * 先頭から読めるようにする
+ */
+bool ZipEntryStream::init(){
+	end();
+	pos = 0;
+	crc_calc = crc32(0L, Z_NULL, 0);
+	if(method == ZIP_METHOD_STORED)
+		return true;
+	memset(&zs, 0, sizeof(zs));
+	// zipのデータはヘッダの無い生のdeflate
+	if(inflateInit2(&zs, -MAX_WBITS) != Z_OK){
+		Log_e("could not initialize inflate.\n");
+		return false;
+	}
+	zs.next_in = const_cast<Bytef*>(data);
+	inflating = true;
+	return true;
+}
+
+/**
+ * 展開しながら読む
+ * 最後まで読んだ時点でCRCを検査し、一致しなければ最後の分を返さない
+ */
+size_t ZipEntryStream::read(void* buffer, size_t size){
+	const size_t rest = this->size - pos;
+	if(size > rest)
+		size = rest;
+	if(size == 0)
+		return 0;
+	if(method == ZIP_METHOD_STORED){
+		memcpy(buffer, data + pos, size);
+	}
+	else{
+		zs.next_out = static_cast<Bytef*>(buffer);
+		size_t done = 0;
+		while(done < size){
+			// z_streamの長さは32bitなので分けて渡す
+			const size_t consumed = static_cast<size_t>(zs.next_in - data);
+			const size_t in_rest = compressed_size - consumed;
+			zs.avail_in = static_cast<uInt>((in_rest < 0x40000000)? in_rest : 0x40000000);
+			const size_t out_rest = size - done;
+			zs.avail_out = static_cast<uInt>((out_rest < 0x40000000)? out_rest : 0x40000000);
+			const uInt avail_out = zs.avail_out;
+			const int ret = inflate(&zs, Z_NO_FLUSH);
+			done += avail_out - zs.avail_out;
+			if(ret == Z_STREAM_END)
+				break;
+			if((ret != Z_OK) || (avail_out == zs.avail_out)){
+				Log_e("could not inflate.\n");
+				return 0;
+			}
+		}
+		size = done;
+	}
+	crc_calc = crc32(crc_calc, static_cast<const Bytef*>(buffer), static_cast<uInt>(size));
+	pos += size;
+	if((pos == this->size) && (crc_calc != crc)){
+		Log_e("CRC mismatch.\n");
+		return 0;
+	}
+	return size;
+}
+
+/**
+ * 圧縮されている場合、戻るには先頭から展開し直す
+ */
+bool ZipEntryStream::seek(unsigned long long offset){
+	if(offset > size)
+		return false;
+	if(method == ZIP_METHOD_STORED){
+		pos = static_cast<size_t>(offset);
+		return true;
+	}
+	if(offset < pos){
+		if(!init())
+			return false;
+	}
+	unsigned char temp[4096];
+	while(pos < offset){
+		const unsigned long long rest = offset - pos;
+		if(read(temp, (rest < sizeof(temp))? static_cast<size_t>(rest) : sizeof(temp)) == 0)
+			return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ZaeArchive::ZaeArchive(){
+}
+
+ZaeArchive::~ZaeArchive(){
+	cleanup();
+}
+
+void ZaeArchive::cleanup(){
+	entries.clear();
+	prefix.clear();
+	file.close();
+}
+
+/**
+ * アーカイブを開いて中央ディレクトリを読む
+ * 展開はファイルを開くまで行わない
+ */
+bool ZaeArchive::load(const char* filename){
+	cleanup();
+	if(!file.open(filename)){
+		Log_e("could not open %s.\n", filename);
+		return false;
+	}
+	if(!loadDirectory()){
+		Log_e("invalid archive %s.\n", filename);
+		cleanup();
+		return false;
+	}
+	prefix.append(filename);
+	prefix.append("/");
+	return true;
+}
+
+bool ZaeArchive::loadDirectory(){
+	const unsigned char* data = file.getData();
+	const size_t size = file.getSize();
+	if(size < 22)
+		return false;
+	// 末尾のコメント(最大65535バイト)の前にある終端レコードを探す
+	const unsigned char* eocd = NULL;
+	const size_t limit = (size > 22 + 0xFFFF)? size - (22 + 0xFFFF) : 0;
+	for(size_t i = size - 22; ; i--){
+		if(readU32(data + i) == ZIP_END_OF_DIR){
+			eocd = data + i;
+			break;
+		}
+		if(i == limit)
+			break;
+	}
+	if(!eocd)
+		return false;
+	unsigned long long count = readU16(eocd + 10);
+	unsigned long long dir_size = readU32(eocd + 12);
+	unsigned long long dir_offset = readU32(eocd + 16);
+	// ZIP64
+	if((count == 0xFFFF) || (dir_size == 0xFFFFFFFF) || (dir_offset == 0xFFFFFFFF)){
+		const size_t eocd_pos = static_cast<size_t>(eocd - data);
+		if((eocd_pos < 20) || (readU32(eocd - 20) != ZIP64_END_OF_DIR_LOCATOR))
+			return false;
+		const unsigned long long eocd64_pos = readU64(eocd - 20 + 8);
+		if((eocd64_pos + 56 > size) || (readU32(data + eocd64_pos) != ZIP64_END_OF_DIR))
+			return false;
+		const unsigned char* eocd64 = data + eocd64_pos;
+		count = readU64(eocd64 + 32);
+		dir_size = readU64(eocd64 + 40);
+		dir_offset = readU64(eocd64 + 48);
+	}
+	if((dir_offset > size) || (dir_size > size - dir_offset))
+		return false;
+	const unsigned char* p = data + dir_offset;
+	const unsigned char* dir_end = p + dir_size;
+	for(unsigned long long i = 0; i < count; i++){
+		if((dir_end - p < 46) || (readU32(p) != ZIP_CENTRAL_HEADER))
+			return false;
+		const unsigned int flags = readU16(p + 8);
+		const size_t name_len = readU16(p + 28);
+		const size_t extra_len = readU16(p + 30);
+		const size_t comment_len = readU16(p + 32);
+		if(static_cast<size_t>(dir_end - p) < 46 + name_len + extra_len + comment_len)
+			return false;
+		Entry entry;
+		entry.method = readU16(p + 10);
+		entry.crc = readU32(p + 16);
+		entry.compressed_size = readU32(p + 20);
+		entry.size = readU32(p + 24);
+		entry.offset = readU32(p + 42);
+		// ZIP64拡張フィールドには0xFFFFFFFFだった値だけがこの順で入る
+		const unsigned char* extra = p + 46 + name_len;
+		const unsigned char* extra_end = extra + extra_len;
+		while(extra_end - extra >= 4){
+			const unsigned int id = readU16(extra);
+			const size_t len = readU16(extra + 2);
+			if(static_cast<size_t>(extra_end - extra - 4) < len)
+				break;
+			if(id == 0x0001){
+				const unsigned char* q = extra + 4;
+				const unsigned char* q_end = q + len;
+				if((entry.size == 0xFFFFFFFF) && (q_end - q >= 8)){
+					entry.size = readU64(q);
+					q += 8;
+				}
+				if((entry.compressed_size == 0xFFFFFFFF) && (q_end - q >= 8)){
+					entry.compressed_size = readU64(q);
+					q += 8;
+				}
+				if((entry.offset == 0xFFFFFFFF) && (q_end - q >= 8))
+					entry.offset = readU64(q);
+			}
+			extra += 4 + len;
+		}
+		std::string name(reinterpret_cast<const char*>(p + 46), name_len);
+		p += 46 + name_len + extra_len + comment_len;
+		// ディレクトリ、暗号化されたファイルは使わない
+		if(name.empty() || (name[name.size() - 1] == '/') || (flags & 0x0001))
+			continue;
+		if((entry.method != ZIP_METHOD_STORED) && (entry.method != ZIP_METHOD_DEFLATED)){
+			Log_w("unsupported compression method %u (%s).\n", entry.method, name.c_str());
+			continue;
+		}
+		entries.insert(std::pair<std::string, Entry>(name, entry));
+	}
+	return true;
+}
+
+/**
+ * "./"と"dir/../"を取り除く
+ */
+static void normalize(const std::string& path, std::string* output){
+	std::vector<std::string> parts;
+	size_t start = 0;
+	while(start <= path.size()){
+		size_t end = path.find('/', start);
+		if(end == std::string::npos)
+			end = path.size();
+		const std::string part(path, start, end - start);
+		if(part == ".."){
+			if(!parts.empty())
+				parts.pop_back();
+		}
+		else
+		if(!part.empty() && (part != "."))
+			parts.push_back(part);
+		start = end + 1;
+	}
+	output->clear();
+	for(size_t i = 0; i < parts.size(); i++){
+		if(i > 0)
+			output->push_back('/');
+		output->append(parts[i]);
+	}
+}
+
+/**
+ * URIの%エスケープを戻す
+ */
+static void unescape(const std::string& uri, std::string* output){
+	output->clear();
+	for(size_t i = 0; i < uri.size(); i++){
+		if((uri[i] == '%') && (i + 2 < uri.size()) && isxdigit(static_cast<unsigned char>(uri[i + 1])) && isxdigit(static_cast<unsigned char>(uri[i + 2]))){
+			const char hex[3] = { uri[i + 1], uri[i + 2], '\0' };
+			output->push_back(static_cast<char>(strtol(hex, NULL, 16)));
+			i += 2;
+		}
+		else{
+			output->push_back(uri[i]);
+		}
+	}
+}
+
+const ZaeArchive::Entry* ZaeArchive::find(const std::string& name) const{
+	std::string path;
+	normalize(name, &path);
+	std::map<std::string, Entry>::const_iterator it = entries.find(path);
+	if(it != entries.end())
+		return &it->second;
+	std::string unescaped;
+	unescape(path, &unescaped);
+	it = entries.find(unescaped);
+	return (it != entries.end())? &it->second : NULL;
+}
+
+/**
+ * 最初に読む文書のURI
+ * manifest.xmlの<dae_root>、無ければ最上位にある.daeファイル
+ */
+bool ZaeArchive::getRoot(std::string* uri){
+	std::string root;
+	const Entry* manifest = find("manifest.xml");
+	if(manifest){
+		Stream* stream = openEntry(manifest);
+		std::vector<unsigned char> buffer;
+		const bool read = stream && readStream(stream, &buffer);
+		delete stream;
+		if(read && !buffer.empty()){
+			XmlReader reader(reinterpret_cast<const char*>(&buffer[0]), buffer.size());
+			bool in_root = false;
+			for(bool done = false; !done; ){
+				switch(reader.next()){
+				case XmlReader::Token_StartElement:
+					in_root = XmlReader::isEqual(reader.getName(), "dae_root");
+					break;
+				case XmlReader::Token_Text:
+					if(in_root){
+						XmlReader::decode(reader.getText(), &root);
+						done = true;
+					}
+					break;
+				case XmlReader::Token_EndElement:
+					in_root = false;
+					break;
+				default:
+					done = true;
+					break;
+				}
+			}
+			root.assign(root, 0, root.find('#'));
+			trim(&root);
+		}
+	}
+	if(root.empty()){
+		for(std::map<std::string, Entry>::const_iterator it = entries.begin(); it != entries.end(); it++){
+			const std::string& name = it->first;
+			if((name.find('/') == std::string::npos) && hasExtension(name.c_str(), ".dae")){
+				root = name;
+				break;
+			}
+		}
+	}
+	if(root.empty() || !find(root)){
+		Log_e("root document not found.\n");
+		return false;
+	}
+	std::string path;
+	normalize(root, &path);
+	uri->assign(prefix);
+	uri->append(path);
+	return true;
+}
+
+/**
+ * アーカイブ内のファイルを開く
+ */
+Stream* ZaeArchive::open(const char* uri){
+	if(prefix.empty() || (strncmp(uri, prefix.c_str(), prefix.size()) != 0))
+		return file_resolver.open(uri);
+	const Entry* entry = find(std::string(uri + prefix.size()));
+	if(!entry){
+		Log_e("%s not found in archive.\n", uri + prefix.size());
+		return NULL;
+	}
+	return openEntry(entry);
+}
+
+Stream* ZaeArchive::openEntry(const Entry* entry){
+	const unsigned char* data = file.getData();
+	const size_t size = file.getSize();
+	// ローカルヘッダの拡張フィールドは中央ディレクトリと長さが違うことがある
+	if((entry->offset + 30 > size) || (readU32(data + entry->offset) != ZIP_LOCAL_HEADER)){
+		Log_e("invalid local header.\n");
+		return NULL;
+	}
+	const unsigned char* local = data + entry->offset;
+	const unsigned long long begin = entry->offset + 30 + readU16(local + 26) + readU16(local + 28);
+	if((begin > size) || (entry->compressed_size > size - begin)){
+		Log_e("invalid entry.\n");
+		return NULL;
+	}
+	if((entry->size > static_cast<size_t>(-1)) || ((entry->method == ZIP_METHOD_STORED) && (entry->size != entry->compressed_size))){
+		Log_e("invalid entry size.\n");
+		return NULL;
+	}
+	ZipEntryStream* stream;
+	try{
+		stream = new ZipEntryStream(data + begin, static_cast<size_t>(entry->compressed_size), static_cast<size_t>(entry->size), entry->method, entry->crc);
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return NULL;
+	}
+	if(!stream->init()){
+		delete stream;
+		return NULL;
+	}
+	return stream;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * 拡張子が.zaeか
+ */
+bool isArchive(const char* uri){
+	return hasExtension(uri, ".zae");
+}
+
+} // namespace collada
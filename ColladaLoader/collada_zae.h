@@ -0,0 +1,75 @@
+﻿/**
+ * zip圧縮されたCOLLADA(.zae)
+ * 中央ディレクトリだけを読み、各ファイルは開いた時点でメモリ上のアーカイブから直接展開する
+ * 一時ファイルは作らない
+ */
+#pragma once
+#include <map>
+#include <string>
+#include <zlib.h>
+#include "collada_io.h"
+#include "mapped_file.h"
+
+namespace collada{
+
+/**
+ * アーカイブ内の1ファイル
+ * 無圧縮ならアーカイブのデータを直接参照する
+ */
+class ZipEntryStream : public Stream{
+public:
+	ZipEntryStream(const unsigned char* data, size_t compressed_size, size_t size, unsigned int method, unsigned int crc);
+	~ZipEntryStream();
+	bool init();
+	size_t read(void* buffer, size_t size);
+	bool seek(unsigned long long offset);
+	unsigned long long getSize(){ return size; }
+	const unsigned char* getData(){ return (method == 0)? data : NULL; }
+private:
+	void end();
+private:
+	const unsigned char* data;
+	size_t compressed_size;
+	size_t size;
+	unsigned int method;
+	unsigned int crc;	// 展開後のCRC(zip形式)
+	size_t pos;
+	unsigned long crc_calc;
+	z_stream zs;
+	bool inflating;
+};
+
+/**
+ * アーカイブ内のファイルを"<アーカイブのパス>/<ファイル名>"というURIで開く
+ * それ以外のURIは通常のファイルとして開く
+ */
+class ZaeArchive : public Resolver{
+public:
+	ZaeArchive();
+	~ZaeArchive();
+	bool load(const char* filename);
+	void cleanup();
+	bool getRoot(std::string* uri);
+	Stream* open(const char* uri);
+private:
+	typedef struct{
+		unsigned long long offset;	// ローカルヘッダの位置
+		unsigned long long compressed_size;
+		unsigned long long size;
+		unsigned int method;
+		unsigned int crc;
+	}Entry;
+private:
+	bool loadDirectory();
+	const Entry* find(const std::string& name) const;
+	Stream* openEntry(const Entry* entry);
+private:
+	MappedFile file;
+	std::string prefix;	// "<アーカイブのパス>/"
+	std::map<std::string, Entry> entries;
+	FileResolver file_resolver;
+};
+
+bool isArchive(const char* uri);
+
+} // namespace collada
@@ -1,6 +1,22 @@
 ﻿#include <string.h>
+#include "crc32.h"
 //#define DEBUG_CRC32
 
+// PCLMULQDQによる畳み込みを使えるか(実際の使用は実行時に判定)
+#if defined(_MSC_VER) && (_MSC_VER >= 1500) && (defined(_M_IX86) || defined(_M_X64))
+#define CRC32_USE_PCLMUL
+#include <intrin.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#define CRC32_TARGET_PCLMUL
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define CRC32_USE_PCLMUL
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#define CRC32_TARGET_PCLMUL __attribute__((target("pclmul,ssse3")))
+#endif
+
 #ifndef DEBUG_CRC32
 static unsigned int crc32tbl[256] = {
     0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9,
@@ -82,25 +98,153 @@ void makeCRCTable(void){
 }
 #endif // !DEBUG_CRC32 
 
-unsigned int calcCRC32(const unsigned char* buf, int len){
+/**
+ * slicing-by-8用のテーブル
+ * crc32tbl_slice[k][i]はバイトiの後ろに0をk+1バイト続けたCRC
+ */
+static unsigned int crc32tbl_slice[7][256];
+
+static void makeSliceTable(void){
 #ifdef DEBUG_CRC32
-	static bool ready = false;
-	if(!ready){
-		makeCRCTable();
-	}
+	makeCRCTable();
 #endif // DEBUG_CRC32
-	unsigned int crc = 0xffffffff;
-    for(int i = 0; i < len; i++){
-        crc = (crc << 8) ^ crc32tbl[((crc >> 24) ^ buf[i]) & 0xff];
-    }
-    return crc;
+	for(int i = 0; i < 256; i++){
+		unsigned int crc = crc32tbl[i];
+		for(int k = 0; k < 7; k++){
+			crc = (crc << 8) ^ crc32tbl[crc >> 24];
+			crc32tbl_slice[k][i] = crc;
+		}
+	}
+}
+
+#ifdef CRC32_USE_PCLMUL
+static bool hasPCLMUL(void){
+	// PCLMULQDQ(ECX bit1)とSSSE3(ECX bit9)
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	const unsigned int ecx = static_cast<unsigned int>(info[2]);
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+#endif
+	return ((ecx & (1 << 1)) != 0) && ((ecx & (1 << 9)) != 0);
+}
+static bool use_pclmul = false;
+#endif // CRC32_USE_PCLMUL
+
+/**
+ * テーブルはmain以前に静的に初期化しておく
+ */
+static struct CRC32Initializer{
+	CRC32Initializer(){
+		makeSliceTable();
+#ifdef CRC32_USE_PCLMUL
+		use_pclmul = hasPCLMUL();
+#endif
+	}
+}crc32_initializer;
+
+static unsigned int updateBytewise(unsigned int crc, const unsigned char* buf, unsigned long long len){
+	for(unsigned long long i = 0; i < len; i++){
+		crc = (crc << 8) ^ crc32tbl[((crc >> 24) ^ buf[i]) & 0xff];
+	}
+	return crc;
+}
+
+static unsigned int updateSlicing8(unsigned int crc, const unsigned char* buf, unsigned long long len){
+	while(len >= 8){
+		const unsigned int a = crc ^ ((static_cast<unsigned int>(buf[0]) << 24)
+									| (static_cast<unsigned int>(buf[1]) << 16)
+									| (static_cast<unsigned int>(buf[2]) << 8)
+									|  static_cast<unsigned int>(buf[3]));
+		crc = crc32tbl_slice[6][a >> 24]
+			^ crc32tbl_slice[5][(a >> 16) & 0xff]
+			^ crc32tbl_slice[4][(a >> 8) & 0xff]
+			^ crc32tbl_slice[3][a & 0xff]
+			^ crc32tbl_slice[2][buf[4]]
+			^ crc32tbl_slice[1][buf[5]]
+			^ crc32tbl_slice[0][buf[6]]
+			^ crc32tbl[buf[7]];
+		buf += 8;
+		len -= 8;
+	}
+	return updateBytewise(crc, buf, len);
+}
+
+#ifdef CRC32_USE_PCLMUL
+/**
+ * 128bitずつ畳み込んでから残りをテーブルで計算する
+ * MSBファーストなのでバイト順を反転してx^127を最上位ビットに置く
+ * 定数はx^n mod P (P = 0x104C11DB7)
+ */
+CRC32_TARGET_PCLMUL
+static inline __m128i fold128(__m128i x, __m128i k, __m128i y){
+	const __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+	const __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+	return _mm_xor_si128(_mm_xor_si128(hi, lo), y);
+}
+
+CRC32_TARGET_PCLMUL
+static unsigned int updatePCLMUL(unsigned int crc, const unsigned char* buf, unsigned long long len){
+	const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m128i k512 = _mm_set_epi32(0, 0x8833794c, 0, 0xe6228b11);	// x^576, x^512
+	const __m128i k128 = _mm_set_epi32(0, 0xc5b9cd4c, 0, 0xe8a45605);	// x^192, x^128
+
+	// 初期値は先頭4バイトに加えておく
+	__m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buf +  0)), swap);
+	__m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 16)), swap);
+	__m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 32)), swap);
+	__m128i x3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 48)), swap);
+	x0 = _mm_xor_si128(x0, _mm_set_epi32(static_cast<int>(crc), 0, 0, 0));
+	buf += 64;
+	len -= 64;
+
+	// 64byte単位
+	while(len >= 64){
+		x0 = fold128(x0, k512, _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buf +  0)), swap));
+		x1 = fold128(x1, k512, _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 16)), swap));
+		x2 = fold128(x2, k512, _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 32)), swap));
+		x3 = fold128(x3, k512, _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 48)), swap));
+		buf += 64;
+		len -= 64;
+	}
+	// 4本を1本にまとめる
+	x0 = fold128(x0, k128, x1);
+	x0 = fold128(x0, k128, x2);
+	x0 = fold128(x0, k128, x3);
+	// 16byte単位
+	while(len >= 16){
+		x0 = fold128(x0, k128, _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buf)), swap));
+		buf += 16;
+		len -= 16;
+	}
+	// 畳み込んだ結果と残りのCRCを計算
+	unsigned char folded[16];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(folded), _mm_shuffle_epi8(x0, swap));
+	crc = updateSlicing8(0, folded, sizeof(folded));
+	return updateSlicing8(crc, buf, len);
+}
+#endif // CRC32_USE_PCLMUL
+
+unsigned int updateCRC32(unsigned int crc, const void* buf, unsigned long long len){
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(buf);
+#ifdef CRC32_USE_PCLMUL
+	if(use_pclmul && (len >= 64))
+		return updatePCLMUL(crc, p, len);
+#endif
+	return updateSlicing8(crc, p, len);
+}
+
+unsigned int calcCRC32(const unsigned char* buf, int len){
+	if(len <= 0)
+		return CRC32_INIT;
+	return updateCRC32(CRC32_INIT, buf, static_cast<unsigned long long>(len));
 }
 
+
 unsigned int calcCRC32(const unsigned char* string){
 	const size_t len = strlen(reinterpret_cast<const char*>(string));
-	unsigned int crc = 0xffffffff;
-    for(size_t i = 0; i < len; i++){
-        crc = (crc << 8) ^ crc32tbl[((crc >> 24) ^ string[i]) & 0xff];
-    }
-    return crc;
+	return updateCRC32(CRC32_INIT, string, len);
 }
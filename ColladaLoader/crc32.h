@@ -1,8 +1,18 @@
 ﻿/**
  * CRC-32-IEEE 802.3
+ * 初期値0xffffffff、最終XORなし(MSBファースト)
  */
 #pragma once
 
+#define CRC32_INIT 0xffffffff
+
 unsigned int calcCRC32(const unsigned char* buf, int len);
+
 unsigned int calcCRC32(const unsigned char* string);
 
+/**
+ * 逐次計算
+ * crcにCRC32_INITを与えて分割したバッファを順に渡すと
+ * 全体を一度に計算した場合と同じ値になる
+ */
+unsigned int updateCRC32(unsigned int crc, const void* buf, unsigned long long len);
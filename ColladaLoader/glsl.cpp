@@ -1,17 +1,45 @@
-#include <stdio.h>
+﻿#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <vector>
+#include "collada_cache.h"
+#include "hash64.h"
+#include "mapped_file.h"
 #include "log.h"
 #include "glsl.h"
 
+#define PROGRAM_CACHE_MAGIC	0x50534c47	// "GLSP"
+#define PROGRAM_CACHE_VERSION	1
+
 Glsl::Glsl(){
 	program = 0;
+	pending_vert = 0;
+	pending_frag = 0;
+	cache_key = 0;
+	cached = false;
 }
 
 Glsl::~Glsl(){
+	if(pending_vert != 0)
+		glDeleteShader(pending_vert);
+	if(pending_frag != 0)
+		glDeleteShader(pending_frag);
 	if(program != 0)
 		glDeleteProgram(program);
 }
 
+/**
+ * createFromSource()/begin()で作ったプログラムのバイナリをdirectoryにキャッシュする
+ * directoryはファイル名の前にそのまま付ける(末尾の区切りを含む)、NULLならキャッシュしない
+ */
+void Glsl::setCacheDirectory(const char* directory){
+	if(directory)
+		cache_dir.assign(directory);
+	else
+		cache_dir.clear();
+}
+
 bool Glsl::create(const char* vert, const char* frag){
 	GLuint vertShader = 0;
 	GLuint fragShader = 0;
@@ -23,6 +51,86 @@ bool Glsl::create(const char* vert, const char* frag){
 		return false;
 	}
 
+	return link(vertShader, fragShader);
+}
+
+/**
+ * メモリ上のソースから作る
+ * headerは両方のソースの前に付ける(#versionや#defineなど)
+ */
+bool Glsl::createFromSource(const char* vert_source, const char* frag_source, const char* header){
+	return begin(vert_source, frag_source, header) && finish();
+}
+
+/**
+ * コンパイルとリンクを発行し、結果は確かめずに戻る
+ * 複数のプログラムをまとめて発行してからfinish()を呼べば、対応するドライバでは並列にコンパイルされる
+ * キャッシュにあればバイナリを読み込むだけで済ませる
+ */
+bool Glsl::begin(const char* vert_source, const char* frag_source, const char* header){
+	cached = false;
+	if(!cache_dir.empty() && GLEW_ARB_get_program_binary){
+		cache_key = getCacheKey(vert_source, frag_source, header);
+		if(loadCache()){
+			cached = true;
+			return true;
+		}
+	}
+	GLuint vertShader = 0;
+	GLuint fragShader = 0;
+	if(!compile(&vertShader, GL_VERTEX_SHADER, header, vert_source)){
+		return false;
+	}
+	if(!compile(&fragShader, GL_FRAGMENT_SHADER, header, frag_source)){
+		glDeleteShader(vertShader);
+		return false;
+	}
+	if(!startLink(vertShader, fragShader))
+		return false;
+	pending_vert = vertShader;
+	pending_frag = fragShader;
+	return true;
+}
+
+/**
+ * begin()の結果を確かめる(終わっていなければ待つ)
+ */
+bool Glsl::finish(){
+	if(cached)
+		return true;
+	if((pending_vert == 0) || (pending_frag == 0))
+		return false;
+	const GLuint vertShader = pending_vert;
+	const GLuint fragShader = pending_frag;
+	pending_vert = 0;
+	pending_frag = 0;
+	const bool vert_compiled = checkCompile(vertShader, GL_VERTEX_SHADER);
+	const bool frag_compiled = checkCompile(fragShader, GL_FRAGMENT_SHADER);
+	if(!vert_compiled || !frag_compiled){
+		glDetachShader(program, vertShader);
+		glDetachShader(program, fragShader);
+		glDeleteShader(vertShader);
+		glDeleteShader(fragShader);
+		glDeleteProgram(program);
+		program = 0;
+		return false;
+	}
+	if(!checkLink(vertShader, fragShader))
+		return false;
+	if(!cache_dir.empty() && GLEW_ARB_get_program_binary && !saveCache())
+		Log_w("could not save program cache.\n");
+	return true;
+}
+
+/**
+ * シェーダをリンクする
+ * 成否に関わらずシェーダは削除する
+ */
+bool Glsl::link(GLuint vertShader, GLuint fragShader){
+	return startLink(vertShader, fragShader) && checkLink(vertShader, fragShader);
+}
+
+bool Glsl::startLink(GLuint vertShader, GLuint fragShader){
 	program = glCreateProgram();
 	if(program == 0){
 		Log_e("could not create program.\n");
@@ -32,8 +140,15 @@ bool Glsl::create(const char* vert, const char* frag){
 	}
 	glAttachShader(program, vertShader);
 	glAttachShader(program, fragShader);
+	// キャッシュする場合はバイナリを取り出せるようにしておく
+	if(!cache_dir.empty() && GLEW_ARB_get_program_binary)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
 	glLinkProgram(program);
+	return true;
+}
+
+bool Glsl::checkLink(GLuint vertShader, GLuint fragShader){
 	GLint linked;
 	glGetProgramiv(program, GL_LINK_STATUS, &linked);
 #ifdef _DEBUG
@@ -135,6 +250,147 @@ bool Glsl::createFragmentShader(GLuint* shader, const char* frag){
 	return true;
 }
 
+/**
+ * コンパイルを発行する(結果はcheckCompile()で確かめる)
+ */
+bool Glsl::compile(GLuint* shader, GLenum type, const char* header, const char* source){
+	(*shader) = glCreateShader(type);
+	if((*shader) == 0){
+		Log_e("could not create shader.\n");
+		return false;
+	}
+	const GLchar* sources[] = { header, source };
+	if(header)
+		glShaderSource((*shader), 2, sources, NULL);
+	else
+		glShaderSource((*shader), 1, &sources[1], NULL);
+	glCompileShader((*shader));
+	return true;
+}
+
+bool Glsl::checkCompile(GLuint shader, GLenum type){
+	GLint compiled;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+#ifdef _DEBUG
+	printShaderInfoLog(shader);
+#endif // _DEBUG
+	if(compiled == GL_FALSE) {
+		Log_e("failed to compile in %s shader.\n", (type == GL_VERTEX_SHADER)? "vertex" : "fragment");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * ソースとドライバからキャッシュのキーを作る
+ * ドライバが変わればバイナリは使えないので、ベンダ、レンダラ、バージョンの文字列を含める
+ */
+unsigned long long Glsl::getCacheKey(const char* vert_source, const char* frag_source, const char* header) const{
+	const char* strings[] = {
+		reinterpret_cast<const char*>(glGetString(GL_VENDOR)),
+		reinterpret_cast<const char*>(glGetString(GL_RENDERER)),
+		reinterpret_cast<const char*>(glGetString(GL_VERSION)),
+		header, vert_source, frag_source
+	};
+	unsigned long long key = PROGRAM_CACHE_VERSION;
+	for(size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++){
+		// 長さも含めて連結する(区切り位置の違う内容を区別するため)
+		const unsigned long long length = strings[i]? strlen(strings[i]) : 0;
+		key = calcHash64(reinterpret_cast<const unsigned char*>(&length), sizeof(length), key);
+		if(length > 0)
+			key = calcHash64(reinterpret_cast<const unsigned char*>(strings[i]), static_cast<size_t>(length), key);
+	}
+	return key;
+}
+
+void Glsl::getCacheName(std::string* output) const{
+	char name[32];
+	sprintf(name, "%016llx.glsl", cache_key);
+	output->assign(cache_dir);
+	output->append(name);
+}
+
+/**
+ * キャッシュしたバイナリからプログラムを作る
+ * ドライバが受け付けなければfalse(呼び出し側でコンパイルし直す)
+ */
+bool Glsl::loadCache(){
+	std::string filename;
+	getCacheName(&filename);
+	MappedFile file;
+	if(!file.open(filename.c_str()))
+		return false;
+	collada::CacheReader reader(file.getData(), file.getSize());
+	unsigned int magic, version, format, length;
+	unsigned long long key;
+	if(!reader.readU32(&magic) || (magic != PROGRAM_CACHE_MAGIC)
+	|| !reader.readU32(&version) || (version != PROGRAM_CACHE_VERSION)
+	|| !reader.readU64(&key) || (key != cache_key)
+	|| !reader.readU32(&format) || !reader.readU32(&length) || (length == 0) || (length != reader.getRemain()))
+		return false;
+	program = glCreateProgram();
+	if(program == 0){
+		Log_e("could not create program.\n");
+		return false;
+	}
+	glProgramBinary(program, format, file.getData() + (file.getSize() - length), static_cast<GLsizei>(length));
+	GLint linked;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if(linked == GL_FALSE){
+		Log_i("program cache is out of date(%s).\n", filename.c_str());
+		glDeleteProgram(program);
+		program = 0;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * リンクしたプログラムのバイナリを保存する
+ * 途中のファイルを読まないよう一時ファイルに書いてから置き換える
+ */
+bool Glsl::saveCache() const{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if(length <= 0)
+		return false;
+	std::vector<unsigned char> binary;
+	try{
+		binary.resize(length);
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	GLenum format;
+	glGetProgramBinary(program, length, &length, &format, &binary[0]);
+	if(length <= 0)
+		return false;
+	std::string filename;
+	getCacheName(&filename);
+	std::string temp(filename);
+	temp.append(".tmp");
+	collada::CacheWriter writer;
+	if(!writer.open(temp.c_str()))
+		return false;
+	writer.writeU32(PROGRAM_CACHE_MAGIC);
+	writer.writeU32(PROGRAM_CACHE_VERSION);
+	writer.writeU64(cache_key);
+	writer.writeU32(format);
+	writer.writeU32(static_cast<unsigned int>(length));
+	writer.writeBytes(&binary[0], length);
+	if(!writer.close()){
+		remove(temp.c_str());
+		return false;
+	}
+	remove(filename.c_str());
+	if(rename(temp.c_str(), filename.c_str()) != 0){
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
 #ifdef _DEBUG
 void Glsl::printShaderInfoLog(GLuint shader){
 	GLsizei bufSize;
@@ -1,4 +1,5 @@
-#pragma once
+﻿#pragma once
+#include <string>
 #include <GL/glew.h>
 
 class Glsl{
@@ -6,16 +7,35 @@ public:
 	Glsl();
 	~Glsl();
 	bool create(const char* vert, const char* frag);
+	bool createFromSource(const char* vert_source, const char* frag_source, const char* header = NULL);
+	bool begin(const char* vert_source, const char* frag_source, const char* header = NULL);
+	bool finish();
+	void setCacheDirectory(const char* directory);
+	bool isCached() const { return cached; }
 	GLuint getProgram(){ return program; }
 
 private:
 	bool read(GLuint shader, const char* filename);
 	bool createVertexShader(GLuint* shader, const char* vert);
 	bool createFragmentShader(GLuint* shader, const char* frag);
+	bool compile(GLuint* shader, GLenum type, const char* header, const char* source);
+	bool checkCompile(GLuint shader, GLenum type);
+	bool startLink(GLuint vertShader, GLuint fragShader);
+	bool checkLink(GLuint vertShader, GLuint fragShader);
+	bool link(GLuint vertShader, GLuint fragShader);
+	unsigned long long getCacheKey(const char* vert_source, const char* frag_source, const char* header) const;
+	void getCacheName(std::string* output) const;
+	bool loadCache();
+	bool saveCache() const;
 #ifdef _DEBUG
 	void printShaderInfoLog(GLuint shader);
 	void printProgramInfoLog(GLuint program);
 #endif // _DEBUG
 private:
 	GLuint program;
+	GLuint pending_vert;	// begin()で発行して結果を確かめていないシェーダ
+	GLuint pending_frag;
+	std::string cache_dir;	// プログラムのバイナリの置き場所、空ならキャッシュしない
+	unsigned long long cache_key;
+	bool cached;	// キャッシュから読み込めた
 };
\ No newline at end of file
@@ -0,0 +1,99 @@
+﻿#include <string.h>
+#include "hash64.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline unsigned long long rotl64(unsigned long long x, int r){
+	return (x << r) | (x >> (64 - r));
+}
+
+// リトルエンディアン前提
+static inline unsigned long long read64(const unsigned char* p){
+	unsigned long long v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline unsigned int read32(const unsigned char* p){
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline unsigned long long round64(unsigned long long acc, unsigned long long input){
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	acc *= PRIME64_1;
+	return acc;
+}
+
+static inline unsigned long long mergeRound64(unsigned long long acc, unsigned long long val){
+	val = round64(0, val);
+	acc ^= val;
+	acc = acc * PRIME64_1 + PRIME64_4;
+	return acc;
+}
+
+unsigned long long calcHash64(const unsigned char* buf, size_t len, unsigned long long seed){
+	const unsigned char* p = buf;
+	const unsigned char* const end = buf + len;
+	unsigned long long h;
+
+	// 32byte単位で4レーンを並列に処理
+	if(len >= 32){
+		const unsigned char* const limit = end - 32;
+		unsigned long long v1 = seed + PRIME64_1 + PRIME64_2;
+		unsigned long long v2 = seed + PRIME64_2;
+		unsigned long long v3 = seed + 0;
+		unsigned long long v4 = seed - PRIME64_1;
+		do{
+			v1 = round64(v1, read64(p)); p += 8;
+			v2 = round64(v2, read64(p)); p += 8;
+			v3 = round64(v3, read64(p)); p += 8;
+			v4 = round64(v4, read64(p)); p += 8;
+		}while(p <= limit);
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = mergeRound64(h, v1);
+		h = mergeRound64(h, v2);
+		h = mergeRound64(h, v3);
+		h = mergeRound64(h, v4);
+	}
+	else{
+		h = seed + PRIME64_5;
+	}
+	h += static_cast<unsigned long long>(len);
+
+	// 残り
+	while(p + 8 <= end){
+		h ^= round64(0, read64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+	if(p + 4 <= end){
+		h ^= static_cast<unsigned long long>(read32(p)) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	while(p < end){
+		h ^= static_cast<unsigned long long>(*p) * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+		p++;
+	}
+
+	// 攪拌
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+unsigned long long calcHash64(const unsigned char* string){
+	const size_t len = strlen(reinterpret_cast<const char*>(string));
+	return calcHash64(string, len);
+}
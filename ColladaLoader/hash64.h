@@ -0,0 +1,9 @@
+﻿/**
+ * 64bitハッシュ(XXH64互換)
+ * ID文字列からuidを生成するために使う
+ */
+#pragma once
+#include <stddef.h>
+
+unsigned long long calcHash64(const unsigned char* buf, size_t len, unsigned long long seed = 0);
+unsigned long long calcHash64(const unsigned char* string);
@@ -3,11 +3,13 @@
 #include <stdlib.h>
 #include <stdarg.h>
 
-static char _buff[512];
-static char _filename[256];
-static char _ext[5];
-
+/**
+ * 別々のスレッドから同時に呼ばれるので作業領域はスタックに置く
+ */
 void log_fprint(FILE* file, const char* func, const char* filename, int line, const char* format, ...){
+	char _buff[512];
+	char _filename[256];
+	char _ext[5];
 	_splitpath_s(filename, NULL, 0, NULL, 0, _filename, sizeof(_filename), _ext, sizeof(_ext));
 	va_list args;
     va_start(args, format);
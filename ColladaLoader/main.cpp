@@ -1,12 +1,21 @@
 ﻿#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
 #include <GL/glew.h>
 //#include <GL/glut.h>
 #include <GL/freeglut.h>
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 #include "glsl.h"
+#include "shader_variant.h"
+#include "mesh_buffer.h"
 #include "collada.h"
-#include "crc32.h"
+#include "collada_material_table.h"
+#include "collada_texture.h"
+#include "hash64.h"
+#include "timer.h"
 #include "vector.h"
 #include "quaternion.h"
 #include "matrix.h"
@@ -25,19 +34,183 @@ collada::Collada* model = NULL;
 // GLSLテスト
 #define USE_SHADER
 #ifdef USE_SHADER
-static Glsl glsl0;
-static Glsl glsl1;
+static ShaderVariants shader_variants;	// 材質の特徴ごとに特化したシェーダ
 #endif
 
 // テクスチャ
 #define USE_TEXTURE
-static std::map<unsigned int, GLuint> textures;
+static std::map<collada::Uid, GLuint> textures;
+
+// 材質の表(シェーダからはuniformブロックの0番で参照する)
+static collada::MaterialTable material_table;
+static GLuint material_buffer = 0;
+
+// 頂点とインデクス(読み込み時に転送する)
+static MeshBuffers mesh_buffers;
+
+/**
+ * OpenCVによる画像の展開
+ * TextureLoaderのスレッドから呼ばれる
+ */
+class CvImageDecoder : public collada::ImageDecoder{
+public:
+	bool decode(const unsigned char* data, size_t size, unsigned int* width, unsigned int* height, std::vector<unsigned char>* pixels){
+		CvMat mat = cvMat(1, static_cast<int>(size), CV_8UC1, const_cast<unsigned char*>(data));
+		IplImage* image = cvDecodeImage(&mat, CV_LOAD_IMAGE_COLOR);
+		if(!image)
+			return false;
+		IplImage* rgba = cvCreateImage(cvGetSize(image), IPL_DEPTH_8U, 4);
+		cvCvtColor(image, rgba, CV_BGR2RGBA);
+		cvReleaseImage(&image);
+		*width = rgba->width;
+		*height = rgba->height;
+		const size_t pitch = static_cast<size_t>(rgba->width) * 4;
+		pixels->resize(pitch * rgba->height);
+		for(int y = 0; y < rgba->height; y++)
+			memcpy(&(*pixels)[y * pitch], rgba->imageData + y * rgba->widthStep, pitch);
+		cvReleaseImage(&rgba);
+		return true;
+	}
+};
+
+/**
+ * 圧縮したテクスチャの内部形式
+ */
+static GLenum getInternalFormat(collada::TextureFormat format){
+	switch(format){
+	case collada::TextureFormat_BC1:
+		return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case collada::TextureFormat_BC3:
+		return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case collada::TextureFormat_BC5:
+		return GL_COMPRESSED_RG_RGTC2;
+	case collada::TextureFormat_BC7:
+		return GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+	default:
+		return GL_RGBA;
+	}
+}
 
 // カメラ
 static float fov = 45.0f;
 static float cam_pos_z = 20.0f;
 
 static Quaternion qc;
+
+#ifdef USE_SHADER
+/**
+ * 描画中に作らないよう、使う組み合わせのシェーダを先に作っておく
+ * まとめて作るとコンパイルが並列に進む
+ */
+static void prepareShaders(void){
+	std::vector<ShaderKey> keys;
+	for(const collada::Node* node = model->getScene()->findNode(); node; node = node->getNext()){
+		const collada::GeometryPtrArray& geoms = node->getGeometries();
+		for(size_t i = 0; i < geoms.size(); i++){
+			const collada::Mesh* mesh = geoms[i]->getMesh();
+			if(mesh == NULL)
+				continue;
+			const collada::TrianglesPtrArray* triangles = mesh->getTriangles();
+			for(size_t j = 0; j < triangles->size(); j++){
+				const unsigned int material_index = (*triangles)[j]->getMaterialIndex();
+				if(material_index == INVALID_INDEX)
+					continue;
+				const collada::InputPtrArray* texcoords = (*triangles)[j]->getTexCoords();
+				const ShaderKey key = makeShaderKey(material_table.getMaterial(material_index), texcoords? texcoords->size() : 0);
+				if(std::find(keys.begin(), keys.end(), key) == keys.end())
+					keys.push_back(key);
+			}
+		}
+	}
+	if(!keys.empty())
+		shader_variants.prepare(&keys[0], keys.size());
+}
+
+/**
+ * シェーダを読み込む
+ * 材質の数を埋め込むので、表の大きさが変わったら読み直す
+ */
+static bool loadShaders(void){
+	// uniformブロックに入らなければgl_FrontMaterialで渡す
+	if(!shader_variants.load("shader/material.vert", "shader/material.frag", material_buffer? material_table.getCount() : 0))
+		return false;
+	// 2回目からはリンク済みのプログラムを読み込む
+	shader_variants.setCacheDirectory("shader/");
+	prepareShaders();
+	return true;
+}
+#endif
+
+/**
+ * 材質の表をuniformバッファへ転送する
+ * 入らなければバッファを作らない
+ */
+static void uploadMaterials(void){
+	GLint max_block_size = 0;
+	if(GLEW_ARB_uniform_buffer_object)
+		glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &max_block_size);
+	if((material_table.getCount() > 0) && (material_table.getDataSize() <= static_cast<size_t>(max_block_size))){
+		if(!material_buffer)
+			glGenBuffers(1, &material_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, material_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, material_table.getDataSize(), material_table.getData(), GL_STATIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, 0, material_buffer);
+	}
+	else if(material_buffer){
+		glDeleteBuffers(1, &material_buffer);
+		material_buffer = 0;
+	}
+}
+
+/**
+ * 画像を読み込んでテクスチャを作る
+ */
+static void loadTextures(void){
+	// 画像の展開とミップマップの生成は複数のスレッドで行い、転送だけここで行う
+	CvImageDecoder decoder;
+	collada::TextureLoader texture_loader;
+	if(GLEW_EXT_texture_compression_s3tc)
+		texture_loader.setCompression(GLEW_ARB_texture_compression_bptc? collada::TextureLoader::Compression_BC7 : collada::TextureLoader::Compression_BC);
+	// 2回目からは展開と圧縮を省く
+	if(model->getImages())
+		texture_loader.setDiskCache(model->getImages()->getPath()->c_str());
+	texture_loader.load(model, &decoder);
+	for(size_t i = 0; i < texture_loader.getCount(); i++){
+		const collada::Texture* _texture = texture_loader.getTexture(i);
+		if(_texture->levels.empty())
+			continue;
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for(size_t j = 0; j < _texture->levels.size(); j++){
+			const collada::TextureLevel& level = _texture->levels[j];
+			if(_texture->format == collada::TextureFormat_RGBA8)
+				glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(j), GL_RGBA, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &level.pixels[0]);
+			else
+				glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(j), getInternalFormat(_texture->format), level.width, level.height, 0, static_cast<GLsizei>(level.pixels.size()), &level.pixels[0]);
+		}
+
+		std::pair<collada::Uid, GLuint> p(_texture->uid, texture);
+		std::map<collada::Uid, GLuint>::_Pairib pib = textures.insert(p);
+		if(!pib.second){	// キーが重複している
+			glDeleteTextures(1, &texture);
+		}
+	}
+}
+
+static void releaseTextures(void){
+	std::map<collada::Uid, GLuint>::iterator it = textures.begin();
+	while(it != textures.end()){
+		glDeleteTextures(1, &it->second);
+		it++;
+	}
+	textures.clear();
+}
+
 /**
  * 初期化
  */
@@ -72,53 +245,89 @@ static bool init(void){
 		model = NULL;
 		return false;
 	}
-#ifdef USE_SHADER
-	if(!glsl0.create("shader/simple.vert", "shader/mqo.frag"))
+	// 材質は表にまとめて1回で転送する
+	if(!material_table.build(model))
 		return false;
-//	if(!glsl1.create("shader/simple.vert", "shader/mqo_tex.frag"))
-	if(!glsl1.create("shader/simple.vert", "shader/output_texture.frag"))
+	uploadMaterials();
+	if(!mesh_buffers.load(model))
+		return false;
+#ifdef USE_SHADER
+	if(!loadShaders())
 		return false;
 #endif
-	const collada::Images* images = model->getImages();
-	if(images){
-		const collada::StringArray* _images = images->getImages();
-		std::string path;
-		for(size_t i = 0; i < _images->size(); i++){
-			path.clear();
-			path.append(images->getPath()->c_str());
-			path.append((*_images)[i].c_str());
-			unsigned int uid = calcCRC32(reinterpret_cast<const unsigned char*>(path.c_str()));
-
-			IplImage* image = cvLoadImage(path.c_str());
-			cvCvtColor(image, image, CV_BGR2RGB);
-			cvFlip(image, NULL, 0);
-			GLuint texture;
-			glGenTextures(1, &texture);
-			glBindTexture(GL_TEXTURE_2D, texture);
-			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR_MIPMAP_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
-			gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGB, image->width, image->height, GL_RGB, GL_UNSIGNED_BYTE, image->imageData);
-			cvReleaseImage(&image);
-
-			std::pair<unsigned int, GLuint> p(uid, texture);
-			std::map<unsigned int, GLuint>::_Pairib pib = textures.insert(p);
-			if(!pib.second){	// キーが重複している
-			}
-		}
-	}
+	loadTextures();
 	return true;
 }
 
+/**
+ * ファイルを読み直し、変わったものの資源だけを作り直す
+ */
+static void reload(void){
+	collada::ReloadResult result;
+	if(!model || !model->reload(&result))
+		return;
+	mesh_buffers.update(result);
+	if(result.rebuilt || !result.meshes.empty() || !result.materials.empty()){
+		const size_t material_count = material_buffer? material_table.getCount() : 0;
+		if(!material_table.update(model, result))
+			return;
+		uploadMaterials();
+#ifdef USE_SHADER
+		if((material_buffer? material_table.getCount() : 0) != material_count)
+			loadShaders();
+		else
+			prepareShaders();
+#endif
+	}
+	if(result.rebuilt || !result.images.empty()){
+		releaseTextures();
+		loadTextures();
+	}
+}
+
 /**
  * 解放
+ * GLのコンテキストが有効なうちに呼ぶ(ウィンドウを閉じる時にGLUTから呼ばれる)
  */
 void release(){
-	std::map<unsigned int, GLuint>::iterator it = textures.begin();
-	while(it != textures.end()){
-		glDeleteTextures(1, &it->second);
-		it++;
+	releaseTextures();
+#ifdef USE_SHADER
+	shader_variants.cleanup();
+#endif
+	if(material_buffer){
+		glDeleteBuffers(1, &material_buffer);
+		material_buffer = 0;
 	}
-	textures.clear();
+	material_table.cleanup();
+	mesh_buffers.cleanup();
+	delete model;
+	model = NULL;
+}
+
+// 描画の時間の計測(-benchmark)
+static int benchmark_frames = 0;	// 計るフレーム数(0なら計らない)
+static int benchmark_count = -1;	// 計り始めてから描いたフレーム数
+static unsigned long long benchmark_begin = 0;
+
+/**
+ * 描き終えたフレームを数え、benchmark_frames描いたら1フレームの平均の時間を表示して終える
+ * 窓が表示されて描画のコールバックが呼ばれてから数える
+ * 資源は窓を閉じる時のrelease()で解放される
+ */
+static void countBenchmarkFrame(void){
+	glFinish();
+	// 初回の描画は準備の分が掛かるので除く
+	if(benchmark_count < 0){
+		benchmark_begin = getMicroseconds();
+		benchmark_count = 0;
+		return;
+	}
+	if(++benchmark_count < benchmark_frames)
+		return;
+	const unsigned long long elapsed = getMicroseconds() - benchmark_begin;
+	std::cout << "frame time: " << elapsed / 1000.0 / benchmark_count << " ms (" << benchmark_count << " frames)" << std::endl;
+	benchmark_frames = 0;
+	glutLeaveMainLoop();
 }
 
 /**
@@ -137,6 +346,10 @@ static void display(void){
 		const_cast<collada::Node*>(node)->updateMatrix(&matR);
 	}
 
+	unsigned int current_material = INVALID_INDEX;
+#ifdef USE_SHADER
+	GLuint current_program = 0;
+#endif
 	while(node != NULL){
 		glPushMatrix();
 		glMultMatrixf(*(node->getCurrentMatrix()));
@@ -147,68 +360,81 @@ static void display(void){
 			if(mesh == NULL)
 				continue;
 
-			std::map<unsigned int, collada::Material*>& bind_material = geoms[i]->getBindMaterial();
 			const collada::TrianglesPtrArray* triangles = mesh->getTriangles();
 			for(size_t j = 0; j < triangles->size(); j++){
-				// マテリアル
-				collada::Material* material = bind_material[(*triangles)[j]->getMaterialUid()];
-				glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, material->getEmission()->color);
-				glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, material->getAmbient()->color);
-				glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, material->getDiffuse()->color);
-				glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, material->getSpecular()->color);
-				glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, material->getShininess());
-				// 位置
-				const collada::UintArray* indices = (*triangles)[j]->getIndices();
-				const collada::Input* position = (*triangles)[j]->getPosition();
-				if(!indices || !position)
+				const unsigned int material_index = (*triangles)[j]->getMaterialIndex();
+				if(material_index == INVALID_INDEX)
+					continue;
+				const collada::MaterialData* material = material_table.getMaterial(material_index);
+				// 頂点とインデクス
+				const MeshBuffers::Buffer* buffer = mesh_buffers.get(geoms[i], j);
+				if(!buffer)
 					continue;
-				glEnableClientState(GL_VERTEX_ARRAY);
-				glVertexPointer(position->stride, GL_FLOAT, 0, &position->f_array[0]);
-				// 法線
-				const collada::Input* normal = (*triangles)[j]->getNormal();
-				if(normal){
-					glEnableClientState(GL_NORMAL_ARRAY);
-					glNormalPointer(GL_FLOAT, 0, &normal->f_array[0]);
+				const collada::InputPtrArray* texcoords = (*triangles)[j]->getTexCoords();
+				bool use_gl_material = true;
+#ifdef USE_SHADER
+				// 材質の特徴に合わせたシェーダ(作れなければ固定機能で描く)
+				// uniformブロックから材質を読むシェーダならglMaterialは要らない
+				const ShaderKey key = makeShaderKey(material, texcoords? texcoords->size() : 0);
+				const ShaderVariants::Variant* variant = shader_variants.get(key);
+				const GLuint program = variant? variant->glsl->getProgram() : 0;
+				if(program != current_program){
+					glUseProgram(program);
+					current_program = program;
+				}
+				if(variant && (variant->material_index >= 0)){
+					glUniform1i(variant->material_index, static_cast<GLint>(material_index));
+					use_gl_material = false;
+				}
+#endif
+				// 固定機能とgl_FrontMaterialを読むシェーダのマテリアル(直前と同じなら設定しない)
+				if(use_gl_material && (material_index != current_material)){
+					glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, material->emission);
+					glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, material->ambient);
+					glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, material->diffuse);
+					glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, material->specular);
+					glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, material->shininess);
+					current_material = material_index;
 				}
 #ifdef USE_TEXTURE
- #ifdef USE_SHADER
-				glUseProgram(glsl0.getProgram());
- #endif
 				// テクスチャ座標
-				const collada::InputPtrArray* texcoords = (*triangles)[j]->getTexCoords();
 				if(texcoords){
-					glActiveTexture(GL_TEXTURE0);
-					glClientActiveTexture(GL_TEXTURE0);
-					glEnable(GL_TEXTURE_2D);
-					if(material->getDiffuse()->sampler){
  #ifdef USE_SHADER
-						glUseProgram(glsl1.getProgram());
+					if(variant){
+						// 項ごとに決まったユニットへ
+						for(int k = 0; k < ShaderTexture_Count; k++){
+							if(!hasShaderTexture(key, static_cast<ShaderTexture>(k)))
+								continue;
+							glActiveTexture(GL_TEXTURE0 + k);
+							glBindTexture(GL_TEXTURE_2D, textures[material_table.getImage(getShaderTextureImage(material, static_cast<ShaderTexture>(k)))]);
+						}
+						glActiveTexture(GL_TEXTURE0);
+					}
+					else
  #endif
-						glBindTexture(GL_TEXTURE_2D, textures[material->getDiffuse()->sampler->image_uid]);
+					if(material->diffuse_texture >= 0){
+						glActiveTexture(GL_TEXTURE0);
+						glEnable(GL_TEXTURE_2D);
+						glBindTexture(GL_TEXTURE_2D, textures[material_table.getImage(material->diffuse_texture)]);
 					}
-					glClientActiveTexture(GL_TEXTURE0);
-					glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-					collada::InputPtrArray::const_iterator it = texcoords->begin();
-					glTexCoordPointer((*it)[0].stride, GL_FLOAT, 0, &(*it)[0].f_array[0]);
 				}
 #endif
-				// 描画
-				glDrawElements(GL_TRIANGLES, indices->size(), GL_UNSIGNED_INT, &(*indices)[0]);
-				// 後始末
-				glDisableClientState(GL_VERTEX_ARRAY);
-				glDisableClientState(GL_NORMAL_ARRAY);
-				glClientActiveTexture(GL_TEXTURE0);
+				// 描画(テクスチャ座標はセットごとに別のユニットへ、シェーダは0番だけを使う)
+				mesh_buffers.draw(buffer);
 				glDisable(GL_TEXTURE_2D);
 			}
 		}
 		node = node->getNext();
 		glPopMatrix();
 	}
+	mesh_buffers.unbind();
 //	glPopMatrix();
 #ifdef USE_SHADER
 	glUseProgram(0);
 #endif
 	glutSwapBuffers();
+	if(benchmark_frames > 0)
+		countBenchmarkFrame();
 }
 
 /**
@@ -272,8 +498,19 @@ void MouseWheel(int wheel_number, int direction, int x, int y){
 		cam_pos_z = 1.0f;
 }
 
+/**
+ * GLUT用コールバック
+ * rでファイルを読み直す
+ */
+static void keyboard(unsigned char key, int x, int y){
+	if(key == 'r')
+		reload();
+}
+
+
 /**
  * エントリ
+ * -benchmark <フレーム数>で描画の時間を計って終了する(idle()から描き続けたフレームを数える)
  */
 int main(int argc, char *argv[]){
 	// initialize GLUT
@@ -297,10 +534,15 @@ int main(int argc, char *argv[]){
 	glutReshapeFunc(resize);
 	glutMouseFunc(mouse);
 	glutMotionFunc(motion);
-	//glutKeyboardFunc(keyboard);
+	glutKeyboardFunc(keyboard);
 	glutMouseWheelFunc(MouseWheel);
-	if(!init())
+	glutCloseFunc(release);
+	if(!init()){
+		release();
 		return EXIT_FAILURE;
+	}
+	if((argc > 2) && (strcmp(argv[1], "-benchmark") == 0))
+		benchmark_frames = atoi(argv[2]);
 	glutMainLoop();
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
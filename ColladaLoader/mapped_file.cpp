@@ -0,0 +1,120 @@
+﻿#include "mapped_file.h"
+#include "log.h"
+#ifdef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(){
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#else
+	fd = -1;
+#endif
+	data = NULL;
+	size = 0;
+	opened = false;
+}
+
+MappedFile::~MappedFile(){
+	close();
+}
+
+bool MappedFile::open(const char* filename){
+	close();
+#ifdef _WIN32
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(file, &file_size) || (static_cast<unsigned long long>(file_size.QuadPart) > static_cast<size_t>(-1))){
+		Log_e("could not get file size(%s).\n", filename);
+		close();
+		return false;
+	}
+	size = static_cast<size_t>(file_size.QuadPart);
+	if(size > 0){	// 0バイトのファイルはマップできない
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(mapping == NULL){
+			Log_e("could not map file(%s).\n", filename);
+			close();
+			return false;
+		}
+		data = reinterpret_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if(data == NULL){
+			Log_e("could not map file(%s).\n", filename);
+			close();
+			return false;
+		}
+	}
+#else
+	fd = ::open(filename, O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat st;
+	if(fstat(fd, &st) != 0){
+		Log_e("could not get file size(%s).\n", filename);
+		close();
+		return false;
+	}
+	size = static_cast<size_t>(st.st_size);
+	if(size > 0){
+		void* addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(addr == MAP_FAILED){
+			Log_e("could not map file(%s).\n", filename);
+			close();
+			return false;
+		}
+		data = reinterpret_cast<const unsigned char*>(addr);
+	}
+#endif
+	opened = true;
+	return true;
+}
+
+void MappedFile::close(){
+#ifdef _WIN32
+	if(data)
+		UnmapViewOfFile(data);
+	if(mapping)
+		CloseHandle(mapping);
+	if(file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#else
+	if(data)
+		munmap(const_cast<unsigned char*>(data), size);
+	if(fd >= 0)
+		::close(fd);
+	fd = -1;
+#endif
+	data = NULL;
+	size = 0;
+	opened = false;
+}
+
+/**
+ * ファイルのサイズと更新時刻を取得
+ */
+bool getFileStatus(const char* filename, unsigned long long* size, unsigned long long* mtime){
+#ifdef _WIN32
+	struct _stat64 st;
+	if(_stat64(filename, &st) != 0)
+		return false;
+#else
+	struct stat st;
+	if(stat(filename, &st) != 0)
+		return false;
+#endif
+	*size = static_cast<unsigned long long>(st.st_size);
+	*mtime = static_cast<unsigned long long>(st.st_mtime);
+	return true;
+}
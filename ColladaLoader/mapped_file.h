@@ -0,0 +1,34 @@
+﻿/**
+ * 読み込み専用のメモリマップドファイル
+ */
+#pragma once
+#include <stddef.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+class MappedFile{
+public:
+	MappedFile();
+	~MappedFile();
+	bool open(const char* filename);
+	void close();
+	const unsigned char* getData() const { return data; }
+	size_t getSize() const { return size; }
+	bool isOpen() const { return opened; }
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+private:
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+	const unsigned char* data;
+	size_t size;
+	bool opened;
+};
+
+bool getFileStatus(const char* filename, unsigned long long* size, unsigned long long* mtime);
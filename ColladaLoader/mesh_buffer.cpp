@@ -0,0 +1,316 @@
+﻿#include <algorithm>
+#include <new>
+#include "log.h"
+#include "mesh_buffer.h"
+
+// バッファ内の位置をポインタとして渡す
+static const GLvoid* toPointer(size_t offset){
+	return reinterpret_cast<const GLvoid*>(offset);
+}
+
+MeshBuffers::MeshBuffers() : memory_size(0), current_vao(0){
+}
+
+/**
+ * GLのコンテキストは先に破棄されていることがあるので、ここではGLを呼ばない
+ * 転送した資源はcleanup()で解放しておく
+ */
+MeshBuffers::~MeshBuffers(){
+}
+
+/**
+ * 全てのバッファを解放する
+ * GLのコンテキストが有効なうちに呼ぶ
+ */
+void MeshBuffers::cleanup(){
+	std::map<const collada::Geometry*, std::vector<Buffer> >::iterator it = buffers.begin();
+	while(it != buffers.end()){
+		for(size_t i = 0; i < it->second.size(); i++)
+			destroy(&it->second[i]);
+		it++;
+	}
+	buffers.clear();
+	memory_size = 0;
+}
+
+/**
+ * シーンの展開済みのTrianglesを転送する
+ * 遅延展開で未展開のものは展開せず、展開後に初めてget()した時に転送する
+ */
+bool MeshBuffers::load(const collada::Collada* collada){
+	cleanup();
+	const collada::Scene* scene = collada->getScene();
+	if(!scene)
+		return true;
+	bool result = true;
+	for(const collada::Node* node = scene->findNode(); node; node = node->getNext()){
+		const collada::GeometryPtrArray& geoms = node->getGeometries();
+		for(size_t i = 0; i < geoms.size(); i++){
+			if(!geoms[i]->isDecoded() || (buffers.find(geoms[i]) != buffers.end()))
+				continue;
+			if(!create(geoms[i]))
+				result = false;
+		}
+	}
+	return result;
+}
+
+/**
+ * geometryのindex番目のTrianglesのバッファ(展開済みで初めてならここで転送する)
+ * 未展開か描くものがなければNULL
+ */
+const MeshBuffers::Buffer* MeshBuffers::get(const collada::Geometry* geometry, size_t index){
+	std::map<const collada::Geometry*, std::vector<Buffer> >::iterator it = buffers.find(geometry);
+	if(it == buffers.end()){
+		// 展開は呼び出し側(かprefetch())に任せる
+		if(!geometry->isDecoded())
+			return NULL;
+		create(geometry);
+		it = buffers.find(geometry);
+		if(it == buffers.end())
+			return NULL;
+	}
+	if((index >= it->second.size()) || (it->second[index].count == 0))
+		return NULL;
+	return &it->second[index];
+}
+
+/**
+ * geometryのバッファを解放する
+ * reload()でメッシュを差し替えたGeometryに使い、次のget()で転送し直す
+ */
+void MeshBuffers::release(const collada::Geometry* geometry){
+	std::map<const collada::Geometry*, std::vector<Buffer> >::iterator it = buffers.find(geometry);
+	if(it == buffers.end())
+		return;
+	for(size_t i = 0; i < it->second.size(); i++)
+		destroy(&it->second[i]);
+	buffers.erase(it);
+}
+
+/**
+ * Collada::reload()の結果に合わせて、差し替えたメッシュのバッファを解放する
+ * 全体を入れ替えた場合は以前のGeometryのアドレスが無効なので全て解放する
+ */
+void MeshBuffers::update(const collada::ReloadResult& result){
+	if(result.rebuilt){
+		cleanup();
+		return;
+	}
+	for(size_t i = 0; i < result.meshes.size(); i++)
+		release(result.meshes[i]);
+}
+
+/**
+ * バッファから描く
+ * 頂点配列オブジェクトは直前と違う時だけ結び付け、描き終えたらunbind()で外す
+ */
+void MeshBuffers::draw(const Buffer* buffer){
+	if(buffer->vao){
+		if(buffer->vao != current_vao){
+			glBindVertexArray(buffer->vao);
+			current_vao = buffer->vao;
+		}
+		glDrawRangeElements(GL_TRIANGLES, 0, buffer->max_index, buffer->count, buffer->index_type, toPointer(0));
+	}
+	else{
+		unbind();
+		bindArrays(buffer);
+		glDrawRangeElements(GL_TRIANGLES, 0, buffer->max_index, buffer->count, buffer->index_type, toPointer(0));
+		unbindArrays(buffer);
+	}
+}
+
+/**
+ * 結び付けたままの頂点配列オブジェクトを外す
+ * 1フレーム描き終えた時と、他の頂点配列を使う前に呼ぶ
+ */
+void MeshBuffers::unbind(){
+	if(current_vao){
+		glBindVertexArray(0);
+		current_vao = 0;
+	}
+}
+
+/**
+ * geometryのメッシュの全てのTrianglesを転送する
+ * 転送できなかったTrianglesは描かない
+ */
+bool MeshBuffers::create(const collada::Geometry* geometry){
+	const collada::Mesh* mesh = geometry->getMesh();
+	const collada::TrianglesPtrArray* triangles = mesh? mesh->getTriangles() : NULL;
+	std::vector<Buffer>* target;
+	try{
+		std::pair<const collada::Geometry*, std::vector<Buffer> > p(geometry, std::vector<Buffer>());
+		target = &buffers.insert(p).first->second;
+		if(triangles)
+			target->resize(triangles->size());
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	bool result = true;
+	for(size_t i = 0; i < target->size(); i++){
+		if(!create((*triangles)[i], &(*target)[i]))
+			result = false;
+	}
+	return result;
+}
+
+/**
+ * 頂点の属性を1つのバッファに続けて並べ、インデクスを別のバッファに転送する
+ * 描くものがなければcountが0のまま成功する(インデクスが頂点の数を超える場合も)
+ */
+bool MeshBuffers::create(const collada::Triangles* triangles, Buffer* buffer){
+	buffer->vao = 0;
+	buffer->vertex_buffer = 0;
+	buffer->index_buffer = 0;
+	buffer->count = 0;
+	buffer->max_index = 0;
+	buffer->index_type = GL_UNSIGNED_INT;
+	buffer->position_size = 0;
+	buffer->normal_offset = 0;
+	buffer->size = 0;
+	for(int i = 0; i < 2; i++){
+		buffer->texcoord_size[i] = 0;
+		buffer->texcoord_offset[i] = 0;
+	}
+	const collada::UintArray* indices = triangles->getIndices();
+	const collada::Input* position = triangles->getPosition();
+	if(!indices || indices->empty() || !position || position->f_array.empty())
+		return true;
+	// 頂点の数を超えるインデクスや足りない属性があれば、バッファの外を読まないよう描かない
+	if(!triangles->validate()){
+		Log_w("invalid triangles are skipped.\n");
+		return true;
+	}
+	const collada::Input* normal = triangles->getNormal();
+	const collada::InputPtrArray* texcoords = triangles->getTexCoords();
+
+	// 並べ方を決める(テクスチャ座標はシェーダが使う2セットまで)
+	size_t size = position->f_array.size() * sizeof(float);
+	buffer->position_size = static_cast<GLint>(position->stride);
+	if(normal && !normal->f_array.empty()){
+		buffer->normal_offset = size;
+		size += normal->f_array.size() * sizeof(float);
+	}
+	for(size_t i = 0; texcoords && (i < texcoords->size()) && (i < 2); i++){
+		const collada::Input* texcoord = (*texcoords)[i];
+		if(texcoord->f_array.empty())
+			continue;
+		buffer->texcoord_size[i] = static_cast<GLint>(texcoord->stride);
+		buffer->texcoord_offset[i] = size;
+		size += texcoord->f_array.size() * sizeof(float);
+	}
+	// インデクスが16bitに収まれば詰める
+	const unsigned int max_index = *std::max_element(indices->begin(), indices->end());
+	std::vector<unsigned short> short_indices;
+	if(max_index <= 0xffff){
+		try{
+			short_indices.resize(indices->size());
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			return false;
+		}
+		for(size_t i = 0; i < indices->size(); i++)
+			short_indices[i] = static_cast<unsigned short>((*indices)[i]);
+	}
+
+	// 描画中に作る場合もあるので、結び付けたままの頂点配列オブジェクトに記録しないよう外しておく
+	unbind();
+	glGenBuffers(1, &buffer->vertex_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer->vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, position->f_array.size() * sizeof(float), &position->f_array[0]);
+	if(buffer->normal_offset)
+		glBufferSubData(GL_ARRAY_BUFFER, buffer->normal_offset, normal->f_array.size() * sizeof(float), &normal->f_array[0]);
+	for(int i = 0; i < 2; i++){
+		if(buffer->texcoord_size[i])
+			glBufferSubData(GL_ARRAY_BUFFER, buffer->texcoord_offset[i], (*texcoords)[i]->f_array.size() * sizeof(float), &(*texcoords)[i]->f_array[0]);
+	}
+	// インデクスのバインドは頂点配列オブジェクトに記録されるので、先に作って結び付けておく
+	if(GLEW_ARB_vertex_array_object){
+		glGenVertexArrays(1, &buffer->vao);
+		glBindVertexArray(buffer->vao);
+	}
+	glGenBuffers(1, &buffer->index_buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer->index_buffer);
+	if(!short_indices.empty()){
+		buffer->index_type = GL_UNSIGNED_SHORT;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, short_indices.size() * sizeof(unsigned short), &short_indices[0], GL_STATIC_DRAW);
+		size += short_indices.size() * sizeof(unsigned short);
+	}
+	else{
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices->size() * sizeof(unsigned int), &(*indices)[0], GL_STATIC_DRAW);
+		size += indices->size() * sizeof(unsigned int);
+	}
+	buffer->count = static_cast<GLsizei>(indices->size());
+	buffer->max_index = max_index;
+	buffer->size = size;
+	memory_size += size;
+	if(buffer->vao){
+		bindArrays(buffer);
+		glBindVertexArray(0);
+	}
+	else{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return true;
+}
+
+void MeshBuffers::destroy(Buffer* buffer){
+	if(buffer->vao == current_vao)
+		current_vao = 0;
+	if(buffer->vao)
+		glDeleteVertexArrays(1, &buffer->vao);
+	if(buffer->vertex_buffer)
+		glDeleteBuffers(1, &buffer->vertex_buffer);
+	if(buffer->index_buffer)
+		glDeleteBuffers(1, &buffer->index_buffer);
+	memory_size -= buffer->size;
+	buffer->vao = 0;
+	buffer->vertex_buffer = 0;
+	buffer->index_buffer = 0;
+	buffer->count = 0;
+	buffer->size = 0;
+}
+
+/**
+ * 固定機能の頂点配列をバッファに向ける
+ * 頂点配列オブジェクトを作る時と、使えない場合は描画のたびに呼ぶ
+ */
+void MeshBuffers::bindArrays(const Buffer* buffer) const{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer->vertex_buffer);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(buffer->position_size, GL_FLOAT, 0, toPointer(0));
+	if(buffer->normal_offset){
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glNormalPointer(GL_FLOAT, 0, toPointer(buffer->normal_offset));
+	}
+	for(int i = 0; i < 2; i++){
+		if(!buffer->texcoord_size[i])
+			continue;
+		glClientActiveTexture(GL_TEXTURE0 + i);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(buffer->texcoord_size[i], GL_FLOAT, 0, toPointer(buffer->texcoord_offset[i]));
+	}
+	glClientActiveTexture(GL_TEXTURE0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer->index_buffer);
+}
+
+void MeshBuffers::unbindArrays(const Buffer* buffer) const{
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	for(int i = 0; i < 2; i++){
+		if(!buffer->texcoord_size[i])
+			continue;
+		glClientActiveTexture(GL_TEXTURE0 + i);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+	glClientActiveTexture(GL_TEXTURE0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
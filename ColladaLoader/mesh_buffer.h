@@ -0,0 +1,49 @@
+﻿/**
+ * Trianglesごとの頂点バッファとインデクスバッファ
+ * 頂点の属性とインデクスを読み込み時(か初めての描画時)に1回だけ転送し、描画のたびにクライアントの配列を渡さない
+ * 配列の設定は頂点配列オブジェクトに記録する(使えなければ描画のたびに設定する)
+ * 転送した資源は文書と共にcleanup()で解放し(デストラクタでは解放しない)、Collada::reload()で差し替えたGeometryの分はrelease()で解放する
+ */
+#pragma once
+#include <map>
+#include <vector>
+#include <GL/glew.h>
+#include "collada.h"
+
+class MeshBuffers{
+public:
+	typedef struct{
+		GLuint vao;	// 使えなければ0
+		GLuint vertex_buffer;	// 位置、法線、テクスチャ座標の順に並べる
+		GLuint index_buffer;
+		GLsizei count;	// インデクスの数(0なら描かない)
+		GLuint max_index;	// glDrawRangeElements()に渡す
+		GLenum index_type;	// インデクスが16bitに収まればGL_UNSIGNED_SHORT
+		GLint position_size;
+		size_t normal_offset;	// 法線がなければ0
+		GLint texcoord_size[2];	// 使わないセットは0
+		size_t texcoord_offset[2];
+		size_t size;	// 転送したバイト数
+	}Buffer;
+public:
+	MeshBuffers();
+	~MeshBuffers();
+	void cleanup();
+	bool load(const collada::Collada* collada);
+	const Buffer* get(const collada::Geometry* geometry, size_t index);
+	void release(const collada::Geometry* geometry);
+	void update(const collada::ReloadResult& result);
+	void draw(const Buffer* buffer);
+	void unbind();
+	size_t getMemorySize() const { return memory_size; }
+private:
+	bool create(const collada::Geometry* geometry);
+	bool create(const collada::Triangles* triangles, Buffer* buffer);
+	void destroy(Buffer* buffer);
+	void bindArrays(const Buffer* buffer) const;
+	void unbindArrays(const Buffer* buffer) const;
+private:
+	std::map<const collada::Geometry*, std::vector<Buffer> > buffers;	// Geometry→Trianglesと同じ並び
+	size_t memory_size;	// 転送したバイト数
+	GLuint current_vao;	// 結び付けたままの頂点配列オブジェクト
+};
@@ -0,0 +1,113 @@
+// material.frag
+// ShaderVariants擪#version#definetĎg
+// SHADING_CONSTANT/LAMBERT/PHONG/BLINN : Ae̎
+// EMISSION_TEXTURE, AMBIENT_TEXTURE, DIFFUSE_TEXTURE, SPECULAR_TEXTURE, TRANSPARENT_TEXTURE : eNX`g
+// MATERIAL_COUNT : `Ă΍ގuniformubNǂ(gl_FrontMaterial)
+#ifndef SHADING_CONSTANT
+varying vec3 position;
+varying vec3 normal;
+#endif
+
+#ifdef MATERIAL_COUNT
+// collada::MaterialDataƓ
+struct Material{
+	vec4 emission;
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+	vec4 reflective;
+	vec4 transparent;
+	float shininess;
+	float reflectivity;
+	float transparency;
+	float index_of_refraction;
+	int emission_texture;
+	int ambient_texture;
+	int diffuse_texture;
+	int specular_texture;
+	int reflective_texture;
+	int transparent_texture;
+	int shading;
+	int reserved;
+};
+layout(std140) uniform Materials{
+	Material materials[MATERIAL_COUNT];
+};
+uniform int material_index;
+#define MATERIAL materials[material_index]
+#define EMISSION MATERIAL.emission
+#define AMBIENT MATERIAL.ambient
+#define DIFFUSE MATERIAL.diffuse
+#define SPECULAR MATERIAL.specular
+#define SHININESS MATERIAL.shininess
+#else
+#define EMISSION gl_FrontMaterial.emission
+#define AMBIENT gl_FrontMaterial.ambient
+#define DIFFUSE gl_FrontMaterial.diffuse
+#define SPECULAR gl_FrontMaterial.specular
+#define SHININESS gl_FrontMaterial.shininess
+#endif
+
+#ifdef EMISSION_TEXTURE
+uniform sampler2D emission_map;
+#endif
+#ifdef AMBIENT_TEXTURE
+uniform sampler2D ambient_map;
+#endif
+#ifdef DIFFUSE_TEXTURE
+uniform sampler2D diffuse_map;
+#endif
+#ifdef SPECULAR_TEXTURE
+uniform sampler2D specular_map;
+#endif
+#ifdef TRANSPARENT_TEXTURE
+uniform sampler2D transparent_map;
+#endif
+
+void main(void){
+	// eNX`̍͐F̑Ɏg
+#ifdef EMISSION_TEXTURE
+	vec4 emission = texture2D(emission_map, gl_TexCoord[0].st);
+#else
+	vec4 emission = EMISSION;
+#endif
+#ifdef DIFFUSE_TEXTURE
+	vec4 diffuse = texture2D(diffuse_map, gl_TexCoord[0].st);
+#else
+	vec4 diffuse = DIFFUSE;
+#endif
+	vec4 color = emission;
+#ifndef SHADING_CONSTANT
+ #ifdef AMBIENT_TEXTURE
+	vec4 ambient = texture2D(ambient_map, gl_TexCoord[0].st);
+ #else
+	vec4 ambient = AMBIENT;
+ #endif
+	vec3 fnormal = normalize(normal);
+	vec3 light = normalize(gl_LightSource[0].position.xyz - position);
+	float lambert = max(dot(light, fnormal), 0.0);
+	color += gl_LightSource[0].ambient * ambient + gl_LightSource[0].diffuse * diffuse * lambert;
+ #if defined(SHADING_PHONG) || defined(SHADING_BLINN)
+  #ifdef SPECULAR_TEXTURE
+	vec4 specular = texture2D(specular_map, gl_TexCoord[0].st);
+  #else
+	vec4 specular = SPECULAR;
+  #endif
+	if(lambert > 0.0){
+		vec3 view = normalize(-position);
+  #ifdef SHADING_PHONG
+		float highlight = max(dot(reflect(-light, fnormal), view), 0.0);
+  #else
+		float highlight = max(dot(fnormal, normalize(light + view)), 0.0);
+  #endif
+		color += gl_LightSource[0].specular * specular * pow(highlight, SHININESS);
+	}
+ #endif
+#endif
+	// x͊gUF̃At@Ƃ
+	color.a = diffuse.a;
+#ifdef TRANSPARENT_TEXTURE
+	color.a *= texture2D(transparent_map, gl_TexCoord[0].st).a;
+#endif
+	gl_FragColor = color;
+}
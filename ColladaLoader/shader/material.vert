@@ -0,0 +1,19 @@
+// material.vert
+// ShaderVariants擪#version#definetĎg
+// SHADING_CONSTANT/LAMBERT/PHONG/BLINN : Ae̎
+// USE_TEXCOORD : 0Ԃ̃eNX`Wn(tOgVF[_0Ԃg)
+#ifndef SHADING_CONSTANT
+varying vec3 position;
+varying vec3 normal;
+#endif
+
+void main(void){
+#ifndef SHADING_CONSTANT
+	position = vec3(gl_ModelViewMatrix * gl_Vertex);
+	normal = normalize(gl_NormalMatrix * gl_Normal);
+#endif
+	gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+#ifdef USE_TEXCOORD
+	gl_TexCoord[0] = gl_MultiTexCoord0;
+#endif
+}
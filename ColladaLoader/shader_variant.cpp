@@ -0,0 +1,243 @@
+﻿#include <stdio.h>
+#include <new>
+#include <vector>
+#include "log.h"
+#include "shader_variant.h"
+
+// キーのビットの並び
+#define SHADER_KEY_SHADING_BITS	2	// Material::Shading
+#define SHADER_KEY_TEXTURE_SHIFT	SHADER_KEY_SHADING_BITS	// ShaderTextureごとに1ビット
+
+/**
+ * 材質とテクスチャ座標の数からキーを作る
+ * テクスチャ座標が無ければテクスチャは使えないので色だけで描く
+ * シェーダは0番のセットだけを使うので、座標の数はキーに含めない
+ */
+ShaderKey makeShaderKey(const collada::MaterialData* material, size_t texcoord_count){
+	ShaderKey key = static_cast<ShaderKey>(material->shading) & ((1 << SHADER_KEY_SHADING_BITS) - 1);
+	if(texcoord_count == 0)
+		return key;
+	for(int i = 0; i < ShaderTexture_Count; i++){
+		if(getShaderTextureImage(material, static_cast<ShaderTexture>(i)) >= 0)
+			key |= 1 << (SHADER_KEY_TEXTURE_SHIFT + i);
+	}
+	return key;
+}
+
+bool hasShaderTexture(ShaderKey key, ShaderTexture texture){
+	return (key & (1 << (SHADER_KEY_TEXTURE_SHIFT + texture))) != 0;
+}
+
+/**
+ * textureのユニットに割り当てる画像(MaterialTable::getImage()の添字、無ければ-1)
+ */
+int getShaderTextureImage(const collada::MaterialData* material, ShaderTexture texture){
+	switch(texture){
+	case ShaderTexture_Emission:
+		return material->emission_texture;
+	case ShaderTexture_Ambient:
+		return material->ambient_texture;
+	case ShaderTexture_Diffuse:
+		return material->diffuse_texture;
+	case ShaderTexture_Specular:
+		return material->specular_texture;
+	case ShaderTexture_Transparent:
+		return material->transparent_texture;
+	default:
+		return -1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ShaderVariants::ShaderVariants(){
+	material_count = 0;
+}
+
+ShaderVariants::~ShaderVariants(){
+	cleanup();
+}
+
+void ShaderVariants::cleanup(){
+	for(std::map<ShaderKey, Variant>::iterator it = variants.begin(); it != variants.end(); it++)
+		delete it->second.glsl;
+	variants.clear();
+	vert_template.clear();
+	frag_template.clear();
+	material_count = 0;
+}
+
+/**
+ * テンプレートを読み込む
+ * material_countが0でなければ材質をuniformブロックの0番から読む(MaterialTableの数)
+ */
+bool ShaderVariants::load(const char* vert, const char* frag, size_t material_count){
+	cleanup();
+	if(!readFile(vert, &vert_template) || !readFile(frag, &frag_template)){
+		cleanup();
+		return false;
+	}
+	this->material_count = material_count;
+	return true;
+}
+
+/**
+ * プログラムのバイナリをdirectoryにキャッシュする(Glsl::setCacheDirectory())
+ * シェーダを作る前に呼ぶ
+ */
+void ShaderVariants::setCacheDirectory(const char* directory){
+	if(directory)
+		cache_dir.assign(directory);
+	else
+		cache_dir.clear();
+}
+
+/**
+ * キーのシェーダを返す(初めてのキーならここで作る)
+ * 作れなければNULL、同じキーで再び作ることはしない
+ */
+const ShaderVariants::Variant* ShaderVariants::get(ShaderKey key){
+	std::map<ShaderKey, Variant>::iterator it = variants.find(key);
+	if(it == variants.end()){
+		prepare(&key, 1);
+		it = variants.find(key);
+		if(it == variants.end())
+			return NULL;
+	}
+	return it->second.glsl? &it->second : NULL;
+}
+
+/**
+ * keysのシェーダをまとめて作る
+ * 全てのコンパイルを発行してから結果を確かめるので、対応するドライバでは並列にコンパイルされる
+ * 全て作れればtrue
+ */
+bool ShaderVariants::prepare(const ShaderKey* keys, size_t count){
+	std::vector<Variant*> started;
+	try{
+		started.reserve(count);
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		return false;
+	}
+	bool result = true;
+	for(size_t i = 0; i < count; i++){
+		if(variants.find(keys[i]) != variants.end())
+			continue;
+		Variant* variant;
+		std::string header;
+		try{
+			makeHeader(keys[i], &header);
+			Variant empty;
+			empty.glsl = NULL;
+			empty.material_index = -1;
+			std::pair<ShaderKey, Variant> p(keys[i], empty);
+			variant = &variants.insert(p).first->second;
+			variant->glsl = new Glsl;
+		}
+		catch(std::bad_alloc& e){
+			Log_e("could not allocate memory.\n");
+			result = false;
+			break;
+		}
+		variant->glsl->setCacheDirectory(cache_dir.empty()? NULL : cache_dir.c_str());
+		if(!variant->glsl->begin(vert_template.c_str(), frag_template.c_str(), header.c_str())){
+			Log_e("could not create shader(key %08x).\n", keys[i]);
+			delete variant->glsl;
+			variant->glsl = NULL;
+			result = false;
+			continue;
+		}
+		started.push_back(variant);
+	}
+	for(std::vector<Variant*>::iterator it = started.begin(); it != started.end(); it++){
+		Variant* variant = *it;
+		if(!variant->glsl->finish()){
+			Log_e("could not create shader.\n");
+			delete variant->glsl;
+			variant->glsl = NULL;
+			result = false;
+			continue;
+		}
+		setup(variant);
+	}
+	return result;
+}
+
+/**
+ * サンプラとuniformブロックの割り当ては変わらないので作った時に設定する
+ */
+void ShaderVariants::setup(Variant* variant) const{
+	static const char* const samplers[ShaderTexture_Count] = {
+		"emission_map", "ambient_map", "diffuse_map", "specular_map", "transparent_map"
+	};
+	const GLuint program = variant->glsl->getProgram();
+	glUseProgram(program);
+	for(int i = 0; i < ShaderTexture_Count; i++){
+		const GLint location = glGetUniformLocation(program, samplers[i]);
+		if(location >= 0)
+			glUniform1i(location, i);
+	}
+	glUseProgram(0);
+	if(material_count > 0){
+		const GLuint block = glGetUniformBlockIndex(program, "Materials");
+		if(block != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, block, 0);
+		variant->material_index = glGetUniformLocation(program, "material_index");
+	}
+}
+
+bool ShaderVariants::readFile(const char* filename, std::string* output){
+	FILE* fp = fopen(filename, "rb");
+	if(fp == NULL){
+		perror(filename);
+		return false;
+	}
+	bool result = true;
+	char buffer[4096];
+	size_t size;
+	try{
+		while((size = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+			output->append(buffer, size);
+	}
+	catch(std::bad_alloc& e){
+		Log_e("could not allocate memory.\n");
+		result = false;
+	}
+	if(ferror(fp)){
+		Log_e("could not read file(%s).\n", filename);
+		result = false;
+	}
+	fclose(fp);
+	return result;
+}
+
+/**
+ * テンプレートの前に付ける#versionと#define
+ */
+void ShaderVariants::makeHeader(ShaderKey key, std::string* output) const{
+	static const char* const shadings[] = {
+		"#define SHADING_CONSTANT\n", "#define SHADING_LAMBERT\n", "#define SHADING_PHONG\n", "#define SHADING_BLINN\n"
+	};
+	static const char* const textures[ShaderTexture_Count] = {
+		"#define EMISSION_TEXTURE\n", "#define AMBIENT_TEXTURE\n", "#define DIFFUSE_TEXTURE\n",
+		"#define SPECULAR_TEXTURE\n", "#define TRANSPARENT_TEXTURE\n"
+	};
+	char line[64];
+	output->assign("#version 120\n");
+	if(material_count > 0){
+		output->append("#extension GL_ARB_uniform_buffer_object : enable\n");
+		sprintf(line, "#define MATERIAL_COUNT %u\n", static_cast<unsigned int>(material_count));
+		output->append(line);
+	}
+	output->append(shadings[key & ((1 << SHADER_KEY_SHADING_BITS) - 1)]);
+	for(int i = 0; i < ShaderTexture_Count; i++){
+		if(hasShaderTexture(key, static_cast<ShaderTexture>(i)))
+			output->append(textures[i]);
+	}
+	// テクスチャを使う項があれば0番のテクスチャ座標を渡す
+	if(key >> SHADER_KEY_TEXTURE_SHIFT)
+		output->append("#define USE_TEXCOORD\n");
+	output->append("#line 1\n");
+}
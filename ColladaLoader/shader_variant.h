@@ -0,0 +1,54 @@
+﻿/**
+ * 材質ごとのシェーダの組み合わせ
+ * 材質の特徴(陰影の種類、テクスチャを使う項)からキーを作り、
+ * テンプレートに#defineを付けて特化したシェーダをキーごとに1回だけ作る
+ * 分岐や不要な計算はプリプロセッサで取り除かれる
+ */
+#pragma once
+#include <map>
+#include <string>
+#include "glsl.h"
+#include "collada_material_table.h"
+
+// テクスチャユニット(サンプラはこの番号に設定する)
+typedef enum{
+	ShaderTexture_Emission,
+	ShaderTexture_Ambient,
+	ShaderTexture_Diffuse,
+	ShaderTexture_Specular,
+	ShaderTexture_Transparent,
+	ShaderTexture_Count
+}ShaderTexture;
+
+typedef unsigned int ShaderKey;
+
+ShaderKey makeShaderKey(const collada::MaterialData* material, size_t texcoord_count);
+bool hasShaderTexture(ShaderKey key, ShaderTexture texture);
+int getShaderTextureImage(const collada::MaterialData* material, ShaderTexture texture);
+
+class ShaderVariants{
+public:
+	typedef struct{
+		Glsl* glsl;
+		GLint material_index;	// uniform int material_index(材質をuniformブロックから読まなければ-1)
+	}Variant;
+public:
+	ShaderVariants();
+	~ShaderVariants();
+	void cleanup();
+	bool load(const char* vert, const char* frag, size_t material_count = 0);
+	void setCacheDirectory(const char* directory);
+	bool prepare(const ShaderKey* keys, size_t count);
+	const Variant* get(ShaderKey key);
+	size_t getCount() const { return variants.size(); }
+private:
+	static bool readFile(const char* filename, std::string* output);
+	void makeHeader(ShaderKey key, std::string* output) const;
+	void setup(Variant* variant) const;
+private:
+	std::string vert_template;
+	std::string frag_template;
+	size_t material_count;	// 0ならgl_FrontMaterialを使う
+	std::string cache_dir;	// プログラムのバイナリの置き場所、空ならキャッシュしない
+	std::map<ShaderKey, Variant> variants;	// 作れなかったキーはglslがNULL
+};
@@ -0,0 +1,362 @@
+﻿#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "text_number.h"
+
+// 空白の判定を16バイト単位で行う
+#if defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)))
+#define TEXT_NUMBER_USE_SSE2
+#include <intrin.h>
+#include <emmintrin.h>
+#elif defined(__GNUC__) && defined(__SSE2__)
+#define TEXT_NUMBER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// 8桁ずつまとめて変換する(リトルエンディアン前提)
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define TEXT_NUMBER_USE_SWAR
+#endif
+
+// 0x20以下を空白とみなす(XMLの空白は' ', '\t', '\r', '\n'のみ)
+static inline bool isSpace(char c){
+	return static_cast<unsigned char>(c) <= ' ';
+}
+
+static inline bool isDigit(char c){
+	return static_cast<unsigned char>(c - '0') < 10;
+}
+
+#ifdef TEXT_NUMBER_USE_SSE2
+static inline unsigned int countTrailingZeros(unsigned int mask){
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return static_cast<unsigned int>(index);
+#else
+	return static_cast<unsigned int>(__builtin_ctz(mask));
+#endif
+}
+
+// 各バイトが空白ならビットが立つ
+static inline unsigned int getSpaceMask(const char* p){
+	const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	const __m128i space = _mm_set1_epi8(' ');
+	return static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(x, space), x)));
+}
+#endif
+
+/**
+ * 空白を読み飛ばす
+ * 区切りが1文字なら逐次で済ませ、改行と字下げのような長い空白だけ16バイトずつ調べる
+ */
+static inline const char* skipSpace(const char* p, const char* end){
+	if((p < end) && !isSpace(*p))
+		return p;
+#ifdef TEXT_NUMBER_USE_SSE2
+	while(end - p >= 16){
+		const unsigned int mask = ~getSpaceMask(p) & 0xFFFF;
+		if(mask)
+			return p + countTrailingZeros(mask);
+		p += 16;
+	}
+#endif
+	while((p < end) && isSpace(*p))
+		p++;
+	return p;
+}
+
+/**
+ * 字句の終わり(次の空白)を探す
+ */
+static inline const char* findSpace(const char* p, const char* end){
+#ifdef TEXT_NUMBER_USE_SSE2
+	while(end - p >= 16){
+		const unsigned int mask = getSpaceMask(p);
+		if(mask)
+			return p + countTrailingZeros(mask);
+		p += 16;
+	}
+#endif
+	while((p < end) && !isSpace(*p))
+		p++;
+	return p;
+}
+
+#ifdef TEXT_NUMBER_USE_SWAR
+static inline unsigned long long read64(const char* p){
+	unsigned long long v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline bool isEightDigits(unsigned long long v){
+	return (((v & 0xF0F0F0F0F0F0F0F0ULL) | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL);
+}
+
+static inline unsigned int parseEightDigits(unsigned long long v){
+	const unsigned long long mask = 0x000000FF000000FFULL;
+	const unsigned long long mul1 = 0x000F424000000064ULL;	// 100 + (1000000ULL << 32)
+	const unsigned long long mul2 = 0x0000271000000001ULL;	// 1 + (10000ULL << 32)
+	v -= 0x3030303030303030ULL;
+	v = (v * 10) + (v >> 8);
+	v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+	return static_cast<unsigned int>(v);
+}
+#endif
+
+/**
+ * 10進数字の並びを仮数に加える
+ * 有効桁が19桁を超える場合はfalse
+ */
+static inline const char* readDigits(const char* p, const char* end, unsigned long long* mantissa, int* digits, int* count){
+	const char* start = p;
+#ifdef TEXT_NUMBER_USE_SWAR
+	while((end - p >= 8) && (*digits + 8 <= 19) && isEightDigits(read64(p))){
+		*mantissa = *mantissa * 100000000ULL + parseEightDigits(read64(p));
+		*digits += 8;	// 先頭の0も数えるが、多すぎればstrtod()に任せるだけ
+		p += 8;
+	}
+#endif
+	while((p < end) && isDigit(*p)){
+		if(*mantissa || (*p != '0')){
+			if(++(*digits) > 19)
+				return NULL;
+		}
+		*mantissa = *mantissa * 10 + (*p - '0');
+		p++;
+	}
+	*count = static_cast<int>(p - start);
+	return p;
+}
+
+static const double powers_of_ten[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * strtod()による変換
+ * 字句は終端されていないので複製してから渡す
+ */
+static bool toDoubleSlow(const char* p, const char* end, double* value){
+	const size_t len = static_cast<size_t>(end - p);
+	char buf[64];
+	std::string temp;
+	const char* str;
+	if(len < sizeof(buf)){
+		memcpy(buf, p, len);
+		buf[len] = '\0';
+		str = buf;
+	}
+	else{
+		temp.assign(p, end);
+		str = temp.c_str();
+	}
+	char* endptr;
+	*value = strtod(str, &endptr);
+	return (len > 0) && (endptr == str + len);
+}
+
+/**
+ * 1字句をdoubleに変換する
+ * 仮数が2^53以下で10の指数が22以下なら1回の乗除算で正しく丸められる(Clingerの方法)
+ * それ以外はstrtod()に任せる
+ */
+static bool toDouble(const char* p, const char* end, double* value){
+	const char* start = p;
+	bool negative = false;
+	if((p < end) && ((*p == '-') || (*p == '+'))){
+		negative = (*p == '-');
+		p++;
+	}
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int int_count = 0;
+	int frac_count = 0;
+	p = readDigits(p, end, &mantissa, &digits, &int_count);
+	if(!p)
+		return toDoubleSlow(start, end, value);
+	if((p < end) && (*p == '.')){
+		p = readDigits(p + 1, end, &mantissa, &digits, &frac_count);
+		if(!p)
+			return toDoubleSlow(start, end, value);
+	}
+	if(int_count + frac_count == 0)
+		return toDoubleSlow(start, end, value);	// INF, NaNなど
+	int exponent = -frac_count;
+	if((p < end) && ((*p == 'e') || (*p == 'E'))){
+		p++;
+		bool exp_negative = false;
+		if((p < end) && ((*p == '-') || (*p == '+'))){
+			exp_negative = (*p == '-');
+			p++;
+		}
+		if((p >= end) || !isDigit(*p))
+			return false;
+		int exp = 0;
+		while((p < end) && isDigit(*p)){
+			if(exp < 10000)
+				exp = exp * 10 + (*p - '0');
+			p++;
+		}
+		exponent += exp_negative? -exp : exp;
+	}
+	if(p != end)
+		return toDoubleSlow(start, end, value);
+	if(mantissa == 0){
+		*value = negative? -0.0 : 0.0;
+		return true;
+	}
+	if((mantissa > (1ULL << 53)) || (exponent < -22) || (exponent > 22))
+		return toDoubleSlow(start, end, value);
+	double d = static_cast<double>(mantissa);
+	if(exponent < 0)
+		d /= powers_of_ten[-exponent];
+	else
+		d *= powers_of_ten[exponent];
+	*value = negative? -d : d;
+	return true;
+}
+
+static bool toUint(const char* p, const char* end, unsigned int* value){
+	if(p >= end)
+		return false;
+	unsigned long long v = 0;
+#ifdef TEXT_NUMBER_USE_SWAR
+	while((end - p >= 8) && isEightDigits(read64(p))){
+		v = v * 100000000ULL + parseEightDigits(read64(p));
+		if(v > 0xFFFFFFFFULL)
+			return false;
+		p += 8;
+	}
+#endif
+	while(p < end){
+		if(!isDigit(*p))
+			return false;
+		v = v * 10 + (*p - '0');
+		if(v > 0xFFFFFFFFULL)
+			return false;
+		p++;
+	}
+	*value = static_cast<unsigned int>(v);
+	return true;
+}
+
+bool parseFloats(const char* begin, const char* end, std::vector<float>* output){
+	const char* p = skipSpace(begin, end);
+	while(p < end){
+		const char* q = findSpace(p, end);
+		double d;
+		if(!toDouble(p, q, &d))
+			return false;
+		output->push_back(static_cast<float>(d));
+		p = skipSpace(q, end);
+	}
+	return true;
+}
+
+bool parseUints(const char* begin, const char* end, std::vector<unsigned int>* output){
+	const char* p = skipSpace(begin, end);
+	while(p < end){
+		const char* q = findSpace(p, end);
+		unsigned int u;
+		if(!toUint(p, q, &u))
+			return false;
+		output->push_back(u);
+		p = skipSpace(q, end);
+	}
+	return true;
+}
+
+bool parseFloats(const char* begin, const char* end, float* output, size_t max_count, size_t* count){
+	*count = 0;
+	const char* p = skipSpace(begin, end);
+	while((p < end) && (*count < max_count)){
+		const char* q = findSpace(p, end);
+		double d;
+		if(!toDouble(p, q, &d))
+			return false;
+		output[(*count)++] = static_cast<float>(d);
+		p = skipSpace(q, end);
+	}
+	return true;
+}
+
+/**
+ * 16進数字1文字の値、数字でなければ0x10以上
+ */
+static inline unsigned int toNibble(char c){
+	const unsigned int d = static_cast<unsigned char>(c - '0');
+	if(d < 10)
+		return d;
+	const unsigned int a = static_cast<unsigned char>((c | 0x20) - 'a');
+	return (a < 6)? a + 10 : 0x10;
+}
+
+#ifdef TEXT_NUMBER_USE_SSE2
+/**
+ * 16文字を8バイトに変換する
+ * 16進数字以外が含まれていればfalse
+ */
+static inline bool toHex16(const char* p, unsigned char* output){
+	const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	// 0-9
+	const __m128i d = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+	const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+	// a-f(大文字も)
+	const __m128i a = _mm_sub_epi8(_mm_or_si128(x, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	const __m128i is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(5)), a);
+	if(_mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)) != 0xFFFF)
+		return false;
+	const __m128i nibble = _mm_or_si128(_mm_and_si128(is_digit, d), _mm_and_si128(is_alpha, _mm_add_epi8(a, _mm_set1_epi8(10))));
+	// 16ビットごとに先の文字が上位4ビット
+	const __m128i hi = _mm_slli_epi16(_mm_and_si128(nibble, _mm_set1_epi16(0x00FF)), 4);
+	const __m128i lo = _mm_srli_epi16(nibble, 8);
+	const __m128i bytes = _mm_or_si128(hi, lo);
+	_mm_storel_epi64(reinterpret_cast<__m128i*>(output), _mm_packus_epi16(bytes, bytes));
+	return true;
+}
+#endif
+
+/**
+ * 空白区切りの16進数字の並び(xs:hexBinaryのリスト)をバイト列にする
+ * 字句の長さが奇数か16進数字以外があればfalse
+ */
+bool parseHex(const char* begin, const char* end, std::vector<unsigned char>* output){
+	const size_t start = output->size();
+	output->resize(start + static_cast<size_t>(end - begin) / 2);
+	unsigned char* dst = output->empty()? NULL : &(*output)[0] + start;
+	const unsigned char* const dst_begin = dst;
+	bool result = true;
+	const char* p = skipSpace(begin, end);
+	while(p < end){
+		const char* q = findSpace(p, end);
+		if((q - p) & 1){
+			result = false;
+			break;
+		}
+#ifdef TEXT_NUMBER_USE_SSE2
+		while(q - p >= 16){
+			if(!toHex16(p, dst))
+				break;
+			p += 16;
+			dst += 8;
+		}
+#endif
+		for(; p < q; p += 2){
+			const unsigned int h = toNibble(p[0]);
+			const unsigned int l = toNibble(p[1]);
+			if((h | l) & 0x10)
+				break;
+			*dst++ = static_cast<unsigned char>((h << 4) | l);
+		}
+		if(p < q){
+			result = false;
+			break;
+		}
+		p = skipSpace(q, end);
+	}
+	output->resize(start + static_cast<size_t>(dst - dst_begin));
+	return result;
+}
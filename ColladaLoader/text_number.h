@@ -0,0 +1,18 @@
+﻿/**
+ * 空白区切りの数値テキストの変換
+ * <float_array>や<p>を中間の配列を介さず直接格納先へ変換する
+ * 浮動小数はdoubleとして正しく丸めてからfloatにするのでstrtod()を使った場合と同じ値になる
+ */
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+// 変換できない字句があればfalse、outputには変換済みの値が追加されている
+bool parseFloats(const char* begin, const char* end, std::vector<float>* output);
+bool parseUints(const char* begin, const char* end, std::vector<unsigned int>* output);
+
+// 最大max_count個まで変換し、変換した個数をcountに返す
+bool parseFloats(const char* begin, const char* end, float* output, size_t max_count, size_t* count);
+
+// 空白区切りの16進数字(<image><data>)をバイト列にして追加する
+bool parseHex(const char* begin, const char* end, std::vector<unsigned char>* output);
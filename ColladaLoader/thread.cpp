@@ -0,0 +1,218 @@
+﻿#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#include "thread.h"
+#include "log.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int getProcessorCount(){
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	const long count = static_cast<long>(info.dwNumberOfProcessors);
+#else
+	const long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return (count > 0)? static_cast<unsigned int>(count) : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Mutex::Mutex(){
+#ifdef _WIN32
+	InitializeCriticalSection(&cs);
+#else
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+#endif
+}
+
+Mutex::~Mutex(){
+#ifdef _WIN32
+	DeleteCriticalSection(&cs);
+#else
+	pthread_mutex_destroy(&mutex);
+#endif
+}
+
+void Mutex::lock(){
+#ifdef _WIN32
+	EnterCriticalSection(&cs);
+#else
+	pthread_mutex_lock(&mutex);
+#endif
+}
+
+void Mutex::unlock(){
+#ifdef _WIN32
+	LeaveCriticalSection(&cs);
+#else
+	pthread_mutex_unlock(&mutex);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Condition::Condition(){
+#if defined(USE_CONDITION_VARIABLE)
+	InitializeConditionVariable(&cv);
+#elif defined(_WIN32)
+	InitializeCriticalSection(&lock);
+	event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if(event == NULL)
+		Log_e("could not create event.\n");
+	waiters = 0;
+	releases = 0;
+	generation = 0;
+#else
+	pthread_cond_init(&cv, NULL);
+#endif
+}
+
+Condition::~Condition(){
+#if defined(USE_CONDITION_VARIABLE)
+#elif defined(_WIN32)
+	if(event)
+		CloseHandle(event);
+	DeleteCriticalSection(&lock);
+#else
+	pthread_cond_destroy(&cv);
+#endif
+}
+
+void Condition::wait(Mutex* mutex){
+#if defined(USE_CONDITION_VARIABLE)
+	SleepConditionVariableCS(&cv, &mutex->cs, INFINITE);
+#elif defined(_WIN32)
+	EnterCriticalSection(&lock);
+	waiters++;
+	const unsigned int my_generation = generation;
+	LeaveCriticalSection(&lock);
+	LeaveCriticalSection(&mutex->cs);
+	// 待ち始めた後のsignal()で起こされるまで待つ(それより前のものはイベントが残っていても見送る)
+	// 起きる分は確かめたのと同じロックの中で取る(同じ世代の待ち手が1回のsignal()で揃って起きないように)
+	for(;;){
+		WaitForSingleObject(event, INFINITE);
+		EnterCriticalSection(&lock);
+		const bool woken = (releases > 0) && (generation != my_generation);
+		if(woken){
+			waiters--;
+			releases--;
+			if(releases == 0)
+				ResetEvent(event);
+		}
+		LeaveCriticalSection(&lock);
+		if(woken)
+			break;
+		Sleep(0);
+	}
+	EnterCriticalSection(&mutex->cs);
+#else
+	pthread_cond_wait(&cv, &mutex->mutex);
+#endif
+}
+
+void Condition::signal(){
+#if defined(USE_CONDITION_VARIABLE)
+	WakeConditionVariable(&cv);
+#elif defined(_WIN32)
+	EnterCriticalSection(&lock);
+	if(waiters > releases){
+		SetEvent(event);
+		releases++;
+		generation++;
+	}
+	LeaveCriticalSection(&lock);
+#else
+	pthread_cond_signal(&cv);
+#endif
+}
+
+void Condition::broadcast(){
+#if defined(USE_CONDITION_VARIABLE)
+	WakeAllConditionVariable(&cv);
+#elif defined(_WIN32)
+	EnterCriticalSection(&lock);
+	if(waiters > 0){
+		SetEvent(event);
+		releases = waiters;
+		generation++;
+	}
+	LeaveCriticalSection(&lock);
+#else
+	pthread_cond_broadcast(&cv);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Thread::Thread(){
+#ifdef _WIN32
+	handle = NULL;
+#endif
+	function = NULL;
+	arg = NULL;
+	running = false;
+}
+
+Thread::~Thread(){
+	join();
+}
+
+#ifdef _WIN32
+unsigned int __stdcall Thread::entry(void* arg){
+	Thread* thread = static_cast<Thread*>(arg);
+	thread->function(thread->arg);
+	return 0;
+}
+#else
+void* Thread::entry(void* arg){
+	Thread* thread = static_cast<Thread*>(arg);
+	thread->function(thread->arg);
+	return NULL;
+}
+#endif
+
+bool Thread::start(Function function, void* arg){
+	if(running)
+		return false;
+	this->function = function;
+	this->arg = arg;
+#ifdef _WIN32
+	// CRTを使うので_beginthreadex()
+	handle = reinterpret_cast<HANDLE>(_beginthreadex(NULL, 0, entry, this, 0, NULL));
+	if(handle == NULL){
+		Log_e("could not create thread.\n");
+		return false;
+	}
+#else
+	if(pthread_create(&handle, NULL, entry, this) != 0){
+		Log_e("could not create thread.\n");
+		return false;
+	}
+#endif
+	running = true;
+	return true;
+}
+
+/**
+ * 終了を待つ
+ */
+void Thread::join(){
+	if(!running)
+		return;
+#ifdef _WIN32
+	WaitForSingleObject(handle, INFINITE);
+	CloseHandle(handle);
+	handle = NULL;
+#else
+	pthread_join(handle, NULL);
+#endif
+	running = false;
+}
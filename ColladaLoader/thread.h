@@ -0,0 +1,137 @@
+﻿/**
+ * スレッドと排他制御の薄いラッパ
+ * Win32とpthreadの差を吸収する
+ */
+#pragma once
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// Vista以降を対象にする場合のみWin32の条件変数を使う(XPとVS2005のSDKにはない)
+#if defined(_WIN32) && defined(_WIN32_WINNT) && (_WIN32_WINNT >= 0x0600)
+#define USE_CONDITION_VARIABLE
+#endif
+
+// スレッドごとの変数(組み込み型とポインタのみ)
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// 使えるプロセッサの数
+unsigned int getProcessorCount();
+
+/**
+ * 一度だけ立てるフラグ
+ * 立てる前の書き込みは、立ったのを見たスレッドからも見えるので、立った後はロックなしで読める
+ */
+class ReadyFlag{
+public:
+	ReadyFlag() : value(0){}
+#ifdef _WIN32
+	bool isSet() const { return InterlockedCompareExchange(const_cast<volatile long*>(&value), 0, 0) != 0; }
+	void set(){ InterlockedExchange(&value, 1); }
+#else
+	bool isSet() const { return __atomic_load_n(&value, __ATOMIC_ACQUIRE) != 0; }
+	void set(){ __atomic_store_n(&value, 1, __ATOMIC_RELEASE); }
+#endif
+	void reset(){ value = 0; }	// 他のスレッドが参照していない時だけ
+private:
+	volatile long value;
+};
+
+
+
+/**
+ * 再帰的に獲得できるミューテックス
+ */
+class Mutex{
+public:
+	Mutex();
+	~Mutex();
+	void lock();
+	void unlock();
+private:
+	Mutex(const Mutex&);
+	Mutex& operator=(const Mutex&);
+private:
+	friend class Condition;
+#ifdef _WIN32
+	CRITICAL_SECTION cs;
+#else
+	pthread_mutex_t mutex;
+#endif
+};
+
+/**
+ * 条件変数
+ * wait()はmutexを1回だけロックした状態で呼ぶ
+ * 条件変数のないWin32ではイベントと世代の数で代用する(起きた後も条件を確かめ直すこと)
+ */
+class Condition{
+public:
+	Condition();
+	~Condition();
+	void wait(Mutex* mutex);
+	void signal();
+	void broadcast();
+private:
+	Condition(const Condition&);
+	Condition& operator=(const Condition&);
+private:
+#if defined(USE_CONDITION_VARIABLE)
+	CONDITION_VARIABLE cv;
+#elif defined(_WIN32)
+	CRITICAL_SECTION lock;	// 以下の数を守る
+	HANDLE event;	// 手動リセット、起こす待ち手がいる間はシグナル状態
+	unsigned int waiters;	// 待っている数
+	unsigned int releases;	// 起こすと決めてまだ起きていない数
+	unsigned int generation;	// signal()とbroadcast()のたびに進む(それより前から待っていたものだけが起きる)
+#else
+	pthread_cond_t cv;
+#endif
+};
+
+/**
+ * スコープを抜けるまでロックする
+ */
+class ScopedLock{
+public:
+	explicit ScopedLock(Mutex* mutex) : mutex(mutex){ mutex->lock(); }
+	~ScopedLock(){ mutex->unlock(); }
+private:
+	ScopedLock(const ScopedLock&);
+	ScopedLock& operator=(const ScopedLock&);
+private:
+	Mutex* mutex;
+};
+
+class Thread{
+public:
+	typedef void (*Function)(void* arg);
+	Thread();
+	~Thread();
+	bool start(Function function, void* arg);
+	void join();
+	bool isRunning() const { return running; }
+private:
+	Thread(const Thread&);
+	Thread& operator=(const Thread&);
+#ifdef _WIN32
+	static unsigned int __stdcall entry(void* arg);
+#else
+	static void* entry(void* arg);
+#endif
+private:
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	Function function;
+	void* arg;
+	bool running;
+};
@@ -0,0 +1,24 @@
+﻿#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "timer.h"
+
+unsigned long long getMicroseconds(){
+#ifdef _WIN32
+	static LARGE_INTEGER frequency = { 0 };
+	if(frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	// 乗算の桁あふれを避けて秒と端数に分ける
+	const unsigned long long freq = static_cast<unsigned long long>(frequency.QuadPart);
+	const unsigned long long count = static_cast<unsigned long long>(counter.QuadPart);
+	return (count / freq) * 1000000ULL + (count % freq) * 1000000ULL / freq;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<unsigned long long>(ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+}
@@ -0,0 +1,7 @@
+﻿/**
+ * 高分解能の時刻
+ */
+#pragma once
+
+// 単調増加する時刻(マイクロ秒)
+unsigned long long getMicroseconds();
@@ -0,0 +1,298 @@
+﻿#include <string.h>
+#include "xml_reader.h"
+
+static inline bool isSpace(char c){
+	return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
+static inline bool isNameEnd(char c){
+	return isSpace(c) || (c == '/') || (c == '>') || (c == '=');
+}
+
+static inline bool startsWith(const char* ptr, const char* end, const char* string){
+	const size_t len = strlen(string);
+	return (static_cast<size_t>(end - ptr) >= len) && (memcmp(ptr, string, len) == 0);
+}
+
+XmlReader::XmlReader(const char* data, size_t size){
+	begin = data;
+	end = data + size;
+	ptr = data;
+	// UTF-8のBOM
+	if(startsWith(ptr, end, "\xEF\xBB\xBF"))
+		ptr += 3;
+	name.begin = name.end = NULL;
+	text.begin = text.end = NULL;
+	pending_end = false;
+}
+
+/**
+ * 次の字句を返す
+ * コメント、処理命令、文書型宣言は読み飛ばす
+ * 空要素<a/>は開始タグと終了タグの2つに分けて返す
+ */
+XmlReader::TokenType XmlReader::next(){
+	if(pending_end){
+		pending_end = false;
+		return Token_EndElement;
+	}
+	for(;;){
+		if(ptr >= end)
+			return Token_End;
+		if(*ptr != '<'){
+			// テキストは次の'<'まで(memchrでまとめて探す)
+			const char* lt = static_cast<const char*>(memchr(ptr, '<', end - ptr));
+			text.begin = ptr;
+			text.end = lt? lt : end;
+			ptr = text.end;
+			return Token_Text;
+		}
+		if(startsWith(ptr, end, "<!--")){
+			ptr += 4;
+			if(!skipUntil("-->"))
+				return error();
+			continue;
+		}
+		if(startsWith(ptr, end, "<![CDATA[")){
+			ptr += 9;
+			text.begin = ptr;
+			if(!skipUntil("]]>"))
+				return error();
+			text.end = ptr - 3;
+			return Token_Text;
+		}
+		if(startsWith(ptr, end, "<?")){
+			ptr += 2;
+			if(!skipUntil("?>"))
+				return error();
+			continue;
+		}
+		if(startsWith(ptr, end, "<!")){
+			// <!DOCTYPE>など、内部サブセット[...]内の'>'は無視する
+			int depth = 0;
+			for(ptr += 2; ptr < end; ptr++){
+				if(*ptr == '[')
+					depth++;
+				else
+				if(*ptr == ']')
+					depth--;
+				else
+				if((*ptr == '>') && (depth <= 0))
+					break;
+			}
+			if(ptr >= end)
+				return error();
+			ptr++;
+			continue;
+		}
+		return readTag();
+	}
+}
+
+/**
+ * 直前に返した開始タグの要素を終了タグまで読み飛ばす
+ */
+bool XmlReader::skip(){
+	size_t depth = 1;
+	while(depth > 0){
+		switch(next()){
+		case Token_StartElement:
+			depth++;
+			break;
+		case Token_EndElement:
+			depth--;
+			break;
+		case Token_Text:
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+XmlReader::TokenType XmlReader::readTag(){
+	ptr++;	// '<'
+	const bool end_tag = (ptr < end) && (*ptr == '/');
+	if(end_tag)
+		ptr++;
+	name.begin = ptr;
+	while((ptr < end) && !isNameEnd(*ptr))
+		ptr++;
+	name.end = ptr;
+	if(name.begin == name.end)
+		return error();
+	attributes.clear();
+	if(end_tag){
+		while((ptr < end) && isSpace(*ptr))
+			ptr++;
+		if((ptr >= end) || (*ptr != '>'))
+			return error();
+		ptr++;
+		return Token_EndElement;
+	}
+	if(!readAttributes())
+		return error();
+	return Token_StartElement;
+}
+
+bool XmlReader::readAttributes(){
+	for(;;){
+		while((ptr < end) && isSpace(*ptr))
+			ptr++;
+		if(ptr >= end)
+			return false;
+		if(*ptr == '>'){
+			ptr++;
+			return true;
+		}
+		if(*ptr == '/'){
+			if((ptr + 1 >= end) || (ptr[1] != '>'))
+				return false;
+			ptr += 2;
+			pending_end = true;
+			return true;
+		}
+		Attribute attr;
+		attr.name.begin = ptr;
+		while((ptr < end) && !isNameEnd(*ptr))
+			ptr++;
+		attr.name.end = ptr;
+		if(attr.name.begin == attr.name.end)
+			return false;
+		while((ptr < end) && isSpace(*ptr))
+			ptr++;
+		if((ptr >= end) || (*ptr != '='))
+			return false;
+		ptr++;
+		while((ptr < end) && isSpace(*ptr))
+			ptr++;
+		if((ptr >= end) || ((*ptr != '"') && (*ptr != '\'')))
+			return false;
+		const char quote = *ptr++;
+		const char* close = static_cast<const char*>(memchr(ptr, quote, end - ptr));
+		if(!close)
+			return false;
+		attr.value.begin = ptr;
+		attr.value.end = close;
+		ptr = close + 1;
+		attributes.push_back(attr);
+	}
+}
+
+/**
+ * terminatorの直後まで進める
+ */
+bool XmlReader::skipUntil(const char* terminator){
+	const size_t len = strlen(terminator);
+	while(ptr < end){
+		const char* p = static_cast<const char*>(memchr(ptr, terminator[0], end - ptr));
+		if(!p)
+			break;
+		if(startsWith(p, end, terminator)){
+			ptr = p + len;
+			return true;
+		}
+		ptr = p + 1;
+	}
+	ptr = end;
+	return false;
+}
+
+XmlReader::TokenType XmlReader::error(){
+	pending_end = false;
+	return Token_Error;
+}
+
+bool XmlReader::isEqual(const Span& span, const char* string){
+	const size_t len = strlen(string);
+	return (static_cast<size_t>(span.end - span.begin) == len) && (memcmp(span.begin, string, len) == 0);
+}
+
+static void appendUtf8(std::string* output, unsigned long code){
+	if(code < 0x80){
+		output->push_back(static_cast<char>(code));
+	}
+	else
+	if(code < 0x800){
+		output->push_back(static_cast<char>(0xC0 | (code >> 6)));
+		output->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+	}
+	else
+	if(code < 0x10000){
+		output->push_back(static_cast<char>(0xE0 | (code >> 12)));
+		output->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+		output->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+	}
+	else{
+		output->push_back(static_cast<char>(0xF0 | (code >> 18)));
+		output->push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+		output->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+		output->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+	}
+}
+
+/**
+ * 実体参照を展開して文字列にする
+ * 未知の参照はそのまま残す
+ */
+void XmlReader::decode(const Span& span, std::string* output){
+	output->clear();
+	const char* p = span.begin;
+	while(p < span.end){
+		const char* amp = static_cast<const char*>(memchr(p, '&', span.end - p));
+		if(!amp){
+			output->append(p, span.end);
+			break;
+		}
+		output->append(p, amp);
+		const char* semi = static_cast<const char*>(memchr(amp, ';', span.end - amp));
+		if(!semi){
+			output->append(amp, span.end);
+			break;
+		}
+		Span ref = { amp + 1, semi };
+		if(isEqual(ref, "lt"))
+			output->push_back('<');
+		else
+		if(isEqual(ref, "gt"))
+			output->push_back('>');
+		else
+		if(isEqual(ref, "amp"))
+			output->push_back('&');
+		else
+		if(isEqual(ref, "quot"))
+			output->push_back('"');
+		else
+		if(isEqual(ref, "apos"))
+			output->push_back('\'');
+		else
+		if((ref.end - ref.begin >= 2) && (ref.begin[0] == '#')){
+			const bool hex = (ref.begin[1] == 'x');
+			unsigned long code = 0;
+			bool valid = true;
+			for(const char* c = ref.begin + (hex? 2 : 1); c < ref.end; c++){
+				if((*c >= '0') && (*c <= '9'))
+					code = code * (hex? 16 : 10) + (*c - '0');
+				else
+				if(hex && (*c >= 'a') && (*c <= 'f'))
+					code = code * 16 + (*c - 'a' + 10);
+				else
+				if(hex && (*c >= 'A') && (*c <= 'F'))
+					code = code * 16 + (*c - 'A' + 10);
+				else{
+					valid = false;
+					break;
+				}
+			}
+			if(valid && (code <= 0x10FFFF))
+				appendUtf8(output, code);
+			else
+				output->append(amp, semi + 1);
+		}
+		else{
+			output->append(amp, semi + 1);
+		}
+		p = semi + 1;
+	}
+}
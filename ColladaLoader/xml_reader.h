@@ -0,0 +1,56 @@
+﻿/**
+ * プル型のXML字句解析
+ * 入力はメモリ上のバッファ(メモリマップドファイルなど)をそのまま参照し、複製しない
+ * 名前やテキストはバッファ内の範囲として返すので、バッファは解析中有効である必要がある
+ */
+#pragma once
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class XmlReader{
+public:
+	typedef enum{
+		Token_StartElement,
+		Token_EndElement,
+		Token_Text,
+		Token_End,
+		Token_Error
+	}TokenType;
+
+	typedef struct{
+		const char* begin;
+		const char* end;
+	}Span;
+
+	typedef struct{
+		Span name;
+		Span value;	// 引用符の内側、実体参照は未展開
+	}Attribute;
+
+public:
+	XmlReader(const char* data, size_t size);
+	TokenType next();
+	bool skip();
+	const Span& getName() const { return name; }
+	const Span& getText() const { return text; }
+	size_t getAttributeCount() const { return attributes.size(); }
+	const Attribute& getAttribute(size_t index) const { return attributes[index]; }
+	size_t getOffset() const { return static_cast<size_t>(ptr - begin); }
+
+	static bool isEqual(const Span& span, const char* string);
+	static void decode(const Span& span, std::string* output);
+private:
+	TokenType readTag();
+	bool readAttributes();
+	bool skipUntil(const char* terminator);
+	TokenType error();
+private:
+	const char* begin;
+	const char* end;
+	const char* ptr;
+	Span name;
+	Span text;
+	std::vector<Attribute> attributes;
+	bool pending_end;	// <a/>の終了タグを次に返す
+};